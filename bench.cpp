@@ -0,0 +1,1337 @@
+/*
+    Chow's Whitebox AES benchmarks
+        - ./bench <name> [args], ./bench lists the benchmarks
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "aes.h"
+#include "wbaes.h"
+#include "wbaes_tables.h"
+#include "wbaes_numa.h"
+#include "wbaes_cpu.h"
+#include "wbaes_modes.h"
+#include "wbaes_pool.h"
+#include "wbaes_mem.h"
+#include "wbaes_xts.h"
+#include "wbaes_jit.h"
+#include "wbaes_metrics.h"
+#include "utils.h"
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define BENCH_BLOCKS    4096
+#define BENCH_MS        500
+
+
+uint8_t  u8_aes_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+uint32_t u32_round_key[11][4];
+
+static double get_ns() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec * 1e9 + t_val.tv_nsec;
+}
+
+static void rand_bytes(uint8_t *x, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        x[i] = std::rand();
+    }
+}
+
+/*
+    Hardware counters (perf_event_open), -1 when not permitted
+*/
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int perf_open_dtlb_miss() {
+    return perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                     (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static long long perf_read(int fd) {
+    long long v = 0;
+
+    if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) {
+        return -1;
+    }
+    return v;
+}
+
+/*
+    Runs the batched kernel for about ms milliseconds
+     - returns nanoseconds per block
+*/
+static double run_blocks(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n, int ms) {
+    size_t total = 0;
+    double begin = get_ns(), now;
+
+    do {
+        wbaes_encrypt_blocks(et, blocks, n);
+        total += n;
+        now = get_ns();
+    } while (now - begin < ms * 1e6);
+
+    return (now - begin) / total;
+}
+
+/*
+    NUMA: throughput of every (cpu node, table node) pair
+*/
+static void numa_pair(const WBAES_ENCRYPTION_TABLE *et, int cpu_node, double *ns) {
+    std::vector<uint8_t> blocks(16 * BENCH_BLOCKS);
+
+    wbaes_numa_bind_thread(cpu_node);
+    rand_bytes(blocks.data(), blocks.size());
+    *ns = run_blocks(*et, blocks.data(), BENCH_BLOCKS, BENCH_MS);
+}
+
+static int bench_numa(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_TABLE_REPLICAS    rep;
+    int i, j, nodes = wbaes_numa_nodes();
+    double ns;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    if (wbaes_table_replicate(*et, rep) != 0) {
+        perror("replication failed");
+        return -1;
+    }
+
+    puts("===================== NUMA ======================");
+    printf("nodes %d, MB/s per (cpu node, table node)\n", nodes);
+    printf("cpu\\table");
+    for (j = 0; j < nodes; j++) {
+        printf(" %9d", j);
+    }
+    puts("");
+
+    for (i = 0; i < nodes; i++) {
+        printf("%9d", i);
+        for (j = 0; j < nodes; j++) {
+            std::thread(numa_pair, rep.node[j], i, &ns).join();
+            printf(" %9.2f%s", 16e3 / ns, i == j ? "*" : " ");
+        }
+        puts("");
+    }
+    puts("(* node-local)");
+    puts("=================================================");
+
+    wbaes_table_replicas_free(rep);
+    delete et;
+    delete ee;
+    delete ie;
+
+    return 0;
+}
+
+/*
+    Huge pages: many resident keys, each batch goes to a random key
+*/
+static int bench_hugepage(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    static const char *backing[] = { "4KB", "THP", "hugetlb" };
+    int keys = argc > 0 ? atoi(argv[0]) : 32, mode, k;
+    size_t total;
+    uint8_t blocks[16 * WBAES_BATCH_LANES];
+
+    keys = keys > 0 ? keys : 1;
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    rand_bytes(blocks, sizeof(blocks));
+
+    puts("=================== HUGEPAGE ====================");
+    printf("keys %d, %d blocks per batch\n", keys, WBAES_BATCH_LANES);
+
+    for (mode = 0; mode < 2; mode++) {
+        std::vector<WBAES_ENCRYPTION_TABLE *> tables(keys);
+        int fd;
+        long long misses;
+        double begin, ns;
+
+        for (k = 0; k < keys; k++) {
+            tables[k] = wbaes_table_alloc(-1, mode ? WBAES_MEM_HUGE : 0);
+            memcpy((void *)tables[k], et, sizeof(WBAES_ENCRYPTION_TABLE));
+        }
+
+        fd = perf_open_dtlb_miss();
+        total = 0;
+        begin = get_ns();
+        do {
+            for (k = 0; k < 1024; k++) {
+                wbaes_encrypt_blocks(*tables[std::rand() % keys], blocks, WBAES_BATCH_LANES);
+            }
+            total += 1024 * WBAES_BATCH_LANES;
+        } while (get_ns() - begin < BENCH_MS * 1e6);
+        ns = (get_ns() - begin) / total;
+        misses = perf_read(fd);
+
+        printf("%-8s (%-7s) %8.1f ns/block  ", mode ? "huge" : "small", backing[wbaes_table_backing(tables[0])], ns);
+        if (misses >= 0) {
+            printf("%8.3f dTLB misses/block\n", (double)misses / total);
+        }
+        else {
+            printf("dTLB misses n/a (perf_event_open not permitted)\n");
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+        for (k = 0; k < keys; k++) {
+            wbaes_table_free(tables[k]);
+        }
+    }
+    puts("=================================================");
+
+    delete et;
+    delete ee;
+    delete ie;
+
+    return 0;
+}
+
+/*
+    Warm-up: latency of the first block after the caches were evicted
+*/
+static volatile uint8_t evict_sink;
+
+static void evict_caches() {
+    std::vector<uint8_t> evict(64 << 20, 1);
+    size_t i;
+
+    for (i = 0; i < evict.size(); i += 64) {
+        evict_sink ^= evict[i];
+    }
+}
+
+static double first_block_ns(const WBAES_ENCRYPTION_TABLE &et) {
+    uint8_t block[16] = {0, };
+    double begin = get_ns();
+
+    wbaes_encrypt(et, block);
+    return get_ns() - begin;
+}
+
+static int bench_warm(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_ENCRYPTION_TABLE *t;
+    WBAES_WARM_STATS        st;
+    char path[] = "/tmp/wbaes_warm_XXXXXX";
+    int fd;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    if ((fd = mkstemp(path)) < 0) {
+        return -1;
+    }
+    close(fd);
+    et->write(path);
+
+    puts("===================== WARM ======================");
+
+    t = wbaes_table_load(path, -1);
+    evict_caches();
+    printf("cold          first block %8.1f us\n", first_block_ns(*t) / 1e3);
+    wbaes_table_free(t);
+
+    t = wbaes_table_load(path, -1);
+    evict_caches();
+    wbaes_table_warm(t, WBAES_WARM_ALL, &st);
+    printf("warm (sync)   first block %8.1f us\n", first_block_ns(*t) / 1e3);
+    printf("  prefault %.3fms, lock %.3fms%s, cache %.3fms, total %.3fms\n", st.prefault_ms, st.lock_ms,
+           st.lock_errno ? " (mlock failed)" : "", st.cache_ms, st.total_ms);
+    wbaes_table_free(t);
+
+    t = wbaes_table_load(path, -1, WBAES_MEM_POPULATE);
+    st = wbaes_table_warm_async(t, WBAES_WARM_PREFAULT | WBAES_WARM_CACHE).get();
+    printf("warm (async)  total %.3fms\n", st.total_ms);
+    wbaes_table_free(t);
+
+    puts("=================================================");
+
+    unlink(path);
+    delete et;
+    delete ee;
+    delete ie;
+
+    return 0;
+}
+
+/*
+    Prefetch: batched throughput per prefetch distance, with the table
+    hot (one key) and with the tables mostly out of cache (many keys)
+*/
+static int bench_prefetch(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    int keys = argc > 0 ? atoi(argv[0]) : 64, d, k, saved = wbaes_get_prefetch_distance();
+    std::vector<uint8_t> blocks(16 * BENCH_BLOCKS);
+    std::vector<WBAES_ENCRYPTION_TABLE *> tables;
+
+    keys = keys > 0 ? keys : 1;
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    rand_bytes(blocks.data(), blocks.size());
+    for (k = 0; k < keys; k++) {
+        tables.push_back(wbaes_table_alloc(-1, WBAES_MEM_HUGE));
+        memcpy((void *)tables[k], et, sizeof(WBAES_ENCRYPTION_TABLE));
+    }
+
+    puts("=================== PREFETCH ====================");
+    printf("layout: struct (WBAES_ENCRYPTION_TABLE), %d lanes\n", WBAES_BATCH_LANES);
+    printf("distance   1 key ns/block   %d keys ns/block\n", keys);
+
+    for (d = 0; d <= WBAES_BATCH_LANES; d++) {
+        size_t total = 0;
+        double begin, hot, cold;
+
+        wbaes_set_prefetch_distance(d);
+        hot = run_blocks(*et, blocks.data(), BENCH_BLOCKS, BENCH_MS / 2);
+
+        begin = get_ns();
+        do {
+            for (k = 0; k < 256; k++) {
+                wbaes_encrypt_blocks(*tables[std::rand() % keys], blocks.data(), WBAES_BATCH_LANES);
+            }
+            total += 256 * WBAES_BATCH_LANES;
+        } while (get_ns() - begin < BENCH_MS / 2 * 1e6);
+        cold = (get_ns() - begin) / total;
+
+        printf("%8d   %14.1f   %15.1f%s\n", d, hot, cold, d == WBAES_PREFETCH_DEFAULT ? "  (default)" : d == WBAES_PREFETCH_COLD ? "  (cold)" : "");
+    }
+    puts("=================================================");
+
+    wbaes_set_prefetch_distance(saved);
+    for (k = 0; k < keys; k++) {
+        wbaes_table_free(tables[k]);
+    }
+    delete et;
+    delete ee;
+    delete ie;
+
+    return 0;
+}
+
+/*
+    Single-block latency
+     - every block is the previous ciphertext, so a call cannot overlap with the next one
+*/
+#define LATENCY_SAMPLES 100000
+
+static void latency_run(void (*enc)(const WBAES_ENCRYPTION_TABLE &, uint8_t *), const std::vector<WBAES_ENCRYPTION_TABLE *> &tables, const char *name) {
+    std::vector<double> ns(LATENCY_SAMPLES / tables.size() * tables.size());
+    uint8_t block[16] = {0, };
+    double  t;
+    size_t  i;
+
+    for (i = 0; i < 1000; i++) {
+        enc(*tables[i % tables.size()], block);
+    }
+    for (i = 0; i < ns.size(); i++) {
+        const WBAES_ENCRYPTION_TABLE &et = *tables[std::rand() % tables.size()];
+
+        t = get_ns();
+        enc(et, block);
+        ns[i] = get_ns() - t;
+    }
+    std::sort(ns.begin(), ns.end());
+
+    printf("%-22s %8.0f %8.0f %8.0f\n", name, ns[ns.size() / 2], ns[ns.size() * 99 / 100], ns[ns.size() * 999 / 1000]);
+}
+
+static int bench_latency(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    int keys = argc > 0 ? atoi(argv[0]) : 1, i, bad = 0;
+    std::vector<WBAES_ENCRYPTION_TABLE *> tables;
+    uint8_t a[16], b[16];
+
+    keys = keys > 0 ? keys : 1;
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    for (i = 0; i < keys; i++) {
+        tables.push_back(wbaes_table_alloc(-1, WBAES_MEM_HUGE));
+        memcpy((void *)tables[i], et, sizeof(WBAES_ENCRYPTION_TABLE));
+    }
+
+    for (i = 0; i < 10000; i++) {
+        rand_bytes(a, 16);
+        memcpy(b, a, 16);
+        wbaes_encrypt(*et, a);
+        wbaes_encrypt_lowlat(*et, b);
+        bad += memcmp(a, b, 16) != 0;
+    }
+
+    puts("==================== LATENCY ====================");
+    printf("%d key(s), random key per block, %s kernel\n", keys, wbaes_kernel_name(wbaes_kernels().level));
+    printf("kernel                      p50      p99    p99.9 (ns)\n");
+    latency_run(wbaes_encrypt       , tables, "wbaes_encrypt");
+    latency_run(wbaes_encrypt_lowlat, tables, "wbaes_encrypt_lowlat");
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    for (i = 0; i < keys; i++) {
+        wbaes_table_free(tables[i]);
+    }
+
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Compiled straight-line code vs the interpreted evaluator
+     - the blocks rows compare against the scalar batched kernel, the level the emitted code
+       replaces, and the dispatched one
+*/
+static double jit_run(void (*fn)(const void *, uint8_t *, size_t), const void *arg, uint8_t *blocks) {
+    size_t total = 0;
+    double begin = get_ns();
+
+    do {
+        fn(arg, blocks, BENCH_BLOCKS);
+        total += BENCH_BLOCKS;
+    } while (get_ns() - begin < BENCH_MS * 1e6);
+
+    return (get_ns() - begin) / total;
+}
+
+static void jit_single(const void *jit, uint8_t *blocks, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        wbaes_jit_encrypt((const WBAES_JIT *)jit, blocks + 16*i);
+    }
+}
+
+static void jit_blocks(const void *jit, uint8_t *blocks, size_t n) {
+    wbaes_jit_encrypt_blocks((const WBAES_JIT *)jit, blocks, n);
+}
+
+static void ref_single(const void *et, uint8_t *blocks, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        wbaes_encrypt(*(const WBAES_ENCRYPTION_TABLE *)et, blocks + 16*i);
+    }
+}
+
+static void ref_scalar(const void *et, uint8_t *blocks, size_t n) {
+    wbaes_encrypt_blocks_scalar(*(const WBAES_ENCRYPTION_TABLE *)et, blocks, n);
+}
+
+static void ref_blocks(const void *et, uint8_t *blocks, size_t n) {
+    wbaes_encrypt_blocks(*(const WBAES_ENCRYPTION_TABLE *)et, blocks, n);
+}
+
+static int bench_jit(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    std::vector<uint8_t> buf(16 * BENCH_BLOCKS), ref;
+    WBAES_JIT *jit;
+    double begin, ms;
+    size_t i;
+    int bad;
+
+    (void)argc;
+    (void)argv;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+
+    begin = get_ns();
+    jit   = wbaes_jit_compile(*et);
+    ms    = (get_ns() - begin) / 1e6;
+    if (!jit) {
+        printf("jit unavailable: %s\n", strerror(errno));
+        delete et;
+        delete ee;
+        delete ie;
+        return errno == ENOSYS ? 0 : -1;
+    }
+
+    rand_bytes(buf.data(), buf.size());
+    ref = buf;
+    wbaes_jit_encrypt_blocks(jit, buf.data(), BENCH_BLOCKS);
+    for (i = 0; i < BENCH_BLOCKS; i++) {
+        wbaes_encrypt(*et, ref.data() + 16*i);
+    }
+    bad = memcmp(buf.data(), ref.data(), buf.size()) != 0;
+
+    puts("====================== JIT ======================");
+    printf("compiled %zu KB of code in %.1f ms, ns/block\n", jit->size >> 10, ms);
+    printf("wbaes_encrypt           %8.1f\n", jit_run(ref_single, et , buf.data()));
+    printf("jit encrypt             %8.1f\n", jit_run(jit_single, jit, buf.data()));
+    printf("blocks scalar           %8.1f\n", jit_run(ref_scalar, et , buf.data()));
+    printf("blocks %-16s %8.1f\n", wbaes_kernel_name(wbaes_kernels().level), jit_run(ref_blocks, et, buf.data()));
+    printf("jit blocks              %8.1f\n", jit_run(jit_blocks, jit, buf.data()));
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    wbaes_jit_free(jit);
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Library metrics
+     - threads run single-block and batched calls, the snapshot must account for every call
+       and block; then the cost of a snapshot and of the Prometheus text
+     - the instrumentation overhead itself is the difference against a METRICS=0 build
+*/
+static void metrics_thread(const WBAES_ENCRYPTION_TABLE *et, size_t calls) {
+    std::vector<uint8_t> buf(16 * BENCH_BLOCKS);
+    size_t i;
+
+    rand_bytes(buf.data(), buf.size());
+    for (i = 0; i < calls; i++) {
+        wbaes_encrypt(*et, buf.data());
+        wbaes_encrypt_blocks(*et, buf.data(), BENCH_BLOCKS);
+    }
+}
+
+static int bench_metrics(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_METRICS_SNAPSHOT *before = new WBAES_METRICS_SNAPSHOT(), *after = new WBAES_METRICS_SNAPSHOT();
+    std::vector<std::thread> threads;
+    int    n = argc > 0 ? atoi(argv[0]) : 4, i, bad = 0;
+    size_t calls = 64, k;
+    double begin, snap_us, text_us;
+    FILE  *null;
+
+    n = n > 0 ? n : 1;
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+
+    wbaes_metrics_snapshot(before);
+    for (i = 0; i < n; i++) {
+        threads.emplace_back(metrics_thread, et, calls);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    wbaes_metrics_snapshot(after);
+
+    if (WBAES_METRICS) {
+        bad += after->calls[WBAES_API_ENCRYPT] - before->calls[WBAES_API_ENCRYPT] != n * calls;
+        bad += after->blocks[WBAES_API_ENCRYPT_BLOCKS] - before->blocks[WBAES_API_ENCRYPT_BLOCKS] != n * calls * BENCH_BLOCKS;
+        bad += after->latency[WBAES_API_ENCRYPT_BLOCKS].samples - before->latency[WBAES_API_ENCRYPT_BLOCKS].samples != n * calls;
+    }
+
+    begin = get_ns();
+    for (k = 0; k < 100; k++) {
+        wbaes_metrics_snapshot(after);
+    }
+    snap_us = (get_ns() - begin) / 100 / 1e3;
+
+    null  = fopen("/dev/null", "w");
+    begin = get_ns();
+    for (k = 0; k < 100; k++) {
+        wbaes_metrics_write(null);
+    }
+    text_us = (get_ns() - begin) / 100 / 1e3;
+    fclose(null);
+
+    puts("==================== METRICS ====================");
+    printf("metrics %s, %d thread(s), %u slot(s)\n", WBAES_METRICS ? "on" : "off (METRICS=0)", n, after->threads);
+    printf("api                  calls     blocks  p50 ns  p99 ns\n");
+    for (i = 0; i < WBAES_METRIC_APIS; i++) {
+        if (after->calls[i]) {
+            printf("%-18s %7llu %10llu %7llu %7llu\n", wbaes_metric_api_name((WBAES_METRIC_API)i),
+                (unsigned long long)after->calls[i], (unsigned long long)after->blocks[i],
+                (unsigned long long)wbaes_hist_quantile(after->latency[i], 0.5),
+                (unsigned long long)wbaes_hist_quantile(after->latency[i], 0.99));
+        }
+    }
+    printf("snapshot %.1f us, prometheus text %.1f us\n", snap_us, text_us);
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    delete before;
+    delete after;
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Multi-thread scaling
+     - threads are pinned one per physical core first, SMT siblings only with "smt"
+     - shared: every thread reads the same table; replicated: each thread first-touches its own copy
+     - resident keys: all threads round-robin over k distinct tables, k doubling past
+       twice the L3 size, the working set is k * sizeof(WBAES_ENCRYPTION_TABLE)
+     - latency is per call of SCALE_BATCH blocks
+*/
+#define SCALE_BATCH     (8 * WBAES_BATCH_LANES)
+
+struct scale_result {
+    double              mbs;        // aggregate
+    std::vector<double> thread_mbs;
+    std::vector<double> us;         // per call, sorted
+};
+
+static int sysfs_int(const char *fmt, int cpu) {
+    char path[128];
+    int  v = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), fmt, cpu);
+    if ((f = fopen(path, "r"))) {
+        if (fscanf(f, "%d", &v) != 1) {
+            v = -1;
+        }
+        fclose(f);
+    }
+    return v;
+}
+
+/* allowed CPUs, first sibling of every core first, then the other siblings */
+static std::vector<int> scale_cpus(bool smt) {
+    std::vector<int> first, other;
+    cpu_set_t set;
+    int cpu, sib;
+
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+        sib = sysfs_int("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        (sib < 0 || sib == cpu ? first : other).push_back(cpu);
+    }
+    if (smt) {
+        first.insert(first.end(), other.begin(), other.end());
+    }
+    return first;
+}
+
+static size_t l3_bytes() {
+    char  unit = 0;
+    long  v = 0;
+    FILE *f = fopen("/sys/devices/system/cpu/cpu0/cache/index3/size", "r");
+
+    if (f) {
+        if (fscanf(f, "%ld%c", &v, &unit) < 1) {
+            v = 0;
+        }
+        fclose(f);
+    }
+    return v * (unit == 'K' ? 1 << 10 : unit == 'M' ? 1 << 20 : 1);
+}
+
+static scale_result scale_run(const std::vector<WBAES_ENCRYPTION_TABLE *> &tables, bool replicate, const std::vector<int> &cpus, unsigned threads) {
+    std::vector<std::thread>          pool;
+    std::vector<std::vector<double> > us(threads);
+    std::vector<size_t>               blocks(threads, 0);
+    std::atomic<unsigned>             ready(0);
+    std::atomic<bool>                 go(false);
+    scale_result res;
+    unsigned t;
+
+    for (t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::vector<uint8_t> buf(16 * SCALE_BATCH);
+            WBAES_ENCRYPTION_TABLE *own = NULL;
+            cpu_set_t set;
+            double begin, now, last;
+            size_t k = t;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpus[t % cpus.size()], &set);
+            sched_setaffinity(0, sizeof(set), &set);
+
+            if (replicate) {
+                own = wbaes_table_alloc(-1);
+                memcpy((void *)own, tables[0], sizeof(WBAES_ENCRYPTION_TABLE));
+            }
+            for (size_t i = 0; i < tables.size(); i++) {
+                wbaes_encrypt_blocks(own ? *own : *tables[i], buf.data(), SCALE_BATCH);
+            }
+            us[t].reserve(1 << 16);
+
+            ready++;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+
+            begin = last = get_ns();
+            do {
+                wbaes_encrypt_blocks(own ? *own : *tables[k++ % tables.size()], buf.data(), SCALE_BATCH);
+                now = get_ns();
+                us[t].push_back((now - last) / 1e3);
+                blocks[t] += SCALE_BATCH;
+                last = now;
+            } while (now - begin < BENCH_MS * 1e6);
+
+            if (own) {
+                wbaes_table_free(own);
+            }
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    go = true;
+    for (auto &th : pool) {
+        th.join();
+    }
+
+    res.mbs = 0;
+    for (t = 0; t < threads; t++) {
+        res.thread_mbs.push_back(16.0 * blocks[t] / (BENCH_MS * 1e3));
+        res.mbs += res.thread_mbs.back();
+        res.us.insert(res.us.end(), us[t].begin(), us[t].end());
+    }
+    std::sort(res.us.begin(), res.us.end());
+    return res;
+}
+
+static void scale_print(const char *label, unsigned x, const scale_result &r) {
+    double lo = *std::min_element(r.thread_mbs.begin(), r.thread_mbs.end());
+
+    printf("%-10s %6u %9.1f %9.1f %9.1f %8.0f %8.0f %8.0f\n", label, x, r.mbs, r.mbs / r.thread_mbs.size(), lo,
+        r.us[r.us.size() / 2], r.us[r.us.size() * 99 / 100], r.us[r.us.size() * 999 / 1000]);
+}
+
+static int bench_scale(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    bool     smt = argc > 2 && !strcmp(argv[2], "smt");
+    std::vector<int> cpus = scale_cpus(smt);
+    unsigned max_threads = argc > 0 && atoi(argv[0]) > 0 ? atoi(argv[0]) : cpus.size(), t;
+    size_t   l3 = l3_bytes(), max_keys = argc > 1 ? atoi(argv[1]) : 0, k;
+    std::vector<WBAES_ENCRYPTION_TABLE *> tables;
+    uint8_t  a[16], b[16];
+    int      bad = 0, i;
+
+    if (!max_keys) {
+        for (max_keys = 1; max_keys < 1024 && max_keys * sizeof(WBAES_ENCRYPTION_TABLE) < 2 * l3; max_keys *= 2) {
+        }
+    }
+    if (cpus.empty()) {
+        cpus.push_back(0);
+    }
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    for (k = 0; k < max_keys; k++) {
+        tables.push_back(wbaes_table_alloc(-1));
+        memcpy((void *)tables[k], et, sizeof(WBAES_ENCRYPTION_TABLE));
+    }
+    for (i = 0; i < 1000; i++) {
+        rand_bytes(a, 16);
+        memcpy(b, a, 16);
+        wbaes_encrypt(*et, a);
+        wbaes_encrypt_blocks(*tables[i % max_keys], b, 1);
+        bad += memcmp(a, b, 16) != 0;
+    }
+
+    puts("===================== SCALE =====================");
+    printf("%zu cpu(s)%s, L3 %zu KB, table %zu KB, kernel %s, %d blocks per call\n", cpus.size(), smt ? " with SMT siblings" : "",
+        l3 >> 10, sizeof(WBAES_ENCRYPTION_TABLE) >> 10, wbaes_kernel_name(wbaes_kernels().level), SCALE_BATCH);
+    printf("%-10s %6s %9s %9s %9s %8s %8s %8s\n", "tables", "thr", "MB/s", "MB/s/thr", "min thr", "p50 us", "p99 us", "p99.9 us");
+
+    std::vector<WBAES_ENCRYPTION_TABLE *> one(tables.begin(), tables.begin() + 1);
+    for (t = 1; ; t = t * 2 < max_threads ? t * 2 : max_threads) {
+        scale_print("shared", t, scale_run(one, false, cpus, t));
+        scale_print("replica", t, scale_run(one, true, cpus, t));
+        if (t == max_threads) {
+            break;
+        }
+    }
+
+    printf("\n%-10s %6s %9s %9s %9s %8s %8s %8s  (%u threads)\n", "keys", "set MB", "MB/s", "MB/s/thr", "min thr", "p50 us", "p99 us", "p99.9 us", max_threads);
+    for (k = 1; k <= max_keys; k *= 2) {
+        std::vector<WBAES_ENCRYPTION_TABLE *> set(tables.begin(), tables.begin() + k);
+        char label[32];
+
+        snprintf(label, sizeof(label), "%zu%s", k, l3 && k * sizeof(WBAES_ENCRYPTION_TABLE) > l3 ? " >L3" : "");
+        scale_print(label, (unsigned)(k * sizeof(WBAES_ENCRYPTION_TABLE) >> 20), scale_run(set, false, cpus, max_threads));
+    }
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    for (k = 0; k < max_keys; k++) {
+        wbaes_table_free(tables[k]);
+    }
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Kernels per dispatch level, each checked against the scalar one
+*/
+static int bench_kernels(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    const WBAES_KERNELS *scalar = wbaes_kernels_at(WBAES_KERNEL_SCALAR), *k;
+    std::vector<uint8_t> in(16 * BENCH_BLOCKS), ref(16 * BENCH_BLOCKS), out(16 * BENCH_BLOCKS);
+    double begin, blocks_ns, ext_ns, aes_ns;
+    size_t total, i;
+    int l, bad = 0;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    rand_bytes(in.data(), in.size());
+
+    puts("==================== KERNELS ====================");
+    printf("cpu: %s, bound: %s%s\n", wbaes_kernel_name(wbaes_cpu_level()), wbaes_kernel_name(wbaes_kernels().level),
+           wbaes_kernels().aesni ? " (aes-ni)" : "");
+    printf("level     blocks ns/block   ext ns/block   oracle ns/block\n");
+
+    for (l = 0; l < WBAES_KERNEL_LEVELS; l++) {
+        if (!(k = wbaes_kernels_at((WBAES_KERNEL)l))) {
+            printf("%-8s  (not supported)\n", wbaes_kernel_name((WBAES_KERNEL)l));
+            continue;
+        }
+
+        memcpy(ref.data(), in.data(), in.size());
+        memcpy(out.data(), in.data(), in.size());
+        scalar->encrypt_blocks(*et, ref.data(), BENCH_BLOCKS);
+        scalar->encode_ext_blocks(ee->ext_g, ref.data(), BENCH_BLOCKS);
+        k->encrypt_blocks(*et, out.data(), BENCH_BLOCKS);
+        k->encode_ext_blocks(ee->ext_g, out.data(), BENCH_BLOCKS);
+        for (i = 0; i < BENCH_BLOCKS; i++) {
+            scalar->aes_encrypt(in.data() + 16*i, u32_round_key, ref.data() + 16*i);
+            k->aes_encrypt(in.data() + 16*i, u32_round_key, out.data() + 16*i);
+        }
+        bad += memcmp(ref.data(), out.data(), out.size()) != 0;
+
+        total = 0;
+        begin = get_ns();
+        do {
+            k->encrypt_blocks(*et, out.data(), 256);
+            total += 256;
+        } while (get_ns() - begin < BENCH_MS * 1e6 / 4);
+        blocks_ns = (get_ns() - begin) / total;
+
+        total = 0;
+        begin = get_ns();
+        do {
+            k->encode_ext_blocks(ee->ext_f, out.data(), BENCH_BLOCKS);
+            total += BENCH_BLOCKS;
+        } while (get_ns() - begin < BENCH_MS * 1e6 / 8);
+        ext_ns = (get_ns() - begin) / total;
+
+        total = 0;
+        begin = get_ns();
+        do {
+            for (i = 0; i < BENCH_BLOCKS; i++) {
+                k->aes_encrypt(out.data() + 16*i, u32_round_key, out.data() + 16*i);
+            }
+            total += BENCH_BLOCKS;
+        } while (get_ns() - begin < BENCH_MS * 1e6 / 8);
+        aes_ns = (get_ns() - begin) / total;
+
+        printf("%-8s  %16.1f   %12.2f   %15.2f\n", wbaes_kernel_name((WBAES_KERNEL)l), blocks_ns, ext_ns, aes_ns);
+    }
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    CTR fast path against the plain scalar path, on consecutive counter blocks
+*/
+static int bench_ctr(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    std::vector<uint8_t> ctr(16 * BENCH_BLOCKS), ref(16 * BENCH_BLOCKS), out(16 * BENCH_BLOCKS);
+    WBAES_CTR_CACHE cache;
+    uint8_t iv[16];
+    double begin, plain_ns, cached_ns;
+    size_t total, i;
+    int bad;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    rand_bytes(iv, 16);
+    iv[15] = 0xf0;                      // crosses carries into bytes 14, 13 ...
+    for (i = 0; i < BENCH_BLOCKS; i++) {
+        memcpy(ctr.data() + 16*i, iv, 16);
+        wbaes_ctr_add(ctr.data() + 16*i, i);
+    }
+    encode_ext_blocks(ee->ext_f, ctr.data(), BENCH_BLOCKS);
+
+    memcpy(ref.data(), ctr.data(), ctr.size());
+    memcpy(out.data(), ctr.data(), ctr.size());
+    cache.valid = false;
+    wbaes_encrypt_blocks_scalar(*et, ref.data(), BENCH_BLOCKS);
+    wbaes_encrypt_ctr_blocks(*et, cache, out.data(), BENCH_BLOCKS);
+    bad = memcmp(ref.data(), out.data(), out.size()) != 0;
+
+    total = 0;
+    begin = get_ns();
+    do {
+        memcpy(out.data(), ctr.data(), ctr.size());
+        wbaes_encrypt_blocks_scalar(*et, out.data(), BENCH_BLOCKS);
+        total += BENCH_BLOCKS;
+    } while (get_ns() - begin < BENCH_MS * 1e6);
+    plain_ns = (get_ns() - begin) / total;
+
+    total = 0;
+    begin = get_ns();
+    do {
+        memcpy(out.data(), ctr.data(), ctr.size());
+        cache.valid = false;
+        wbaes_encrypt_ctr_blocks(*et, cache, out.data(), BENCH_BLOCKS);
+        total += BENCH_BLOCKS;
+    } while (get_ns() - begin < BENCH_MS * 1e6);
+    cached_ns = (get_ns() - begin) / total;
+
+    puts("====================== CTR ======================");
+    printf("%d consecutive counter blocks, scalar kernel\n", BENCH_BLOCKS);
+    printf("plain      %8.1f ns/block  (2032 lookups)\n", plain_ns);
+    printf("cached     %8.1f ns/block  (1820 lookups on a low-byte step)\n", cached_ns);
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    delete et;
+    delete ee;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    XTS: ECB on the same blocks as the baseline, then XTS over 512-byte and 4K sectors
+    on the calling thread and on the engine
+*/
+static double xts_run(const WBAES_XTS *x, WBAES_ENGINE *eng, bool decrypt, uint8_t *buf, size_t size, size_t len) {
+    size_t total = 0;
+    double begin = get_ns();
+
+    do {
+        if (eng) {
+            wbaes_xts_engine(x, eng, decrypt, 0, buf, buf, size, len / size);
+        }
+        else if (decrypt) {
+            wbaes_xts_decrypt(x, 0, buf, buf, size, len / size);
+        }
+        else {
+            wbaes_xts_encrypt(x, 0, buf, buf, size, len / size);
+        }
+        total += len;
+    } while (get_ns() - begin < BENCH_MS * 1e6);
+
+    return total / ((get_ns() - begin) / 1e3);     // MB/s
+}
+
+static int bench_xts(int argc, char *argv[]) {
+    static const size_t sizes[2] = { 512, 4096 };
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE(), *dt = new WBAES_ENCRYPTION_TABLE(), *tt = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING(), *de = new WBAES_EXT_ENCODING(), *te = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_XTS     x = { et, ee, dt, de, tt, te };
+    WBAES_ENGINE *eng = wbaes_engine_create(argc > 0 ? atoi(argv[0]) : 0, 64);
+    std::vector<uint8_t> buf(1 << 20), ref;
+    size_t total = 0, s;
+    double begin, ecb;
+    int bad = 0;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    wbaes_gen_decryption_table(*dt, *de, *ie, (uint32_t *)u32_round_key);
+    wbaes_gen_encryption_table(*tt, *te, *ie, (uint32_t *)u32_round_key);
+    wbaes_engine_add_table(eng, et);
+    wbaes_engine_add_table(eng, dt);
+    rand_bytes(buf.data(), buf.size());
+    ref = buf;
+
+    begin = get_ns();
+    do {
+        wbaes_encrypt_blocks_ext(*et, ee, buf.data(), buf.size() / 16);
+        total += buf.size();
+    } while (get_ns() - begin < BENCH_MS * 1e6);
+    ecb = total / ((get_ns() - begin) / 1e3);
+
+    puts("====================== XTS ======================");
+    printf("%zu KB per call, kernel %s, MB/s\n", buf.size() >> 10, wbaes_kernel_name(wbaes_kernels().level));
+    printf("ecb baseline      %8.1f\n", ecb);
+    for (s = 0; s < 2; s++) {
+        printf("%4zu encrypt      %8.1f\n", sizes[s], xts_run(&x, NULL, false, buf.data(), sizes[s], buf.size()));
+        printf("%4zu decrypt      %8.1f\n", sizes[s], xts_run(&x, NULL, true , buf.data(), sizes[s], buf.size()));
+        printf("%4zu engine enc   %8.1f\n", sizes[s], xts_run(&x, eng , false, buf.data(), sizes[s], buf.size()));
+        printf("%4zu engine dec   %8.1f\n", sizes[s], xts_run(&x, eng , true , buf.data(), sizes[s], buf.size()));
+
+        /* engine and batched agree, decryption undoes encryption */
+        std::vector<uint8_t> enc(buf.size());
+        wbaes_xts_encrypt(&x, 5, ref.data(), buf.data(), sizes[s], buf.size() / sizes[s]);
+        wbaes_xts_engine(&x, eng, false, 5, ref.data(), enc.data(), sizes[s], buf.size() / sizes[s]);
+        bad += memcmp(buf.data(), enc.data(), buf.size()) != 0;
+        wbaes_xts_decrypt(&x, 5, buf.data(), buf.data(), sizes[s], buf.size() / sizes[s]);
+        bad += memcmp(buf.data(), ref.data(), buf.size()) != 0;
+    }
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    wbaes_engine_destroy(eng);
+    delete et;
+    delete dt;
+    delete tt;
+    delete ee;
+    delete de;
+    delete te;
+    delete ie;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Key onboarding: full generation vs its two stages vs a warm pool
+*/
+static bool table_ok(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING &ee, uint32_t (*rk)[4]) {
+    uint8_t pt[16], x[16], ct[16];
+
+    rand_bytes(pt, 16);
+    memcpy(x, pt, 16);
+    encode_ext_x(ee.ext_f, x);
+    wbaes_encrypt(et, x);
+    encode_ext_x(ee.ext_g, x);
+    aes_encrypt(pt, rk, ct);
+
+    return memcmp(x, ct, 16) == 0;
+}
+
+static int bench_keygen(int argc, char *argv[]) {
+    int keys = argc > 0 ? atoi(argv[0]) : 8, i, bad = 0;
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_GEN_MATERIAL     *m  = new WBAES_GEN_MATERIAL();
+    WBAES_GEN_POOL *pool;
+    uint8_t  key[16];
+    uint32_t rk[11][4];
+    double   begin, full_ms, material_ms, keyed_ms, pooled_ms;
+
+    keys = keys > 0 ? keys : 1;
+
+    begin = get_ns();
+    for (i = 0; i < keys; i++) {
+        rand_bytes(key, 16);
+        aes32_enc_keyschedule(key, rk);
+        wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)rk);
+        bad += !table_ok(*et, *ee, rk);
+    }
+    full_ms = (get_ns() - begin) / 1e6 / keys;
+
+    begin = get_ns();
+    for (i = 0; i < keys; i++) {
+        wbaes_gen_material(*m);
+    }
+    material_ms = (get_ns() - begin) / 1e6 / keys;
+
+    begin = get_ns();
+    for (i = 0; i < keys; i++) {
+        wbaes_gen_keyed_table(*et, *m, (uint32_t *)rk);
+    }
+    keyed_ms = (get_ns() - begin) / 1e6 / keys;
+
+    pool = wbaes_gen_pool_create(keys, 1);
+    while (wbaes_gen_pool_ready(pool) < (size_t)keys) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    begin = get_ns();
+    for (i = 0; i < keys; i++) {
+        rand_bytes(key, 16);
+        aes32_enc_keyschedule(key, rk);
+        wbaes_gen_encryption_table_pooled(pool, *et, *ee, NULL, (uint32_t *)rk);
+        bad += !table_ok(*et, *ee, rk);
+    }
+    pooled_ms = (get_ns() - begin) / 1e6 / keys;
+    wbaes_gen_pool_destroy(pool);
+
+    puts("==================== KEYGEN =====================");
+    printf("%d key(s), ms per key\n", keys);
+    printf("wbaes_gen_encryption_table   %8.2f\n", full_ms);
+    printf("  key-independent stage      %8.2f\n", material_ms);
+    printf("  key stage                  %8.2f\n", keyed_ms);
+    printf("warm pool                    %8.2f\n", pooled_ms);
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    delete et;
+    delete ee;
+    delete ie;
+    delete m;
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Generation peak memory: in-memory generation vs streaming into a file
+     - every method runs in a forked child, peak RSS is read there right after generating
+*/
+struct genmem_result {
+    long   rss_kb;
+    double ms;
+    int    ok;
+};
+
+static long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static genmem_result genmem_child(int method, const char *file) {
+    genmem_result res = { peak_rss_kb(), 0, 1 };
+    WBAES_ENCRYPTION_TABLE *et = NULL;
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie;
+    double begin = get_ns();
+
+    if (method == 1) {
+        et = new WBAES_ENCRYPTION_TABLE();
+        ie = new WBAES_INT_ENCODING();
+        wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+        delete ie;
+    }
+    else if (method == 2) {
+        res.ok = wbaes_gen_table_file(file, *ee, (uint32_t *)u32_round_key) == 0;
+    }
+    res.ms     = (get_ns() - begin) / 1e6;
+    res.rss_kb = peak_rss_kb();
+
+    if (method == 1) {
+        res.ok = table_ok(*et, *ee, u32_round_key);
+        delete et;
+    }
+    else if (method == 2 && res.ok) {
+        et = wbaes_table_load(file, -1);
+        res.ok = et && table_ok(*et, *ee, u32_round_key);
+        wbaes_table_free(et);
+        unlink(file);
+    }
+    delete ee;
+
+    return res;
+}
+
+static int bench_genmem(int argc, char *argv[]) {
+    static const char *names[] = { "baseline (no generation)", "wbaes_gen_encryption_table", "wbaes_gen_table_file" };
+    const char *file = argc > 0 ? argv[0] : "/tmp/wbaes_genmem.tbl";
+    genmem_result res[3];
+    int fd[2], i, bad = 0;
+    pid_t pid;
+
+    for (i = 0; i < 3; i++) {
+        if (pipe(fd) < 0 || (pid = fork()) < 0) {
+            perror("genmem");
+            return -1;
+        }
+        if (pid == 0) {
+            genmem_result r = genmem_child(i, file);
+            _exit(write(fd[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+        }
+        close(fd[1]);
+        if (read(fd[0], &res[i], sizeof(res[i])) != sizeof(res[i])) {
+            res[i].ok = 0;
+        }
+        close(fd[0]);
+        waitpid(pid, NULL, 0);
+        bad += !res[i].ok;
+    }
+
+    puts("==================== GENMEM =====================");
+    printf("table %zu KB\n", sizeof(WBAES_ENCRYPTION_TABLE) >> 10);
+    printf("%-28s %10s %10s %8s\n", "", "peak KB", "over base", "ms");
+    for (i = 0; i < 3; i++) {
+        printf("%-28s %10ld %10ld %8.1f\n", names[i], res[i].rss_kb, res[i].rss_kb - res[0].rss_kb, res[i].ms);
+    }
+    printf("mismatches %d\n", bad);
+    puts("=================================================");
+
+    return bad ? -1 : 0;
+}
+
+/*
+    Generation phases
+     - every thread generates `keys` tables, the phase times are read from each thread's
+       WBAES_GEN_STATS and reported per table; wall time shows the scaling over threads
+*/
+struct gen_run {
+    WBAES_GEN_STATS st;
+    double          wall_ms;
+    int             bad;
+};
+
+static void gen_thread(int keys, unsigned seed, WBAES_GEN_STATS *st, int *bad) {
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    uint8_t  key[16];
+    uint32_t rk[11][4];
+    int i, j;
+
+    wbaes_gen_stats(st, true);
+    for (i = 0; i < keys; i++) {
+        for (j = 0; j < 16; j++) {
+            key[j] = (uint8_t)rand_r(&seed);
+        }
+        aes32_enc_keyschedule(key, rk);
+        wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)rk);
+        *bad += !table_ok(*et, *ee, rk);
+    }
+    wbaes_gen_stats(st, true);
+
+    delete et;
+    delete ee;
+    delete ie;
+}
+
+static int bench_gen(int argc, char *argv[]) {
+    int keys = argc > 0 ? atoi(argv[0]) : 4, bad = 0, p;
+    unsigned max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency(), t, i;
+    std::vector<unsigned> counts;
+    std::vector<gen_run>  runs;
+
+    keys = keys > 0 ? keys : 1;
+    max_threads = max_threads ? max_threads : 1;
+    for (t = 1; t < max_threads; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+
+    for (unsigned n : counts) {
+        std::vector<std::thread>     threads;
+        std::vector<WBAES_GEN_STATS> st(n);
+        std::vector<int>             errs(n, 0);
+        gen_run run;
+        double  begin = get_ns();
+
+        for (i = 0; i < n; i++) {
+            threads.emplace_back(gen_thread, keys, 1 + i, &st[i], &errs[i]);
+        }
+        for (auto &th : threads) {
+            th.join();
+        }
+
+        memset(&run, 0, sizeof(run));
+        run.wall_ms = (get_ns() - begin) / 1e6;
+        for (i = 0; i < n; i++) {
+            for (p = 0; p < WBAES_GEN_PHASES; p++) {
+                run.st.ns[p]    += st[i].ns[p];
+                run.st.calls[p] += st[i].calls[p];
+            }
+            run.st.tables      += st[i].tables;
+            run.st.allocs      += st[i].allocs;
+            run.st.alloc_bytes += st[i].alloc_bytes;
+            run.bad            += errs[i];
+        }
+        bad += run.bad;
+        runs.push_back(run);
+    }
+
+    puts("====================== GEN ======================");
+    printf("%d key(s) per thread, kernel %s, phase times in ms per table\n", keys, wbaes_kernel_name(wbaes_kernels().level));
+    printf("%-16s", "threads");
+    for (unsigned n : counts) {
+        printf(" %9u", n);
+    }
+    printf("\n%-16s", "tables/s");
+    for (const gen_run &r : runs) {
+        printf(" %9.1f", 1e3 * r.st.tables / r.wall_ms);
+    }
+    for (p = 0; p < WBAES_GEN_PHASES; p++) {
+        printf("\n%-16s", wbaes_gen_phase_name(p));
+        for (const gen_run &r : runs) {
+            printf(" %9.3f", r.st.ns[p] / 1e6 / r.st.tables);
+        }
+    }
+    printf("\n%-16s", "allocs/table");
+    for (const gen_run &r : runs) {
+        printf(" %9.0f", (double)r.st.allocs / r.st.tables);
+    }
+    printf("\n%-16s", "alloc KB/table");
+    for (const gen_run &r : runs) {
+        printf(" %9.0f", r.st.alloc_bytes / 1024.0 / r.st.tables);
+    }
+    printf("\nmismatches %d\n", bad);
+    puts("=================================================");
+
+    return bad ? -1 : 0;
+}
+
+struct bench_entry {
+    const char *name;
+    int       (*fn)(int argc, char *argv[]);
+    const char *desc;
+};
+
+static const bench_entry benches[] = {
+    { "numa",     bench_numa,     "local vs remote table throughput per NUMA node pair" },
+    { "hugepage", bench_hugepage, "[keys] small vs huge page tables, ns/block and dTLB misses" },
+    { "warm",     bench_warm,     "first-block latency of a loaded table, cold vs warmed" },
+    { "prefetch", bench_prefetch, "[keys] batched ns/block per software prefetch distance" },
+    { "kernels",  bench_kernels,  "blocks, external encoding and oracle AES per dispatch level" },
+    { "ctr",      bench_ctr,      "CTR with cached round-1/2 columns vs the plain scalar path" },
+    { "xts",      bench_xts,      "[workers] XTS MB/s on 512-byte and 4K sectors, batched and on the engine, vs ECB" },
+    { "keygen",   bench_keygen,   "[keys] key onboarding time, full generation vs warm material pool" },
+    { "gen",      bench_gen,      "[keys] [threads] generation time per phase, swept over 1..threads threads" },
+    { "genmem",   bench_genmem,   "[file] peak memory of generation, in memory vs streamed into a file" },
+    { "scale",    bench_scale,    "[threads] [keys] [smt] shared vs replicated table over 1..threads, then resident keys vs L3" },
+    { "latency",  bench_latency,  "[keys] single-block latency percentiles, wbaes_encrypt vs low-latency kernel" },
+    { "jit",      bench_jit,      "straight-line code compiled per table vs wbaes_encrypt and the batched kernels" },
+    { "metrics",  bench_metrics,  "[threads] library counters under concurrent calls, snapshot and export cost" },
+};
+
+int main(int argc, char *argv[]) {
+    size_t i;
+
+    aes32_enc_keyschedule(u8_aes_key, u32_round_key);
+
+    if (argc >= 2) {
+        for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+            if (std::strcmp(argv[1], benches[i].name) == 0) {
+                return benches[i].fn(argc - 2, argv + 2);
+            }
+        }
+    }
+
+    puts("usage: ./bench <name> [args]");
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        printf("  %-12s %s\n", benches[i].name, benches[i].desc);
+    }
+
+    return argc >= 2 ? -1 : 0;
+}
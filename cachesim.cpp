@@ -0,0 +1,231 @@
+/*
+    Chow's Whitebox AES cache-footprint analyzer
+        - ./wbaestrace [options]
+        - records the table references of a workload (or reads a saved trace)
+          and replays them through a cache / TLB model, for every layout and page size
+*/
+
+#include <iostream>
+#include <random>
+
+#include "aes.h"
+#include "wbaes.h"
+#include "wbaes_mem.h"
+#include "wbaes_trace.h"
+
+#include <unistd.h>
+
+#define TRACE_MAGIC     0x52544257      // "WBTR"
+
+
+static void usage() {
+    puts("usage: ./wbaestrace [options]");
+    puts("  -n <blocks>         blocks of the workload (default 4096)");
+    puts("  -k <keys>           tables the workload is spread over (default 1)");
+    puts("  -b <lanes>          blocks interleaved per batch, 1 = wbaes_encrypt() (default 8)");
+    puts("  -1 / -2 / -3 <size:ways>   L1 / L2 / L3, e.g. 48K:12, 0 to drop the level");
+    puts("                      (default 32K:8, 1M:16, 32M:16, 64-byte lines)");
+    puts("  -T <entries:ways>   data TLB (default 64:4), 0 for none");
+    puts("  -L struct|round     layout (default: both)");
+    puts("  -P 4k|2m            page size (default: both)");
+    puts("  -w <file>           saves the trace");
+    puts("  -r <file>           replays a saved trace instead of running a workload");
+    puts("  -v                  miss rates per round");
+}
+
+static bool parse_level(const char *s, size_t *size, int *ways) {
+    char  unit = 0;
+    double v;
+
+    if (!strcmp(s, "0")) {
+        *size = 0;
+        *ways = 0;
+        return true;
+    }
+    if (sscanf(s, "%lf%c:%d", &v, &unit, ways) == 3) {
+        *size = (size_t)(v * (unit == 'K' || unit == 'k' ? 1 << 10 : unit == 'M' || unit == 'm' ? 1 << 20 : 1));
+        return *ways > 0;
+    }
+    if (sscanf(s, "%lf:%d", &v, ways) == 2) {
+        *size = (size_t)v;
+        return *ways > 0;
+    }
+    return false;
+}
+
+static bool save_trace(const char *file, const std::vector<uint32_t> &trace) {
+    FILE    *f = fopen(file, "wb");
+    uint32_t magic = TRACE_MAGIC;
+    uint64_t n = trace.size();
+    bool     ok;
+
+    if (!f) {
+        return false;
+    }
+    ok = fwrite(&magic, 4, 1, f) == 1 && fwrite(&n, 8, 1, f) == 1 &&
+         fwrite(trace.data(), 4, n, f) == n;
+    return fclose(f) == 0 && ok;
+}
+
+static bool load_trace(const char *file, std::vector<uint32_t> &trace) {
+    FILE    *f = fopen(file, "rb");
+    uint32_t magic = 0;
+    uint64_t n = 0;
+    bool     ok;
+
+    if (!f) {
+        return false;
+    }
+    ok = fread(&magic, 4, 1, f) == 1 && magic == TRACE_MAGIC && fread(&n, 8, 1, f) == 1;
+    if (ok) {
+        trace.resize(n);
+        ok = fread(trace.data(), 4, n, f) == n;
+    }
+    fclose(f);
+    return ok;
+}
+
+/* runs the workload on k fresh tables, checking the traced path against wbaes_encrypt() */
+static bool record(size_t blocks, size_t keys, size_t lanes, std::vector<uint32_t> &trace) {
+    std::vector<WBAES_ENCRYPTION_TABLE *> et(keys);
+    std::vector<uint8_t> data(16 * blocks), ref;
+    std::mt19937_64 rng(1);
+    WBAES_EXT_ENCODING *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING *ie = new WBAES_INT_ENCODING();
+    uint8_t  key[16];
+    uint32_t rk[11][4];
+    size_t   i, k, mismatch = 0;
+
+    for (k = 0; k < keys; k++) {
+        for (i = 0; i < 16; i++) {
+            key[i] = (uint8_t)rng();
+        }
+        aes32_enc_keyschedule(key, rk);
+        et[k] = wbaes_table_alloc(-1);
+        wbaes_gen_encryption_table(*et[k], *ee, *ie, (uint32_t *)rk);
+    }
+    for (i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)rng();
+    }
+    ref = data;
+
+    wbaes_trace_blocks(et.data(), keys, data.data(), blocks, lanes, trace);
+
+    for (i = 0, k = 0; i < blocks; i += lanes, k = (k + 1) % keys) {
+        for (size_t l = i; l < i + lanes && l < blocks; l++) {
+            wbaes_encrypt(*et[k], ref.data() + 16*l);
+        }
+    }
+    for (i = 0; i < blocks; i++) {
+        mismatch += memcmp(data.data() + 16*i, ref.data() + 16*i, 16) != 0;
+    }
+
+    for (k = 0; k < keys; k++) {
+        wbaes_table_free(et[k]);
+    }
+    delete ee;
+    delete ie;
+
+    if (mismatch) {
+        fprintf(stderr, "traced path differs from wbaes_encrypt() on %zu blocks\n", mismatch);
+    }
+    return mismatch == 0;
+}
+
+int main(int argc, char *argv[]) {
+    WBAES_CACHE_MODEL   m;
+    WBAES_CACHE_REPORT *rep = new WBAES_CACHE_REPORT();
+    std::vector<uint32_t> trace;
+    const char *in = NULL, *out = NULL;
+    size_t blocks = 4096, keys = 1, lanes = WBAES_BATCH_LANES;
+    int    layout = -1, page = -1, opt, l, p;
+    bool   per_round = false;
+
+    memset(&m, 0, sizeof(m));
+    m.level[0]    = { 32 << 10, 8 };
+    m.level[1]    = { 1 << 20, 16 };
+    m.level[2]    = { 32 << 20, 16 };
+    m.line        = 64;
+    m.tlb_entries = 64;
+    m.tlb_ways    = 4;
+
+    while ((opt = getopt(argc, argv, "n:k:b:1:2:3:T:L:P:w:r:vh")) != -1) {
+        switch (opt) {
+        case 'n': blocks = strtoull(optarg, NULL, 0); break;
+        case 'k': keys   = strtoull(optarg, NULL, 0); break;
+        case 'b': lanes  = strtoull(optarg, NULL, 0); break;
+        case '1':
+        case '2':
+        case '3':
+            l = opt - '1';
+            if (!parse_level(optarg, &m.level[l].size, &m.level[l].ways)) {
+                usage();
+                return -1;
+            }
+            break;
+        case 'T':
+            if (!strcmp(optarg, "0")) {
+                m.tlb_entries = 0;
+            }
+            else if (sscanf(optarg, "%d:%d", &m.tlb_entries, &m.tlb_ways) != 2) {
+                usage();
+                return -1;
+            }
+            break;
+        case 'L': layout = !strcmp(optarg, "struct") ? WBAES_LAYOUT_STRUCT : !strcmp(optarg, "round") ? WBAES_LAYOUT_ROUND : -2; break;
+        case 'P': page   = !strcmp(optarg, "4k") ? 0 : !strcmp(optarg, "2m") ? 1 : -2; break;
+        case 'w': out = optarg; break;
+        case 'r': in  = optarg; break;
+        case 'v': per_round = true; break;
+        default:  usage(); return -1;
+        }
+    }
+    if (layout == -2 || page == -2 || !blocks || !keys || keys > WBAES_TRACE_MAX_TABLES || !lanes ||
+        (!m.level[0].size && (m.level[1].size || m.level[2].size)) || (!m.level[1].size && m.level[2].size)) {
+        usage();
+        return -1;
+    }
+
+    if (in) {
+        if (!load_trace(in, trace)) {
+            fprintf(stderr, "cannot read trace %s\n", in);
+            return -1;
+        }
+    }
+    else if (!record(blocks, keys, lanes, trace)) {
+        return -1;
+    }
+    if (out && !save_trace(out, trace)) {
+        fprintf(stderr, "cannot write trace %s\n", out);
+        return -1;
+    }
+
+    printf("%zu references", trace.size());
+    if (!in) {
+        printf(", %zu blocks, %zu table(s), %zu lane(s)", blocks, keys, lanes);
+    }
+    printf("\nL1 %zuK/%d, L2 %zuK/%d, L3 %zuK/%d, %d-byte lines, TLB %d/%d\n",
+        m.level[0].size >> 10, m.level[0].ways, m.level[1].size >> 10, m.level[1].ways,
+        m.level[2].size >> 10, m.level[2].ways, m.line, m.tlb_entries, m.tlb_ways);
+
+    for (l = 0; l < WBAES_TRACE_LAYOUTS; l++) {
+        for (p = 0; p < 2; p++) {
+            if ((layout >= 0 && layout != l) || (page >= 0 && page != p)) {
+                continue;
+            }
+
+            m.layout = (WBAES_TRACE_LAYOUT)l;
+            m.page   = p ? 2UL << 20 : 4096;
+            if (wbaes_cache_replay(trace, m, rep) < 0) {
+                fputs("invalid model: sizes must be multiples of ways * line, TLB entries of its ways\n", stderr);
+                return -1;
+            }
+
+            printf("\n==== layout %s, %s pages ====\n", wbaes_trace_layout_name(l), p ? "2M" : "4K");
+            wbaes_cache_dump(*rep, per_round, stdout);
+        }
+    }
+
+    delete rep;
+    return 0;
+}
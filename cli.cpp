@@ -0,0 +1,486 @@
+/*
+    Chow's Whitebox AES file encryption
+        - ./wbaes enc|dec [options] [<in> [<out>]], "-" or nothing is stdin / stdout
+        - regular input files are mapped, streams are read in double-buffered chunks;
+          every chunk is split into CTR jobs for the engine, the next chunk is read
+          (or submitted) while the workers run the current one
+        - GCM appends the 16-byte tag on enc and checks it on dec; a mapped input is
+          authenticated before any plaintext is written, a streamed one only at its end,
+          so streamed GCM decryption needs an output file (removed if the tag is wrong)
+*/
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "wbaes_engine.h"
+#include "wbaes_modes.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CLI_CHUNK       (4UL << 20)     // bytes per chunk, a multiple of CLI_JOB
+#define CLI_JOB         (256UL << 10)   // bytes per engine job
+#define CLI_JOBS        (CLI_CHUNK / CLI_JOB)
+
+
+struct chunk {
+    const uint8_t *in;
+    uint8_t       *out;
+    size_t         len;
+    uint8_t        ctr[16];             // counter block of the first byte
+
+    WBAES_JOB      jobs[CLI_JOBS];
+    size_t         pending;
+};
+
+struct cli_ctx {
+    bool                          enc, gcm, quiet;
+    bool                          hashed;       // GCM dec: ciphertext already hashed
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+    WBAES_ENGINE                 *eng;
+    WBAES_GCM                     g;
+    uint8_t                       ctr[16];      // counter block of the next chunk
+    int                           failed;       // a job failed
+};
+
+static double now_s() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec + t_val.tv_nsec / 1e9;
+}
+
+static void usage() {
+    puts("usage: ./wbaes enc|dec [options] [<in> [<out>]]");
+    puts("  -T <file>       whitebox table (required)");
+    puts("  -X <file>       external encoding (required)");
+    puts("  -m ctr|gcm      mode (default ctr)");
+    puts("  -i <hex>        CTR: initial counter block (16 bytes), GCM: IV (12 bytes recommended)");
+    puts("  -a <hex>        GCM: additional authenticated data");
+    puts("  -w <workers>    engine workers (default: all cores)");
+    puts("  -q              no throughput stats");
+    puts("dec gcm from a pipe writes plaintext before the tag is checked: it needs an <out> file,");
+    puts("deleted on authentication failure");
+}
+
+static size_t parse_hex(const char *hex, std::vector<uint8_t> &out) {
+    size_t n = strlen(hex) / 2, i;
+    unsigned v;
+
+    out.clear();
+    if (strlen(hex) % 2) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (sscanf(hex + 2*i, "%2x", &v) != 1) {
+            return 0;
+        }
+        out.push_back(v);
+    }
+
+    return n;
+}
+
+static bool read_full(int fd, uint8_t *p, size_t len, size_t *got) {
+    ssize_t r;
+
+    for (*got = 0; *got < len; *got += r) {
+        r = read(fd, p + *got, len - *got);
+        if (r < 0 && errno == EINTR) {
+            r = 0;
+            continue;
+        }
+        if (r <= 0) {
+            return r == 0;
+        }
+    }
+
+    return true;
+}
+
+static bool write_full(int fd, const uint8_t *p, size_t len) {
+    ssize_t w;
+
+    for (; len; len -= w, p += w) {
+        w = write(fd, p, len);
+        if (w < 0 && errno == EINTR) {
+            w = 0;
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Engine fan-out
+*/
+static void reap(cli_ctx &c, int timeout_ms) {
+    WBAES_JOB *done[CLI_JOBS * 2];
+    size_t n, i;
+
+    n = wbaes_engine_wait(c.eng, done, CLI_JOBS * 2, timeout_ms);
+    for (i = 0; i < n; i++) {
+        ((chunk *)done[i]->user)->pending--;
+        c.failed |= done[i]->status != 0;
+    }
+}
+
+/* GCM steps its counter with inc32 */
+static inline void ctr_step(const cli_ctx &c, uint8_t *ctr, uint64_t n) {
+    if (c.gcm) {
+        wbaes_ctr_add32(ctr, n);
+    }
+    else {
+        wbaes_ctr_add(ctr, n);
+    }
+}
+
+static void submit(cli_ctx &c, chunk &k, const uint8_t *in, uint8_t *out, size_t len) {
+    size_t off, i;
+
+    k.in      = in;
+    k.out     = out;
+    k.len     = len;
+    k.pending = 0;
+    memcpy(k.ctr, c.ctr, 16);
+    ctr_step(c, c.ctr, (len + 15) / 16);
+
+    if (c.gcm && !c.enc && !c.hashed) {
+        wbaes_gcm_ghash(&c.g, in, len);
+    }
+
+    for (off = 0, i = 0; off < len; off += CLI_JOB, i++) {
+        WBAES_JOB &job = k.jobs[i];
+
+        memset(&job, 0, sizeof(job));
+        job.et   = c.et;
+        job.ee   = c.ee;
+        job.mode = c.gcm ? WBAES_JOB_CTR32 : WBAES_JOB_CTR;
+        job.in   = in + off;
+        job.out  = out + off;
+        job.len  = len - off < CLI_JOB ? len - off : CLI_JOB;
+        job.user = &k;
+        memcpy(job.iv, k.ctr, 16);
+        ctr_step(c, job.iv, off / 16);
+
+        k.pending++;
+        while (wbaes_engine_submit(c.eng, &job) == -EAGAIN) {
+            reap(c, 10);
+        }
+    }
+}
+
+static void finish(cli_ctx &c, chunk &k) {
+    while (k.pending) {
+        reap(c, 100);
+    }
+
+    if (c.gcm && c.enc) {
+        wbaes_gcm_ghash(&c.g, k.out, k.len);
+    }
+}
+
+/*
+    Mapped input: chunks are submitted straight from the mapping,
+    into the mapped output file or into two buffers written to a stream
+*/
+static int run_mapped(cli_ctx &c, const uint8_t *in, size_t len, int out_fd, uint8_t *out_map, uint8_t *tag_in, uint8_t *tag_out) {
+    static chunk k[2];
+    std::vector<uint8_t> buf[2];
+    size_t off, n;
+    int cur = 0, prev = -1;
+
+    if (!out_map) {
+        buf[0].resize(CLI_CHUNK);
+        buf[1].resize(CLI_CHUNK);
+    }
+    /* GCM dec: the tag is checked before the first plaintext byte leaves */
+    if (tag_in) {
+        memcpy(tag_in, in + len, 16);
+        wbaes_gcm_ghash(&c.g, in, len);
+        wbaes_gcm_tag(&c.g, tag_out);
+        if (memcmp(tag_in, tag_out, 16) != 0) {
+            return 0;
+        }
+        c.hashed = true;
+    }
+
+    for (off = 0; ; off += n) {
+        n = len - off < CLI_CHUNK ? len - off : CLI_CHUNK;
+        if (n) {
+            submit(c, k[cur], in + off, out_map ? out_map + off : buf[cur].data(), n);
+        }
+
+        if (prev >= 0) {
+            finish(c, k[prev]);
+            if (!out_map && !write_full(out_fd, k[prev].out, k[prev].len)) {
+                return -1;
+            }
+        }
+        if (!n) {
+            break;
+        }
+        prev = cur;
+        cur ^= 1;
+    }
+
+    if (c.gcm && c.enc) {
+        wbaes_gcm_tag(&c.g, tag_out);
+        if (out_map) {
+            memcpy(out_map + len, tag_out, 16);
+        }
+        else if (!write_full(out_fd, tag_out, 16)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Streamed input: two buffers, one is read while the other is on the engine.
+    GCM dec holds the last 16 bytes back (the tag) in front of the next buffer.
+*/
+static int run_stream(cli_ctx &c, int in_fd, int out_fd, uint64_t *total, uint8_t *tag_in, uint8_t *tag_out) {
+    static chunk k[2];
+    const size_t hold = (c.gcm && !c.enc) ? 16 : 0;
+    std::vector<uint8_t> buf[2];
+    uint8_t tail[16];
+    size_t  got;
+    bool    eof = false;
+    int     cur = 0, prev = -1;
+
+    buf[0].resize(CLI_CHUNK + 16);
+    buf[1].resize(CLI_CHUNK + 16);
+
+    if (hold && (!read_full(in_fd, tail, 16, &got) || got < 16)) {
+        fputs("input shorter than a tag\n", stderr);
+        return -1;
+    }
+
+    *total = 0;
+    while (!eof || prev >= 0) {
+        got = 0;
+        if (!eof) {
+            uint8_t *b = buf[cur].data();
+
+            memcpy(b, tail, hold);
+            if (!read_full(in_fd, b + hold, CLI_CHUNK, &got)) {
+                perror("read");
+                return -1;
+            }
+            eof = got < CLI_CHUNK;
+            memcpy(tail, b + got, hold);
+
+            if (got) {
+                submit(c, k[cur], b, b, got);
+                *total += got;
+            }
+        }
+
+        if (prev >= 0) {
+            finish(c, k[prev]);
+            if (!write_full(out_fd, k[prev].out, k[prev].len)) {
+                return -1;
+            }
+        }
+
+        prev = got ? cur : -1;
+        cur ^= 1;
+    }
+
+    if (c.gcm) {
+        wbaes_gcm_tag(&c.g, tag_out);
+        if (c.enc && !write_full(out_fd, tag_out, 16)) {
+            return -1;
+        }
+        memcpy(tag_in, tail, 16);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    WBAES_ENCRYPTION_TABLE *et;
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    std::vector<uint8_t> iv, aad;
+    const char *table = NULL, *ext = NULL, *in_path = "-", *out_path = "-";
+    unsigned workers = 0;
+    cli_ctx  c;
+    struct stat st;
+    uint8_t  tag_in[16], tag_out[16], *in_map = NULL, *out_map = NULL;
+    uint64_t len = 0;
+    size_t   map_len = 0, out_len = 0;
+    int      opt, in_fd = 0, out_fd = 1, ret, rc;
+    double   begin, elapsed;
+
+    memset(&c, 0, sizeof(c));
+
+    if (argc < 2 || (strcmp(argv[1], "enc") && strcmp(argv[1], "dec"))) {
+        usage();
+        return -1;
+    }
+    c.enc = strcmp(argv[1], "enc") == 0;
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "T:X:m:i:a:w:q")) != -1) {
+        switch (opt) {
+        case 'T': table = optarg; break;
+        case 'X': ext   = optarg; break;
+        case 'm': c.gcm = strcmp(optarg, "gcm") == 0;
+                  if (!c.gcm && strcmp(optarg, "ctr")) { usage(); return -1; }
+                  break;
+        case 'i': parse_hex(optarg, iv);  break;
+        case 'a': parse_hex(optarg, aad); break;
+        case 'w': workers = atoi(optarg); break;
+        case 'q': c.quiet = true; break;
+        default:  usage(); return -1;
+        }
+    }
+    if (optind < argc) in_path  = argv[optind++];
+    if (optind < argc) out_path = argv[optind++];
+
+    if (!table || !ext || (c.gcm ? iv.empty() : iv.size() != 16)) {
+        usage();
+        return -1;
+    }
+    if (!(et = wbaes_table_load(table, -1)) || !ee->read(ext)) {
+        fprintf(stderr, "cannot read %s / %s\n", table, ext);
+        return -1;
+    }
+
+    c.et  = et;
+    c.ee  = ee;
+    c.eng = wbaes_engine_create(workers, 4 * CLI_JOBS);
+    if (!c.eng) {
+        perror("engine");
+        return -1;
+    }
+    if ((rc = wbaes_engine_add_table(c.eng, et)) != 0) {
+        fprintf(stderr, "engine: cannot add the table: %s\n", strerror(-rc));
+        return -1;
+    }
+
+    if (c.gcm) {
+        wbaes_gcm_init(&c.g, *et, ee, iv.data(), iv.size());
+        wbaes_gcm_aad(&c.g, aad.data(), aad.size());
+        memcpy(c.ctr, c.g.ctr, 16);
+    }
+    else {
+        memcpy(c.ctr, iv.data(), 16);
+    }
+
+    if (strcmp(in_path, "-") && (in_fd = open(in_path, O_RDONLY)) < 0) {
+        perror(in_path);
+        return -1;
+    }
+
+    /* regular files are mapped, the output too when it is a regular file */
+    if (fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map_len = st.st_size;
+        in_map  = (uint8_t *)mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (in_map == MAP_FAILED) {
+            in_map = NULL;
+        }
+        else {
+            madvise(in_map, map_len, MADV_SEQUENTIAL);
+        }
+    }
+    if (in_map && c.gcm && !c.enc && map_len < 16) {
+        fputs("input shorter than a tag\n", stderr);
+        return -1;
+    }
+
+    if (!in_map && c.gcm && !c.enc && !strcmp(out_path, "-")) {
+        fputs("dec gcm from a stream needs an output file: plaintext is written before the tag is checked\n", stderr);
+        return -1;
+    }
+
+    len = in_map ? map_len - ((c.gcm && !c.enc) ? 16 : 0) : 0;
+
+    /*
+        The output is private (plaintext on dec), a mapped one has its blocks reserved first:
+        a store into a hole the disk cannot back would be a SIGBUS, write() gets ENOSPC instead
+    */
+    if (strcmp(out_path, "-")) {
+        if ((out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+            perror(out_path);
+            return -1;
+        }
+        out_len = len + ((c.gcm && c.enc) ? 16 : 0);
+        if (in_map && out_len && fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (posix_fallocate(out_fd, 0, out_len) == 0) {
+                out_map = (uint8_t *)mmap(NULL, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+                if (out_map == MAP_FAILED) {
+                    out_map = NULL;
+                }
+            }
+            if (!out_map && ftruncate(out_fd, 0) != 0) {       // written with write() from the start
+                perror(out_path);
+                return -1;
+            }
+        }
+    }
+
+    begin = now_s();
+    if (in_map) {
+        ret = run_mapped(c, in_map, len, out_fd, out_map, (c.gcm && !c.enc) ? tag_in : NULL, tag_out);
+    }
+    else {
+        ret = run_stream(c, in_fd, out_fd, &len, tag_in, tag_out);
+    }
+    elapsed = now_s() - begin;
+
+    /* writeback errors fail the run, the output is then removed */
+    if (out_map) {
+        if (msync(out_map, out_len, MS_SYNC) != 0 && !ret) {
+            perror(out_path);
+            ret = -1;
+        }
+        munmap(out_map, out_len);
+    }
+    else if (strcmp(out_path, "-") && fsync(out_fd) != 0 && errno != EINVAL && !ret) {
+        perror(out_path);           // EINVAL: a device (/dev/null) has nothing to sync
+        ret = -1;
+    }
+    if (strcmp(out_path, "-") && close(out_fd) != 0 && !ret) {
+        perror(out_path);
+        ret = -1;
+    }
+    if (in_map) {
+        munmap(in_map, map_len);
+    }
+
+    if (!ret && c.failed) {
+        fputs("engine job failed\n", stderr);
+        ret = -1;
+    }
+    if (!ret && c.gcm && !c.enc && memcmp(tag_in, tag_out, 16) != 0) {
+        fputs("authentication failed\n", stderr);
+        ret = 1;
+    }
+    if (ret && strcmp(out_path, "-")) {
+        unlink(out_path);
+    }
+
+    if (!c.quiet && ret >= 0) {
+        fprintf(stderr, "%s %s: %llu bytes in %.3f s, %.2f MB/s (%s, %u workers)\n",
+            c.enc ? "enc" : "dec", c.gcm ? "gcm" : "ctr", (unsigned long long)len, elapsed,
+            elapsed > 0 ? len / elapsed / 1e6 : 0.0, in_map ? "mapped" : "streamed",
+            workers ? workers : std::thread::hardware_concurrency());
+    }
+
+    wbaes_engine_destroy(c.eng);
+    wbaes_table_free(et);
+    delete ee;
+    close(in_fd);
+
+    return ret;
+}
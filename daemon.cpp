@@ -0,0 +1,914 @@
+/*
+    Chow's Whitebox AES encryption daemon
+        - ./wbaesd serve  -s <socket> -d <keystore dir | archive> [-w workers] [-l latency target us] [-m metrics file]
+        - ./wbaesd client -s <socket> -k <id> [-n requests] [-c connections] [-b bytes]
+        - ./wbaesd keygen -d <keystore> -k <id> <key (32 hex digits)>
+        - one process owns the tables of the keystore and serves them over a Unix domain socket;
+          requests of all connections are queued, coalesced into batches per key
+          and sized from the queue depth and the latency target
+        - with -m, the library metrics are dumped every second in the Prometheus text format
+*/
+
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "wbaes_cpu.h"
+#include "wbaes_modes.h"
+#include "wbaes_keystore.h"
+#include "wbaes_metrics.h"
+
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+    Protocol, host byte order (both ends are on the same host)
+     request:  wbaesd_req_hdr, key id (key_len bytes), data (len bytes)
+     response: wbaesd_resp_hdr, data (len bytes), tag echoes the request
+*/
+#define WBAESD_MAGIC        0x31414257      // "WBA1"
+#define WBAESD_MAX_LEN      (1U << 20)
+
+enum WBAESD_OP {
+    WBAESD_ECB   = 1,       // len a multiple of 16
+    WBAESD_CTR   = 2,       // iv is the initial counter block
+    WBAESD_STATS = 3        // no key, no data, answers with a text report
+};
+
+struct wbaesd_req_hdr {
+    uint32_t magic;
+    uint32_t tag;
+    uint8_t  op;
+    uint8_t  key_len;
+    uint16_t reserved;
+    uint32_t len;
+    uint8_t  iv[16];
+};
+
+struct wbaesd_resp_hdr {
+    uint32_t magic;
+    uint32_t tag;
+    int32_t  status;        // 0, -ENOENT (unknown key), -EINVAL (malformed)
+    uint32_t len;
+};
+
+static_assert(sizeof(wbaesd_req_hdr) == 32, "request header layout");
+static_assert(sizeof(wbaesd_resp_hdr) == 16, "response header layout");
+
+#define BATCH_MAX_BLOCKS    4096
+#define LATENCY_TARGET_US   500
+
+
+static double get_ns() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec * 1e9 + t_val.tv_nsec;
+}
+
+static bool send_full(int fd, const void *p, size_t len) {
+    const uint8_t *x = (const uint8_t *)p;
+    ssize_t w;
+
+    for (; len; len -= w, x += w) {
+        w = send(fd, x, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) {
+            w = 0;
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool recv_full(int fd, void *p, size_t len) {
+    uint8_t *x = (uint8_t *)p;
+    ssize_t r;
+
+    for (; len; len -= r, x += r) {
+        r = recv(fd, x, len, 0);
+        if (r < 0 && errno == EINTR) {
+            r = 0;
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Log2 histogram, bucket i counts values in [2^(i-1), 2^i)
+*/
+struct histogram {
+    std::atomic<uint64_t> b[40];
+
+    histogram() { clear(); }
+
+    void clear() {
+        for (auto &x : b) {
+            x.store(0);
+        }
+    }
+    void add(uint64_t v) {
+        b[v ? 64 - __builtin_clzll(v) : 0]++;
+    }
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (auto &x : b) {
+            n += x.load();
+        }
+        return n;
+    }
+    /* upper bound of the bucket holding the p-quantile */
+    uint64_t quantile(double p) const {
+        uint64_t n = count(), acc = 0;
+        int i;
+
+        for (i = 0; i < 40 && n; i++) {
+            acc += b[i].load();
+            if (acc >= p * n) {
+                return i ? (1ULL << i) - 1 : 0;
+            }
+        }
+        return 0;
+    }
+    void print(std::string &out, const char *unit) const {
+        char line[96];
+        int  i;
+
+        for (i = 0; i < 40; i++) {
+            if (b[i].load()) {
+                snprintf(line, sizeof(line), "  < %8llu %-6s %10llu\n",
+                    (unsigned long long)(1ULL << i), unit, (unsigned long long)b[i].load());
+                out += line;
+            }
+        }
+    }
+};
+
+/*
+    Server
+     - accepted sockets are non-blocking: a response is appended to the output buffer of its
+       connection and sent as far as the socket takes it, the rest is flushed by the epoll
+       loop on EPOLLOUT, no batch worker ever waits for a client to read
+     - a connection with half of WBAESD_WBUF_MAX bytes unread or still to be answered is not
+       read from until it catches up, one leaving more than WBAESD_WBUF_MAX unread is dropped
+     - a connection stays registered until its reader closed, its queued requests are
+       answered and its output is flushed (or it failed)
+*/
+#define WBAESD_WBUF_MAX     (4 * (sizeof(wbaesd_resp_hdr) + WBAESD_MAX_LEN))
+
+struct conn {
+    int                  fd;
+    int                  efd;
+    std::vector<uint8_t> rbuf;      // epoll loop only
+    size_t               rlen;
+
+    std::mutex           wlock;     // everything below, responses of several batch workers
+    std::vector<uint8_t> wbuf;
+    size_t               woff;      // sent part of wbuf
+    size_t               inflight;  // response bytes of the requests in the batch queue
+    uint32_t             events;    // epoll interest
+    bool                 rd_open;
+    bool                 failed;
+    bool                 registered;
+
+    conn(int f, int e) : fd(f), efd(e), rbuf(sizeof(wbaesd_req_hdr) + WBAES_KEY_ID_MAX + WBAESD_MAX_LEN), rlen(0),
+                         woff(0), inflight(0), events(EPOLLIN), rd_open(true), failed(false), registered(true) {}
+    ~conn() { close(fd); }
+
+    bool done() const { return failed || (!rd_open && !inflight && wbuf.empty()); }
+};
+
+struct request {
+    std::shared_ptr<conn> c;
+    wbaesd_req_hdr        hdr;
+    char                  id[WBAES_KEY_ID_MAX];
+    const WBAES_KEY      *key;     // resolved by the batch worker
+    std::vector<uint8_t>  data;
+    double                arrival;
+    size_t                blocks;
+};
+
+struct server {
+    WBAES_KEYSTORE           *ks;
+    double                    target_ns;
+
+    std::mutex                lock;
+    std::condition_variable   cv;
+    std::deque<request *>     q;
+    size_t                    q_blocks;
+    bool                      stop;
+
+    /* adaptive batching, under lock */
+    double                    ns_per_block;     // EWMA of the batch cost
+    double                    gap_ns;           // EWMA of the inter-arrival time
+    double                    last_arrival;
+
+    std::atomic<uint64_t>     requests, blocks, batches;
+    histogram                 latency_us;
+    histogram                 batch_blocks;
+};
+
+/* under c.wlock */
+static void conn_fail(conn &c) {
+    if (!c.failed) {
+        c.failed = true;
+        c.wbuf.clear();
+        c.woff = 0;
+        shutdown(c.fd, SHUT_RDWR);      // reported to the epoll loop as EPOLLHUP
+    }
+}
+
+static void conn_flush(conn &c) {
+    ssize_t w;
+
+    while (c.woff < c.wbuf.size()) {
+        w = send(c.fd, &c.wbuf[c.woff], c.wbuf.size() - c.woff, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (w <= 0) {
+            conn_fail(c);
+            return;
+        }
+        c.woff += w;
+    }
+
+    if (c.woff == c.wbuf.size()) {
+        c.wbuf.clear();
+        c.woff = 0;
+    }
+}
+
+/*
+    EPOLLIN unless half of WBAESD_WBUF_MAX is unread or still to be answered (the client is
+    not read from until it catches up), EPOLLOUT while output is pending or once the
+    connection is done
+*/
+static void conn_watch(conn &c) {
+    struct epoll_event ev;
+    bool backlog = c.wbuf.size() - c.woff + c.inflight > WBAESD_WBUF_MAX / 2;
+
+    ev.events  = (c.rd_open && !c.failed && !backlog ? EPOLLIN : 0) | (!c.wbuf.empty() || c.done() ? EPOLLOUT : 0);
+    ev.data.fd = c.fd;
+    if (c.registered && ev.events != c.events) {
+        epoll_ctl(c.efd, EPOLL_CTL_MOD, c.fd, &ev);
+        c.events = ev.events;
+    }
+}
+
+/*
+    Queues a response, reserved: the bytes a queued request being answered counted in inflight
+*/
+static void respond(conn &c, uint32_t tag, int32_t status, const uint8_t *data, uint32_t len, size_t reserved = 0) {
+    wbaesd_resp_hdr h = { WBAESD_MAGIC, tag, status, len };
+    std::lock_guard<std::mutex> guard(c.wlock);
+    bool idle = c.wbuf.empty();
+
+    c.inflight -= reserved;
+    if (!c.failed) {
+        c.wbuf.insert(c.wbuf.end(), (const uint8_t *)&h, (const uint8_t *)(&h + 1));
+        c.wbuf.insert(c.wbuf.end(), data, data + len);
+
+        if (c.wbuf.size() - c.woff > WBAESD_WBUF_MAX) {
+            conn_fail(c);
+        }
+        else if (idle) {
+            conn_flush(c);
+        }
+    }
+    conn_watch(c);
+}
+
+static std::string stats_report(server &s) {
+    std::string out;
+    char line[160];
+
+    snprintf(line, sizeof(line), "requests %llu, blocks %llu, batches %llu, avg batch %.1f blocks, %.0f ns/block\n",
+        (unsigned long long)s.requests.load(), (unsigned long long)s.blocks.load(), (unsigned long long)s.batches.load(),
+        s.batches.load() ? (double)s.blocks.load() / s.batches.load() : 0.0, s.ns_per_block);
+    out += line;
+
+    snprintf(line, sizeof(line), "latency us (bucket bound): p50 %llu, p90 %llu, p99 %llu, p99.9 %llu\n",
+        (unsigned long long)s.latency_us.quantile(0.5), (unsigned long long)s.latency_us.quantile(0.9),
+        (unsigned long long)s.latency_us.quantile(0.99), (unsigned long long)s.latency_us.quantile(0.999));
+    out += line;
+    s.latency_us.print(out, "us");
+
+    out += "batch size\n";
+    s.batch_blocks.print(out, "blocks");
+
+    return out;
+}
+
+/*
+    Batch sizing
+     - the batch is capped so that it runs in half the latency target at the measured cost per block
+     - below the cap, the worker lingers for more requests only while the oldest one
+       still has budget left and the arrival rate says another request is due within it
+*/
+static size_t batch_cap(const server &s) {
+    double cap = s.target_ns / 2 / s.ns_per_block;
+    size_t lanes = wbaes_kernels().lanes;
+
+    return std::max(lanes, std::min((size_t)cap, (size_t)BATCH_MAX_BLOCKS));
+}
+
+static void take_batch(server &s, std::vector<request *> &batch) {
+    std::unique_lock<std::mutex> guard(s.lock);
+    size_t cap, n;
+    double budget;
+
+    s.cv.wait(guard, [&s] { return s.stop || !s.q.empty(); });
+
+    for (;;) {
+        if (s.q.empty()) {
+            return;
+        }
+        cap    = batch_cap(s);
+        budget = s.target_ns - (get_ns() - s.q.front()->arrival) - s.q_blocks * s.ns_per_block;
+        if (s.stop || s.q_blocks >= cap || budget <= s.gap_ns) {
+            break;
+        }
+        s.cv.wait_for(guard, std::chrono::nanoseconds((long long)std::min(budget, 2 * s.gap_ns)));
+    }
+
+    for (n = 0; !s.q.empty() && (n == 0 || n + s.q.front()->blocks <= cap); ) {
+        request *r = s.q.front();
+
+        s.q.pop_front();
+        s.q_blocks -= r->blocks;
+        n += r->blocks;
+        batch.push_back(r);
+    }
+}
+
+static size_t reserved(const request *r) {
+    return sizeof(wbaesd_resp_hdr) + r->hdr.len;
+}
+
+static void run_batch(server &s, std::vector<request *> &batch) {
+    std::vector<uint8_t> buf;
+    size_t i, j, k, n, off, total = 0;
+    double begin, now;
+
+    /*
+        Keys are resolved here, not on the epoll loop: loading a set reads the disk,
+        an unknown id is answered from the keystore's negative cache afterwards
+    */
+    for (i = j = 0; i < batch.size(); i++) {
+        request *r = batch[i];
+
+        if (!(r->key = wbaes_keystore_get(s.ks, r->id))) {
+            respond(*r->c, r->hdr.tag, -ENOENT, NULL, 0, reserved(r));
+            delete r;
+            continue;
+        }
+        if (!r->blocks) {
+            respond(*r->c, r->hdr.tag, 0, NULL, 0, reserved(r));
+            delete r;
+            continue;
+        }
+        batch[j++] = r;
+    }
+    batch.resize(j);
+    begin = get_ns();
+
+    /* one wbaes_encrypt_blocks() per key */
+    std::stable_sort(batch.begin(), batch.end(), [](const request *a, const request *b) { return a->key < b->key; });
+
+    for (i = 0; i < batch.size(); i = j) {
+        const WBAES_KEY *key = batch[i]->key;
+
+        for (j = i, n = 0; j < batch.size() && batch[j]->key == key; j++) {
+            n += batch[j]->blocks;
+        }
+        buf.resize(16 * n);
+
+        for (k = i, off = 0; k < j; off += 16 * batch[k]->blocks, k++) {
+            request *r = batch[k];
+
+            if (r->hdr.op == WBAESD_ECB) {
+                memcpy(&buf[off], r->data.data(), r->data.size());
+            }
+            else {
+                uint8_t ctr[16];
+                size_t  b;
+
+                memcpy(ctr, r->hdr.iv, 16);
+                for (b = 0; b < r->blocks; b++) {
+                    memcpy(&buf[off + 16*b], ctr, 16);
+                    wbaes_ctr_add(ctr, 1);
+                }
+            }
+        }
+
+        wbaes_encrypt_blocks_ext(*key->et, key->ee, buf.data(), n);
+
+        for (k = i, off = 0; k < j; off += 16 * batch[k]->blocks, k++) {
+            request *r = batch[k];
+
+            if (r->hdr.op == WBAESD_ECB) {
+                memcpy(r->data.data(), &buf[off], r->data.size());
+            }
+            else {
+                for (size_t b = 0; b < r->data.size(); b++) {
+                    r->data[b] ^= buf[off + b];
+                }
+            }
+        }
+        total += n;
+    }
+
+    now = get_ns();
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.ns_per_block = 0.8 * s.ns_per_block + 0.2 * (now - begin) / (total ? total : 1);
+    }
+
+    s.batches++;
+    s.blocks += total;
+    s.batch_blocks.add(total);
+
+    for (request *r : batch) {
+        respond(*r->c, r->hdr.tag, 0, r->data.data(), r->data.size(), reserved(r));
+        s.latency_us.add((uint64_t)((get_ns() - r->arrival) / 1e3));
+        s.requests++;
+        delete r;
+    }
+    batch.clear();
+}
+
+static void worker_main(server *s) {
+    std::vector<request *> batch;
+
+    for (;;) {
+        take_batch(*s, batch);
+        if (batch.empty()) {
+            return;
+        }
+        run_batch(*s, batch);
+    }
+}
+
+static void enqueue(server &s, request *r) {
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    if (s.last_arrival) {
+        s.gap_ns = 0.9 * s.gap_ns + 0.1 * (r->arrival - s.last_arrival);
+    }
+    s.last_arrival = r->arrival;
+
+    s.q.push_back(r);
+    s.q_blocks += r->blocks;
+    s.cv.notify_one();
+}
+
+/*
+    Parses the complete requests in the read buffer
+    @return false if the connection must be dropped (malformed header)
+*/
+static bool parse(server &s, const std::shared_ptr<conn> &c) {
+    wbaesd_req_hdr h;
+    size_t used = 0, need;
+    char   id[WBAES_KEY_ID_MAX];
+
+    while (c->rlen - used >= sizeof(h)) {
+        memcpy(&h, &c->rbuf[used], sizeof(h));
+        if (h.magic != WBAESD_MAGIC || h.len > WBAESD_MAX_LEN || h.key_len >= WBAES_KEY_ID_MAX) {
+            return false;
+        }
+        need = sizeof(h) + h.key_len + h.len;
+        if (c->rlen - used < need) {
+            break;
+        }
+
+        const uint8_t *p = &c->rbuf[used + sizeof(h)];
+        used += need;
+
+        if (h.op == WBAESD_STATS) {
+            std::string rep = stats_report(s);
+            respond(*c, h.tag, 0, (const uint8_t *)rep.data(), rep.size());
+            continue;
+        }
+
+        memcpy(id, p, h.key_len);
+        id[h.key_len] = 0;
+
+        if ((h.op != WBAESD_ECB && h.op != WBAESD_CTR) || (h.op == WBAESD_ECB && h.len % 16)) {
+            respond(*c, h.tag, -EINVAL, NULL, 0);
+            continue;
+        }
+
+        if (!wbaes_key_id_valid(id)) {
+            respond(*c, h.tag, -ENOENT, NULL, 0);
+            continue;
+        }
+
+        request *r = new request();
+        r->c       = c;
+        r->hdr     = h;
+        r->key     = NULL;
+        r->arrival = get_ns();
+        r->blocks  = (h.len + 15) / 16;
+        strcpy(r->id, id);
+
+        /* empty requests go through the queue too: the key decides between 0 and -ENOENT */
+        r->data.assign(p + h.key_len, p + h.key_len + h.len);
+        {
+            std::lock_guard<std::mutex> guard(c->wlock);
+            c->inflight += reserved(r);
+        }
+        enqueue(s, r);
+    }
+
+    memmove(&c->rbuf[0], &c->rbuf[used], c->rlen - used);
+    c->rlen -= used;
+
+    return true;
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int) {
+    stopping = 1;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int serve(const char *sock, const char *dir, unsigned workers, double target_us, const char *metrics) {
+    std::unordered_map<int, std::shared_ptr<conn>> conns;
+    std::vector<std::thread> threads;
+    struct epoll_event ev, evs[64];
+    server  s;
+    int     lfd, efd, n, i, fd;
+    ssize_t r;
+    time_t  dumped = 0;
+
+    if (!(s.ks = wbaes_keystore_open(dir, WBAES_MEM_HUGE))) {
+        fprintf(stderr, "not a keystore directory or archive: %s\n", dir);
+        return -1;
+    }
+    if ((lfd = listen_unix(sock)) < 0) {
+        perror(sock);
+        return -1;
+    }
+
+    /* requests rotate over the keys of the store, their tables are mostly out of cache */
+    wbaes_set_prefetch_distance(WBAES_PREFETCH_COLD);
+
+    s.target_ns    = target_us * 1e3;
+    s.q_blocks     = 0;
+    s.stop         = false;
+    s.ns_per_block = 1000;
+    s.gap_ns       = s.target_ns;
+    s.last_arrival = 0;
+    s.requests     = 0;
+    s.blocks       = 0;
+    s.batches      = 0;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < (int)(workers ? workers : 1); i++) {
+        threads.emplace_back(worker_main, &s);
+    }
+
+    efd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events  = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev);
+
+    fprintf(stderr, "wbaesd: %s, keystore %s, %u worker(s), target %.0f us, kernel %s\n",
+        sock, dir, workers ? workers : 1, target_us, wbaes_kernel_name(wbaes_kernels().level));
+
+    while (!stopping) {
+        n = epoll_wait(efd, evs, 64, 200);
+
+        if (metrics && time(NULL) != dumped) {
+            dumped = time(NULL);
+            if (wbaes_metrics_dump(metrics) < 0) {
+                perror(metrics);
+                metrics = NULL;
+            }
+        }
+
+        for (i = 0; i < n; i++) {
+            fd = evs[i].data.fd;
+
+            if (fd == lfd) {
+                if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+                    conns[fd]  = std::make_shared<conn>(fd, efd);
+                    ev.events  = EPOLLIN;
+                    ev.data.fd = fd;
+                    epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+
+            auto it = conns.find(fd);
+            if (it == conns.end()) {
+                continue;
+            }
+            std::shared_ptr<conn> c = it->second;
+            bool drop;
+
+            if (c->rd_open && (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                r = recv(fd, &c->rbuf[c->rlen], c->rbuf.size() - c->rlen, MSG_DONTWAIT);
+                if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR) || (r > 0 && (c->rlen += r, !parse(s, c)))) {
+                    /* queued requests are still answered, the connection lingers until they are sent */
+                    shutdown(fd, SHUT_RD);
+                    std::lock_guard<std::mutex> guard(c->wlock);
+                    c->rd_open = false;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(c->wlock);
+
+                if (evs[i].events & EPOLLOUT) {
+                    conn_flush(*c);
+                }
+                if ((drop = c->done())) {
+                    epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+                    c->registered = false;
+                }
+                else {
+                    conn_watch(*c);
+                }
+            }
+            if (drop) {
+                conns.erase(fd);
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.stop = true;
+    }
+    s.cv.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    fputs(stats_report(s).c_str(), stderr);
+    if (metrics) {
+        wbaes_metrics_dump(metrics);
+    }
+
+    conns.clear();
+    close(efd);
+    close(lfd);
+    unlink(sock);
+    wbaes_keystore_close(s.ks);
+
+    return 0;
+}
+
+/*
+    Client: closed-loop connections, every request is a CTR round trip
+    (encrypt, then decrypt the answer and compare with the input)
+*/
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int call(int fd, uint8_t op, uint32_t tag, const char *id, const uint8_t *iv, const uint8_t *in, uint32_t len, std::vector<uint8_t> &out) {
+    wbaesd_req_hdr  h;
+    wbaesd_resp_hdr rh;
+    size_t key_len = id ? strlen(id) : 0;
+
+    memset(&h, 0, sizeof(h));
+    h.magic   = WBAESD_MAGIC;
+    h.tag     = tag;
+    h.op      = op;
+    h.key_len = key_len;
+    h.len     = len;
+    if (iv) {
+        memcpy(h.iv, iv, 16);
+    }
+
+    if (!send_full(fd, &h, sizeof(h)) || !send_full(fd, id, key_len) || !send_full(fd, in, len) ||
+        !recv_full(fd, &rh, sizeof(rh)) || rh.magic != WBAESD_MAGIC || rh.tag != tag) {
+        return -EIO;
+    }
+
+    out.resize(rh.len);
+    if (!recv_full(fd, out.data(), rh.len)) {
+        return -EIO;
+    }
+
+    return rh.status;
+}
+
+struct client_result {
+    histogram latency_us;
+    uint64_t  requests;
+    uint64_t  errors;
+};
+
+static void client_main(const char *sock, const char *id, size_t requests, size_t bytes, unsigned seed, client_result *res) {
+    std::vector<uint8_t> pt(bytes), ct, back;
+    uint8_t  iv[16];
+    uint32_t tag = 0;
+    size_t   i, j;
+    double   begin;
+    int      fd = connect_unix(sock);
+
+    if (fd < 0) {
+        res->errors += requests;
+        return;
+    }
+
+    /* rand_r(): a stream per connection, reproducible from its seed */
+    for (i = 0; i < requests; i += 2) {
+        for (j = 0; j < bytes; j++) {
+            pt[j] = rand_r(&seed);
+        }
+        for (j = 0; j < 16; j++) {
+            iv[j] = rand_r(&seed);
+        }
+
+        begin = get_ns();
+        if (call(fd, WBAESD_CTR, tag++, id, iv, pt.data(), bytes, ct) != 0) {
+            res->errors++;
+            break;
+        }
+        res->latency_us.add((uint64_t)((get_ns() - begin) / 1e3));
+
+        begin = get_ns();
+        if (call(fd, WBAESD_CTR, tag++, id, iv, ct.data(), bytes, back) != 0 || back != pt) {
+            res->errors++;
+            break;
+        }
+        res->latency_us.add((uint64_t)((get_ns() - begin) / 1e3));
+        res->requests += 2;
+    }
+
+    close(fd);
+}
+
+static int client(const char *sock, const char *id, size_t requests, unsigned conns, size_t bytes) {
+    std::vector<std::thread> threads;
+    std::vector<client_result> res(conns);
+    std::vector<uint8_t> stats;
+    histogram all;
+    uint64_t  done = 0, errors = 0;
+    double    begin, elapsed;
+    unsigned  i;
+    int       fd, k;
+
+    begin = get_ns();
+    for (i = 0; i < conns; i++) {
+        res[i].requests = res[i].errors = 0;
+        threads.emplace_back(client_main, sock, id, (requests + conns - 1) / conns, bytes, 1234 + i, &res[i]);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    elapsed = (get_ns() - begin) / 1e9;
+
+    for (i = 0; i < conns; i++) {
+        done   += res[i].requests;
+        errors += res[i].errors;
+        for (k = 0; k < 40; k++) {
+            all.b[k] += res[i].latency_us.b[k].load();
+        }
+    }
+
+    puts("==================== CLIENT =====================");
+    printf("%u connection(s), %zu bytes per request\n", conns, bytes);
+    printf("requests %llu, errors %llu, %.0f req/s, %.2f MB/s\n", (unsigned long long)done, (unsigned long long)errors,
+        elapsed > 0 ? done / elapsed : 0.0, elapsed > 0 ? done * bytes / elapsed / 1e6 : 0.0);
+    printf("round trip us (bucket bound): p50 %llu, p99 %llu, p99.9 %llu\n",
+        (unsigned long long)all.quantile(0.5), (unsigned long long)all.quantile(0.99), (unsigned long long)all.quantile(0.999));
+
+    if ((fd = connect_unix(sock)) >= 0 && call(fd, WBAESD_STATS, 0, NULL, NULL, NULL, 0, stats) == 0) {
+        puts("-------------------- server ---------------------");
+        fwrite(stats.data(), 1, stats.size(), stdout);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    puts("=================================================");
+
+    return errors ? -1 : 0;
+}
+
+static void usage() {
+    puts("usage: ./wbaesd serve  -s <socket> -d <keystore dir | archive> [-w workers] [-l latency target us] [-m metrics file]");
+    puts("       ./wbaesd client -s <socket> -k <id> [-n requests] [-c connections] [-b bytes]");
+    puts("       ./wbaesd keygen -d <keystore> -k <id> <key (32 hex digits)>");
+}
+
+int main(int argc, char *argv[]) {
+    const char *sock = NULL, *dir = NULL, *id = NULL, *metrics = NULL;
+    unsigned workers = 1, conns = 4;
+    size_t   requests = 10000, bytes = 256;
+    double   target_us = LATENCY_TARGET_US;
+    uint8_t  key[16];
+    unsigned v;
+    int      opt, i;
+
+    if (argc < 2) {
+        usage();
+        return -1;
+    }
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "s:d:k:w:l:n:c:b:m:")) != -1) {
+        switch (opt) {
+        case 's': sock      = optarg; break;
+        case 'd': dir       = optarg; break;
+        case 'k': id        = optarg; break;
+        case 'w': workers   = atoi(optarg); break;
+        case 'l': target_us = atof(optarg); break;
+        case 'n': requests  = strtoull(optarg, NULL, 0); break;
+        case 'c': conns     = atoi(optarg); break;
+        case 'b': bytes     = strtoull(optarg, NULL, 0); break;
+        case 'm': metrics   = optarg; break;
+        default:  usage(); return -1;
+        }
+    }
+
+    if (!strcmp(argv[1], "serve") && sock && dir && target_us > 0) {
+        return serve(sock, dir, workers, target_us, metrics);
+    }
+    if (!strcmp(argv[1], "client") && sock && id && conns && bytes && bytes <= WBAESD_MAX_LEN) {
+        return client(sock, id, requests, conns, bytes);
+    }
+    if (!strcmp(argv[1], "keygen") && dir && id && optind < argc && strlen(argv[optind]) == 32) {
+        for (i = 0; i < 16; i++) {
+            if (sscanf(argv[optind] + 2*i, "%2x", &v) != 1) {
+                usage();
+                return -1;
+            }
+            key[i] = v;
+        }
+        if (wbaes_keystore_put(dir, id, key) != 0) {
+            fprintf(stderr, "cannot write key %s into %s: %s\n", id, dir, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    usage();
+    return -1;
+}
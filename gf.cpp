@@ -3,13 +3,19 @@
 #include "gf.h"
 
 
+static_assert(gf_tables.sbox[0x00] == 0x63 && gf_tables.sbox[0x53] == 0xed && gf_tables.sbox[0xff] == 0x16, "AES Sbox");
+static_assert(gf_tables.inv_sbox[0x63] == 0x00 && gf_tables.inv_sbox[0x16] == 0xff, "AES inverse Sbox");
+static_assert(gf_tables.mul[0x57][0x83] == 0xc1 && gf_mul_c(0x57, 0x13) == 0xfe, "FIPS-197 4.2");
+static_assert(gf_tables.tyi[0][1] == 0x02010103, "Tyi");
+static_assert(gf_tables.inv_tyi[0][1] == 0x0e0b0d09 && gf_tables.inv_tyi[1][1] == 0x090e0b0d, "inverse Tyi");
+
 void gf_print(byte gf) {
     int coef;
 
     printf("%d = %02x = ", gf, gf);
     for (int i = 7; i >= 0; i--) {
         coef = (gf >> i) & 0x01;
-        
+
         if (coef == 1) {
             std::cout << " + " << "x^" << i;
         }
@@ -23,84 +29,43 @@ byte gf_add(byte gf1, byte gf2) {
 }
 
 byte gf_xtime(byte gf) {
-    return ((gf >> 7) & 0x01 == 1) ? (gf << 1) ^ 0x1b : gf << 1;
+    return gf_xtime_c(gf);
 }
 
 byte gf_mul(byte f, byte g) {
-    byte h = 0; 
-    int coef;
-
-    for (int i = 7; i >= 0; i--) {
-        coef = (f >> i) & 0x01;     // a7, a6, a5, ... ,a0
-        h = gf_xtime(h);
-        
-        if (coef == 1) {
-            h = gf_add(h, g);
-        }
-    }
-
-    return h;
+    return gf_tables.mul[f][g];
 }
 
 byte gf_inv(byte f) {
-    byte f_inv = 1, temp = f;
+    return gf_tables.inv[f];
+}
 
-    for (int i = 0; i < 7; i++) {
-        temp = gf_mul(temp, temp);
-        f_inv = gf_mul(f_inv, temp);
-    }
+void gf_mul_vec(byte c, const byte *x, byte *y, size_t n) {
+    const byte *row = gf_tables.mul[c];
+    size_t i;
 
-    return f_inv;
+    for (i = 0; i < n; i++) {
+        y[i] = row[x[i]];
+    }
 }
 
-byte aes_affine(byte w) {
-    byte A[8][8] = {  
-        {1, 0, 0, 0, 1, 1, 1, 1},
-        {1, 1, 0, 0, 0, 1, 1, 1},
-        {1, 1, 1, 0, 0, 0, 1, 1},
-        {1, 1, 1, 1, 0, 0, 0, 1},
-        {1, 1, 1, 1, 1, 0, 0, 0},
-        {0, 1, 1, 1, 1, 1, 0, 0},
-        {0, 0, 1, 1, 1, 1, 1, 0},
-        {0, 0, 0, 1, 1, 1, 1, 1}
-    };
-    byte b_vec[8] = { 1, 1, 0, 0, 0, 1, 1, 0 };
-    byte w_vec[8], y_vec[8], y;
-
-    for (int i = 0; i < 8; i++) {
-        w_vec[i] = (w >> i) & 0x01;
-    }
+void gf_mul_add_vec(byte c, const byte *x, byte *y, size_t n) {
+    const byte *row = gf_tables.mul[c];
+    size_t i;
 
-    for (int i = 0; i < 8; i++) {
-        y_vec[i] = b_vec[i];
-        for (int j = 0; j < 8; j++) {
-            y_vec[i] ^= A[i][j] * w_vec[j];
-        }
+    for (i = 0; i < n; i++) {
+        y[i] ^= row[x[i]];
     }
+}
 
-    y = 0;
-    byte temp_bit;
-    for (int i = 0; i < 8; i++) {
-        temp_bit = y_vec[i] << i;
-        y ^= temp_bit;
-    }
-    return y;
+byte aes_affine(byte w) {
+    return aes_affine_c(w);
 }
 
 void get_aes_Sbox(byte sbox[256]) {
-    byte temp;
-
-    sbox[0] = aes_affine(0);
-    for (int i = 1; i < 256; i++) {
-        temp = gf_inv(i);
-        sbox[i] = aes_affine(temp);
-    }
+    memcpy(sbox, gf_tables.sbox, 256);
 }
 
 void get_aes_inv_Sbox(byte isbox[256]) {
-    byte Sbox[256];
-    get_aes_Sbox(Sbox);
-    for (int i = 0; i < 256; i++) {
-        isbox[Sbox[i]] = i;
-    }
+    memcpy(isbox, gf_tables.inv_sbox, 256);
 }
@@ -18,6 +18,12 @@ void aes32_inv_round(u32 state[4], u32 rk[4]);
 void aes32_encrypt(byte pt[16], u32 rk[11][4], byte ct[16]);
 void aes32_decrypt(byte ct[16], u32 rk[11][4], byte pt[16]);
 
+/*
+    AES - Oracle
+     - aes32_encrypt() on the best kernel of the CPU (AES-NI when available), see wbaes_cpu.h
+*/
+void aes_encrypt(byte pt[16], u32 rk[11][4], byte ct[16]);
+
 /*
     AES32 - Key Schedule
 */
@@ -6,6 +6,102 @@
 
 void gf_print(byte gf);
 
+/*
+  GF(2^8) Tables
+   - log / antilog over the generator 0x03, the full 256x256 product table,
+     inverses, the AES Sbox and its inverse, and the Tyi tables (MixColumns columns)
+   - inv_tyi are the InvMixColumns columns with rows 1 and 3 swapped, the order
+     the decryption tables keep the state in (see wbaes_gen_decryption_table())
+   - built by gf_build_tables() at compile time (constexpr), gf_tables lives in
+     read-only data: no runtime initialization, and its entries are constant
+     expressions in every translation unit
+*/
+struct GF_TABLES {
+    byte     exp[510];          // exp[i] = 3^i, doubled so exp[log a + log b] needs no reduction
+    byte     log[256];          // log[0] unused
+    byte     inv[256];          // inv[0] = 0
+    byte     mul[256][256];
+    byte     sbox[256];
+    byte     inv_sbox[256];
+    uint32_t tyi[4][256];
+    uint32_t inv_tyi[4][256];
+};
+
+constexpr byte gf_xtime_c(byte gf) {
+    return (byte)((gf << 1) ^ ((gf & 0x80) ? 0x1b : 0));
+}
+
+constexpr byte gf_rotl_c(byte x, int n) {
+    return (byte)((x << n) | (x >> (8 - n)));
+}
+
+constexpr byte aes_affine_c(byte w) {
+    return w ^ gf_rotl_c(w, 1) ^ gf_rotl_c(w, 2) ^ gf_rotl_c(w, 3) ^ gf_rotl_c(w, 4) ^ 0x63;
+}
+
+/* bit-serial product, for constant expressions that do not go through the tables */
+constexpr byte gf_mul_c(byte f, byte g) {
+    byte h = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        h = gf_xtime_c(h);
+        if ((f >> i) & 0x01) {
+            h ^= g;
+        }
+    }
+    return h;
+}
+
+constexpr GF_TABLES gf_build_tables() {
+    GF_TABLES t = {};
+    byte x = 1;
+
+    for (int a = 0; a < 255; a++) {
+        t.exp[a] = t.exp[a + 255] = x;
+        t.log[x] = (byte)a;
+        x ^= gf_xtime_c(x);
+    }
+
+    for (int a = 1; a < 256; a++) {
+        t.inv[a] = t.exp[255 - t.log[a]];
+        for (int b = 1; b < 256; b++) {
+            t.mul[a][b] = t.exp[t.log[a] + t.log[b]];
+        }
+    }
+
+    for (int a = 0; a < 256; a++) {
+        t.sbox[a] = aes_affine_c(t.inv[a]);
+        t.inv_sbox[t.sbox[a]] = (byte)a;
+
+        uint32_t x1 = a, x2 = t.mul[2][a], x3 = t.mul[3][a];
+
+        t.tyi[0][a] = x2 << 24 | x1 << 16 | x1 <<  8 | x3;
+        t.tyi[1][a] = x3 << 24 | x2 << 16 | x1 <<  8 | x1;
+        t.tyi[2][a] = x1 << 24 | x3 << 16 | x2 <<  8 | x1;
+        t.tyi[3][a] = x1 << 24 | x1 << 16 | x3 <<  8 | x2;
+
+        uint32_t x9 = t.mul[9][a], xb = t.mul[0xb][a], xd = t.mul[0xd][a], xe = t.mul[0xe][a];
+
+        t.inv_tyi[0][a] = xe << 24 | xb << 16 | xd <<  8 | x9;
+        t.inv_tyi[1][a] = x9 << 24 | xe << 16 | xb <<  8 | xd;
+        t.inv_tyi[2][a] = xd << 24 | x9 << 16 | xe <<  8 | xb;
+        t.inv_tyi[3][a] = xb << 24 | xd << 16 | x9 <<  8 | xe;
+    }
+
+    return t;
+}
+
+/* C++14 has no inline variables: a static member of a class template is defined once across translation units */
+template <class T = void>
+struct GF_TABLES_HOLDER {
+    static constexpr GF_TABLES tables = gf_build_tables();
+};
+
+template <class T>
+constexpr GF_TABLES GF_TABLES_HOLDER<T>::tables;
+
+static constexpr const GF_TABLES &gf_tables = GF_TABLES_HOLDER<>::tables;
+
 /*
   GF(2^8) Operations
 */
@@ -14,6 +110,13 @@ byte gf_xtime(byte gf);
 byte gf_mul(byte f, byte g);
 byte gf_inv(byte f);
 
+/*
+  Bulk operations
+   - y[i] = c * x[i], and y[i] ^= c * x[i], over one row of the product table
+*/
+void gf_mul_vec(byte c, const byte *x, byte *y, size_t n);
+void gf_mul_add_vec(byte c, const byte *x, byte *y, size_t n);
+
 /*
   AES Sbox
 */
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 
 typedef unsigned char byte;
 typedef unsigned char   u8;
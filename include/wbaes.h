@@ -3,6 +3,20 @@
 
 #include "wbaes_tables.h"
 
+/*
+    Number of blocks interleaved by the batched encryption path
+*/
+#define WBAES_BATCH_LANES   8
+
+/*
+    Software prefetch distance of the batched path, in lanes (0 = off)
+     - off by default: with one hot table the prefetches only add loads
+     - callers rotating over many keys, whose tables are mostly out of cache,
+       opt in with wbaes_set_prefetch_distance(WBAES_PREFETCH_COLD)
+*/
+#define WBAES_PREFETCH_DEFAULT  0
+#define WBAES_PREFETCH_COLD     2
+
 /**
  * @brief
  *  AES-128 encryption using a whitebox encryption table
@@ -11,4 +25,69 @@
 */
 void wbaes_encrypt(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
 
+/**
+ * @brief
+ *  wbaes_encrypt() keeping the (encoded) state after every round, for debugging mismatches
+ * @param et        Whitebox Encryption Table
+ * @param pt        Plaintext
+ * @param states    State after rounds 1-9 (states[0-8]) and the last box (states[9])
+*/
+void wbaes_encrypt_trace(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt, uint8_t (*states)[16]);
+
+/**
+ * @brief
+ *  AES-128 encryption of a single block, latency-optimized
+ *  (same result as wbaes_encrypt(), for callers that cannot batch): the lookups of a stage
+ *  are issued as vector gathers on the avx2 level and up, it is wbaes_encrypt() below
+ * @param et    Whitebox Encryption Table
+ * @param pt    Plaintext
+*/
+void wbaes_encrypt_lowlat(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
+
+/**
+ * @brief
+ *  AES-128 encryption of n consecutive blocks in place, interleaved in lanes of WBAES_BATCH_LANES
+ *  (or in vector lanes, on the kernel bound by wbaes_kernels())
+ * @param et        Whitebox Encryption Table
+ * @param blocks    Blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void wbaes_encrypt_blocks(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n);
+
+/*
+    Round-1/round-2 intermediates of the last counter block, see wbaes_encrypt_ctr_blocks()
+*/
+struct WBAES_CTR_CACHE {
+    bool     valid;             // false: nothing cached yet
+    uint8_t  in[16];            // encoded counter block the entries belong to
+    uint8_t  r1[16];            // state after round 1
+    uint32_t r2_t[16];          // round-2 T-box words
+    uint8_t  r2_x[4][16];       // round-2 first XOR level per column (a^b nibbles, then c^d)
+};
+
+/**
+ * @brief
+ *  AES-128 encryption of n consecutive counter blocks in place, reusing the round-1 columns
+ *  and round-2 words that the bytes changed since the previous block do not feed.
+ *  Same result as wbaes_encrypt_blocks(), pays off when blocks differ in their low bytes only.
+ * @param et        Whitebox Encryption Table
+ * @param cache     Cache, zero it before the first call, keep it across calls on the same table
+ * @param blocks    Encoded counter blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void wbaes_encrypt_ctr_blocks(const WBAES_ENCRYPTION_TABLE &et, WBAES_CTR_CACHE &cache, uint8_t *blocks, size_t n);
+
+/**
+ * @brief
+ *  Sets the software prefetch distance of the batched path for all threads
+ * @param d     Distance in lanes, 0 disables prefetching
+*/
+void wbaes_set_prefetch_distance(int d);
+
+/**
+ * @brief
+ *  Current software prefetch distance of the batched path
+*/
+int wbaes_get_prefetch_distance();
+
 #endif /* WBAES_H */
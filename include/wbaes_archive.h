@@ -0,0 +1,106 @@
+#ifndef WBAES_ARCHIVE_H
+#define WBAES_ARCHIVE_H
+
+#include "wbaes_keystore.h"
+
+/*
+    Table archive
+     - the table sets of many keys in one file, for mass provisioning:
+       header page, key index (sorted by id), then one entry per key
+     - an entry is a WBAES_ENCRYPTION_TABLE followed by its WBAES_EXT_ENCODING,
+       entries start on page boundaries so one of them is mapped without reading the rest
+     - every entry carries a CRC32C, the index has its own
+     - built under <file>.tmp and renamed once complete, a reader never sees a partial archive
+*/
+#define WBAES_ARCHIVE_VERSION   1
+
+struct WBAES_ARCHIVE_KEY {
+    char    id[WBAES_KEY_ID_MAX];
+    uint8_t key[16];
+};
+
+struct WBAES_ARCHIVE_STATS {
+    size_t keys;
+    size_t bytes;               // archive size
+    double seconds;
+};
+
+struct WBAES_ARCHIVE_ENTRY {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+
+    void   *map;
+    size_t  map_len;
+};
+
+struct WBAES_ARCHIVE;
+
+/**
+ * @brief
+ *  Generates the table sets of n keys into an archive, on `threads` threads;
+ *  every thread streams its table into the file (see wbaes_gen_table_file()),
+ *  so memory stays bounded whatever the number of keys
+ * @param file      Archive, replaced once complete
+ * @param keys      Key ids and AES-128 keys
+ * @param n         Number of keys
+ * @param threads   Generator threads (0 = 1)
+ * @param st        Stats (nullable)
+ * @return  0 on success, -1 with errno on failure (EINVAL: invalid or duplicate id)
+*/
+int wbaes_archive_build(const char *file, const WBAES_ARCHIVE_KEY *keys, size_t n, unsigned threads, WBAES_ARCHIVE_STATS *st);
+
+/**
+ * @brief
+ *  Opens an archive, reading its header and index only
+ * @return  Archive, NULL if the file is not an archive or its index is corrupted
+*/
+WBAES_ARCHIVE *wbaes_archive_open(const char *file);
+
+/**
+ * @brief
+ *  Closes an archive, mapped entries stay valid
+*/
+void wbaes_archive_close(WBAES_ARCHIVE *ar);
+
+/**
+ * @brief
+ *  Number of entries
+*/
+size_t wbaes_archive_count(const WBAES_ARCHIVE *ar);
+
+/**
+ * @brief
+ *  Id of an entry, entries are sorted by id
+*/
+const char *wbaes_archive_id(const WBAES_ARCHIVE *ar, size_t i);
+
+/**
+ * @brief
+ *  Looks an id up (binary search on the index)
+ * @return  Entry number, -1 if absent
+*/
+long wbaes_archive_find(const WBAES_ARCHIVE *ar, const char *id);
+
+/**
+ * @brief
+ *  Maps one entry read-only
+ * @param i     Entry number
+ * @param e     Mapping, released with wbaes_archive_unmap()
+ * @param check Verifies the CRC32C of the entry (reads it whole)
+ * @return  0 on success, -1 with errno on failure (EBADMSG: checksum mismatch)
+*/
+int wbaes_archive_map(const WBAES_ARCHIVE *ar, size_t i, WBAES_ARCHIVE_ENTRY *e, bool check);
+
+/**
+ * @brief
+ *  Releases a mapping from wbaes_archive_map()
+*/
+void wbaes_archive_unmap(WBAES_ARCHIVE_ENTRY *e);
+
+/**
+ * @brief
+ *  CRC32C (Castagnoli), crc = 0 to start
+*/
+uint32_t wbaes_crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif /* WBAES_ARCHIVE_H */
@@ -0,0 +1,94 @@
+#ifndef WBAES_CPU_H
+#define WBAES_CPU_H
+
+#include "wbaes_tables.h"
+
+/*
+    CPU feature dispatch
+     - features are detected once, on the first call, and the best kernel
+       of every dispatched function is bound for the rest of the process
+     - WBAES_KERNEL=scalar|ssse3|avx2|avx512 caps the level (for testing),
+       a level the CPU does not support falls back to the best supported one
+     - levels are cumulative, a function without a kernel of the bound level
+       uses the best lower one (e.g. the ssse3 level encrypts blocks with the scalar kernel)
+     - AES-NI and GFNI are not levels: they are used from the ssse3 level up when present
+*/
+enum WBAES_KERNEL {
+    WBAES_KERNEL_SCALAR = 0,
+    WBAES_KERNEL_SSSE3  = 1,
+    WBAES_KERNEL_AVX2   = 2,
+    WBAES_KERNEL_AVX512 = 3     // AVX-512F + AVX-512BW
+};
+
+#define WBAES_KERNEL_LEVELS     4
+
+struct WBAES_KERNELS {
+    WBAES_KERNEL level;
+    bool         aesni;         // oracle AES on AES-NI
+    bool         gfni;          // table generation on GF2P8AFFINEQB / GF2P8AFFINEINVQB
+    int          lanes;         // blocks per encrypt_blocks() step, a batch of this size fills the kernel
+
+    void (*encrypt_block)(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
+    void (*encrypt_blocks)(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n);
+    void (*encode_ext_blocks)(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n);
+    void (*aes_encrypt)(byte pt[16], u32 rk[11][4], byte ct[16]);
+
+    /*
+        Generation
+         - gf2_linear_bytes: y[i] = A * x[i], A an 8x8 matrix over GF(2) in the gf2p8affineqb
+           layout (byte 7-j of a holds the row of output bit j, bit k of a row selects input bit k)
+         - gf2_sbox_bytes:   y[i] = sbox(x[i] ^ k)
+    */
+    void (*gf2_linear_bytes)(uint64_t a, const uint8_t *x, uint8_t *y, size_t n);
+    void (*gf2_sbox_bytes)(uint8_t k, const uint8_t *x, uint8_t *y, size_t n);
+};
+
+/**
+ * @brief
+ *  Best level supported by the CPU (and the build)
+*/
+WBAES_KERNEL wbaes_cpu_level();
+
+/**
+ * @brief
+ *  Kernels bound for this process (WBAES_KERNEL applied)
+*/
+const WBAES_KERNELS &wbaes_kernels();
+
+/**
+ * @brief
+ *  Kernels of a given level, for benchmarks and cross-checks
+ * @return  Kernel set, NULL if the CPU does not support the level
+*/
+const WBAES_KERNELS *wbaes_kernels_at(WBAES_KERNEL level);
+
+/**
+ * @brief
+ *  Name of a level ("scalar", "ssse3", "avx2", "avx512")
+*/
+const char *wbaes_kernel_name(WBAES_KERNEL level);
+
+/*
+    Kernels
+     - each ISA lives in its own translation unit, built with the matching -m flags,
+       and must only be called once wbaes_cpu_level() allows it
+*/
+void wbaes_encrypt_block_scalar(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
+void wbaes_encrypt_block_avx2(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
+void wbaes_encrypt_block_avx512(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt);
+
+void wbaes_encrypt_blocks_scalar(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n);
+void wbaes_encrypt_blocks_avx2(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n);
+void wbaes_encrypt_blocks_avx512(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n);
+
+void encode_ext_blocks_scalar(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n);
+void encode_ext_blocks_ssse3(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n);
+
+void aes_encrypt_aesni(byte pt[16], u32 rk[11][4], byte ct[16]);
+
+void gf2_linear_bytes_scalar(uint64_t a, const uint8_t *x, uint8_t *y, size_t n);
+void gf2_linear_bytes_gfni(uint64_t a, const uint8_t *x, uint8_t *y, size_t n);
+void gf2_sbox_bytes_scalar(uint8_t k, const uint8_t *x, uint8_t *y, size_t n);
+void gf2_sbox_bytes_gfni(uint8_t k, const uint8_t *x, uint8_t *y, size_t n);
+
+#endif /* WBAES_CPU_H */
@@ -0,0 +1,94 @@
+#ifndef WBAES_ENGINE_H
+#define WBAES_ENGINE_H
+
+#include "wbaes_modes.h"
+#include "wbaes_mem.h"
+
+/*
+    Asynchronous encryption engine
+     - producers push jobs into a lock-free submission ring
+     - workers drain it, coalesce blocks of jobs sharing a table into batches
+       for wbaes_encrypt_blocks() and post finished jobs to a completion ring
+     - completions are polled, or waited on through an eventfd
+     - on NUMA machines every node has its own submission ring and bound
+       workers, and registered tables are replicated onto every node
+*/
+#define WBAES_ENGINE_BATCH_BLOCKS   (8 * WBAES_BATCH_LANES)
+#define WBAES_ENGINE_MAX_JOBS       32
+#define WBAES_ENGINE_MAX_TABLES     256
+
+enum WBAES_JOB_MODE {
+    WBAES_JOB_ECB   = 0,
+    WBAES_JOB_CTR   = 1,
+    WBAES_JOB_CTR32 = 2     // counter stepped with inc32 (GCM), see wbaes_ctr_add32()
+};
+
+struct WBAES_JOB {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;       // nullable on ECB, required on CTR / CTR32
+    int                           mode;     // WBAES_JOB_MODE
+
+    const uint8_t *in;
+    uint8_t       *out;                     // may alias in
+    size_t         len;                     // multiple of 16 on ECB
+    uint8_t        iv[16];                  // initial counter block on CTR / CTR32
+
+    void          *user;
+    int            status;                  // 0 on success, set on completion
+};
+
+struct WBAES_ENGINE;
+
+/**
+ * @brief
+ *  Creates an engine and starts its workers, spread over the NUMA nodes
+ * @param workers   Number of worker threads (0 = hardware concurrency)
+ * @param depth     Maximum number of jobs in flight
+*/
+WBAES_ENGINE *wbaes_engine_create(unsigned workers, size_t depth);
+
+/**
+ * @brief
+ *  Stops the workers and releases the engine, jobs in flight are finished first
+*/
+void wbaes_engine_destroy(WBAES_ENGINE *eng);
+
+/**
+ * @brief
+ *  Replicates a table onto every NUMA node, jobs referring to et are then
+ *  served from the replica local to the worker. Must not race with jobs using et.
+ * @param flags WBAES_MEM_* for the replicas
+ * @return  0 on success, -ENOSPC (table limit) or -errno from wbaes_table_replicate() on failure
+*/
+int wbaes_engine_add_table(WBAES_ENGINE *eng, const WBAES_ENCRYPTION_TABLE *et, int flags = 0);
+
+/**
+ * @brief
+ *  Submits a job to the ring of the caller's node, the job must stay valid until it is returned as a completion
+ * @return  0 on success, -EAGAIN if the engine is full, -EINVAL on a malformed job
+*/
+int wbaes_engine_submit(WBAES_ENGINE *eng, WBAES_JOB *job);
+
+/**
+ * @brief
+ *  Pops up to max completed jobs without blocking
+ * @return  Number of jobs written to done
+*/
+size_t wbaes_engine_poll(WBAES_ENGINE *eng, WBAES_JOB **done, size_t max);
+
+/**
+ * @brief
+ *  Pops up to max completed jobs, blocks until at least one is available or timeout expires
+ * @param timeout_ms    Milliseconds to wait, -1 for no limit
+ * @return  Number of jobs written to done
+*/
+size_t wbaes_engine_wait(WBAES_ENGINE *eng, WBAES_JOB **done, size_t max, int timeout_ms);
+
+/**
+ * @brief
+ *  Eventfd that becomes readable when completions are posted, for use in an event loop.
+ *  It is drained by wbaes_engine_poll() / wbaes_engine_wait().
+*/
+int wbaes_engine_eventfd(const WBAES_ENGINE *eng);
+
+#endif /* WBAES_ENGINE_H */
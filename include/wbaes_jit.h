@@ -0,0 +1,54 @@
+#ifndef WBAES_JIT_H
+#define WBAES_JIT_H
+
+#include "wbaes_tables.h"
+
+/*
+    Straight-line encryption code per table (x86-64)
+     - wbaes_jit_compile() emits wbaes_encrypt() fully unrolled for one table: the table
+       address is an immediate, every T-box, MBL and XOR-table index is a fixed displacement,
+       ShiftRows is folded into the byte loads
+     - the code is written into an anonymous mapping that is then made read + execute,
+       never writable and executable at once
+     - the table must stay at the same address, unchanged, until wbaes_jit_free()
+     - other architectures, or a system refusing executable mappings, get NULL
+*/
+struct WBAES_JIT {
+    void  (*encrypt)(uint8_t *pt);                          // one block
+    void  (*encrypt_blocks)(uint8_t *blocks, size_t n);     // n consecutive blocks
+    const WBAES_ENCRYPTION_TABLE *et;
+    void   *code;
+    size_t  size;
+};
+
+/**
+ * @brief
+ *  Compiles the encryption of a table, then checks it against wbaes_encrypt() on random blocks
+ * @param et    Whitebox Encryption Table
+ * @return  Compiled code, NULL with errno set (ENOSYS: not x86-64, EIO: check failed, or from mmap / mprotect)
+*/
+WBAES_JIT *wbaes_jit_compile(const WBAES_ENCRYPTION_TABLE &et);
+
+/**
+ * @brief
+ *  Releases compiled code
+*/
+void wbaes_jit_free(WBAES_JIT *jit);
+
+/**
+ * @brief
+ *  AES-128 encryption of one block in place, same result as wbaes_encrypt() on the compiled table
+*/
+inline void wbaes_jit_encrypt(const WBAES_JIT *jit, uint8_t *pt) {
+    jit->encrypt(pt);
+}
+
+/**
+ * @brief
+ *  AES-128 encryption of n consecutive blocks in place
+*/
+inline void wbaes_jit_encrypt_blocks(const WBAES_JIT *jit, uint8_t *blocks, size_t n) {
+    jit->encrypt_blocks(blocks, n);
+}
+
+#endif /* WBAES_JIT_H */
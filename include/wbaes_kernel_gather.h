@@ -0,0 +1,101 @@
+#ifndef WBAES_KERNEL_GATHER_H
+#define WBAES_KERNEL_GATHER_H
+
+#include <immintrin.h>
+
+#include "wbaes_cpu.h"
+
+extern uint8_t shift_map[16];
+
+/*
+    Gather batch kernel, library internal
+     - the body shared by the avx2 and avx512 kernels: ISA supplies the vector type, LANES
+       and the handful of operations used below, each kernel translation unit instantiates
+       it with its own ISA (declared in an unnamed namespace) under its own -m flags
+     - one block per 32-bit lane: lane l of s[j] holds byte j of block l
+     - every lookup of the scalar path becomes one gather across the blocks
+     - XOR tables and the last box are byte tables, the dword gather at the byte
+       offset keeps the low byte (the 3 bytes read past an entry are still inside
+       WBAES_ENCRYPTION_TABLE, last_box is followed by mbl_tables)
+*/
+template <class ISA>
+struct WBAES_GATHER_KERNEL {
+    typedef typename ISA::vec vec;
+
+    static inline vec gather_u8(const uint8_t *base, vec idx) {
+        return ISA::and_(ISA::template gather<1>(base, idx), ISA::set1(0xff));
+    }
+
+    static inline vec nibbles(vec a, vec b, __m128i sh) {
+        const vec f = ISA::set1(0xf);
+
+        return ISA::or_(ISA::slli4(ISA::and_(ISA::srl(a, sh), f)), ISA::and_(ISA::srl(b, sh), f));
+    }
+
+    static void stage(const uint32_t (*tables)[256], const uint8_t (*xor_tables)[16][16], vec *s, const uint8_t *map) {
+        const uint8_t *flat = &xor_tables[0][0][0];
+        vec w[16], x1, x2, x3, hi = ISA::set1(0);
+        int i, k;
+
+        for (i = 0; i < 16; i++) {
+            w[i] = ISA::template gather<4>(tables[i], s[map[i]]);
+        }
+
+        for (i = 0; i < 4; i++) {
+            for (k = 0; k < 8; k++) {
+                __m128i sh = _mm_cvtsi32_si128(28 - 4*k);
+
+                x1 = gather_u8(flat, ISA::add(ISA::set1((i*16 + k    )*256), nibbles(w[i*4  ], w[i*4+1], sh)));
+                x2 = gather_u8(flat, ISA::add(ISA::set1((i*16 + k + 8)*256), nibbles(w[i*4+2], w[i*4+3], sh)));
+                x3 = gather_u8(flat, ISA::add(ISA::set1((64 + i*8 + k)*256), ISA::or_(ISA::slli4(x1), x2)));
+
+                if (k & 1) {
+                    s[i*4 + k/2] = ISA::or_(hi, x3);
+                }
+                else {
+                    hi = ISA::slli4(x3);
+                }
+            }
+        }
+    }
+
+    static void encrypt(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks) {
+        static const uint8_t id_map[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+        uint32_t t[16][ISA::LANES];
+        vec      s[16];
+        int r, i, l;
+
+        for (l = 0; l < ISA::LANES; l++) {
+            for (i = 0; i < 16; i++) {
+                t[i][l] = blocks[16*l + i];
+            }
+        }
+        for (i = 0; i < 16; i++) {
+            s[i] = ISA::load(t[i]);
+        }
+
+        for (r = 0; r < 9; r++) {
+            stage(et.ty_boxes[r]  , et.r1_xor_tables[r], s, shift_map);
+            stage(et.mbl_tables[r], et.r2_xor_tables[r], s, id_map);
+        }
+
+        for (i = 0; i < 16; i++) {
+            ISA::store(t[i], gather_u8(et.last_box[i], s[shift_map[i]]));
+        }
+        for (l = 0; l < ISA::LANES; l++) {
+            for (i = 0; i < 16; i++) {
+                blocks[16*l + i] = t[i][l];
+            }
+        }
+    }
+
+    static void encrypt_blocks(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n) {
+        for (; n >= ISA::LANES; n -= ISA::LANES, blocks += 16*ISA::LANES) {
+            encrypt(et, blocks);
+        }
+
+        wbaes_encrypt_blocks_scalar(et, blocks, n);
+    }
+};
+
+#endif /* WBAES_KERNEL_GATHER_H */
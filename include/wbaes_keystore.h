@@ -0,0 +1,67 @@
+#ifndef WBAES_KEYSTORE_H
+#define WBAES_KEYSTORE_H
+
+#include "wbaes_mem.h"
+
+/*
+    Keystore
+     - a directory holding one table set per key id: <id>.tbl (WBAES_ENCRYPTION_TABLE)
+       and <id>.ext (WBAES_EXT_ENCODING), or an archive file (wbaes_archive.h)
+     - sets are loaded on first use and stay loaded until the keystore is closed,
+       an id that failed to load answers NULL without touching the disk for
+       WBAES_KEYSTORE_MISS_MS
+     - ids are 1-63 characters of [A-Za-z0-9_-], so an id never leaves the directory
+*/
+#define WBAES_KEY_ID_MAX        64
+#define WBAES_KEYSTORE_MISS_MS  1000
+#define WBAES_KEYSTORE_MISSES   4096    // ids remembered as missing, forgotten all at once past it
+
+struct WBAES_KEY {
+    char                    id[WBAES_KEY_ID_MAX];
+    WBAES_ENCRYPTION_TABLE *et;
+    WBAES_EXT_ENCODING     *ee;
+};
+
+struct WBAES_KEYSTORE;
+
+/**
+ * @brief
+ *  Opens a keystore directory or archive
+ * @param dir       Directory or archive file
+ * @param flags     WBAES_MEM_* for the loaded tables
+ * @return  Keystore, NULL if dir is neither a directory nor a valid archive
+*/
+WBAES_KEYSTORE *wbaes_keystore_open(const char *dir, int flags = 0);
+
+/**
+ * @brief
+ *  Releases the keystore and every loaded set, no WBAES_KEY may be in use
+*/
+void wbaes_keystore_close(WBAES_KEYSTORE *ks);
+
+/**
+ * @brief
+ *  Looks a key up, loading its set on first use (thread-safe, a load may take milliseconds:
+ *  not for an event loop)
+ * @return  Key, NULL on an invalid id or a missing / short set
+*/
+const WBAES_KEY *wbaes_keystore_get(WBAES_KEYSTORE *ks, const char *id);
+
+/**
+ * @brief
+ *  Generates the set of a key into a keystore directory (see wbaes_gen_table_file()),
+ *  both files 0600 and synced
+ * @param dir   Directory
+ * @param id    Key id
+ * @param key   AES-128 key
+ * @return  0 on success, -1 with errno on failure
+*/
+int wbaes_keystore_put(const char *dir, const char *id, const uint8_t *key);
+
+/**
+ * @brief
+ *  Checks a key id
+*/
+bool wbaes_key_id_valid(const char *id);
+
+#endif /* WBAES_KEYSTORE_H */
@@ -0,0 +1,67 @@
+#ifndef WBAES_MAC_H
+#define WBAES_MAC_H
+
+#include "wbaes_engine.h"
+
+/*
+    Message authentication on the batched whitebox path
+     - CMAC (RFC 4493) for interop, serial per message: wbaes_cmac_multi() interleaves
+       independent messages, one block of each per wbaes_encrypt_blocks() call
+     - PMAC (Black-Rogaway, Gray-code offsets): every block is encrypted independently,
+       E(M[i] ^ Z[i]) with Z[i] = gamma_i * L, so whole chunks of a message go
+       through the batched kernel, or through the engine workers
+     - GF(2^128) doubling is big-endian with x^128 + x^7 + x^2 + x + 1, as in CMAC
+*/
+#define WBAES_PMAC_LEVELS   64
+
+struct WBAES_MAC_KEY {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+
+    uint8_t k1[16], k2[16];                 // CMAC subkeys
+    uint8_t l[WBAES_PMAC_LEVELS][16];       // PMAC: L * x^i
+    uint8_t l_inv[16];                      // PMAC: L * x^-1
+};
+
+/**
+ * @brief
+ *  Derives the CMAC subkeys and the PMAC offsets from L = E(0^128)
+ * @param et    Whitebox Encryption Table
+ * @param ee    External Encoding Table
+*/
+void wbaes_mac_init(WBAES_MAC_KEY *k, const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee);
+
+/**
+ * @brief
+ *  AES-CMAC of one message
+ * @param tag   Tag (16 bytes)
+*/
+void wbaes_cmac(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t len, uint8_t *tag);
+
+/**
+ * @brief
+ *  AES-CMAC of n independent messages, interleaved in the batched kernel
+ * @param msgs  Messages
+ * @param lens  Lengths in bytes
+ * @param tags  Tags (16 bytes each)
+*/
+void wbaes_cmac_multi(const WBAES_MAC_KEY *k, const uint8_t *const *msgs, const size_t *lens, size_t n, uint8_t (*tags)[16]);
+
+/**
+ * @brief
+ *  PMAC of one message on the batched kernel of the calling thread
+ * @param tag   Tag (16 bytes)
+*/
+void wbaes_pmac(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t len, uint8_t *tag);
+
+/**
+ * @brief
+ *  PMAC of one message, the block encryptions are spread over the engine workers
+ *  (same tag as wbaes_pmac()); the table should be registered with wbaes_engine_add_table()
+ * @param eng   Engine
+ * @return  0 on success, -EIO if an engine job failed, the wbaes_engine_submit() error
+ *          if a job was refused (the tag is then not written)
+*/
+int wbaes_pmac_engine(const WBAES_MAC_KEY *k, WBAES_ENGINE *eng, const uint8_t *msg, size_t len, uint8_t *tag);
+
+#endif /* WBAES_MAC_H */
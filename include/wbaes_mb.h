@@ -0,0 +1,84 @@
+#ifndef WBAES_MB_H
+#define WBAES_MB_H
+
+#include "wbaes_modes.h"
+
+/*
+    Multi-buffer manager (in the style of ISA-L crypto)
+     - every job owns one lane; each step encrypts one block of every busy lane
+       in a single wbaes_encrypt_blocks() call, so many short messages share
+       a batch even when their blocks depend on each other (CBC)
+     - submit() hands out a job once it completes and keeps the rest in their lanes,
+       flush() drains partially filled lanes when the caller needs a latency bound
+     - a manager serves one table and one external encoding and is not thread-safe,
+       use one manager per thread (and per key)
+*/
+#define WBAES_MB_MAX_LANES  16
+
+enum WBAES_MB_MODE {
+    WBAES_MB_ECB     = 0,
+    WBAES_MB_CBC_ENC = 1,
+    WBAES_MB_CTR     = 2
+};
+
+enum WBAES_MB_STATUS {
+    WBAES_MB_INVALID             = -1,      // rejected: bad mode or length
+    WBAES_MB_BEING_PROCESSED     = 0,
+    WBAES_MB_COMPLETED           = 1
+};
+
+struct WBAES_MB_JOB {
+    int            mode;                    // WBAES_MB_MODE
+
+    const uint8_t *in;
+    uint8_t       *out;                     // may alias in
+    size_t         len;                     // multiple of 16 on ECB and CBC
+    uint8_t        iv[16];                  // IV on CBC, initial counter block on CTR
+
+    void          *user;
+    int            status;                  // WBAES_MB_STATUS
+};
+
+struct WBAES_MB_MGR {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+
+    int           lanes;                            // lanes in use, from the bound kernel
+    unsigned      busy;                             // lane bitmap
+    WBAES_MB_JOB *job[WBAES_MB_MAX_LANES];
+    size_t        done[WBAES_MB_MAX_LANES];         // bytes processed
+    uint8_t       chain[WBAES_MB_MAX_LANES][16];    // CBC: previous ciphertext, CTR: counter
+
+    WBAES_MB_JOB *completed[2 * WBAES_MB_MAX_LANES];    // completed, not yet returned
+    int           n_completed;
+};
+
+/**
+ * @brief
+ *  Initializes an empty manager
+ * @param et    Whitebox Encryption Table
+ * @param ee    External Encoding Table (nullable, blocks are then used as encoded)
+*/
+void wbaes_mb_mgr_init(WBAES_MB_MGR *mgr, const WBAES_ENCRYPTION_TABLE *et, const WBAES_EXT_ENCODING *ee);
+
+/**
+ * @brief
+ *  Submits a job, blocks are only processed once every lane is busy
+ * @return  A completed (or rejected) job, not necessarily the one submitted, or NULL
+*/
+WBAES_MB_JOB *wbaes_mb_submit(WBAES_MB_MGR *mgr, WBAES_MB_JOB *job);
+
+/**
+ * @brief
+ *  Processes the busy lanes until a job completes, even if lanes are empty
+ * @return  A completed job, NULL once the manager is empty
+*/
+WBAES_MB_JOB *wbaes_mb_flush(WBAES_MB_MGR *mgr);
+
+/**
+ * @brief
+ *  Number of jobs held by the manager (in lanes or completed but not returned)
+*/
+int wbaes_mb_jobs(const WBAES_MB_MGR *mgr);
+
+#endif /* WBAES_MB_H */
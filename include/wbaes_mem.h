@@ -0,0 +1,125 @@
+#ifndef WBAES_MEM_H
+#define WBAES_MEM_H
+
+#include <future>
+
+#include <sys/types.h>
+
+#include "wbaes_tables.h"
+
+/*
+    Table memory
+     - tables are mapped with mmap() so that they start on a page boundary
+       and can carry a NUMA memory policy
+     - with WBAES_MEM_HUGE, tables are packed into 2MB huge-page regions
+       (22 tables per 16MB region), backed by hugetlbfs (MAP_HUGETLB) when
+       pages are reserved, by transparent huge pages (MADV_HUGEPAGE) otherwise,
+       and by regular pages if neither is available
+*/
+#define WBAES_MEM_HUGE          0x1
+#define WBAES_MEM_POPULATE      0x2     // prefaults the table's pages, per allocation
+#define WBAES_MEM_LOCK          0x4     // keeps the table resident (mlock)
+
+/*
+    Warm-up
+     - PREFAULT faults in every page (swapped or reclaimed ones included)
+     - LOCK marks the table hot: locked in memory, never swapped or reclaimed
+     - CACHE reads every cache line, last round first, so the lines of the
+       first rounds are the most recently used ones when the first request arrives
+*/
+#define WBAES_WARM_PREFAULT     0x1
+#define WBAES_WARM_LOCK         0x2
+#define WBAES_WARM_CACHE        0x4
+#define WBAES_WARM_ALL          (WBAES_WARM_PREFAULT | WBAES_WARM_LOCK | WBAES_WARM_CACHE)
+
+struct WBAES_WARM_STATS {
+    double prefault_ms;
+    double lock_ms;
+    double cache_ms;
+    double total_ms;
+    int    lock_errno;          // 0 if locked (or not requested), errno of mlock otherwise
+};
+
+/*
+    Backing of an allocated table
+*/
+enum WBAES_MEM_BACKING {
+    WBAES_MEM_SMALL   = 0,      // 4KB pages
+    WBAES_MEM_THP     = 1,      // transparent huge pages requested
+    WBAES_MEM_HUGETLB = 2       // reserved 2MB pages
+};
+
+/**
+ * @brief
+ *  Allocates a zeroed Whitebox Encryption Table
+ * @param node  Kernel NUMA node the pages are bound to (mbind, see wbaes_numa_os_node()), -1 for first-touch
+ * @param flags WBAES_MEM_*, a failing WBAES_MEM_LOCK does not fail the allocation
+ * @return  Table, NULL with errno on failure (a failing mbind fails the allocation)
+*/
+WBAES_ENCRYPTION_TABLE *wbaes_table_alloc(int node, int flags = 0);
+
+/**
+ * @brief
+ *  Releases a table from wbaes_table_alloc()
+*/
+void wbaes_table_free(WBAES_ENCRYPTION_TABLE *et);
+
+/**
+ * @brief
+ *  Allocates a table and reads it from a file written by WBAES_ENCRYPTION_TABLE::write()
+ * @return  Table, NULL on failure or short file
+*/
+WBAES_ENCRYPTION_TABLE *wbaes_table_load(const char *file, int node, int flags = 0);
+
+/**
+ * @brief
+ *  Generates a table straight into a file (read back with wbaes_table_load()),
+ *  one round at a time: each round is written back and released from memory once done,
+ *  peak memory stays far below a whole table
+ * @param file      Output file, created or truncated
+ * @param ee        Context of External Encoding Table
+ * @param roundkeys AES-128 Round keys for encryption
+ * @return  0 on success, -1 with errno on failure
+*/
+int wbaes_gen_table_file(const char *file, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys);
+
+/**
+ * @brief
+ *  wbaes_gen_table_file() into a region of an open file, which must already be large enough
+ * @param fd        File, opened read-write
+ * @param offset    Offset of the table, a multiple of the page size
+ * @return  0 on success, -1 with errno on failure
+*/
+int wbaes_gen_table_fd(int fd, off_t offset, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys);
+
+/**
+ * @brief
+ *  Reports how a table from wbaes_table_alloc() is backed
+*/
+WBAES_MEM_BACKING wbaes_table_backing(const WBAES_ENCRYPTION_TABLE *et);
+
+/**
+ * @brief
+ *  Warms a table before its first request
+ * @param et    Whitebox Encryption Table
+ * @param flags WBAES_WARM_*
+ * @param st    Time spent per step (nullable)
+ * @return  0 on success, -1 if a requested step failed (see st)
+*/
+int wbaes_table_warm(const WBAES_ENCRYPTION_TABLE *et, int flags, WBAES_WARM_STATS *st);
+
+/**
+ * @brief
+ *  Runs wbaes_table_warm() on a background thread, the table must outlive it
+ * @return  Future holding the stats
+*/
+std::future<WBAES_WARM_STATS> wbaes_table_warm_async(const WBAES_ENCRYPTION_TABLE *et, int flags);
+
+/**
+ * @brief
+ *  Marks a table hot (mlock) or releases it to the kernel's normal reclaim (munlock)
+ * @return  0 on success, -1 with errno on failure (e.g. RLIMIT_MEMLOCK)
+*/
+int wbaes_table_set_hot(const WBAES_ENCRYPTION_TABLE *et, bool hot);
+
+#endif /* WBAES_MEM_H */
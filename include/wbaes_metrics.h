@@ -0,0 +1,210 @@
+#ifndef WBAES_METRICS_H
+#define WBAES_METRICS_H
+
+#include <atomic>
+#include <cstdio>
+
+#include <time.h>
+
+#include "wbaes_cpu.h"
+
+/*
+    Library metrics
+     - every thread counts into its own slot (calls, blocks and bytes per entry point, calls and
+       blocks per kernel level) with plain relaxed stores, no lock and no shared cache line;
+       a snapshot sums the slots, a slot outlives its thread and is reused by the next one
+     - latencies go into log-linear histograms (HDR-style, 8 sub-buckets per power of two,
+       under 12.5% error from 1 ns to 2^40 ns); single-block calls are timed one in
+       WBAES_METRICS_SAMPLE, calls of at least WBAES_METRICS_SAMPLE blocks, table loads and archive
+       maps always (loads and maps count only once they succeeded)
+     - a call made from another entry point counts in both (wbaes_encrypt_blocks_ext() shows
+       under wbaes_encrypt_blocks() too), the kernel series count every block once
+     - WBAES_METRICS=0 at compile time (make METRICS=0) removes the instrumentation,
+       snapshots are then all zero
+*/
+#ifndef WBAES_METRICS
+#define WBAES_METRICS           1
+#endif
+
+#define WBAES_METRICS_SAMPLE    16
+#define WBAES_HIST_SUB_BITS     3
+#define WBAES_HIST_MAX_EXP      40
+#define WBAES_HIST_BUCKETS      ((WBAES_HIST_MAX_EXP - WBAES_HIST_SUB_BITS + 2) << WBAES_HIST_SUB_BITS)
+
+enum WBAES_METRIC_API {
+    WBAES_API_ENCRYPT        = 0,   // wbaes_encrypt()
+    WBAES_API_ENCRYPT_LOWLAT = 1,   // wbaes_encrypt_lowlat()
+    WBAES_API_ENCRYPT_BLOCKS = 2,   // wbaes_encrypt_blocks()
+    WBAES_API_BLOCKS_EXT     = 3,   // wbaes_encrypt_blocks_ext()
+    WBAES_API_CTR_BLOCKS     = 4,   // wbaes_encrypt_ctr_blocks()
+    WBAES_API_TABLE_LOAD     = 5,   // wbaes_table_load()
+    WBAES_API_ARCHIVE_MAP    = 6,   // wbaes_archive_map()
+    WBAES_METRIC_APIS        = 7
+};
+
+struct WBAES_HISTOGRAM {
+    uint64_t count[WBAES_HIST_BUCKETS];
+    uint64_t samples;
+    uint64_t sum_ns;
+};
+
+struct WBAES_METRICS_SNAPSHOT {
+    uint64_t        calls[WBAES_METRIC_APIS];
+    uint64_t        blocks[WBAES_METRIC_APIS];
+    uint64_t        bytes[WBAES_METRIC_APIS];
+    uint64_t        kernel_calls[WBAES_KERNEL_LEVELS];
+    uint64_t        kernel_blocks[WBAES_KERNEL_LEVELS];
+    WBAES_HISTOGRAM latency[WBAES_METRIC_APIS];
+    unsigned        threads;        // slots ever attached
+};
+
+/**
+ * @brief
+ *  Sums the counters of every thread, without stopping them: a snapshot taken during calls
+ *  may miss their last increments, never tear a counter
+*/
+void wbaes_metrics_snapshot(WBAES_METRICS_SNAPSHOT *s);
+
+/**
+ * @brief
+ *  Latency at quantile q (0..1), the upper bound of the bucket holding it
+ * @return  ns, 0 for an empty histogram
+*/
+uint64_t wbaes_hist_quantile(const WBAES_HISTOGRAM &h, double q);
+
+/**
+ * @brief
+ *  Upper bound (exclusive) of a histogram bucket, in ns
+*/
+uint64_t wbaes_hist_bucket_ns(int bucket);
+
+/**
+ * @brief
+ *  Name of an entry point in the exported labels ("encrypt", "encrypt_blocks", "table_load", ...)
+*/
+const char *wbaes_metric_api_name(WBAES_METRIC_API api);
+
+/**
+ * @brief
+ *  Writes a snapshot in the Prometheus text exposition format
+ * @return  0 on success, -1 on a write error
+*/
+int wbaes_metrics_write(FILE *f);
+
+/**
+ * @brief
+ *  wbaes_metrics_write() into a file, written aside and renamed over it
+ *  (fit for the node_exporter textfile collector)
+ * @return  0 on success, -1 with errno on failure
+*/
+int wbaes_metrics_dump(const char *file);
+
+/*
+    Instrumentation, library internal
+     - WBAES_METRIC(api, blocks, bytes) counts the enclosing call and times it if sampled,
+       WBAES_METRIC_KERNEL(level, blocks) counts a kernel call
+     - an entry point counting its successes only takes WBAES_METRIC_START(t) on entry and
+       WBAES_METRIC_DONE(api, blocks, bytes, t) once it has succeeded (always timed)
+*/
+#if WBAES_METRICS
+
+struct WBAES_METRICS_SLOT {
+    std::atomic<uint64_t> calls[WBAES_METRIC_APIS];
+    std::atomic<uint64_t> blocks[WBAES_METRIC_APIS];
+    std::atomic<uint64_t> bytes[WBAES_METRIC_APIS];
+    std::atomic<uint64_t> kernel_calls[WBAES_KERNEL_LEVELS];
+    std::atomic<uint64_t> kernel_blocks[WBAES_KERNEL_LEVELS];
+    std::atomic<uint64_t> hist[WBAES_METRIC_APIS][WBAES_HIST_BUCKETS];
+    std::atomic<uint64_t> hist_sum[WBAES_METRIC_APIS];
+    unsigned              tick;     // sampling, owner only
+    std::atomic<bool>     in_use;
+    WBAES_METRICS_SLOT   *next;
+};
+
+extern thread_local WBAES_METRICS_SLOT *wbaes_metrics_tls;
+
+WBAES_METRICS_SLOT *wbaes_metrics_attach();
+
+static inline WBAES_METRICS_SLOT *wbaes_metrics_slot() {
+    WBAES_METRICS_SLOT *s = wbaes_metrics_tls;
+    return s ? s : wbaes_metrics_attach();
+}
+
+/* single writer: load + store, no locked read-modify-write */
+static inline void wbaes_metrics_add(std::atomic<uint64_t> &c, uint64_t v) {
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+static inline int wbaes_hist_bucket(uint64_t ns) {
+    int e;
+
+    if (ns < (1U << WBAES_HIST_SUB_BITS)) {
+        return (int)ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    if (e > WBAES_HIST_MAX_EXP) {
+        return WBAES_HIST_BUCKETS - 1;
+    }
+    return ((e - WBAES_HIST_SUB_BITS + 1) << WBAES_HIST_SUB_BITS) |
+           (int)((ns >> (e - WBAES_HIST_SUB_BITS)) & ((1U << WBAES_HIST_SUB_BITS) - 1));
+}
+
+static inline uint64_t wbaes_metrics_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+struct WBAES_METRIC_SCOPE {
+    WBAES_METRICS_SLOT *slot;
+    WBAES_METRIC_API    api;
+    uint64_t            start;
+
+    WBAES_METRIC_SCOPE(WBAES_METRIC_API a, uint64_t blocks, uint64_t bytes) : slot(wbaes_metrics_slot()), api(a), start(0) {
+        wbaes_metrics_add(slot->calls[api], 1);
+        wbaes_metrics_add(slot->blocks[api], blocks);
+        wbaes_metrics_add(slot->bytes[api], bytes);
+        if (blocks >= WBAES_METRICS_SAMPLE || !blocks || ++slot->tick % WBAES_METRICS_SAMPLE == 0) {
+            start = wbaes_metrics_ns();
+        }
+    }
+    ~WBAES_METRIC_SCOPE() {
+        if (start) {
+            uint64_t ns = wbaes_metrics_ns() - start;
+
+            wbaes_metrics_add(slot->hist[api][wbaes_hist_bucket(ns)], 1);
+            wbaes_metrics_add(slot->hist_sum[api], ns);
+        }
+    }
+};
+
+static inline void wbaes_metrics_done(WBAES_METRIC_API api, uint64_t blocks, uint64_t bytes, uint64_t start) {
+    WBAES_METRICS_SLOT *s  = wbaes_metrics_slot();
+    uint64_t            ns = wbaes_metrics_ns() - start;
+
+    wbaes_metrics_add(s->calls[api], 1);
+    wbaes_metrics_add(s->blocks[api], blocks);
+    wbaes_metrics_add(s->bytes[api], bytes);
+    wbaes_metrics_add(s->hist[api][wbaes_hist_bucket(ns)], 1);
+    wbaes_metrics_add(s->hist_sum[api], ns);
+}
+
+#define WBAES_METRIC(api, blocks, bytes)    WBAES_METRIC_SCOPE wbaes_metric_scope_(api, blocks, bytes)
+#define WBAES_METRIC_KERNEL(level, blocks)  do { \
+        WBAES_METRICS_SLOT *s_ = wbaes_metrics_slot(); \
+        wbaes_metrics_add(s_->kernel_calls[level], 1); \
+        wbaes_metrics_add(s_->kernel_blocks[level], blocks); \
+    } while (0)
+#define WBAES_METRIC_START(t)               uint64_t t = wbaes_metrics_ns()
+#define WBAES_METRIC_DONE(api, blocks, bytes, t)    wbaes_metrics_done(api, blocks, bytes, t)
+
+#else
+
+#define WBAES_METRIC(api, blocks, bytes)    do {} while (0)
+#define WBAES_METRIC_KERNEL(level, blocks)  do {} while (0)
+#define WBAES_METRIC_START(t)               do {} while (0)
+#define WBAES_METRIC_DONE(api, blocks, bytes, t)    do {} while (0)
+
+#endif /* WBAES_METRICS */
+
+#endif /* WBAES_METRICS_H */
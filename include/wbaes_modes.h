@@ -0,0 +1,154 @@
+#ifndef WBAES_MODES_H
+#define WBAES_MODES_H
+
+#include "wbaes.h"
+
+/*
+    Modes of operation on top of the batched whitebox path
+
+     The external encoding is applied around every block:
+      block -> ExtF -> wbaes_encrypt_blocks() -> ExtG -> E_k(block)
+     if ee is NULL, blocks are assumed to be encoded by the caller already.
+*/
+
+/**
+ * @brief
+ *  Encrypts n blocks in place and removes the external encodings
+ * @param et        Whitebox Encryption Table
+ * @param ee        External Encoding Table (nullable)
+ * @param blocks    Blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void wbaes_encrypt_blocks_ext(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *blocks, size_t n);
+
+/**
+ * @brief
+ *  ECB encryption, in and out may alias
+ * @param et    Whitebox Encryption Table
+ * @param ee    External Encoding Table (nullable)
+ * @param in    Input (16 * n bytes)
+ * @param out   Output (16 * n bytes)
+ * @param n     Number of blocks
+*/
+void wbaes_ecb_encrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, const uint8_t *in, uint8_t *out, size_t n);
+
+/**
+ * @brief
+ *  Decrypts n blocks in place on a decryption table (wbaes_gen_decryption_table()),
+ *  reordering them around the table and removing the external encodings
+ * @param dt        Whitebox Decryption Table
+ * @param ee        External Encoding Table of dt (nullable: encoded in the table order by the caller)
+ * @param blocks    Blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void wbaes_decrypt_blocks_ext(const WBAES_ENCRYPTION_TABLE &dt, const WBAES_EXT_ENCODING *ee, uint8_t *blocks, size_t n);
+
+/**
+ * @brief
+ *  ECB decryption, in and out may alias
+ * @param dt    Whitebox Decryption Table
+ * @param ee    External Encoding Table of dt (nullable)
+ * @param in    Input (16 * n bytes)
+ * @param out   Output (16 * n bytes)
+ * @param n     Number of blocks
+*/
+void wbaes_ecb_decrypt(const WBAES_ENCRYPTION_TABLE &dt, const WBAES_EXT_ENCODING *ee, const uint8_t *in, uint8_t *out, size_t n);
+
+/**
+ * @brief
+ *  CTR encryption/decryption with a 128-bit big-endian counter, in and out may alias
+ * @param et    Whitebox Encryption Table
+ * @param ee    External Encoding Table
+ * @param ctr   Counter block, advanced by the number of blocks consumed
+ * @param in    Input
+ * @param out   Output
+ * @param len   Length in bytes
+*/
+void wbaes_ctr_xcrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len);
+
+/**
+ * @brief
+ *  wbaes_ctr_xcrypt() stepping the counter with inc32 (GCM): the low 32 bits wrap,
+ *  the first 12 bytes never change
+*/
+void wbaes_ctr32_xcrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len);
+
+/**
+ * @brief
+ *  Adds n to a 128-bit big-endian counter block
+ * @param ctr   Counter block
+ * @param n     Increment
+*/
+void wbaes_ctr_add(uint8_t *ctr, uint64_t n);
+
+/**
+ * @brief
+ *  Adds n modulo 2^32 to the last 4 bytes (big-endian) of a counter block, inc32 of SP 800-38D
+*/
+void wbaes_ctr_add32(uint8_t *ctr, uint64_t n);
+
+/*
+    GCM (NIST SP 800-38D)
+     - the counter part is wbaes_ctr32_xcrypt() from inc32(J0), GHASH uses 4-bit tables (Shoup);
+       the counter steps with inc32, not the 128-bit increment: with an IV other than 96 bits
+       J0 = GHASH(IV) and its low word can wrap after a few blocks
+     - calls may split the data freely, the hash keeps the partial block;
+       the counter part needs multiples of 16 on every call but the last one
+     - callers that run the counter part elsewhere (e.g. on the engine, WBAES_JOB_CTR32) feed the
+       ciphertext to wbaes_gcm_ghash(), start their counter at ctr and step it with wbaes_ctr_add32()
+*/
+struct WBAES_GCM {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+
+    uint64_t hh[16], hl[16];        // multiples of H
+    uint8_t  j0[16];
+    uint8_t  ctr[16];               // next counter block
+    uint8_t  x[16];                 // GHASH accumulator
+    uint8_t  part[16];              // partial block not hashed yet
+    size_t   n_part;
+    uint64_t aad_len, ct_len;       // bytes
+};
+
+/**
+ * @brief
+ *  Starts a GCM message
+ * @param et        Whitebox Encryption Table
+ * @param ee        External Encoding Table
+ * @param iv        IV (12 bytes recommended)
+ * @param iv_len    Length of iv in bytes
+*/
+void wbaes_gcm_init(WBAES_GCM *g, const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, const uint8_t *iv, size_t iv_len);
+
+/**
+ * @brief
+ *  Hashes additional authenticated data, all of it before the first ciphertext
+*/
+void wbaes_gcm_aad(WBAES_GCM *g, const uint8_t *aad, size_t len);
+
+/**
+ * @brief
+ *  Hashes ciphertext only (counter part run by the caller)
+*/
+void wbaes_gcm_ghash(WBAES_GCM *g, const uint8_t *ct, size_t len);
+
+/**
+ * @brief
+ *  Encrypts and hashes, in and out may alias
+*/
+void wbaes_gcm_encrypt(WBAES_GCM *g, const uint8_t *in, uint8_t *out, size_t len);
+
+/**
+ * @brief
+ *  Hashes and decrypts, in and out may alias
+*/
+void wbaes_gcm_decrypt(WBAES_GCM *g, const uint8_t *in, uint8_t *out, size_t len);
+
+/**
+ * @brief
+ *  Finishes the message
+ * @param tag   Authentication tag (16 bytes)
+*/
+void wbaes_gcm_tag(WBAES_GCM *g, uint8_t *tag);
+
+#endif /* WBAES_MODES_H */
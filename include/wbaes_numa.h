@@ -0,0 +1,89 @@
+#ifndef WBAES_NUMA_H
+#define WBAES_NUMA_H
+
+#include "wbaes_mem.h"
+
+/*
+    NUMA topology and table replication
+     - topology is read once from /sys/devices/system/node, a machine
+       without it is a single node holding every CPU
+     - nodes are the kernel nodes having both CPUs and memory, numbered 0 .. n-1 (sparse
+       or offline kernel ids leave no gap), the CPUs of a node without memory belong
+       to the nearest node with memory
+     - WBAES_NUMA_NODES=<n> splits the CPUs into n emulated nodes,
+       which exercises the routing on single-node machines
+       (emulated nodes rely on first-touch placement, no mbind)
+*/
+#define WBAES_MAX_NODES     64
+
+struct WBAES_TABLE_REPLICAS {
+    int                     nodes;
+    WBAES_ENCRYPTION_TABLE *node[WBAES_MAX_NODES];
+};
+
+/**
+ * @brief
+ *  Number of NUMA nodes (at least 1)
+*/
+int wbaes_numa_nodes();
+
+/**
+ * @brief
+ *  Node owning a CPU, 0 if unknown
+*/
+int wbaes_numa_node_of_cpu(int cpu);
+
+/**
+ * @brief
+ *  Node of the CPU the calling thread runs on
+*/
+int wbaes_numa_current_node();
+
+/**
+ * @brief
+ *  Lists the CPUs of a node
+ * @return  Number of CPUs written to cpus
+*/
+size_t wbaes_numa_cpus(int node, int *cpus, size_t max);
+
+/**
+ * @brief
+ *  Kernel id of a node, for wbaes_table_alloc() (mbind)
+ * @return  Kernel node id, -1 on an emulated node or an invalid one
+*/
+int wbaes_numa_os_node(int node);
+
+/**
+ * @brief
+ *  Restricts the calling thread to the CPUs of a node
+ * @return  0 on success, -1 with errno on failure (EINVAL, or from sched_setaffinity)
+*/
+int wbaes_numa_bind_thread(int node);
+
+/**
+ * @brief
+ *  Copies a table onto every node. Each copy is made by a thread bound to
+ *  its node, so pages are local both with mbind and with first-touch.
+ * @param src   Source table
+ * @param rep   Replicas, one per node
+ * @param flags WBAES_MEM_* for the replicas
+ * @return  0 on success, -1 with errno on failure (thread binding, mbind or allocation),
+ *          no replica is left allocated
+*/
+int wbaes_table_replicate(const WBAES_ENCRYPTION_TABLE &src, WBAES_TABLE_REPLICAS &rep, int flags = 0);
+
+/**
+ * @brief
+ *  Releases the replicas
+*/
+void wbaes_table_replicas_free(WBAES_TABLE_REPLICAS &rep);
+
+/**
+ * @brief
+ *  Replica on a node
+*/
+inline const WBAES_ENCRYPTION_TABLE &wbaes_table_local(const WBAES_TABLE_REPLICAS &rep, int node) {
+    return *rep.node[(node >= 0 && node < rep.nodes) ? node : 0];
+}
+
+#endif /* WBAES_NUMA_H */
@@ -0,0 +1,57 @@
+#ifndef WBAES_POOL_H
+#define WBAES_POOL_H
+
+#include "wbaes_tables.h"
+
+/*
+    Pool of key-independent generation material
+     - background threads keep up to `size` WBAES_GEN_MATERIAL entries ready,
+       onboarding a key then only runs the key stage (wbaes_gen_keyed_table())
+     - every entry is handed out once, and regenerated in place once it is given back
+*/
+struct WBAES_GEN_POOL;
+
+/**
+ * @brief
+ *  Creates a pool and starts filling it
+ * @param size      Number of entries kept ready
+ * @param threads   Background generator threads (0 = 1)
+*/
+WBAES_GEN_POOL *wbaes_gen_pool_create(size_t size, unsigned threads);
+
+/**
+ * @brief
+ *  Stops the generators and releases the pool, entries still taken must have been given back
+*/
+void wbaes_gen_pool_destroy(WBAES_GEN_POOL *pool);
+
+/**
+ * @brief
+ *  Takes a ready entry, blocks until one is available
+*/
+WBAES_GEN_MATERIAL *wbaes_gen_pool_take(WBAES_GEN_POOL *pool);
+
+/**
+ * @brief
+ *  Gives an entry back, it is wiped and regenerated for another key
+*/
+void wbaes_gen_pool_give_back(WBAES_GEN_POOL *pool, WBAES_GEN_MATERIAL *m);
+
+/**
+ * @brief
+ *  Number of entries ready to be taken
+*/
+size_t wbaes_gen_pool_ready(WBAES_GEN_POOL *pool);
+
+/**
+ * @brief
+ *  wbaes_gen_encryption_table() on an entry of the pool
+ * @param pool      Pool
+ * @param et        Context of WBAES Encryption Table
+ * @param ee        Context of External Encoding Table
+ * @param ie        Context of Internal Encoding Table (nullable)
+ * @param roundkeys AES-128 Round keys for encryption
+*/
+void wbaes_gen_encryption_table_pooled(WBAES_GEN_POOL *pool, WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING *ie, uint32_t *roundkeys);
+
+#endif /* WBAES_POOL_H */
@@ -0,0 +1,112 @@
+#ifndef WBAES_RING_H
+#define WBAES_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Bounded lock-free MPMC ring (D. Vyukov)
+     - every cell carries a sequence number, producers and consumers
+       claim a slot with a single CAS on their own cursor
+     - capacity is rounded up to a power of two
+*/
+template <typename T>
+class WBAES_RING {
+public:
+    explicit WBAES_RING(size_t capacity) {
+        size_t i;
+
+        for (mask = 1; mask < capacity; mask <<= 1);
+        cells = new cell[mask];
+        for (i = 0; i < mask; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        mask -= 1;
+
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+    ~WBAES_RING() { delete[] cells; }
+
+    WBAES_RING(const WBAES_RING &) = delete;
+    WBAES_RING &operator=(const WBAES_RING &) = delete;
+
+    inline size_t capacity() const { return mask + 1; }
+
+    inline bool push(const T &v) {
+        cell *c;
+        size_t pos = tail.load(std::memory_order_relaxed);
+
+        for (;;) {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (dif < 0) {
+                return false;       // full
+            }
+            else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        c->data = v;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool pop(T &v) {
+        cell *c;
+        size_t pos = head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (dif < 0) {
+                return false;       // empty
+            }
+            else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        v = c->data;
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T                   data;
+    };
+
+    cell   *cells;
+    size_t  mask;
+
+    /* keeps both cursors on their own cache line */
+    char                pad0[64];
+    std::atomic<size_t> head;
+    char                pad1[64];
+    std::atomic<size_t> tail;
+    char                pad2[64];
+};
+
+#endif /* WBAES_RING_H */
@@ -60,6 +60,17 @@ struct WBAES_EXT_ENCODING {
     */
     uint8_t     ext_g[16][2][16];
     uint8_t inv_ext_g[16][2][16];
+
+    inline bool read(const char* file) {
+        std::ifstream in(file, std::ios::in | std::ios::binary);
+
+        return in.is_open() && in.read((char *)this, sizeof(*this));
+    }
+    inline bool write(const char* file) const {
+        std::ofstream out(file, std::ios::out | std::ios::binary);
+
+        return out.is_open() && out.write((char *)this, sizeof(*this));
+    }
 };
 
 /*
@@ -108,13 +119,41 @@ struct WBAES_INT_ENCODING {
     // uint8_t   inv_int_outo[15][32][16];
 };
 
+/*
+    Key-independent generation material
+     - the encodings, the mixing bijections and every table that does not
+       depend on the key (XOR-tables, MBL-tables)
+     - the key stage only builds the T-boxes and encodes them with this material,
+       so it can be prepared ahead of time (see wbaes_pool.h)
+     - single use: the same material must never serve two keys
+*/
+struct WBAES_GEN_MATERIAL {
+    WBAES_EXT_ENCODING ee;
+    WBAES_INT_ENCODING ie;
+
+    uint32_t                mb[9][4][4][256];   // MB per column, byte-sliced: MB * x = XOR of mb[b][byte b of x]
+    uint8_t              inv_l[9][16][256];     // L^-1
+    uint32_t        mbl_tables[9][16][256];
+    uint8_t      r1_xor_tables[9][96][16][16];
+    uint8_t      r2_xor_tables[9][96][16][16];
+};
+
 /**
  * @brief
  *  Applies external random encoding before or after performing white box encryption.
  * @param f     External Encoding Table
  * @param x     Input
 */
-void encode_ext_x(uint8_t (*f)[2][16], uint8_t *x);
+void encode_ext_x(const uint8_t (*f)[2][16], uint8_t *x);
+
+/**
+ * @brief
+ *  Applies an external encoding to n consecutive blocks, on the kernel bound by wbaes_kernels()
+ * @param f         External Encoding Table
+ * @param blocks    Blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void encode_ext_blocks(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n);
 
 /**
  * @brief
@@ -122,8 +161,51 @@ void encode_ext_x(uint8_t (*f)[2][16], uint8_t *x);
  * @param inv_f     External Encoding Table
  * @param x         Input
 */
-void decode_ext_x(uint8_t (*inv_f)[2][16], uint8_t *x);
+void decode_ext_x(const uint8_t (*inv_f)[2][16], uint8_t *x);
+
+
+/*
+    Generation statistics
+     - time of every phase and the number of timed sections, per thread, always collected
+     - the round-at-a-time generator reports its steps under the same phases
+     - allocs counts the heap blocks the generator itself asks for: material and
+       round buffers, and one per NTL matrix (NTL's internal allocations are not seen)
+*/
+enum WBAES_GEN_PHASE {
+    WBAES_GEN_ENCODING = 0,     // gen_nonlinear_encoding(), random nibble encodings
+    WBAES_GEN_MB       = 1,     // MB / MB^-1 and the input of the MBL-tables
+    WBAES_GEN_L        = 2,     // L / L^-1 and L on the MBL-tables
+    WBAES_GEN_XOR      = 3,     // XOR-tables
+    WBAES_GEN_T_BOXES  = 4,     // T-boxes (the Tyi tables are built at compile time)
+    WBAES_GEN_TYI      = 5,     // composite_t_tyi()
+    WBAES_GEN_APPLY_MB = 6,     // MB on the ty-boxes
+    WBAES_GEN_REENCODE = 7,     // input / output encodings of the ty-boxes and the last box
+    WBAES_GEN_COPY     = 8      // key-independent tables copied into the table
+};
+
+#define WBAES_GEN_PHASES    9
+
+struct WBAES_GEN_STATS {
+    uint64_t ns[WBAES_GEN_PHASES];
+    uint64_t calls[WBAES_GEN_PHASES];   // timed sections
+    uint64_t tables;            // tables completed
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+};
 
+/**
+ * @brief
+ *  Generation statistics of the calling thread
+ * @param st    Statistics
+ * @param reset Clears the counters once read
+*/
+void wbaes_gen_stats(WBAES_GEN_STATS *st, bool reset);
+
+/**
+ * @brief
+ *  Name of a phase ("encoding", "mb", ...)
+*/
+const char *wbaes_gen_phase_name(int phase);
 
 /**
  * @brief
@@ -135,4 +217,56 @@ void decode_ext_x(uint8_t (*inv_f)[2][16], uint8_t *x);
 */
 void wbaes_gen_encryption_table(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys);
 
+/**
+ * @brief
+ *  Generates A Whitebox Decryption Table: the equivalent inverse cipher in the layout of
+ *  WBAES_ENCRYPTION_TABLE, evaluated by wbaes_encrypt() and the batched kernels.
+ *  Blocks go in and come out in the order of wbaes_dec_order(), external encodings
+ *  apply to the reordered block (see wbaes_decrypt_blocks_ext()).
+ * @param dt        Context of WBAES Decryption Table
+ * @param ee        Context of External Encoding Table
+ * @param ie        Context of Internal Encoding Table
+ * @param roundkeys AES-128 Round keys for encryption (aes32_enc_keyschedule())
+*/
+void wbaes_gen_decryption_table(WBAES_ENCRYPTION_TABLE &dt, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys);
+
+/**
+ * @brief
+ *  Swaps rows 1 and 3 of n blocks in place (its own inverse): in that order InvShiftRows
+ *  is ShiftRows, which lets decryption tables run on the encryption evaluator
+ * @param blocks    Blocks (16 * n bytes)
+ * @param n         Number of blocks
+*/
+void wbaes_dec_order(uint8_t *blocks, size_t n);
+
+/**
+ * @brief
+ *  Key-independent stage of wbaes_gen_encryption_table()
+ * @param m         Material to fill
+*/
+void wbaes_gen_material(WBAES_GEN_MATERIAL &m);
+
+/**
+ * @brief
+ *  Key-dependent stage of wbaes_gen_encryption_table(), the encodings of the table are m.ee and m.ie
+ * @param et        Context of WBAES Encryption Table
+ * @param m         Material from wbaes_gen_material(), not to be used for another key
+ * @param roundkeys AES-128 Round keys for encryption
+*/
+void wbaes_gen_keyed_table(WBAES_ENCRYPTION_TABLE &et, const WBAES_GEN_MATERIAL &m, uint32_t *roundkeys);
+
+/**
+ * @brief
+ *  Generates A Whitebox Encrypion Table one round at a time, keeping only the encodings
+ *  of the current and previous round. Same tables as wbaes_gen_encryption_table(),
+ *  for generating into memory that is flushed as it fills (see wbaes_gen_table_file()).
+ * @param et            Destination, round r only touches r1/r2_xor_tables[r], mbl_tables[r], ty_boxes[r]
+ * @param ee            Context of External Encoding Table
+ * @param roundkeys     AES-128 Round keys for encryption
+ * @param round_done    Called once round r (0-8, 9 = last_box) is written (nullable)
+ * @param arg           Argument of round_done
+*/
+void wbaes_gen_encryption_table_rounds(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys,
+                                       void (*round_done)(WBAES_ENCRYPTION_TABLE &et, int r, void *arg) = NULL, void *arg = NULL);
+
 #endif /* WBAES_TABLES_H */
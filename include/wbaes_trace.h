@@ -0,0 +1,112 @@
+#ifndef WBAES_TRACE_H
+#define WBAES_TRACE_H
+
+#include <cstdio>
+#include <vector>
+
+#include "wbaes_tables.h"
+
+/*
+    Table access traces and an offline cache model
+     - a trace is the sequence of table entries an encryption reads, recorded by a traced
+       copy of the reference path (wbaes_encrypt() for 1 lane, the interleaved order of
+       wbaes_encrypt_blocks_scalar() for more); the real tables are used, so indices
+       are the data-dependent ones
+     - each reference is (table << 20) | byte offset in WBAES_ENCRYPTION_TABLE,
+       workloads can spread over up to WBAES_TRACE_MAX_TABLES tables (keys)
+     - the replay maps offsets through a table layout, places the tables as wbaes_table_alloc()
+       does and runs them through set-associative LRU levels (L1, L2, L3) and a TLB;
+       physical frames of small pages are scattered, huge pages are contiguous
+*/
+#define WBAES_TRACE_MAX_TABLES  4096
+#define WBAES_TRACE_FAMILIES    5
+#define WBAES_TRACE_ROUNDS      10
+
+enum WBAES_TRACE_FAMILY {
+    WBAES_TRACE_TY_BOXES = 0,
+    WBAES_TRACE_R1_XOR   = 1,
+    WBAES_TRACE_MBL      = 2,
+    WBAES_TRACE_R2_XOR   = 3,
+    WBAES_TRACE_LAST_BOX = 4
+};
+
+/*
+    Layouts
+     - STRUCT: WBAES_ENCRYPTION_TABLE as declared (each family holds all of its rounds)
+     - ROUND:  round-major, the ty_boxes, r1_xor, mbl and r2_xor tables of a round
+               are contiguous, in the order they are read, then the last box
+*/
+enum WBAES_TRACE_LAYOUT {
+    WBAES_LAYOUT_STRUCT = 0,
+    WBAES_LAYOUT_ROUND  = 1
+};
+
+#define WBAES_TRACE_LAYOUTS     2
+
+struct WBAES_CACHE_LEVEL {
+    size_t size;                // bytes, 0 = level absent
+    int    ways;
+};
+
+struct WBAES_CACHE_MODEL {
+    WBAES_CACHE_LEVEL  level[3];        // L1, L2, L3
+    int                line;            // line size, bytes
+    int                tlb_entries;     // 0 = no TLB
+    int                tlb_ways;
+    size_t             page;            // 4096 or 2MB (WBAES_MEM_HUGE)
+    WBAES_TRACE_LAYOUT layout;
+};
+
+struct WBAES_CACHE_COUNTS {
+    uint64_t refs;
+    uint64_t miss[3];           // misses of each level
+    uint64_t tlb_miss;
+};
+
+struct WBAES_CACHE_REPORT {
+    WBAES_CACHE_COUNTS by[WBAES_TRACE_FAMILIES][WBAES_TRACE_ROUNDS];
+    WBAES_CACHE_COUNTS total;
+};
+
+/**
+ * @brief
+ *  Encrypts n blocks on the traced reference path and appends their table references;
+ *  every group of `lanes` blocks goes to the next table, round robin
+ * @param et        Tables (at most WBAES_TRACE_MAX_TABLES)
+ * @param tables    Number of tables
+ * @param blocks    Blocks, encrypted in place
+ * @param n         Number of blocks
+ * @param lanes     Blocks interleaved stage by stage (1 = wbaes_encrypt())
+ * @param trace     References, appended
+*/
+void wbaes_trace_blocks(const WBAES_ENCRYPTION_TABLE *const *et, size_t tables, uint8_t *blocks, size_t n, size_t lanes, std::vector<uint32_t> &trace);
+
+/**
+ * @brief
+ *  Family and round of a byte offset in WBAES_ENCRYPTION_TABLE
+ * @return  Family, round in *round
+*/
+WBAES_TRACE_FAMILY wbaes_trace_family(uint32_t offset, int *round);
+
+/**
+ * @brief
+ *  Replays a trace through a cache model
+ * @return  0, -1 on an invalid model
+*/
+int wbaes_cache_replay(const std::vector<uint32_t> &trace, const WBAES_CACHE_MODEL &m, WBAES_CACHE_REPORT *rep);
+
+/**
+ * @brief
+ *  Prints miss rates per family (and per round when per_round is set),
+ *  as misses of each level per reference
+*/
+void wbaes_cache_dump(const WBAES_CACHE_REPORT &rep, bool per_round, FILE *out);
+
+/**
+ * @brief
+ *  Names of families ("ty_boxes", ...) and layouts ("struct", "round")
+*/
+const char *wbaes_trace_family_name(int family);
+const char *wbaes_trace_layout_name(int layout);
+
+#endif /* WBAES_TRACE_H */
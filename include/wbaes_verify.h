@@ -0,0 +1,63 @@
+#ifndef WBAES_VERIFY_H
+#define WBAES_VERIFY_H
+
+#include <cstdio>
+
+#include "wbaes_tables.h"
+
+/*
+    Differential verification
+     - random blocks go through ExtF -> wbaes_encrypt_blocks() -> ExtG in batches and are
+       compared against the oracle AES (aes_encrypt()), on every thread at once
+     - the first mismatch stops all threads, its block is traced round by round
+       through the table (encoded states) and through the reference AES
+     - the budget is either a block count or a confidence p of catching a table
+       that is wrong on a fraction e of the blocks: N = ln(1-p) / ln(1-e)
+*/
+struct WBAES_VERIFY_OPTS {
+    uint64_t blocks;            // blocks to check, 0 = from confidence and fault_rate
+    double   confidence;        // p, e.g. 0.999999
+    double   fault_rate;        // e, smallest fraction of wrong blocks to catch
+    unsigned threads;           // 0 = hardware concurrency
+    uint64_t seed;
+};
+
+struct WBAES_VERIFY_REPORT {
+    uint64_t blocks;            // blocks checked
+    double   seconds;
+    double   blocks_per_s;
+
+    bool     mismatch;
+    uint8_t  pt[16];            // plaintext of the first mismatch
+    uint8_t  expected[16];      // oracle ciphertext
+    uint8_t  got[16];           // decoded table ciphertext
+    uint8_t  wb_states[10][16]; // see wbaes_encrypt_trace(), encoded
+    uint8_t  aes_states[11][16];// reference, after AddRoundKey and rounds 1-10
+};
+
+/**
+ * @brief
+ *  Blocks needed to catch, with confidence p, a table that is wrong on a fraction e of the blocks
+ * @return  ceil(ln(1-p) / ln(1-e)), 0 if p or e is out of (0, 1)
+*/
+uint64_t wbaes_verify_budget(double confidence, double fault_rate);
+
+/**
+ * @brief
+ *  Checks a table against the oracle AES
+ * @param et        Whitebox Encryption Table
+ * @param ee        External Encoding Table
+ * @param rk        AES-128 Round keys the table was generated for
+ * @param opts      Budget, threads and seed
+ * @param rep       Result (nullable)
+ * @return  0 if every block matched, 1 on a mismatch, -1 on an invalid budget
+*/
+int wbaes_verify(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING &ee, u32 rk[11][4], const WBAES_VERIFY_OPTS &opts, WBAES_VERIFY_REPORT *rep);
+
+/**
+ * @brief
+ *  Prints a report, with the round states on a mismatch
+*/
+void wbaes_verify_dump(const WBAES_VERIFY_REPORT &rep, FILE *out);
+
+#endif /* WBAES_VERIFY_H */
@@ -0,0 +1,58 @@
+#ifndef WBAES_XTS_H
+#define WBAES_XTS_H
+
+#include "wbaes_engine.h"
+
+/*
+    XTS-AES (IEEE 1619 / NIST SP 800-38E) for block storage
+     - data key: an encryption table for encryption, a decryption table
+       (wbaes_gen_decryption_table()) for decryption; tweak key: an encryption table
+     - the sector number is the data unit sequence number, little-endian in the tweak block;
+       T_j = E_k2(sector) * alpha^j in GF(2^128), little-endian, x^128 + x^7 + x^2 + x + 1
+     - the tweaks of a group of sectors are encrypted in one batch, the blocks of the group
+       are whitened, run through the batched kernel (or the engine workers) and whitened again;
+       a sector that is not a multiple of 16 bytes ends with ciphertext stealing
+     - every encoding is required: the whitening works on plain values
+*/
+struct WBAES_XTS {
+    const WBAES_ENCRYPTION_TABLE *et;       // data key, encryption (nullable when only decrypting)
+    const WBAES_EXT_ENCODING     *ee;
+    const WBAES_ENCRYPTION_TABLE *dt;       // data key, decryption (nullable when only encrypting)
+    const WBAES_EXT_ENCODING     *de;
+    const WBAES_ENCRYPTION_TABLE *tt;       // tweak key, encryption
+    const WBAES_EXT_ENCODING     *te;
+};
+
+/**
+ * @brief
+ *  Encrypts n consecutive sectors, in and out may alias
+ * @param x             Tables
+ * @param sector        Number of the first sector
+ * @param in            Input (sector_size * n bytes)
+ * @param out           Output (sector_size * n bytes)
+ * @param sector_size   Bytes per sector, at least 16
+ * @param n             Number of sectors
+ * @return  0 on success, -EINVAL on a missing table or encoding, or a sector under 16 bytes
+*/
+int wbaes_xts_encrypt(const WBAES_XTS *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n);
+
+/**
+ * @brief
+ *  Decrypts n consecutive sectors, in and out may alias
+ * @return  0 on success, -EINVAL as wbaes_xts_encrypt()
+*/
+int wbaes_xts_decrypt(const WBAES_XTS *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n);
+
+/**
+ * @brief
+ *  wbaes_xts_encrypt() / wbaes_xts_decrypt() with the block encryptions spread over the engine
+ *  workers (same output); the tables should be registered with wbaes_engine_add_table() and
+ *  the engine must not be used by other submitters meanwhile
+ * @param eng       Engine
+ * @param decrypt   Decrypts instead of encrypting
+ * @return  0 on success, -EINVAL as wbaes_xts_encrypt(), -EIO if an engine job failed,
+ *          the wbaes_engine_submit() error if a job was refused
+*/
+int wbaes_xts_engine(const WBAES_XTS *x, WBAES_ENGINE *eng, bool decrypt, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n);
+
+#endif /* WBAES_XTS_H */
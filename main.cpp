@@ -9,6 +9,11 @@
 #include "aes.h"
 #include "wbaes.h"
 #include "wbaes_tables.h"
+#include "wbaes_engine.h"
+#include "wbaes_mb.h"
+#include "wbaes_mac.h"
+#include "wbaes_xts.h"
+#include "wbaes_modes.h"
 #include "utils.h"
 
 #define EPOCH       10000
@@ -94,12 +99,697 @@ void wbaes() {
     delete ie;
 }
 
+/*
+    Reference CTR on the 32-bit AES
+*/
+void aes_ctr(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len) {
+    uint8_t ctr[16], ks[16];
+    size_t i;
+
+    memcpy(ctr, iv, 16);
+    for (i = 0; i < len; i++) {
+        if (i % 16 == 0) {
+            aes_encrypt(ctr, u32_round_key, ks);
+            wbaes_ctr_add(ctr, 1);
+        }
+        out[i] = in[i] ^ ks[i % 16];
+    }
+}
+
+void engine() {
+    const size_t n_jobs = 4096, depth = 256;
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_ENGINE *eng;
+    WBAES_JOB    *jobs, *done[64];
+    uint8_t      *in, *out, ref[256];
+    size_t        i, j, submitted = 0, completed = 0, bytes = 0, mismatch = 0;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+
+    /*
+        Many short CTR messages (16-256 bytes) with their own counter block
+    */
+    jobs = new WBAES_JOB[n_jobs];
+    in   = new uint8_t[n_jobs * 256];
+    out  = new uint8_t[n_jobs * 256];
+
+    for (i = 0; i < n_jobs; i++) {
+        memset(&jobs[i], 0, sizeof(WBAES_JOB));
+        jobs[i].et   = et;
+        jobs[i].ee   = ee;
+        jobs[i].mode = WBAES_JOB_CTR;
+        jobs[i].in   = in  + 256*i;
+        jobs[i].out  = out + 256*i;
+        jobs[i].len  = 16 + (std::rand() % 241);
+        for (j = 0; j < 16; j++) {
+            jobs[i].iv[j] = std::rand();
+        }
+        for (j = 0; j < jobs[i].len; j++) {
+            in[256*i+j] = std::rand();
+        }
+        bytes += jobs[i].len;
+    }
+
+    eng = wbaes_engine_create(0, depth);
+    wbaes_engine_add_table(eng, et, WBAES_MEM_HUGE);
+
+    puts("==================== ENGINE =====================");
+    double begin = get_ms();
+    while (completed < n_jobs) {
+        while (submitted < n_jobs && wbaes_engine_submit(eng, &jobs[submitted]) == 0) {
+            submitted++;
+        }
+        completed += wbaes_engine_wait(eng, done, 64, 100);
+    }
+    double elapsed = get_ms() - begin;
+
+    for (i = 0; i < n_jobs; i++) {
+        aes_ctr(jobs[i].iv, jobs[i].in, ref, jobs[i].len);
+        if (jobs[i].status != 0 || memcmp(ref, jobs[i].out, jobs[i].len) != 0) {
+            mismatch++;
+        }
+    }
+
+    printf("jobs %zu, bytes %zu, mismatches %zu\n", n_jobs, bytes, mismatch);
+    printf("elapsed : %.0fms (%.2f MB/s)\n", elapsed, elapsed > 0 ? bytes / (elapsed * 1000.0) : 0.0);
+    puts("=================================================");
+
+    wbaes_engine_destroy(eng);
+
+    delete[] jobs;
+    delete[] in;
+    delete[] out;
+    delete et;
+    delete ee;
+    delete ie;
+}
+
+/*
+    Reference CBC on the 32-bit AES
+*/
+void aes_cbc(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len) {
+    uint8_t x[16];
+    size_t i, j;
+
+    memcpy(x, iv, 16);
+    for (i = 0; i < len; i += 16) {
+        for (j = 0; j < 16; j++) {
+            x[j] ^= in[i+j];
+        }
+        aes_encrypt(x, u32_round_key, x);
+        memcpy(out + i, x, 16);
+    }
+}
+
+void mb() {
+    const size_t n_jobs = 4096;
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_MB_MGR  mgr;
+    WBAES_MB_JOB *jobs, *job;
+    uint8_t      *in, *out, ref[256];
+    size_t        i, j, completed = 0, bytes = 0, mismatch = 0;
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+
+    /*
+        Many short messages (16-256 bytes), every one with its own IV, half CBC and half CTR
+    */
+    jobs = new WBAES_MB_JOB[n_jobs];
+    in   = new uint8_t[n_jobs * 256];
+    out  = new uint8_t[n_jobs * 256];
+
+    for (i = 0; i < n_jobs; i++) {
+        memset(&jobs[i], 0, sizeof(WBAES_MB_JOB));
+        jobs[i].mode = (i & 1) ? WBAES_MB_CTR : WBAES_MB_CBC_ENC;
+        jobs[i].in   = in  + 256*i;
+        jobs[i].out  = out + 256*i;
+        jobs[i].len  = (i & 1) ? 16 + (std::rand() % 241) : 16 * (1 + std::rand() % 16);
+        for (j = 0; j < 16; j++) {
+            jobs[i].iv[j] = std::rand();
+        }
+        for (j = 0; j < jobs[i].len; j++) {
+            in[256*i+j] = std::rand();
+        }
+        bytes += jobs[i].len;
+    }
+
+    wbaes_mb_mgr_init(&mgr, et, ee);
+
+    puts("================= MULTI-BUFFER ==================");
+    double begin = get_ms();
+    for (i = 0; i < n_jobs; i++) {
+        if (wbaes_mb_submit(&mgr, &jobs[i])) {
+            completed++;
+        }
+    }
+    while ((job = wbaes_mb_flush(&mgr))) {
+        completed++;
+    }
+    double elapsed = get_ms() - begin;
+
+    for (i = 0; i < n_jobs; i++) {
+        if (jobs[i].mode == WBAES_MB_CBC_ENC) {
+            aes_cbc(jobs[i].iv, jobs[i].in, ref, jobs[i].len);
+        }
+        else {
+            aes_ctr(jobs[i].iv, jobs[i].in, ref, jobs[i].len);
+        }
+        if (jobs[i].status != WBAES_MB_COMPLETED || memcmp(ref, jobs[i].out, jobs[i].len) != 0) {
+            mismatch++;
+        }
+    }
+
+    printf("lanes %d, jobs %zu (%zu returned), bytes %zu, mismatches %zu\n", mgr.lanes, n_jobs, completed, bytes, mismatch);
+    printf("elapsed : %.0fms (%.2f MB/s)\n", elapsed, elapsed > 0 ? bytes / (elapsed * 1000.0) : 0.0);
+    puts("=================================================");
+
+    delete[] jobs;
+    delete[] in;
+    delete[] out;
+    delete et;
+    delete ee;
+    delete ie;
+}
+
+/*
+    Reference CMAC / PMAC on the 32-bit AES
+*/
+static void ref_double(uint8_t *x) {
+    uint8_t carry = x[0] >> 7;
+    int i;
+
+    for (i = 0; i < 15; i++) {
+        x[i] = (x[i] << 1) | (x[i+1] >> 7);
+    }
+    x[15] = (x[15] << 1) ^ (carry ? 0x87 : 0);
+}
+
+static void ref_last(const uint8_t *msg, size_t len, uint8_t *x, bool *full) {
+    size_t m = len ? (len + 15) / 16 : 1, r = len - 16 * (m - 1);
+
+    memset(x, 0, 16);
+    memcpy(x, msg + 16 * (m - 1), r);
+    *full = r == 16;
+    if (!*full) {
+        x[r] = 0x80;
+    }
+}
+
+void aes_cmac(const uint8_t *msg, size_t len, uint8_t *tag) {
+    uint8_t k[16] = {0, }, last[16];
+    size_t  m = len ? (len + 15) / 16 : 1, i, j;
+    bool    full;
+
+    aes32_encrypt(k, u32_round_key, k);
+    ref_double(k);
+    ref_last(msg, len, last, &full);
+    if (!full) {
+        ref_double(k);
+    }
+
+    memset(tag, 0, 16);
+    for (i = 0; i < m; i++) {
+        for (j = 0; j < 16; j++) {
+            tag[j] ^= (i < m - 1) ? msg[16*i+j] : (last[j] ^ k[j]);
+        }
+        aes32_encrypt(tag, u32_round_key, tag);
+    }
+}
+
+void aes_pmac(const uint8_t *msg, size_t len, uint8_t *tag) {
+    uint8_t l[64][16] = {{0, }}, l_inv[16], z[16] = {0, }, sigma[16] = {0, }, x[16];
+    size_t  m = len ? (len + 15) / 16 : 1, i, j;
+    bool    full;
+
+    aes32_encrypt(l[0], u32_round_key, l[0]);
+    for (i = 1; i < 64; i++) {
+        memcpy(l[i], l[i-1], 16);
+        ref_double(l[i]);
+    }
+    for (j = 0; j < 16; j++) {
+        l_inv[j] = (l[0][j] >> 1) | (j ? l[0][j-1] << 7 : 0);
+    }
+    if (l[0][15] & 1) {
+        l_inv[0]  ^= 0x80;
+        l_inv[15] ^= 0x43;
+    }
+
+    for (i = 1; i < m; i++) {
+        for (j = 0; j < 16; j++) {
+            z[j] ^= l[__builtin_ctzll(i)][j];
+            x[j]  = msg[16*(i-1)+j] ^ z[j];
+        }
+        aes32_encrypt(x, u32_round_key, x);
+        for (j = 0; j < 16; j++) {
+            sigma[j] ^= x[j];
+        }
+    }
+
+    ref_last(msg, len, x, &full);
+    for (j = 0; j < 16; j++) {
+        sigma[j] ^= x[j] ^ (full ? l_inv[j] : 0);
+    }
+    aes32_encrypt(sigma, u32_round_key, tag);
+}
+
+void mac() {
+    /* RFC 4493, key 2b7e1516 28aed2a6 abf71588 09cf4f3c */
+    static const uint8_t rfc_msg[64] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+    };
+    static const size_t  rfc_len[4] = { 0, 16, 40, 64 };
+    static const uint8_t rfc_tag[4][16] = {
+        {0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46},
+        {0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c},
+        {0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27},
+        {0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe}
+    };
+    const size_t n_msgs = 1024, big = 4 << 20;
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_MAC_KEY k;
+    WBAES_ENGINE *eng;
+    const uint8_t **msgs = new const uint8_t *[n_msgs];
+    size_t   *lens = new size_t[n_msgs], i, mismatch = 0;
+    uint8_t (*tags)[16] = new uint8_t[n_msgs][16];
+    uint8_t  *data = new uint8_t[big], tag[16], ref[16];
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    wbaes_mac_init(&k, *et, ee);
+
+    puts("====================== MAC ======================");
+    for (i = 0; i < 4; i++) {
+        wbaes_cmac(&k, rfc_msg, rfc_len[i], tag);
+        printf("RFC 4493 #%zu %s\n", i + 1, memcmp(tag, rfc_tag[i], 16) ? "FAIL" : "ok");
+        mismatch += memcmp(tag, rfc_tag[i], 16) != 0;
+    }
+
+    for (i = 0; i < big; i++) {
+        data[i] = std::rand();
+    }
+
+    /* every length up to 32 blocks, then random ones */
+    for (i = 0; i < n_msgs; i++) {
+        lens[i] = i <= 512 ? i : std::rand() % 4096;
+        msgs[i] = data + (std::rand() % 4096);
+    }
+    wbaes_cmac_multi(&k, msgs, lens, n_msgs, tags);
+
+    for (i = 0; i < n_msgs; i++) {
+        aes_cmac(msgs[i], lens[i], ref);
+        mismatch += memcmp(ref, tags[i], 16) != 0;
+        wbaes_cmac(&k, msgs[i], lens[i], tag);
+        mismatch += memcmp(ref, tag, 16) != 0;
+
+        aes_pmac(msgs[i], lens[i], ref);
+        wbaes_pmac(&k, msgs[i], lens[i], tag);
+        mismatch += memcmp(ref, tag, 16) != 0;
+    }
+    printf("%zu messages, cmac / cmac_multi / pmac vs aes32 references\n", n_msgs);
+
+    eng = wbaes_engine_create(0, 64);
+    wbaes_engine_add_table(eng, et);
+
+    double begin = get_ms();
+    wbaes_pmac(&k, data, big - 5, tag);
+    double t_pmac = get_ms() - begin;
+
+    begin = get_ms();
+    mismatch += wbaes_pmac_engine(&k, eng, data, big - 5, ref) != 0;
+    double t_engine = get_ms() - begin;
+    mismatch += memcmp(ref, tag, 16) != 0;
+
+    aes_pmac(data, big - 5, ref);
+    mismatch += memcmp(ref, tag, 16) != 0;
+
+    printf("pmac %zu bytes: batched %.0fms, engine %.0fms\n", big - 5, t_pmac, t_engine);
+    printf("mismatches %zu\n", mismatch);
+    puts("=================================================");
+
+    wbaes_engine_destroy(eng);
+
+    delete[] msgs;
+    delete[] lens;
+    delete[] tags;
+    delete[] data;
+    delete et;
+    delete ee;
+    delete ie;
+}
+
+/*
+    Reference XTS on the 32-bit AES, one sector
+*/
+static void ref_xts(u32 (*rk1)[4], u32 (*rk2)[4], bool decrypt, uint64_t sector, const uint8_t *in, uint8_t *out, size_t size) {
+    uint8_t t[16] = {0, }, tm[16], x[16], cc[16];
+    size_t  m = size / 16, r = size % 16, full = r ? m - 1 : m, i;
+    int     j;
+
+    for (j = 0; j < 8; j++) {
+        t[j] = (uint8_t)(sector >> (8*j));
+    }
+    aes32_encrypt(t, rk2, t);
+
+    auto next = [](uint8_t *v) {
+        uint8_t carry = v[15] >> 7;
+        for (int k = 15; k > 0; k--) {
+            v[k] = (v[k] << 1) | (v[k-1] >> 7);
+        }
+        v[0] = (v[0] << 1) ^ (carry ? 0x87 : 0);
+    };
+    auto block = [&](const uint8_t *p, const uint8_t *tw, uint8_t *c) {
+        for (int k = 0; k < 16; k++) {
+            x[k] = p[k] ^ tw[k];
+        }
+        if (decrypt) {
+            aes32_decrypt(x, rk1, x);
+        }
+        else {
+            aes32_encrypt(x, rk1, x);
+        }
+        for (int k = 0; k < 16; k++) {
+            c[k] = x[k] ^ tw[k];
+        }
+    };
+
+    for (i = 0; i < full; i++) {
+        block(in + 16*i, t, out + 16*i);
+        next(t);
+    }
+    if (r) {
+        memcpy(tm, t, 16);
+        next(tm);
+        block(in + 16*full, decrypt ? tm : t, cc);
+        memcpy(x, in + 16*m, r);
+        memcpy(x + r, cc + r, 16 - r);
+        memcpy(out + 16*m, cc, r);
+        block(x, decrypt ? t : tm, out + 16*full);
+    }
+}
+
+void xts() {
+    /* IEEE 1619 vector 1: both keys 0, sector 0, 32 zero bytes */
+    static const uint8_t ieee_ct[32] = {
+        0x91, 0x7c, 0xf6, 0x9e, 0xbd, 0x68, 0xb2, 0xec, 0x9b, 0x9f, 0xe9, 0xa3, 0xea, 0xdd, 0xa6, 0x92,
+        0xcd, 0x43, 0xd2, 0xf5, 0x95, 0x98, 0xed, 0x85, 0x8c, 0x02, 0xc2, 0x65, 0x2f, 0xbf, 0x92, 0x2e
+    };
+    static const size_t sizes[] = { 16, 17, 31, 100, 512, 520, 4096 };
+    const size_t big = 4 << 20;
+    uint8_t  key2[16], zero[16] = {0, }, buf[32] = {0, };
+    u32      rk2[11][4], rk0[11][4], rk0_inv[11][4];
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE(), *dt = new WBAES_ENCRYPTION_TABLE(), *tt = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING(), *de = new WBAES_EXT_ENCODING(), *te = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_XTS     x = { et, ee, dt, de, tt, te };
+    WBAES_ENGINE *eng;
+    uint8_t      *data = new uint8_t[big], *out = new uint8_t[big], *ref = new uint8_t[big];
+    size_t        mismatch = 0, i, s, n;
+
+    puts("====================== XTS ======================");
+
+    /* known answer, all-zero keys */
+    aes32_enc_keyschedule(zero, rk0);
+    aes32_dec_keyschedule(zero, rk0_inv);
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)rk0);
+    wbaes_gen_decryption_table(*dt, *de, *ie, (uint32_t *)rk0);
+    wbaes_gen_encryption_table(*tt, *te, *ie, (uint32_t *)rk0);
+
+    mismatch += wbaes_xts_encrypt(&x, 0, buf, buf, 32, 1) != 0;
+    printf("IEEE 1619 #1 %s\n", memcmp(buf, ieee_ct, 32) ? "FAIL" : "ok");
+    mismatch += memcmp(buf, ieee_ct, 32) != 0;
+    mismatch += wbaes_xts_decrypt(&x, 0, buf, buf, 32, 1) != 0;
+    mismatch += memcmp(buf, zero, 16) != 0 || memcmp(buf + 16, zero, 16) != 0;
+
+    /* whitebox vs aes32, in place and out of place, every sector size */
+    for (i = 0; i < 16; i++) {
+        key2[i] = std::rand();
+    }
+    aes32_enc_keyschedule(key2, rk2);
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    wbaes_gen_decryption_table(*dt, *de, *ie, (uint32_t *)u32_round_key);
+    wbaes_gen_encryption_table(*tt, *te, *ie, (uint32_t *)rk2);
+
+    for (i = 0; i < big; i++) {
+        data[i] = std::rand();
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        n = 65536 / sizes[s];
+
+        for (i = 0; i < n; i++) {
+            ref_xts(u32_round_key, rk2, false, 1000 + i, data + i*sizes[s], ref + i*sizes[s], sizes[s]);
+        }
+        mismatch += wbaes_xts_encrypt(&x, 1000, data, out, sizes[s], n) != 0;
+        mismatch += memcmp(out, ref, n * sizes[s]) != 0;
+
+        for (i = 0; i < n; i++) {
+            ref_xts(u32_inv_round_key, rk2, true, 1000 + i, data + i*sizes[s], ref + i*sizes[s], sizes[s]);
+        }
+        memcpy(out, data, n * sizes[s]);
+        mismatch += wbaes_xts_decrypt(&x, 1000, out, out, sizes[s], n) != 0;
+        mismatch += memcmp(out, ref, n * sizes[s]) != 0;
+    }
+    printf("sector sizes 16 .. 4096, encrypt / decrypt vs aes32 references\n");
+
+    /* 4K sectors: batched vs engine, round trip */
+    eng = wbaes_engine_create(0, 64);
+    wbaes_engine_add_table(eng, et);
+    wbaes_engine_add_table(eng, dt);
+
+    double begin = get_ms();
+    mismatch += wbaes_xts_encrypt(&x, 7, data, out, 4096, big / 4096) != 0;
+    double t_enc = get_ms() - begin;
+
+    begin = get_ms();
+    mismatch += wbaes_xts_engine(&x, eng, false, 7, data, ref, 4096, big / 4096) != 0;
+    double t_engine = get_ms() - begin;
+    mismatch += memcmp(out, ref, big) != 0;
+
+    begin = get_ms();
+    mismatch += wbaes_xts_engine(&x, eng, true, 7, ref, ref, 4096, big / 4096) != 0;
+    double t_dec = get_ms() - begin;
+    mismatch += memcmp(data, ref, big) != 0;
+
+    printf("xts %zu bytes, 4K sectors: batched %.0fms, engine %.0fms, engine decrypt %.0fms\n", big, (double)t_enc, (double)t_engine, (double)t_dec);
+    printf("mismatches %zu\n", mismatch);
+    puts("=================================================");
+
+    wbaes_engine_destroy(eng);
+
+    delete[] data;
+    delete[] out;
+    delete[] ref;
+    delete et;
+    delete dt;
+    delete tt;
+    delete ee;
+    delete de;
+    delete te;
+    delete ie;
+}
+
+/*
+    Reference GCM on the 32-bit AES, bit by bit (SP 800-38D, algorithm 1 for the products)
+*/
+static void ref_gf128_mul(const uint8_t *x, const uint8_t *y, uint8_t *z) {
+    uint8_t v[16], r[16] = {0, }, lsb;
+    int     i, k;
+
+    memcpy(v, y, 16);
+    for (i = 0; i < 128; i++) {
+        if ((x[i/8] >> (7 - i%8)) & 1) {
+            for (k = 0; k < 16; k++) {
+                r[k] ^= v[k];
+            }
+        }
+        lsb = v[15] & 1;
+        for (k = 15; k > 0; k--) {
+            v[k] = (v[k] >> 1) | (v[k-1] << 7);
+        }
+        v[0] = (v[0] >> 1) ^ (lsb ? 0xe1 : 0);
+    }
+    memcpy(z, r, 16);
+}
+
+/* h^-1 = h^(2^128 - 2) */
+static void ref_gf128_inv(const uint8_t *h, uint8_t *z) {
+    uint8_t s[16], r[16] = {0x80, };
+    int     i;
+
+    memcpy(s, h, 16);
+    for (i = 1; i < 128; i++) {
+        ref_gf128_mul(s, s, s);
+        ref_gf128_mul(r, s, r);
+    }
+    memcpy(z, r, 16);
+}
+
+static void ref_ghash(const uint8_t *h, uint8_t *x, const uint8_t *p, size_t len) {
+    size_t i, k;
+
+    for (i = 0; i < len; i += 16) {
+        for (k = 0; k < 16 && i + k < len; k++) {
+            x[k] ^= p[i+k];
+        }
+        ref_gf128_mul(x, h, x);
+    }
+}
+
+static void ref_len_block(uint64_t a, uint64_t b, uint8_t *blk) {
+    for (int k = 0; k < 8; k++) {
+        blk[7-k]  = (uint8_t)(a >> (8*k));
+        blk[15-k] = (uint8_t)(b >> (8*k));
+    }
+}
+
+static void ref_j0(const uint8_t *h, const uint8_t *iv, size_t iv_len, uint8_t *j0) {
+    uint8_t blk[16];
+
+    memset(j0, 0, 16);
+    if (iv_len == 12) {
+        memcpy(j0, iv, 12);
+        j0[15] = 1;
+        return;
+    }
+    ref_ghash(h, j0, iv, iv_len);
+    ref_len_block(0, iv_len * 8, blk);
+    ref_ghash(h, j0, blk, 16);
+}
+
+static void ref_gcm(const uint8_t *iv, size_t iv_len, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag) {
+    uint8_t h[16] = {0, }, j0[16], ctr[16], ks[16], x[16] = {0, }, blk[16];
+    size_t  i, k;
+
+    aes32_encrypt(h, u32_round_key, h);
+    ref_j0(h, iv, iv_len, j0);
+
+    memcpy(ctr, j0, 16);
+    for (i = 0; i < len; i += 16) {
+        PUTU32(ctr + 12, GETU32(ctr + 12) + 1);
+        aes32_encrypt(ctr, u32_round_key, ks);
+        for (k = 0; k < 16 && i + k < len; k++) {
+            out[i+k] = in[i+k] ^ ks[k];
+        }
+    }
+
+    ref_ghash(h, x, aad, aad_len);
+    ref_ghash(h, x, out, len);
+    ref_len_block(aad_len * 8, len * 8, blk);
+    ref_ghash(h, x, blk, 16);
+    aes32_encrypt(j0, u32_round_key, ks);
+    for (k = 0; k < 16; k++) {
+        tag[k] = x[k] ^ ks[k];
+    }
+}
+
+void gcm() {
+    const size_t len = 1000;
+    WBAES_ENCRYPTION_TABLE *et = new WBAES_ENCRYPTION_TABLE();
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    WBAES_INT_ENCODING     *ie = new WBAES_INT_ENCODING();
+    WBAES_ENGINE *eng;
+    WBAES_JOB     job, *done[1];
+    WBAES_GCM     g;
+    uint8_t  iv[3][16], h[16] = {0, }, hi[16], blk[16], j0[16], aad[20];
+    uint8_t  in[len], ref[len], out[len], tag_ref[16], tag[16];
+    size_t   iv_lens[3] = { 12, 16, 16 }, mismatch = 0, i, v;
+
+    puts("====================== GCM ======================");
+
+    wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)u32_round_key);
+    for (i = 0; i < len; i++) {
+        in[i] = std::rand();
+    }
+    for (i = 0; i < sizeof(aad); i++) {
+        aad[i] = std::rand();
+    }
+    for (v = 0; v < 2; v++) {
+        for (i = 0; i < 16; i++) {
+            iv[v][i] = std::rand();
+        }
+    }
+
+    /* a 128-bit IV whose J0 = GHASH(IV) ends in fffffff0: inc32 wraps at the 16th block */
+    aes32_encrypt(h, u32_round_key, h);
+    ref_gf128_inv(h, hi);
+    memset(j0, 0, 16);
+    for (i = 0; i < 12; i++) {
+        j0[i] = std::rand();
+    }
+    PUTU32(j0 + 12, 0xfffffff0);
+    ref_len_block(0, 128, blk);
+    ref_gf128_mul(j0, hi, iv[2]);
+    for (i = 0; i < 16; i++) {
+        iv[2][i] ^= blk[i];
+    }
+    ref_gf128_mul(iv[2], hi, iv[2]);
+    ref_j0(h, iv[2], 16, blk);
+    mismatch += memcmp(blk, j0, 16) != 0;
+
+    for (v = 0; v < 3; v++) {
+        ref_gcm(iv[v], iv_lens[v], aad, sizeof(aad), in, ref, len, tag_ref);
+
+        /* encryption in two calls, the first a multiple of 16 */
+        wbaes_gcm_init(&g, *et, ee, iv[v], iv_lens[v]);
+        wbaes_gcm_aad(&g, aad, sizeof(aad));
+        wbaes_gcm_encrypt(&g, in, out, 480);
+        wbaes_gcm_encrypt(&g, in + 480, out + 480, len - 480);
+        wbaes_gcm_tag(&g, tag);
+        mismatch += memcmp(out, ref, len) != 0 || memcmp(tag, tag_ref, 16) != 0;
+
+        wbaes_gcm_init(&g, *et, ee, iv[v], iv_lens[v]);
+        wbaes_gcm_aad(&g, aad, sizeof(aad));
+        wbaes_gcm_decrypt(&g, out, out, len);
+        wbaes_gcm_tag(&g, tag);
+        mismatch += memcmp(out, in, len) != 0 || memcmp(tag, tag_ref, 16) != 0;
+
+        printf("%zu-byte IV%s: %s\n", iv_lens[v], v == 2 ? ", J0 low word fffffff0" : "",
+            memcmp(tag, tag_ref, 16) ? "FAIL" : "ok");
+    }
+
+    /* the counter part on the engine, as the CLI runs it */
+    eng = wbaes_engine_create(1, 4);
+    wbaes_engine_add_table(eng, et);
+    wbaes_gcm_init(&g, *et, ee, iv[2], 16);
+    memset(&job, 0, sizeof(job));
+    job.et   = et;
+    job.ee   = ee;
+    job.mode = WBAES_JOB_CTR32;
+    job.in   = in;
+    job.out  = out;
+    job.len  = len;
+    memcpy(job.iv, g.ctr, 16);
+    ref_gcm(iv[2], 16, aad, sizeof(aad), in, ref, len, tag_ref);
+    mismatch += wbaes_engine_submit(eng, &job) != 0;
+    while (wbaes_engine_wait(eng, done, 1, 100) == 0) {
+    }
+    mismatch += job.status != 0 || memcmp(out, ref, len) != 0;
+    printf("engine CTR32 jobs across the wrap: %s\n", memcmp(out, ref, len) ? "FAIL" : "ok");
+
+    printf("mismatches %zu\n", mismatch);
+    puts("=================================================");
+
+    wbaes_engine_destroy(eng);
+    delete et;
+    delete ee;
+    delete ie;
+}
+
 int main(int argc, char *argv[]) {
     aes32_enc_keyschedule(u8_aes_key, u32_round_key);
     aes32_dec_keyschedule(u8_aes_key, u32_inv_round_key);
 
     if (argc > 3) {
-        printf("retry ./main or ./main aes or ./main wbaes");
+        printf("retry ./main or ./main aes or ./main wbaes or ./main engine or ./main mb or ./main mac or ./main xts or ./main gcm");
         return -1;
     }
 
@@ -110,8 +800,23 @@ int main(int argc, char *argv[]) {
         else if (std::strcmp(argv[1], "wbaes") == 0) {
             wbaes();
         }
+        else if (std::strcmp(argv[1], "engine") == 0) {
+            engine();
+        }
+        else if (std::strcmp(argv[1], "mb") == 0) {
+            mb();
+        }
+        else if (std::strcmp(argv[1], "mac") == 0) {
+            mac();
+        }
+        else if (std::strcmp(argv[1], "xts") == 0) {
+            xts();
+        }
+        else if (std::strcmp(argv[1], "gcm") == 0) {
+            gcm();
+        }
         else {
-            printf("retry ./main or ./main aes or ./main wbaes");
+            printf("retry ./main or ./main aes or ./main wbaes or ./main engine or ./main mb or ./main mac or ./main xts or ./main gcm");
             return -1;
         }
     }
@@ -0,0 +1,456 @@
+/*
+    Chow's Whitebox AES performance regression harness
+        - ./wbaesperf [options]
+        - runs the kernel, encoding, oracle and generation benchmarks several times,
+          interleaved, and compares them with the baseline of the machine class
+          (perf/<class>.json) using Welch's t-test on the per-run samples
+        - exits 1 when a metric regressed beyond the threshold, for CI; no network involved
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "aes.h"
+#include "wbaes.h"
+#include "wbaes_cpu.h"
+#include "wbaes_tables.h"
+
+#include <unistd.h>
+
+#define PERF_BLOCKS     4096
+#define PERF_GEN_KEYS   4
+#define PERF_SLICES     4
+
+
+uint8_t  u8_aes_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+uint32_t u32_round_key[11][4];
+
+static void usage() {
+    puts("usage: ./wbaesperf [options]");
+    puts("  -r <runs>           samples per metric (default 5)");
+    puts("  -m <ms>             time per sample of a metric (default 100)");
+    puts("  -t <percent>        regression threshold on the median (default 10)");
+    puts("  -c <class>          machine class (default: from the CPU model)");
+    puts("  -b <file>           baseline (default perf/<class>.json)");
+    puts("  -w <file>           writes the results as a baseline");
+    puts("  -f <filter>         only metrics whose name contains filter");
+}
+
+static double get_ns() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec * 1e9 + t_val.tv_nsec;
+}
+
+/* CPU model, lowercased, runs of other characters turned into one '-' */
+static std::string machine_class() {
+    char line[256];
+    std::string model = "unknown", slug;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    const char *p;
+
+    while (f && fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "model name", 10) && (p = strchr(line, ':'))) {
+            model = p + 1;
+            break;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+
+    for (char c : model) {
+        if (isalnum((unsigned char)c)) {
+            slug += (char)tolower((unsigned char)c);
+        }
+        else if (!slug.empty() && slug.back() != '-') {
+            slug += '-';
+        }
+    }
+    while (!slug.empty() && slug.back() == '-') {
+        slug.pop_back();
+    }
+    return slug;
+}
+
+/*
+    Metrics
+     - every metric is a cost (lower is better), one sample per call of its runner
+*/
+struct perf_ctx {
+    WBAES_ENCRYPTION_TABLE *et;
+    WBAES_EXT_ENCODING     *ee;
+    WBAES_INT_ENCODING     *ie;
+    WBAES_GEN_MATERIAL     *m;
+    std::vector<uint8_t>    blocks;
+    double                  ms;
+};
+
+struct perf_metric {
+    std::string name;
+    const char *unit;
+    std::function<double(perf_ctx &)> run;
+    std::vector<double> samples;
+};
+
+/* best of PERF_SLICES slices of the sample time, interference only ever adds time */
+template <typename F>
+static double per_block(perf_ctx &c, size_t n, F step) {
+    double best = INFINITY, begin, now;
+    size_t total;
+    int    s;
+
+    for (s = 0; s < PERF_SLICES; s++) {
+        total = 0;
+        begin = get_ns();
+        do {
+            step();
+            total += n;
+            now = get_ns();
+        } while (now - begin < c.ms * 1e6 / PERF_SLICES);
+
+        best = std::min(best, (now - begin) / total);
+    }
+    return best;
+}
+
+static std::vector<perf_metric> perf_metrics() {
+    std::vector<perf_metric> ms;
+    const WBAES_KERNELS *k;
+    int l;
+
+    for (l = 0; l < WBAES_KERNEL_LEVELS; l++) {
+        if (!(k = wbaes_kernels_at((WBAES_KERNEL)l))) {
+            continue;
+        }
+        std::string level = wbaes_kernel_name((WBAES_KERNEL)l);
+
+        ms.push_back({ "blocks." + level, "ns/block", [k](perf_ctx &c) {
+            return per_block(c, 256, [&]() { k->encrypt_blocks(*c.et, c.blocks.data(), 256); });
+        }, {} });
+        ms.push_back({ "ext." + level, "ns/block", [k](perf_ctx &c) {
+            return per_block(c, PERF_BLOCKS, [&]() { k->encode_ext_blocks(c.ee->ext_f, c.blocks.data(), PERF_BLOCKS); });
+        }, {} });
+        ms.push_back({ "oracle." + level, "ns/block", [k](perf_ctx &c) {
+            return per_block(c, PERF_BLOCKS, [&]() {
+                for (size_t i = 0; i < PERF_BLOCKS; i++) {
+                    k->aes_encrypt(c.blocks.data() + 16*i, u32_round_key, c.blocks.data() + 16*i);
+                }
+            });
+        }, {} });
+    }
+
+    ms.push_back({ "encrypt", "ns/block", [](perf_ctx &c) {
+        return per_block(c, 64, [&]() {
+            for (size_t i = 0; i < 64; i++) {
+                wbaes_encrypt(*c.et, c.blocks.data() + 16*i);
+            }
+        });
+    }, {} });
+    ms.push_back({ "encrypt_lowlat", "ns/block", [](perf_ctx &c) {
+        return per_block(c, 64, [&]() {
+            for (size_t i = 0; i < 64; i++) {
+                wbaes_encrypt_lowlat(*c.et, c.blocks.data() + 16*i);
+            }
+        });
+    }, {} });
+    ms.push_back({ "gen", "ms/table", [](perf_ctx &c) {
+        double begin = get_ns();
+
+        for (int i = 0; i < PERF_GEN_KEYS; i++) {
+            wbaes_gen_encryption_table(*c.et, *c.ee, *c.ie, (uint32_t *)u32_round_key);
+        }
+        return (get_ns() - begin) / 1e6 / PERF_GEN_KEYS;
+    }, {} });
+    ms.push_back({ "gen_keyed", "ms/table", [](perf_ctx &c) {
+        double t = 0, begin;
+
+        for (int i = 0; i < PERF_GEN_KEYS; i++) {
+            wbaes_gen_material(*c.m);
+            begin = get_ns();
+            wbaes_gen_keyed_table(*c.et, *c.m, (uint32_t *)u32_round_key);
+            t += get_ns() - begin;
+        }
+        return t / 1e6 / PERF_GEN_KEYS;
+    }, {} });
+
+    return ms;
+}
+
+/*
+    Statistics
+*/
+struct perf_stat {
+    double median, mean, stddev;
+    int    n;
+};
+
+static perf_stat summarize(std::vector<double> v) {
+    perf_stat s = { 0, 0, 0, (int)v.size() };
+
+    if (v.empty()) {
+        return s;
+    }
+    std::sort(v.begin(), v.end());
+    s.median = v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+    for (double x : v) {
+        s.mean += x / v.size();
+    }
+    for (double x : v) {
+        s.stddev += (x - s.mean) * (x - s.mean);
+    }
+    s.stddev = v.size() > 1 ? sqrt(s.stddev / (v.size() - 1)) : 0;
+    return s;
+}
+
+/* one-sided 95% critical value of Student's t */
+static double t_critical(double df) {
+    static const double t[10] = { 6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812 };
+
+    if (df < 1) {
+        return t[0];
+    }
+    if (df <= 10) {
+        return t[(int)df - 1];
+    }
+    return df <= 20 ? 1.725 : df <= 30 ? 1.697 : 1.645;
+}
+
+/* Welch's t of b against a, and its degrees of freedom */
+static double welch_t(const perf_stat &a, const perf_stat &b, double *df) {
+    double va = a.n > 0 ? a.stddev * a.stddev / a.n : 0, vb = b.n > 0 ? b.stddev * b.stddev / b.n : 0;
+
+    if (va + vb == 0) {
+        *df = 1e9;
+        return b.mean == a.mean ? 0 : (b.mean > a.mean ? INFINITY : -INFINITY);
+    }
+    *df = (va + vb) * (va + vb) / ((a.n > 1 ? va * va / (a.n - 1) : 0) + (b.n > 1 ? vb * vb / (b.n - 1) : 0) + 1e-300);
+    return (b.mean - a.mean) / sqrt(va + vb);
+}
+
+/*
+    Baselines
+     - {"class": ..., "kernel": ..., "metrics": {"<name>": {"unit": ..., "median": ..., "mean": ...,
+       "stddev": ..., "n": ...}, ...}}
+     - read by a small parser into "metrics/<name>/<field>" paths
+*/
+struct json_reader {
+    const char *p;
+    std::map<std::string, double>      num;
+    std::map<std::string, std::string> str;
+
+    void ws() {
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+    bool string(std::string &s) {
+        ws();
+        if (*p != '"') {
+            return false;
+        }
+        for (p++, s.clear(); *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1]) {
+                p++;
+            }
+            s += *p;
+        }
+        return *p++ == '"';
+    }
+    bool value(const std::string &path) {
+        std::string key, s;
+        char *end;
+
+        ws();
+        if (*p == '{') {
+            for (p++, ws(); *p != '}'; ) {
+                if (!string(key) || (ws(), *p++ != ':') || !value(path.empty() ? key : path + "/" + key)) {
+                    return false;
+                }
+                ws();
+                if (*p == ',') {
+                    p++;
+                }
+                else if (*p != '}') {
+                    return false;
+                }
+                ws();
+            }
+            p++;
+            return true;
+        }
+        if (*p == '"') {
+            if (!string(s)) {
+                return false;
+            }
+            str[path] = s;
+            return true;
+        }
+        num[path] = strtod(p, &end);
+        if (end == p) {
+            return false;
+        }
+        p = end;
+        return true;
+    }
+};
+
+static bool read_baseline(const char *file, json_reader &js) {
+    std::string text;
+    char  buf[4096];
+    size_t n;
+    FILE *f = fopen(file, "r");
+
+    if (!f) {
+        return false;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(f);
+
+    js.p = text.c_str();
+    return js.value("");
+}
+
+static bool write_baseline(const char *file, const std::string &cls, int runs, const std::vector<perf_metric> &ms) {
+    FILE  *f = fopen(file, "w");
+    size_t i;
+
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "{\n  \"class\": \"%s\",\n  \"kernel\": \"%s\",\n  \"runs\": %d,\n  \"metrics\": {\n",
+        cls.c_str(), wbaes_kernel_name(wbaes_kernels().level), runs);
+    for (i = 0; i < ms.size(); i++) {
+        perf_stat s = summarize(ms[i].samples);
+
+        fprintf(f, "    \"%s\": { \"unit\": \"%s\", \"median\": %.6g, \"mean\": %.6g, \"stddev\": %.6g, \"n\": %d }%s\n",
+            ms[i].name.c_str(), ms[i].unit, s.median, s.mean, s.stddev, s.n, i + 1 < ms.size() ? "," : "");
+    }
+    fputs("  }\n}\n", f);
+
+    return fclose(f) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string cls = machine_class(), baseline, filter;
+    const char *out = NULL;
+    double threshold = 10;
+    int    runs = 5, opt, r, regressions = 0;
+    perf_ctx c;
+    json_reader js;
+    bool   have_base;
+
+    c.ms = 100;
+    while ((opt = getopt(argc, argv, "r:m:t:c:b:w:f:h")) != -1) {
+        switch (opt) {
+        case 'r': runs      = atoi(optarg); break;
+        case 'm': c.ms      = atof(optarg); break;
+        case 't': threshold = atof(optarg); break;
+        case 'c': cls       = optarg; break;
+        case 'b': baseline  = optarg; break;
+        case 'w': out       = optarg; break;
+        case 'f': filter    = optarg; break;
+        default:  usage(); return -1;
+        }
+    }
+    if (runs < 1 || c.ms <= 0 || threshold < 0) {
+        usage();
+        return -1;
+    }
+    if (baseline.empty()) {
+        baseline = "perf/" + cls + ".json";
+    }
+
+    aes32_enc_keyschedule(u8_aes_key, u32_round_key);
+    c.et = new WBAES_ENCRYPTION_TABLE();
+    c.ee = new WBAES_EXT_ENCODING();
+    c.ie = new WBAES_INT_ENCODING();
+    c.m  = new WBAES_GEN_MATERIAL();
+    c.blocks.resize(16 * PERF_BLOCKS);
+    for (size_t i = 0; i < c.blocks.size(); i++) {
+        c.blocks[i] = std::rand();
+    }
+    wbaes_gen_encryption_table(*c.et, *c.ee, *c.ie, (uint32_t *)u32_round_key);
+
+    std::vector<perf_metric> ms = perf_metrics();
+    ms.erase(std::remove_if(ms.begin(), ms.end(), [&](const perf_metric &m) {
+        return m.name.find(filter) == std::string::npos;
+    }), ms.end());
+
+    /* runs are the outer loop, so drift spreads over every metric */
+    for (r = 0; r < runs; r++) {
+        for (perf_metric &m : ms) {
+            m.samples.push_back(m.run(c));
+        }
+        fprintf(stderr, "\rrun %d/%d", r + 1, runs);
+    }
+    fputs("\n", stderr);
+
+    have_base = read_baseline(baseline.c_str(), js);
+    printf("class %s, kernel %s, %d run(s) of %.0f ms, threshold %.1f%%\n",
+        cls.c_str(), wbaes_kernel_name(wbaes_kernels().level), runs, c.ms, threshold);
+    if (have_base) {
+        printf("baseline %s (kernel %s)\n", baseline.c_str(), js.str["kernel"].c_str());
+    }
+    else {
+        printf("no baseline at %s\n", baseline.c_str());
+    }
+    printf("\n%-18s %-9s %10s %10s %8s %7s  %s\n", "metric", "unit", "baseline", "median", "delta", "t", "");
+
+    for (perf_metric &m : ms) {
+        perf_stat   cur = summarize(m.samples), base;
+        std::string key = "metrics/" + m.name + "/";
+        const char *verdict;
+        double      delta, t, df;
+
+        if (!have_base || !js.num.count(key + "median")) {
+            printf("%-18s %-9s %10s %10.3f %8s %7s  %s\n", m.name.c_str(), m.unit, "-", cur.median, "", "", have_base ? "new" : "");
+            continue;
+        }
+
+        base.median = js.num[key + "median"];
+        base.mean   = js.num[key + "mean"];
+        base.stddev = js.num[key + "stddev"];
+        base.n      = (int)js.num[key + "n"];
+
+        delta = base.median > 0 ? 100 * (cur.median - base.median) / base.median : 0;
+        t     = welch_t(base, cur, &df);
+
+        if (delta > threshold) {
+            verdict = t > t_critical(df) ? "REGRESSION" : "slower (not significant)";
+            regressions += t > t_critical(df);
+        }
+        else if (delta < -threshold) {
+            verdict = t < -t_critical(df) ? "faster" : "faster (not significant)";
+        }
+        else {
+            verdict = "ok";
+        }
+
+        printf("%-18s %-9s %10.3f %10.3f %+7.1f%% %7.2f  %s\n", m.name.c_str(), m.unit, base.median, cur.median, delta,
+            std::isfinite(t) ? t : (t > 0 ? 99.99 : -99.99), verdict);
+    }
+    printf("\n%d regression(s)\n", regressions);
+
+    if (out) {
+        if (!write_baseline(out, cls, runs, ms)) {
+            fprintf(stderr, "cannot write %s\n", out);
+            return -1;
+        }
+        printf("baseline written to %s\n", out);
+    }
+
+    delete c.et;
+    delete c.ee;
+    delete c.ie;
+    delete c.m;
+
+    return regressions ? 1 : 0;
+}
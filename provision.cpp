@@ -0,0 +1,171 @@
+/*
+    Chow's Whitebox AES mass provisioning
+        - ./wbaesprov build -o <archive> [-t threads] <key list | ->
+        - ./wbaesprov list  <archive>
+        - ./wbaesprov check <archive>
+        - a key list has one key per line: <id> <key (32 hex digits)>, blank lines
+          and lines starting with # are skipped
+*/
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "wbaes_archive.h"
+
+#include <unistd.h>
+
+
+static void usage() {
+    puts("usage: ./wbaesprov build -o <archive> [-t threads] <key list | ->");
+    puts("       ./wbaesprov list  <archive>");
+    puts("       ./wbaesprov check <archive>");
+}
+
+static bool parse_key(const char *hex, uint8_t *key) {
+    unsigned v;
+    int i;
+
+    if (strlen(hex) != 32) {
+        return false;
+    }
+    for (i = 0; i < 16; i++) {
+        if (sscanf(hex + 2*i, "%2x", &v) != 1) {
+            return false;
+        }
+        key[i] = v;
+    }
+
+    return true;
+}
+
+static bool read_keys(FILE *in, std::vector<WBAES_ARCHIVE_KEY> &keys) {
+    char line[256], id[256], hex[256];
+    WBAES_ARCHIVE_KEY k;
+    size_t no = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        no++;
+        if (sscanf(line, "%255s", id) != 1 || id[0] == '#') {
+            continue;
+        }
+
+        memset(&k, 0, sizeof(k));
+        if (sscanf(line, "%255s %255s", id, hex) != 2 || !wbaes_key_id_valid(id) || !parse_key(hex, k.key)) {
+            fprintf(stderr, "line %zu: expected <id> <key (32 hex digits)>\n", no);
+            return false;
+        }
+        strcpy(k.id, id);
+        keys.push_back(k);
+    }
+
+    memset(line, 0, sizeof(line));
+    memset(hex, 0, sizeof(hex));
+    return true;
+}
+
+static int build(const char *out, unsigned threads, const char *list) {
+    std::vector<WBAES_ARCHIVE_KEY> keys;
+    WBAES_ARCHIVE_STATS st;
+    FILE *in = strcmp(list, "-") ? fopen(list, "r") : stdin;
+    bool  ok;
+    int   ret;
+
+    if (!in) {
+        perror(list);
+        return -1;
+    }
+    ok = read_keys(in, keys);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (!ok) {
+        return -1;
+    }
+
+    ret = wbaes_archive_build(out, keys.data(), keys.size(), threads, &st);
+    if (!keys.empty()) {
+        memset((void *)keys.data(), 0, keys.size() * sizeof(WBAES_ARCHIVE_KEY));
+    }
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", out, errno == EINVAL ? "invalid or duplicate key id" : strerror(errno));
+        return -1;
+    }
+
+    printf("%zu key(s), %.1f MB, %.2f s (%.1f ms per key, %u thread(s))\n",
+        st.keys, st.bytes / 1e6, st.seconds, st.keys ? 1e3 * st.seconds / st.keys : 0.0, threads);
+    return 0;
+}
+
+static int list(const char *file) {
+    WBAES_ARCHIVE *ar = wbaes_archive_open(file);
+    size_t i;
+
+    if (!ar) {
+        fprintf(stderr, "not an archive, or corrupted index: %s\n", file);
+        return -1;
+    }
+    for (i = 0; i < wbaes_archive_count(ar); i++) {
+        puts(wbaes_archive_id(ar, i));
+    }
+
+    wbaes_archive_close(ar);
+    return 0;
+}
+
+static int check(const char *file) {
+    WBAES_ARCHIVE *ar = wbaes_archive_open(file);
+    WBAES_ARCHIVE_ENTRY e;
+    size_t i, bad = 0;
+
+    if (!ar) {
+        fprintf(stderr, "not an archive, or corrupted index: %s\n", file);
+        return -1;
+    }
+    for (i = 0; i < wbaes_archive_count(ar); i++) {
+        if (wbaes_archive_map(ar, i, &e, true) < 0) {
+            printf("%s: %s\n", wbaes_archive_id(ar, i), strerror(errno));
+            bad++;
+            continue;
+        }
+        wbaes_archive_unmap(&e);
+    }
+
+    printf("%zu entries, %zu bad\n", wbaes_archive_count(ar), bad);
+    wbaes_archive_close(ar);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out = NULL;
+    unsigned threads = std::thread::hardware_concurrency();
+    int opt;
+
+    if (argc < 2) {
+        usage();
+        return -1;
+    }
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "o:t:")) != -1) {
+        switch (opt) {
+        case 'o': out     = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        default:  usage(); return -1;
+        }
+    }
+    threads = threads ? threads : 1;
+
+    if (!strcmp(argv[1], "build") && out && optind + 1 == argc) {
+        return build(out, threads, argv[optind]);
+    }
+    if (!strcmp(argv[1], "list") && optind + 1 == argc) {
+        return list(argv[optind]);
+    }
+    if (!strcmp(argv[1], "check") && optind + 1 == argc) {
+        return check(argv[optind]);
+    }
+
+    usage();
+    return -1;
+}
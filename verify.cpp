@@ -0,0 +1,113 @@
+/*
+    Chow's Whitebox AES table verification
+        - ./verify [options] [<table> <ext-encoding> <key>]
+        - without files, a table is generated for the test key and checked
+*/
+
+#include <iostream>
+
+#include "aes.h"
+#include "wbaes_tables.h"
+#include "wbaes_mem.h"
+#include "wbaes_cpu.h"
+#include "wbaes_verify.h"
+
+#include <unistd.h>
+
+
+uint8_t  u8_aes_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+
+static void usage() {
+    puts("usage: ./verify [options] [<table> <ext-encoding> <key (32 hex digits)>]");
+    puts("  -n <blocks>     blocks to check (overrides -p / -e)");
+    puts("  -p <p>          confidence of catching a faulty table (default 0.999999)");
+    puts("  -e <e>          smallest fraction of wrong blocks to catch (default 1e-5)");
+    puts("  -t <threads>    threads (default: all cores)");
+    puts("  -s <seed>       seed of the random blocks (default: time)");
+    puts("  -f              flip one table entry first (checks that faults are caught)");
+}
+
+static bool parse_key(const char *hex, uint8_t *key) {
+    unsigned v;
+    int i;
+
+    if (strlen(hex) != 32) {
+        return false;
+    }
+    for (i = 0; i < 16; i++) {
+        if (sscanf(hex + 2*i, "%2x", &v) != 1) {
+            return false;
+        }
+        key[i] = v;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    WBAES_VERIFY_OPTS    opts = { 0, 0.999999, 1e-5, 0, (uint64_t)time(NULL) };
+    WBAES_VERIFY_REPORT *rep  = new WBAES_VERIFY_REPORT();
+    WBAES_ENCRYPTION_TABLE *et;
+    WBAES_EXT_ENCODING     *ee = new WBAES_EXT_ENCODING();
+    uint32_t rk[11][4];
+    bool     fault = false;
+    int      c, ret;
+
+    while ((c = getopt(argc, argv, "n:p:e:t:s:fh")) != -1) {
+        switch (c) {
+        case 'n': opts.blocks     = strtoull(optarg, NULL, 0); break;
+        case 'p': opts.confidence = atof(optarg); break;
+        case 'e': opts.fault_rate = atof(optarg); break;
+        case 't': opts.threads    = atoi(optarg); break;
+        case 's': opts.seed       = strtoull(optarg, NULL, 0); break;
+        case 'f': fault = true; break;
+        default:  usage(); return -1;
+        }
+    }
+
+    if (argc - optind == 3) {
+        if (!parse_key(argv[optind+2], u8_aes_key)) {
+            fprintf(stderr, "bad key: %s\n", argv[optind+2]);
+            return -1;
+        }
+        et = wbaes_table_load(argv[optind], -1);
+        if (!et || !ee->read(argv[optind+1])) {
+            fprintf(stderr, "cannot read %s / %s\n", argv[optind], argv[optind+1]);
+            return -1;
+        }
+        aes32_enc_keyschedule(u8_aes_key, rk);
+    }
+    else if (argc == optind) {
+        WBAES_INT_ENCODING *ie = new WBAES_INT_ENCODING();
+
+        et = wbaes_table_alloc(-1);
+        aes32_enc_keyschedule(u8_aes_key, rk);
+        wbaes_gen_encryption_table(*et, *ee, *ie, (uint32_t *)rk);
+        delete ie;
+    }
+    else {
+        usage();
+        return -1;
+    }
+
+    if (fault) {
+        et->mbl_tables[4][7][opts.seed & 0xff] ^= 0x10000;
+    }
+
+    printf("kernel %s, budget %llu blocks\n", wbaes_kernel_name(wbaes_kernels().level),
+        (unsigned long long)(opts.blocks ? opts.blocks : wbaes_verify_budget(opts.confidence, opts.fault_rate)));
+
+    ret = wbaes_verify(*et, *ee, rk, opts, rep);
+    if (ret < 0) {
+        fputs("invalid budget: -n, or -p and -e in (0, 1)\n", stderr);
+    }
+    else {
+        wbaes_verify_dump(*rep, stdout);
+    }
+
+    wbaes_table_free(et);
+    delete ee;
+    delete rep;
+
+    return ret;
+}
@@ -2,10 +2,18 @@
     Implementation of Chow's Whitebox AES
         - Encrypt on the whiteboxing algorithm
 */
+#include <atomic>
+
 #include "wbaes.h"
+#include "wbaes_cpu.h"
+#include "wbaes_metrics.h"
 
 extern uint8_t     shift_map[16];
 
+static const uint8_t id_map[16] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
 
 /*
     A Tutorial on Whitebox AES
@@ -112,7 +120,7 @@ static void ref_table(const uint32_t (*tables)[256], const uint8_t (*xor_tables)
     }
 }
 
-void wbaes_encrypt(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
+void wbaes_encrypt_block_scalar(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
     int r;
 
     // ia(et.i_tables, et.s_xor_tables, ee.ext_f, pt);
@@ -155,3 +163,237 @@ void wbaes_encrypt(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
     puts("----------------------------------------------");
     #endif
 }
+
+void wbaes_encrypt(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
+    WBAES_METRIC(WBAES_API_ENCRYPT, 1, 16);
+    wbaes_encrypt_block_scalar(et, pt);
+}
+
+void wbaes_encrypt_trace(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt, uint8_t (*states)[16]) {
+    int r, i;
+
+    for (r = 0; r < 9; r++) {
+        shift_rows(pt);
+        ref_table(et.ty_boxes[r]  , et.r1_xor_tables[r], pt);
+        ref_table(et.mbl_tables[r], et.r2_xor_tables[r], pt);
+        memcpy(states[r], pt, 16);
+    }
+    shift_rows(pt);
+
+    for (i = 0; i < 16; i++) {
+        pt[i] = et.last_box[i][pt[i]];
+    }
+    memcpy(states[9], pt, 16);
+}
+
+/*
+    Low-latency single block
+     - the lookups of a stage are issued as vector gathers on the avx2 level and up
+       (see wbaes_encrypt_block_avx2()), the scalar evaluator below it
+*/
+void wbaes_encrypt_lowlat(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
+    WBAES_METRIC(WBAES_API_ENCRYPT_LOWLAT, 1, 16);
+    wbaes_kernels().encrypt_block(et, pt);
+}
+
+/*
+    Batched encryption
+     - every lane runs the same stage before the next stage starts,
+       so the lookups of independent blocks overlap in the pipeline
+     - software prefetch, distance d (in lanes):
+        while lane l runs a stage, the T-box/MBL lines of lane l+d for the same stage are prefetched,
+        and once lane l < d finishes a stage, its lines of the next stage are prefetched
+        (its indices are known from that point on, next round ones through the shift map)
+       the XOR-table rows depend on the T-box outputs of the same stage and are left to the interleave
+*/
+static std::atomic<int> prefetch_distance(WBAES_PREFETCH_DEFAULT);
+
+static inline void prefetch_stage(const uint32_t (*tables)[256], const uint8_t *x, const uint8_t *map) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        __builtin_prefetch(&tables[i][x[map[i]]], 0, 3);
+    }
+}
+
+static void encrypt_lanes(const WBAES_ENCRYPTION_TABLE &et, uint8_t *x, size_t lanes, int from = 0) {
+    int r, i;
+    size_t l, pd = prefetch_distance.load(std::memory_order_relaxed);
+
+    /*
+        from: first stage to run (2r = ShiftRows + ty_boxes[r], 2r+1 = mbl_tables[r]),
+        x then holds the state before that stage
+    */
+    pd = pd < lanes ? pd : lanes;
+
+    for (l = 0; l < pd; l++) {
+        if (from & 1) {
+            prefetch_stage(et.mbl_tables[from/2], x + 16*l, id_map);
+        }
+        else {
+            prefetch_stage(et.ty_boxes[from/2], x + 16*l, shift_map);
+        }
+    }
+
+    for (r = from / 2; r < 9; r++) {
+        if (r > from / 2 || !(from & 1)) {
+            for (l = 0; l < lanes; l++) {
+                shift_rows(x + 16*l);
+            }
+
+            for (l = 0; l < lanes; l++) {
+                if (l + pd < lanes && pd) {
+                    prefetch_stage(et.ty_boxes[r], x + 16*(l+pd), id_map);
+                }
+                ref_table(et.ty_boxes[r], et.r1_xor_tables[r], x + 16*l);
+                if (l < pd) {
+                    prefetch_stage(et.mbl_tables[r], x + 16*l, id_map);
+                }
+            }
+        }
+
+        for (l = 0; l < lanes; l++) {
+            if (l + pd < lanes && pd) {
+                prefetch_stage(et.mbl_tables[r], x + 16*(l+pd), id_map);
+            }
+            ref_table(et.mbl_tables[r], et.r2_xor_tables[r], x + 16*l);
+            if (l < pd && r < 8) {
+                prefetch_stage(et.ty_boxes[r+1], x + 16*l, shift_map);
+            }
+        }
+    }
+
+    for (l = 0; l < lanes; l++) {
+        shift_rows(x + 16*l);
+        for (i = 0; i < 16; i++) {
+            x[16*l+i] = et.last_box[i][x[16*l+i]];
+        }
+    }
+}
+
+void wbaes_set_prefetch_distance(int d) {
+    prefetch_distance.store(d < 0 ? 0 : d, std::memory_order_relaxed);
+}
+
+int wbaes_get_prefetch_distance() {
+    return prefetch_distance.load(std::memory_order_relaxed);
+}
+
+void wbaes_encrypt_blocks_scalar(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n) {
+    for (; n >= WBAES_BATCH_LANES; n -= WBAES_BATCH_LANES, blocks += 16*WBAES_BATCH_LANES) {
+        encrypt_lanes(et, blocks, WBAES_BATCH_LANES);
+    }
+
+    if (n) {
+        encrypt_lanes(et, blocks, n);
+    }
+}
+
+void wbaes_encrypt_blocks(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n) {
+    WBAES_METRIC(WBAES_API_ENCRYPT_BLOCKS, n, 16 * n);
+    WBAES_METRIC_KERNEL(wbaes_kernels().level, n);
+    wbaes_kernels().encrypt_blocks(et, blocks, n);
+}
+
+/*
+    CTR fast path
+     - after ShiftRows, input bytes 15, 14, 13 and 12 land in columns 0, 1, 2 and 3:
+       while only the low counter bytes move, the other round-1 columns
+       (T-box, MBL and both XOR trees) are the same as for the previous block
+     - round 2 takes one byte of every round-1 column per column, so a single changed
+       round-1 column changes one T-box word per round-2 column: the other three words
+       and the XOR level combining two unchanged words (a^b or c^d) are reused
+     - with one changed byte a block costs 1820 lookups instead of 2032
+*/
+static inline uint8_t nib(uint32_t w, int k) {
+    return (w >> (28 - 4*k)) & 0xf;
+}
+
+static void xor_tree(const uint8_t (*xor_tables)[16][16], int i, const uint32_t *w, uint8_t *out) {
+    uint8_t x[16];
+    int k;
+
+    for (k = 0; k < 8; k++) {
+        x[k  ] = xor_tables[i*16+k  ][nib(w[0], k)][nib(w[1], k)];
+        x[k+8] = xor_tables[i*16+k+8][nib(w[2], k)][nib(w[3], k)];
+    }
+    for (k = 0; k < 4; k++) {
+        out[k] = xor_tables[64+i*8+2*k][x[2*k]][x[2*k+8]] << 4 | xor_tables[64+i*8+2*k+1][x[2*k+1]][x[2*k+9]];
+    }
+}
+
+/* round-2 positions fed by round-1 column c, and the column of every input byte */
+static const uint8_t ctr_fed[4][4] = {{0, 7, 10, 13}, {1, 4, 11, 14}, {2, 5, 8, 15}, {3, 6, 9, 12}};
+static const uint8_t ctr_col[16]   = {0, 3, 2, 1, 1, 0, 3, 2, 2, 1, 0, 3, 3, 2, 1, 0};
+
+static void ctr_rounds12(const WBAES_ENCRYPTION_TABLE &et, WBAES_CTR_CACHE &c, uint8_t *x) {
+    uint32_t w[4];
+    uint8_t  t[4];
+    int i, j, k, p, cols = 0xf;
+
+    if (c.valid) {
+        for (j = 0, cols = 0; j < 16; j++) {
+            cols |= (x[j] != c.in[j]) << ctr_col[j];
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (!(cols & (1 << i))) {
+            continue;
+        }
+
+        /* round 1, column i */
+        for (j = 0; j < 4; j++) {
+            w[j] = et.ty_boxes[0][i*4+j][x[shift_map[i*4+j]]];
+        }
+        xor_tree(et.r1_xor_tables[0], i, w, t);
+        for (j = 0; j < 4; j++) {
+            w[j] = et.mbl_tables[0][i*4+j][t[j]];
+        }
+        xor_tree(et.r2_xor_tables[0], i, w, c.r1 + i*4);
+
+        /* round 2, the T-box word of every column fed by it and the XOR level using that word */
+        for (j = 0; j < 4; j++) {
+            const uint32_t *v;
+            int g;
+
+            p = ctr_fed[i][j];
+            c.r2_t[p] = et.ty_boxes[1][p][c.r1[shift_map[p]]];
+
+            v = c.r2_t + (p & ~1);
+            g = (p & 2) ? 8 : 0;
+            for (k = 0; k < 8; k++) {
+                c.r2_x[p >> 2][g+k] = et.r1_xor_tables[1][(p >> 2)*16+g+k][nib(v[0], k)][nib(v[1], k)];
+            }
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        for (k = 0; k < 4; k++) {
+            x[i*4+k] = (
+                et.r1_xor_tables[1][64+i*8+2*k  ][c.r2_x[i][2*k  ]][c.r2_x[i][2*k+8]] << 4 |
+                et.r1_xor_tables[1][64+i*8+2*k+1][c.r2_x[i][2*k+1]][c.r2_x[i][2*k+9]]
+            );
+        }
+    }
+}
+
+void wbaes_encrypt_ctr_blocks(const WBAES_ENCRYPTION_TABLE &et, WBAES_CTR_CACHE &cache, uint8_t *blocks, size_t n) {
+    WBAES_METRIC(WBAES_API_CTR_BLOCKS, n, 16 * n);
+    WBAES_METRIC_KERNEL(WBAES_KERNEL_SCALAR, n);
+    uint8_t in[16];
+    size_t  l, lanes;
+
+    for (; n; n -= lanes, blocks += 16*lanes) {
+        lanes = n < WBAES_BATCH_LANES ? n : WBAES_BATCH_LANES;
+
+        for (l = 0; l < lanes; l++) {
+            memcpy(in, blocks + 16*l, 16);
+            ctr_rounds12(et, cache, blocks + 16*l);
+            memcpy(cache.in, in, 16);
+            cache.valid = true;
+        }
+
+        encrypt_lanes(et, blocks, lanes, 3);
+    }
+}
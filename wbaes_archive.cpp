@@ -0,0 +1,394 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Table archive for mass provisioning
+*/
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wbaes_archive.h"
+#include "wbaes_metrics.h"
+
+#define ARCHIVE_MAGIC       "WBAESAR1"
+#define CHECK_CHUNK         (64 * 1024)
+
+/*
+    File layout, host byte order
+     - header at 0, index at one page, entries from data_off on,
+       entry i (in id order) at data_off + i * entry_size
+*/
+struct archive_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t table_size;        // sizeof(WBAES_ENCRYPTION_TABLE)
+    uint64_t ext_size;          // sizeof(WBAES_EXT_ENCODING)
+    uint64_t entry_size;
+    uint64_t index_off;
+    uint64_t data_off;
+    uint32_t index_crc;
+    uint32_t reserved;
+};
+
+struct archive_index {
+    char     id[WBAES_KEY_ID_MAX];
+    uint64_t offset;
+    uint32_t crc;               // table and external encoding
+    uint32_t reserved;
+};
+
+static_assert(sizeof(archive_index) == 80, "index entry layout");
+
+struct WBAES_ARCHIVE {
+    int                        fd;
+    archive_hdr                hdr;
+    std::vector<archive_index> index;
+};
+
+/*
+    CRC32C, slicing-by-8 over tables built at compile time
+*/
+struct crc32c_tables {
+    uint32_t t[8][256];
+};
+
+static constexpr crc32c_tables gen_crc32c_tables() {
+    crc32c_tables ret = {};
+
+    for (int x = 0; x < 256; x++) {
+        uint32_t c = x;
+
+        for (int k = 0; k < 8; k++) {
+            c = (c >> 1) ^ ((c & 1) ? 0x82f63b78 : 0);
+        }
+        ret.t[0][x] = c;
+    }
+    for (int s = 1; s < 8; s++) {
+        for (int x = 0; x < 256; x++) {
+            ret.t[s][x] = (ret.t[s-1][x] >> 8) ^ ret.t[0][ret.t[s-1][x] & 0xff];
+        }
+    }
+    return ret;
+}
+
+static constexpr crc32c_tables crc32c = gen_crc32c_tables();
+
+uint32_t wbaes_crc32c(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t v;
+
+    crc = ~crc;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc32c.t[7][ v        & 0xff] ^ crc32c.t[6][(v >>  8) & 0xff] ^
+              crc32c.t[5][(v >> 16) & 0xff] ^ crc32c.t[4][(v >> 24) & 0xff] ^
+              crc32c.t[3][(v >> 32) & 0xff] ^ crc32c.t[2][(v >> 40) & 0xff] ^
+              crc32c.t[1][(v >> 48) & 0xff] ^ crc32c.t[0][ v >> 56        ];
+    }
+    for (; len; len--, p++) {
+        crc = (crc >> 8) ^ crc32c.t[0][(crc ^ *p) & 0xff];
+    }
+
+    return ~crc;
+}
+
+static inline uint64_t page_round(uint64_t len, uint64_t page) {
+    return (len + page - 1) / page * page;
+}
+
+static inline uint64_t entry_bytes() {
+    return sizeof(WBAES_ENCRYPTION_TABLE) + sizeof(WBAES_EXT_ENCODING);
+}
+
+/* CRC32C of a file range, read in chunks so a table never has to be resident */
+static int crc_range(int fd, uint64_t off, uint64_t len, uint32_t *crc) {
+    std::vector<uint8_t> buf(CHECK_CHUNK);
+    ssize_t got;
+
+    *crc = 0;
+    while (len) {
+        got = pread(fd, buf.data(), len < CHECK_CHUNK ? len : CHECK_CHUNK, off);
+        if (got <= 0) {
+            errno = got < 0 ? errno : EIO;
+            return -1;
+        }
+        *crc = wbaes_crc32c(*crc, buf.data(), got);
+        off += got;
+        len -= got;
+    }
+
+    return 0;
+}
+
+static bool write_all(int fd, const void *p, size_t len, uint64_t off) {
+    const uint8_t *b = (const uint8_t *)p;
+    ssize_t put;
+
+    while (len) {
+        if ((put = pwrite(fd, b, len, off)) <= 0) {
+            return false;
+        }
+        b   += put;
+        off += put;
+        len -= put;
+    }
+    return true;
+}
+
+/* makes a rename in the directory of file durable */
+static int sync_dir(const char *file) {
+    std::string dir(file);
+    size_t slash = dir.rfind('/');
+    int    fd, ret;
+
+    dir = slash == std::string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+    if ((fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY)) < 0) {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/*
+    Build
+     - the whole file is allocated up front: the tables are stored through a shared mapping,
+       where a full disk would raise SIGBUS instead of failing a write
+     - threads take the next entry from a shared counter, stream its table into the file,
+       append the external encoding and checksum the entry from the page cache
+     - the archive replaces file by a rename, followed by an fsync of the directory
+*/
+static int gen_entry(int fd, const WBAES_ARCHIVE_KEY &k, archive_index &ix) {
+    WBAES_EXT_ENCODING *ee = new WBAES_EXT_ENCODING();
+    uint32_t rk[11][4];
+    int ret = 0;
+
+    aes32_enc_keyschedule((byte *)k.key, rk);
+
+    if (wbaes_gen_table_fd(fd, ix.offset, *ee, (uint32_t *)rk) < 0 ||
+        !write_all(fd, ee, sizeof(*ee), ix.offset + sizeof(WBAES_ENCRYPTION_TABLE)) ||
+        crc_range(fd, ix.offset, entry_bytes(), &ix.crc) < 0) {
+        ret = -1;
+    }
+
+    memset(rk, 0, sizeof(rk));
+    memset((void *)ee, 0, sizeof(*ee));
+    delete ee;
+
+    return ret;
+}
+
+int wbaes_archive_build(const char *file, const WBAES_ARCHIVE_KEY *keys, size_t n, unsigned threads, WBAES_ARCHIVE_STATS *st) {
+    auto begin = std::chrono::steady_clock::now();
+    std::string tmp = std::string(file) + ".tmp";
+    std::vector<archive_index> index(n);
+    std::vector<size_t> order(n);
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+    std::atomic<int> err(0);
+    archive_hdr hdr;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    size_t i;
+    int fd, rc;
+
+    if (n > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (!wbaes_key_id_valid(keys[i].id)) {
+            errno = EINVAL;
+            return -1;
+        }
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [keys](size_t a, size_t b) { return strcmp(keys[a].id, keys[b].id) < 0; });
+    for (i = 1; i < n; i++) {
+        if (!strcmp(keys[order[i-1]].id, keys[order[i]].id)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ARCHIVE_MAGIC, 8);
+    hdr.version    = WBAES_ARCHIVE_VERSION;
+    hdr.count      = n;
+    hdr.table_size = sizeof(WBAES_ENCRYPTION_TABLE);
+    hdr.ext_size   = sizeof(WBAES_EXT_ENCODING);
+    hdr.entry_size = page_round(entry_bytes(), page);
+    hdr.index_off  = page;
+    hdr.data_off   = page_round(page + n * sizeof(archive_index), page);
+
+    for (i = 0; i < n; i++) {
+        memset(&index[i], 0, sizeof(archive_index));
+        strcpy(index[i].id, keys[order[i]].id);
+        index[i].offset = hdr.data_off + i * hdr.entry_size;
+    }
+
+    if ((fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+        return -1;
+    }
+    if ((rc = posix_fallocate(fd, 0, hdr.data_off + n * hdr.entry_size)) != 0) {
+        err = rc;
+    }
+
+    threads = threads ? threads : 1;
+    for (unsigned t = 0; t < threads && !err; t++) {
+        workers.emplace_back([&]() {
+            size_t e;
+
+            while (!err && (e = next++) < n) {
+                if (gen_entry(fd, keys[order[e]], index[e]) < 0) {
+                    int zero = 0;
+                    err.compare_exchange_strong(zero, errno ? errno : EIO);
+                }
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    if (!err) {
+        hdr.index_crc = wbaes_crc32c(0, index.data(), n * sizeof(archive_index));
+        if (!write_all(fd, index.data(), n * sizeof(archive_index), hdr.index_off) ||
+            !write_all(fd, &hdr, sizeof(hdr), 0) || fsync(fd) < 0) {
+            err = errno;
+        }
+    }
+    if (close(fd) < 0 && !err) {
+        err = errno;
+    }
+    if (!err && rename(tmp.c_str(), file) < 0) {
+        err = errno;
+    }
+    if (!err && sync_dir(file) < 0) {
+        return -1;
+    }
+    if (err) {
+        unlink(tmp.c_str());
+        errno = err;
+        return -1;
+    }
+
+    if (st) {
+        st->keys    = n;
+        st->bytes   = hdr.data_off + n * hdr.entry_size;
+        st->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    return 0;
+}
+
+/*
+    Read
+*/
+WBAES_ARCHIVE *wbaes_archive_open(const char *file) {
+    WBAES_ARCHIVE *ar = new WBAES_ARCHIVE();
+    struct stat st;
+    size_t len, i;
+    bool ok;
+
+    if ((ar->fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        delete ar;
+        return NULL;
+    }
+
+    ok = fstat(ar->fd, &st) == 0 &&
+         pread(ar->fd, &ar->hdr, sizeof(ar->hdr), 0) == sizeof(ar->hdr) &&
+         !memcmp(ar->hdr.magic, ARCHIVE_MAGIC, 8) &&
+         ar->hdr.version    == WBAES_ARCHIVE_VERSION &&
+         ar->hdr.table_size == sizeof(WBAES_ENCRYPTION_TABLE) &&
+         ar->hdr.ext_size   == sizeof(WBAES_EXT_ENCODING);
+
+    if (ok) {
+        len = ar->hdr.count * sizeof(archive_index);
+        ar->index.resize(ar->hdr.count);
+        ok = pread(ar->fd, ar->index.data(), len, ar->hdr.index_off) == (ssize_t)len &&
+             wbaes_crc32c(0, ar->index.data(), len) == ar->hdr.index_crc;
+    }
+    for (i = 0; ok && i < ar->index.size(); i++) {
+        ar->index[i].id[WBAES_KEY_ID_MAX - 1] = '\0';
+        ok = ar->index[i].offset + entry_bytes() <= (uint64_t)st.st_size;     // a short file would SIGBUS the mapping
+    }
+
+    if (!ok) {
+        wbaes_archive_close(ar);
+        return NULL;
+    }
+    return ar;
+}
+
+void wbaes_archive_close(WBAES_ARCHIVE *ar) {
+    if (!ar) {
+        return;
+    }
+    close(ar->fd);
+    delete ar;
+}
+
+size_t wbaes_archive_count(const WBAES_ARCHIVE *ar) {
+    return ar->index.size();
+}
+
+const char *wbaes_archive_id(const WBAES_ARCHIVE *ar, size_t i) {
+    return i < ar->index.size() ? ar->index[i].id : NULL;
+}
+
+long wbaes_archive_find(const WBAES_ARCHIVE *ar, const char *id) {
+    auto it = std::lower_bound(ar->index.begin(), ar->index.end(), id,
+                               [](const archive_index &x, const char *k) { return strcmp(x.id, k) < 0; });
+
+    return (it != ar->index.end() && !strcmp(it->id, id)) ? it - ar->index.begin() : -1;
+}
+
+int wbaes_archive_map(const WBAES_ARCHIVE *ar, size_t i, WBAES_ARCHIVE_ENTRY *e, bool check) {
+    WBAES_METRIC_START(t);
+    uint64_t page = sysconf(_SC_PAGESIZE), start, head;
+    uint8_t *p;
+
+    if (i >= ar->index.size()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    start = ar->index[i].offset / page * page;
+    head  = ar->index[i].offset - start;
+
+    p = (uint8_t *)mmap(NULL, head + entry_bytes(), PROT_READ, MAP_SHARED, ar->fd, start);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    if (check && wbaes_crc32c(0, p + head, entry_bytes()) != ar->index[i].crc) {
+        munmap(p, head + entry_bytes());
+        errno = EBADMSG;
+        return -1;
+    }
+
+    e->map     = p;
+    e->map_len = head + entry_bytes();
+    e->et      = (const WBAES_ENCRYPTION_TABLE *)(p + head);
+    e->ee      = (const WBAES_EXT_ENCODING *)(p + head + sizeof(WBAES_ENCRYPTION_TABLE));
+
+    WBAES_METRIC_DONE(WBAES_API_ARCHIVE_MAP, 0, entry_bytes(), t);      // mapped entries only
+    return 0;
+}
+
+void wbaes_archive_unmap(WBAES_ARCHIVE_ENTRY *e) {
+    if (e->map) {
+        munmap(e->map, e->map_len);
+        e->map = NULL;
+    }
+}
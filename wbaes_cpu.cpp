@@ -0,0 +1,114 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - CPU feature detection and kernel dispatch
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#include "wbaes.h"
+#include "wbaes_cpu.h"
+
+static const char *level_names[WBAES_KERNEL_LEVELS] = {
+    "scalar", "ssse3", "avx2", "avx512"
+};
+
+static WBAES_KERNELS  levels[WBAES_KERNEL_LEVELS];
+static WBAES_KERNEL   cpu_level;
+static bool           cpu_aesni;
+static bool           cpu_gfni;
+static WBAES_KERNELS *bound;
+static std::once_flag detect_once;
+
+static void detect() {
+    WBAES_KERNEL forced = WBAES_KERNEL_AVX512;
+    const char *env = getenv("WBAES_KERNEL");
+    int l;
+
+    cpu_level = WBAES_KERNEL_SCALAR;
+    cpu_aesni = false;
+    cpu_gfni  = false;
+
+    #if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        cpu_level = WBAES_KERNEL_SSSE3;
+        cpu_aesni = __builtin_cpu_supports("aes");
+        cpu_gfni  = __builtin_cpu_supports("gfni");
+    }
+    if (cpu_level == WBAES_KERNEL_SSSE3 && __builtin_cpu_supports("avx2")) {
+        cpu_level = WBAES_KERNEL_AVX2;
+    }
+    if (cpu_level == WBAES_KERNEL_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        cpu_level = WBAES_KERNEL_AVX512;
+    }
+    #endif
+
+    for (l = 0; l < WBAES_KERNEL_LEVELS; l++) {
+        WBAES_KERNELS &k = levels[l];
+
+        k.level             = (WBAES_KERNEL)l;
+        k.aesni             = cpu_aesni && l >= WBAES_KERNEL_SSSE3;
+        k.gfni              = cpu_gfni && l >= WBAES_KERNEL_SSSE3;
+        k.lanes             = WBAES_BATCH_LANES;
+        k.encrypt_block     = wbaes_encrypt_block_scalar;
+        k.encrypt_blocks    = wbaes_encrypt_blocks_scalar;
+        k.encode_ext_blocks = encode_ext_blocks_scalar;
+        k.aes_encrypt       = k.aesni ? aes_encrypt_aesni : aes32_encrypt;
+        k.gf2_linear_bytes  = k.gfni ? gf2_linear_bytes_gfni : gf2_linear_bytes_scalar;
+        k.gf2_sbox_bytes    = k.gfni ? gf2_sbox_bytes_gfni : gf2_sbox_bytes_scalar;
+
+        if (l >= WBAES_KERNEL_SSSE3) {
+            k.encode_ext_blocks = encode_ext_blocks_ssse3;
+        }
+        if (l >= WBAES_KERNEL_AVX2) {
+            k.encrypt_block  = wbaes_encrypt_block_avx2;
+            k.encrypt_blocks = wbaes_encrypt_blocks_avx2;
+            k.lanes          = 8;
+        }
+        if (l >= WBAES_KERNEL_AVX512) {
+            k.encrypt_block  = wbaes_encrypt_block_avx512;
+            k.encrypt_blocks = wbaes_encrypt_blocks_avx512;
+            k.lanes          = 16;
+        }
+    }
+
+    if (env && *env) {
+        for (l = 0; l < WBAES_KERNEL_LEVELS && strcmp(env, level_names[l]) != 0; l++);
+
+        if (l == WBAES_KERNEL_LEVELS) {
+            fprintf(stderr, "wbaes: unknown WBAES_KERNEL=%s, ignored\n", env);
+        }
+        else if (l > cpu_level) {
+            fprintf(stderr, "wbaes: WBAES_KERNEL=%s not supported by this CPU, using %s\n", env, level_names[cpu_level]);
+        }
+        else {
+            forced = (WBAES_KERNEL)l;
+        }
+    }
+
+    bound = &levels[forced < cpu_level ? forced : cpu_level];
+}
+
+WBAES_KERNEL wbaes_cpu_level() {
+    std::call_once(detect_once, detect);
+    return cpu_level;
+}
+
+const WBAES_KERNELS &wbaes_kernels() {
+    std::call_once(detect_once, detect);
+    return *bound;
+}
+
+const WBAES_KERNELS *wbaes_kernels_at(WBAES_KERNEL level) {
+    std::call_once(detect_once, detect);
+    return (level >= 0 && level <= cpu_level) ? &levels[level] : NULL;
+}
+
+const char *wbaes_kernel_name(WBAES_KERNEL level) {
+    return (level >= 0 && level < WBAES_KERNEL_LEVELS) ? level_names[level] : "unknown";
+}
+
+void aes_encrypt(byte pt[16], u32 rk[11][4], byte ct[16]) {
+    wbaes_kernels().aes_encrypt(pt, rk, ct);
+}
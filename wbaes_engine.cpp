@@ -0,0 +1,432 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Asynchronous submission/completion engine
+*/
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "wbaes_engine.h"
+#include "wbaes_numa.h"
+#include "wbaes_ring.h"
+
+#define ENGINE_SPIN     256
+
+
+/*
+    Per-node submission queue, workers of a node drain their own queue
+    first and only steal from remote nodes when it runs dry
+*/
+struct engine_node {
+    WBAES_RING<WBAES_JOB *>  sq;
+
+    /* slow path for idle workers */
+    std::mutex               lock;
+    std::condition_variable  cv;
+    std::atomic<int>         sleepers;
+
+    engine_node(size_t d) : sq(d), sleepers(0) {}
+};
+
+/*
+    Registered table, resolved to the replica of the worker's node
+*/
+struct engine_table {
+    const WBAES_ENCRYPTION_TABLE *et;
+    WBAES_TABLE_REPLICAS          rep;
+};
+
+struct WBAES_ENGINE {
+    std::vector<engine_node *> nodes;
+    WBAES_RING<WBAES_JOB *>    cq;
+
+    std::atomic<size_t>        in_flight;
+    size_t                     depth;
+    int                        efd;
+
+    std::vector<std::thread>   workers;
+    std::atomic<bool>          stop;
+
+    engine_table               tables[WBAES_ENGINE_MAX_TABLES];
+    std::atomic<size_t>        n_tables;
+    std::mutex                 tables_lock;
+
+    WBAES_ENGINE(size_t d) : cq(d), in_flight(0), depth(d), efd(-1), stop(false), n_tables(0) {}
+};
+
+/*
+    Batch assembly
+     - a slot remembers which job and which block of it sits in the batch
+*/
+struct batch_slot {
+    WBAES_JOB *job;
+    size_t     blk;
+};
+
+struct job_cursor {
+    WBAES_JOB *job;
+    size_t     next;        // next block to schedule
+    size_t     blocks;      // total blocks
+};
+
+static inline void signal_efd(int efd, uint64_t n) {
+    /* fails only when the counter saturates, consumers are signalled then anyway */
+    ssize_t ret = write(efd, &n, sizeof(n));
+    (void)ret;
+}
+
+static inline bool same_key(const WBAES_JOB *a, const WBAES_JOB *b) {
+    return a->et == b->et && a->ee == b->ee;
+}
+
+static void scatter(const batch_slot *slots, const uint8_t *buf, size_t n) {
+    size_t i, j, off, bytes;
+
+    for (i = 0; i < n; i++) {
+        WBAES_JOB *job = slots[i].job;
+        const uint8_t *blk = buf + 16*i;
+
+        off = 16 * slots[i].blk;
+        if (job->mode == WBAES_JOB_ECB) {
+            memcpy(job->out + off, blk, 16);
+        }
+        else {
+            bytes = (job->len - off < 16) ? job->len - off : 16;
+            for (j = 0; j < bytes; j++) {
+                job->out[off+j] = job->in[off+j] ^ blk[j];
+            }
+        }
+    }
+}
+
+static const WBAES_ENCRYPTION_TABLE &local_table(WBAES_ENGINE *eng, const WBAES_ENCRYPTION_TABLE *et, int node) {
+    size_t i, n = eng->n_tables.load(std::memory_order_acquire);
+
+    for (i = 0; i < n; i++) {
+        if (eng->tables[i].et == et) {
+            return wbaes_table_local(eng->tables[i].rep, node);
+        }
+    }
+
+    return *et;
+}
+
+static void process_jobs(WBAES_ENGINE *eng, int node, job_cursor *cur, size_t n_jobs) {
+    uint8_t    buf[16 * WBAES_ENGINE_BATCH_BLOCKS];
+    batch_slot slots[WBAES_ENGINE_BATCH_BLOCKS];
+    size_t     i, n, first;
+
+    for (first = 0; first < n_jobs; ) {
+        const WBAES_JOB *key = cur[first].job;
+
+        /*
+            Fills one batch from every pending job that shares the table
+        */
+        n = 0;
+        for (i = first; i < n_jobs && n < WBAES_ENGINE_BATCH_BLOCKS; i++) {
+            if (!cur[i].job || !same_key(cur[i].job, key)) {
+                continue;
+            }
+
+            while (cur[i].next < cur[i].blocks && n < WBAES_ENGINE_BATCH_BLOCKS) {
+                WBAES_JOB *job = cur[i].job;
+                uint8_t   *blk = buf + 16*n;
+
+                if (job->mode == WBAES_JOB_ECB) {
+                    memcpy(blk, job->in + 16*cur[i].next, 16);
+                }
+                else {
+                    memcpy(blk, job->iv, 16);
+                    if (job->mode == WBAES_JOB_CTR32) {
+                        wbaes_ctr_add32(blk, cur[i].next);
+                    }
+                    else {
+                        wbaes_ctr_add(blk, cur[i].next);
+                    }
+                }
+
+                slots[n].job = job;
+                slots[n].blk = cur[i].next++;
+                n++;
+            }
+        }
+
+        if (n) {
+            wbaes_encrypt_blocks_ext(local_table(eng, key->et, node), key->ee, buf, n);
+            scatter(slots, buf, n);
+        }
+
+        /*
+            Posts finished jobs
+        */
+        for (i = first; i < n_jobs; i++) {
+            if (cur[i].job && cur[i].next == cur[i].blocks) {
+                cur[i].job->status = 0;
+                while (!eng->cq.push(cur[i].job)) {
+                    std::this_thread::yield();
+                }
+                cur[i].job = NULL;
+            }
+        }
+
+        while (first < n_jobs && !cur[first].job) {
+            first++;
+        }
+    }
+}
+
+static size_t pop_jobs(WBAES_ENGINE *eng, int node, job_cursor *cur) {
+    WBAES_JOB *job;
+    size_t n = 0, i, k = eng->nodes.size();
+
+    for (i = 0; i < k && n == 0; i++) {
+        WBAES_RING<WBAES_JOB *> &sq = eng->nodes[(node + i) % k]->sq;
+
+        for (; n < WBAES_ENGINE_MAX_JOBS && sq.pop(job); n++) {
+            cur[n].job    = job;
+            cur[n].next   = 0;
+            cur[n].blocks = (job->len + 15) / 16;
+        }
+    }
+
+    return n;
+}
+
+static bool queues_empty(const WBAES_ENGINE *eng) {
+    size_t i;
+
+    for (i = 0; i < eng->nodes.size(); i++) {
+        if (!eng->nodes[i]->sq.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void worker_main(WBAES_ENGINE *eng, int node) {
+    job_cursor   cur[WBAES_ENGINE_MAX_JOBS];
+    engine_node *self = eng->nodes[node];
+    size_t       n, spin = 0;
+
+    /* an unbound worker still serves its ring, from remote memory */
+    if (eng->nodes.size() > 1 && wbaes_numa_bind_thread(node) < 0) {
+        fprintf(stderr, "wbaes: engine worker not bound to node %d: %s\n", node, strerror(errno));
+    }
+
+    while (!eng->stop.load(std::memory_order_acquire) || !queues_empty(eng)) {
+        n = pop_jobs(eng, node, cur);
+
+        if (n) {
+            process_jobs(eng, node, cur, n);
+
+            signal_efd(eng->efd, n);
+            spin = 0;
+            continue;
+        }
+
+        if (++spin < ENGINE_SPIN) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        /*
+            Sleeps until a producer signals, the timeout only guards against a missed wakeup
+            (and bounds the delay to steal work queued on other nodes)
+        */
+        std::unique_lock<std::mutex> guard(self->lock);
+        self->sleepers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (self->sq.empty() && !eng->stop.load()) {
+            self->cv.wait_for(guard, std::chrono::milliseconds(10));
+        }
+        self->sleepers.fetch_sub(1);
+        spin = 0;
+    }
+}
+
+WBAES_ENGINE *wbaes_engine_create(unsigned workers, size_t depth) {
+    unsigned i;
+    int n, nodes;
+    WBAES_ENGINE *eng;
+
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+        workers = workers ? workers : 1;
+    }
+
+    depth = depth ? depth : 1024;
+    nodes = wbaes_numa_nodes();
+
+    eng = new WBAES_ENGINE(depth);
+    eng->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eng->efd < 0) {
+        delete eng;
+        return NULL;
+    }
+
+    for (n = 0; n < nodes; n++) {
+        eng->nodes.push_back(new engine_node(depth));
+    }
+
+    /*
+        Workers are spread round-robin over the nodes and bound to them
+    */
+    for (i = 0; i < workers; i++) {
+        eng->workers.emplace_back(worker_main, eng, (int)(i % nodes));
+    }
+
+    return eng;
+}
+
+void wbaes_engine_destroy(WBAES_ENGINE *eng) {
+    if (!eng) {
+        return;
+    }
+
+    size_t i;
+
+    eng->stop.store(true, std::memory_order_release);
+    for (i = 0; i < eng->nodes.size(); i++) {
+        std::lock_guard<std::mutex> guard(eng->nodes[i]->lock);
+        eng->nodes[i]->cv.notify_all();
+    }
+    for (auto &t : eng->workers) {
+        t.join();
+    }
+
+    for (i = 0; i < eng->nodes.size(); i++) {
+        delete eng->nodes[i];
+    }
+    for (i = 0; i < eng->n_tables.load(); i++) {
+        wbaes_table_replicas_free(eng->tables[i].rep);
+    }
+
+    close(eng->efd);
+    delete eng;
+}
+
+int wbaes_engine_submit(WBAES_ENGINE *eng, WBAES_JOB *job) {
+    if (!job->et || (job->len && (!job->in || !job->out))) {
+        return -EINVAL;
+    }
+    if (job->mode == WBAES_JOB_ECB ? (job->len % 16) != 0 : ((job->mode != WBAES_JOB_CTR && job->mode != WBAES_JOB_CTR32) || !job->ee)) {
+        return -EINVAL;
+    }
+
+    /*
+        Bounds the jobs in flight (submitted but not yet reaped),
+        so that the completion ring never overflows
+    */
+    if (eng->in_flight.fetch_add(1, std::memory_order_acq_rel) >= eng->depth) {
+        eng->in_flight.fetch_sub(1, std::memory_order_acq_rel);
+        return -EAGAIN;
+    }
+
+    /*
+        Routes the job to the submitting thread's node
+    */
+    engine_node *node = eng->nodes[eng->nodes.size() > 1 ? wbaes_numa_current_node() % eng->nodes.size() : 0];
+
+    job->status = -EINPROGRESS;
+    while (!node->sq.push(job)) {
+        std::this_thread::yield();
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (node->sleepers.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> guard(node->lock);
+        node->cv.notify_one();
+    }
+
+    return 0;
+}
+
+int wbaes_engine_add_table(WBAES_ENGINE *eng, const WBAES_ENCRYPTION_TABLE *et, int flags) {
+    std::lock_guard<std::mutex> guard(eng->tables_lock);
+    size_t i, n = eng->n_tables.load(std::memory_order_relaxed);
+
+    for (i = 0; i < n; i++) {
+        if (eng->tables[i].et == et) {
+            return 0;
+        }
+    }
+    if (n == WBAES_ENGINE_MAX_TABLES) {
+        return -ENOSPC;
+    }
+
+    if (wbaes_table_replicate(*et, eng->tables[n].rep, flags) != 0) {
+        return errno ? -errno : -ENOMEM;
+    }
+    eng->tables[n].et = et;
+    eng->n_tables.store(n + 1, std::memory_order_release);
+
+    return 0;
+}
+
+size_t wbaes_engine_poll(WBAES_ENGINE *eng, WBAES_JOB **done, size_t max) {
+    size_t   n;
+    uint64_t cnt;
+
+    /* resets the eventfd, fails with EAGAIN if nothing was signalled */
+    ssize_t ret = read(eng->efd, &cnt, sizeof(cnt));
+    (void)ret;
+
+    for (n = 0; n < max && eng->cq.pop(done[n]); n++);
+
+    if (n) {
+        eng->in_flight.fetch_sub(n, std::memory_order_acq_rel);
+    }
+
+    /* re-arms the eventfd for completions left behind */
+    if (n == max && !eng->cq.empty()) {
+        signal_efd(eng->efd, 1);
+    }
+
+    return n;
+}
+
+/*
+    The deadline is fixed on entry: a wakeup that finds nothing (another consumer took the
+    completions, or EINTR) polls again for the time left, never for the whole timeout
+*/
+size_t wbaes_engine_wait(WBAES_ENGINE *eng, WBAES_JOB **done, size_t max, int timeout_ms) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : 0);
+    size_t n;
+    int    left = timeout_ms;
+    struct pollfd pfd;
+
+    pfd.fd     = eng->efd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        n = wbaes_engine_poll(eng, done, max);
+        if (n || left == 0) {
+            return n;
+        }
+
+        if (poll(&pfd, 1, left) < 0 && errno != EINTR) {
+            return wbaes_engine_poll(eng, done, max);
+        }
+
+        if (timeout_ms > 0) {
+            /* rounded up, so a sub-millisecond rest is still waited for */
+            auto rest = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now()).count();
+            left = rest > 0 ? (int)((rest + 999) / 1000) : 0;
+        }
+    }
+}
+
+int wbaes_engine_eventfd(const WBAES_ENGINE *eng) {
+    return eng->efd;
+}
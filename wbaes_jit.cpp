@@ -0,0 +1,333 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Straight-line x86-64 encryption code per table
+*/
+#include <cerrno>
+#include <random>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "wbaes.h"
+#include "wbaes_jit.h"
+
+extern uint8_t     shift_map[16];
+
+#define JIT_CHECK_BLOCKS    64
+
+
+#if defined(__x86_64__)
+
+/*
+    Emitted code (System V, rdi = blocks, rsi = n for the batched entry)
+     - rbx holds the table address, every lookup is [rbx + index + fixed offset]
+     - a round reads the state at rdi through ShiftRows into the red zone ([rsp-16]) with the
+       T-boxes and writes it back to rdi with the MBL tables; column words live in r8d..r11d,
+       eax / ecx / edx / esi are scratch
+     - the last round goes through the red zone as well, ShiftRows reads across columns
+*/
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12 };
+
+#define JIT_RED_ZONE    (-16)
+
+struct jit_asm {
+    std::vector<uint8_t> code;
+
+    void b(uint8_t x) {
+        code.push_back(x);
+    }
+    void d32(uint32_t x) {
+        for (int i = 0; i < 4; i++) {
+            b((uint8_t)(x >> (8*i)));
+        }
+    }
+    void rex(bool w, int reg, int index, int base) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+
+        if (r != 0x40) {
+            b(r);
+        }
+    }
+
+    /* op reg, rm (register form) */
+    void rr(const uint8_t *op, int n, int reg, int rm, bool w = false) {
+        rex(w, reg & 8, 0, rm & 8);
+        code.insert(code.end(), op, op + n);
+        b(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    /* op reg, [base + index * scale + disp], index < 0 for none */
+    void rm(const uint8_t *op, int n, int reg, int base, int index, int scale, int32_t disp) {
+        bool    d8  = disp >= -128 && disp < 128;
+        uint8_t mod = d8 ? 0x40 : 0x80;
+
+        rex(false, reg & 8, index < 0 ? 0 : index & 8, base & 8);
+        code.insert(code.end(), op, op + n);
+        if (index < 0 && (base & 7) != RSP) {
+            b(mod | ((reg & 7) << 3) | (base & 7));
+        }
+        else {
+            b(mod | ((reg & 7) << 3) | 4);
+            b((uint8_t)(((scale == 4 ? 2 : 0) << 6) | ((index < 0 ? RSP : index) & 7) << 3 | (base & 7)));
+        }
+        if (d8) {
+            b((uint8_t)disp);
+        }
+        else {
+            d32((uint32_t)disp);
+        }
+    }
+
+    void mov(int dst, int src) {
+        static const uint8_t op[] = { 0x8b };
+        rr(op, 1, dst, src);
+    }
+    void or_(int dst, int src) {
+        static const uint8_t op[] = { 0x0b };
+        rr(op, 1, dst, src);
+    }
+    void shift(int r, int n) {
+        static const uint8_t op[] = { 0xc1 };
+
+        if (n > 0) {
+            rr(op, 1, 5, r);                // shr
+            b((uint8_t)n);
+        }
+        else if (n < 0) {
+            rr(op, 1, 4, r);                // shl
+            b((uint8_t)-n);
+        }
+    }
+    void and_(int r, uint32_t imm) {
+        static const uint8_t op8[] = { 0x83 }, op32[] = { 0x81 };
+
+        if (imm < 0x80) {
+            rr(op8, 1, 4, r);
+            b((uint8_t)imm);
+        }
+        else {
+            rr(op32, 1, 4, r);
+            d32(imm);
+        }
+    }
+    void load8(int dst, int base, int index, int32_t disp) {
+        static const uint8_t op[] = { 0x0f, 0xb6 };  // movzx r32, byte
+        rm(op, 2, dst, base, index, 1, disp);
+    }
+    void load32(int dst, int base, int index, int32_t disp) {
+        static const uint8_t op[] = { 0x8b };
+        rm(op, 1, dst, base, index, 4, disp);
+    }
+    void store8(int src, int base, int32_t disp) {
+        static const uint8_t op[] = { 0x88 };       // al / cl / dl only
+        rm(op, 1, src, base, -1, 1, disp);
+    }
+    void copy16(int dst, int32_t ddisp, int src, int32_t sdisp) {
+        static const uint8_t ld[] = { 0xf3, 0x0f, 0x6f }, st[] = { 0xf3, 0x0f, 0x7f };   // movdqu xmm0
+        rm(ld, 3, 0, src, -1, 1, sdisp);
+        rm(st, 3, 0, dst, -1, 1, ddisp);
+    }
+};
+
+/* displacement of a table from rbx */
+static inline int32_t jit_off(const WBAES_ENCRYPTION_TABLE &et, const void *p) {
+    return (int32_t)((const uint8_t *)p - (const uint8_t *)&et);
+}
+
+/* index register = nibble s of x, nibble s of y: ((x >> s) & 0xf) << 4 | (y >> s) & 0xf, in ecx */
+static void jit_pair(jit_asm &a, int x, int y, int s) {
+    a.mov(RCX, x);
+    a.shift(RCX, s - 4);
+    a.and_(RCX, 0xf0);
+    a.mov(RDX, y);
+    a.shift(RDX, s);
+    a.and_(RDX, 0x0f);
+    a.or_(RCX, RDX);
+}
+
+/* one output nibble of a column: xor_tables[n3][xor_tables[n1][a][b]][xor_tables[n2][c][d]], in eax */
+static void jit_nibble(jit_asm &a, int32_t x1, int32_t x2, int32_t x3, int s) {
+    jit_pair(a, R8, R9, s);
+    a.load8(RAX, RBX, RCX, x1);
+    jit_pair(a, R10, R11, s);
+    a.load8(RDX, RBX, RCX, x2);
+    a.shift(RAX, -4);
+    a.or_(RAX, RDX);
+    a.load8(RAX, RBX, RAX, x3);
+}
+
+/* ref_table() with the input permuted by map */
+static void jit_stage(jit_asm &a, const WBAES_ENCRYPTION_TABLE &et, const uint32_t (*tables)[256], const uint8_t (*xor_tables)[16][16],
+                      int src, int32_t src_disp, const uint8_t *map, int dst, int32_t dst_disp) {
+    int i, k, q;
+
+    for (i = 0; i < 4; i++) {
+        for (k = 0; k < 4; k++) {
+            a.load8(RAX, src, -1, src_disp + map[i*4+k]);
+            a.load32(R8 + k, RBX, RAX, jit_off(et, tables[i*4+k]));
+        }
+        for (q = 0; q < 4; q++) {
+            jit_nibble(a, jit_off(et, xor_tables[i*16+2*q]), jit_off(et, xor_tables[i*16+8+2*q]), jit_off(et, xor_tables[64+i*8+2*q]), 28 - 8*q);
+            a.shift(RAX, -4);
+            a.mov(RSI, RAX);
+            jit_nibble(a, jit_off(et, xor_tables[i*16+2*q+1]), jit_off(et, xor_tables[i*16+9+2*q]), jit_off(et, xor_tables[64+i*8+2*q+1]), 24 - 8*q);
+            a.or_(RAX, RSI);
+            a.store8(RAX, dst, dst_disp + i*4+q);
+        }
+    }
+}
+
+/* encrypts the block at rdi */
+static void jit_body(jit_asm &a, const WBAES_ENCRYPTION_TABLE &et) {
+    static const uint8_t id_map[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    int r, i;
+
+    for (r = 0; r < 9; r++) {
+        jit_stage(a, et, et.ty_boxes[r],   et.r1_xor_tables[r], RDI, 0, shift_map, RSP, JIT_RED_ZONE);
+        jit_stage(a, et, et.mbl_tables[r], et.r2_xor_tables[r], RSP, JIT_RED_ZONE, id_map, RDI, 0);
+    }
+    for (i = 0; i < 16; i++) {
+        a.load8(RAX, RDI, -1, shift_map[i]);
+        a.load8(RAX, RBX, RAX, jit_off(et, et.last_box[i]));
+        a.store8(RAX, RSP, JIT_RED_ZONE + i);
+    }
+    a.copy16(RDI, 0, RSP, JIT_RED_ZONE);
+}
+
+static void jit_table_base(jit_asm &a, const WBAES_ENCRYPTION_TABLE &et) {
+    uint64_t p = (uint64_t)(uintptr_t)&et;
+
+    a.b(0x48); a.b(0xb8 + RBX);             // mov rbx, imm64
+    a.d32((uint32_t)p);
+    a.d32((uint32_t)(p >> 32));
+}
+
+/*
+    encrypt(pt):            push rbx; mov rbx, et; body; pop rbx; ret
+    encrypt_blocks(p, n):   push rbx; push r12; mov rbx, et; mov r12, rsi
+                      loop: test r12, r12; jz done; body; add rdi, 16; dec r12; jmp loop
+                      done: pop r12; pop rbx; ret
+*/
+static size_t jit_emit(jit_asm &a, const WBAES_ENCRYPTION_TABLE &et) {
+    size_t  blocks, loop, jz, end;
+    int32_t rel;
+
+    a.b(0x53);
+    jit_table_base(a, et);
+    jit_body(a, et);
+    a.b(0x5b);
+    a.b(0xc3);
+
+    while (a.code.size() % 64) {
+        a.b(0xcc);
+    }
+    blocks = a.code.size();
+
+    a.b(0x53);
+    a.b(0x41); a.b(0x54);
+    jit_table_base(a, et);
+    a.b(0x49); a.b(0x89); a.b(0xf4);        // mov r12, rsi
+    loop = a.code.size();
+    a.b(0x4d); a.b(0x85); a.b(0xe4);        // test r12, r12
+    a.b(0x0f); a.b(0x84); a.d32(0);         // jz done
+    jz = a.code.size();
+    jit_body(a, et);
+    a.b(0x48); a.b(0x83); a.b(0xc7); a.b(0x10);     // add rdi, 16
+    a.b(0x49); a.b(0xff); a.b(0xcc);                // dec r12
+    a.b(0xe9); a.d32((uint32_t)(int32_t)(loop - (a.code.size() + 4)));
+    end = a.code.size();
+    rel = (int32_t)(end - jz);
+    memcpy(&a.code[jz - 4], &rel, 4);
+    a.b(0x41); a.b(0x5c);
+    a.b(0x5b);
+    a.b(0xc3);
+
+    return blocks;
+}
+
+static bool jit_check(const WBAES_JIT *jit) {
+    std::mt19937 rng(std::random_device{}());
+    uint8_t ref[JIT_CHECK_BLOCKS][16], out[JIT_CHECK_BLOCKS][16], one[16];
+    size_t  i, j;
+
+    for (i = 0; i < JIT_CHECK_BLOCKS; i++) {
+        for (j = 0; j < 16; j++) {
+            ref[i][j] = (uint8_t)rng();
+        }
+    }
+    memcpy(out, ref, sizeof(ref));
+
+    wbaes_jit_encrypt_blocks(jit, out[0], JIT_CHECK_BLOCKS);
+    for (i = 0; i < JIT_CHECK_BLOCKS; i++) {
+        memcpy(one, ref[i], 16);
+        wbaes_jit_encrypt(jit, one);
+        wbaes_encrypt(*jit->et, ref[i]);
+        if (memcmp(one, ref[i], 16) || memcmp(out[i], ref[i], 16)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+WBAES_JIT *wbaes_jit_compile(const WBAES_ENCRYPTION_TABLE &et) {
+    WBAES_JIT *jit;
+    jit_asm    a;
+    size_t     page = (size_t)sysconf(_SC_PAGESIZE), blocks;
+    void      *code;
+    int        err;
+
+    blocks = jit_emit(a, et);
+
+    jit = new WBAES_JIT();
+    jit->et   = &et;
+    jit->size = (a.code.size() + page - 1) & ~(page - 1);
+
+    code = mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        err = errno;
+        delete jit;
+        errno = err;
+        return NULL;
+    }
+    memcpy(code, a.code.data(), a.code.size());
+    if (mprotect(code, jit->size, PROT_READ | PROT_EXEC) < 0) {
+        err = errno;
+        munmap(code, jit->size);
+        delete jit;
+        errno = err;
+        return NULL;
+    }
+
+    jit->code           = code;
+    jit->encrypt        = (void (*)(uint8_t *))code;
+    jit->encrypt_blocks = (void (*)(uint8_t *, size_t))((uint8_t *)code + blocks);
+
+    if (!jit_check(jit)) {
+        wbaes_jit_free(jit);
+        errno = EIO;
+        return NULL;
+    }
+    return jit;
+}
+
+void wbaes_jit_free(WBAES_JIT *jit) {
+    if (jit) {
+        munmap(jit->code, jit->size);
+        delete jit;
+    }
+}
+
+#else
+
+WBAES_JIT *wbaes_jit_compile(const WBAES_ENCRYPTION_TABLE &et) {
+    (void)et;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void wbaes_jit_free(WBAES_JIT *jit) {
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - AES-NI oracle (built with -maes -mssse3)
+*/
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#include "wbaes_cpu.h"
+
+/*
+    Round keys are 32-bit words in big-endian order (GETU32),
+    aesenc wants the bytes of the key in memory order
+*/
+static inline __m128i load_rk(const u32 *rk) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)rk), bswap);
+}
+
+void aes_encrypt_aesni(byte pt[16], u32 rk[11][4], byte ct[16]) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt), load_rk(rk[0]));
+    int r;
+
+    for (r = 1; r < 10; r++) {
+        x = _mm_aesenc_si128(x, load_rk(rk[r]));
+    }
+
+    _mm_storeu_si128((__m128i *)ct, _mm_aesenclast_si128(x, load_rk(rk[10])));
+}
@@ -0,0 +1,98 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - AVX2 kernel (built with -mavx2)
+*/
+#include <immintrin.h>
+
+#include "wbaes_cpu.h"
+#include "wbaes_kernel_gather.h"
+
+namespace {
+
+struct avx2 {
+    typedef __m256i vec;
+    static const int LANES = 8;
+
+    template <int scale>
+    static vec gather(const void *base, vec idx)    { return _mm256_i32gather_epi32((const int *)base, idx, scale); }
+    static vec load(const uint32_t *p)              { return _mm256_loadu_si256((const __m256i *)p); }
+    static void store(uint32_t *p, vec x)           { _mm256_storeu_si256((__m256i *)p, x); }
+    static vec set1(int x)                          { return _mm256_set1_epi32(x); }
+    static vec add(vec a, vec b)                    { return _mm256_add_epi32(a, b); }
+    static vec and_(vec a, vec b)                   { return _mm256_and_si256(a, b); }
+    static vec or_(vec a, vec b)                    { return _mm256_or_si256(a, b); }
+    static vec slli4(vec a)                         { return _mm256_slli_epi32(a, 4); }
+    static vec srl(vec a, __m128i n)                { return _mm256_srl_epi32(a, n); }
+};
+
+}
+
+typedef WBAES_GATHER_KERNEL<avx2> kernel;
+
+void wbaes_encrypt_blocks_avx2(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n) {
+    kernel::encrypt_blocks(et, blocks, n);
+}
+
+/*
+    Single block
+     - one vector per column, lane k holds nibble k (k = 0: bits 31-28) of the column words:
+       the 8 a^b and the 8 c^d lookups of the first XOR level are one gather each,
+       the second level one more, 12 gathers and 2 for the T-boxes per stage
+     - lane k of the second level is nibble k of the column output, byte k/2 of it
+       is the high nibble for k even; pairs are merged in the 64-bit lanes
+*/
+static inline __m256i column_nibbles(__m256i a, __m256i b) {
+    const __m256i sh = _mm256_setr_epi32(28, 24, 20, 16, 12, 8, 4, 0);
+    const __m256i f  = _mm256_set1_epi32(0xf);
+
+    return _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(_mm256_srlv_epi32(a, sh), f), 4), _mm256_and_si256(_mm256_srlv_epi32(b, sh), f));
+}
+
+static __m128i block_stage(const uint32_t (*tables)[256], const uint8_t (*xor_tables)[16][16], __m128i in, __m128i map) {
+    const uint8_t *flat = &xor_tables[0][0][0];
+    const __m256i  k256 = _mm256_setr_epi32(0, 256, 2*256, 3*256, 4*256, 5*256, 6*256, 7*256);
+    __m128i x = _mm_shuffle_epi8(in, map);
+    __m256i w[2], u = _mm256_setzero_si256();
+    int c;
+
+    w[0] = _mm256_i32gather_epi32((const int *)tables[0], _mm256_add_epi32(k256, _mm256_cvtepu8_epi32(x)), 4);
+    w[1] = _mm256_i32gather_epi32((const int *)tables[8], _mm256_add_epi32(k256, _mm256_cvtepu8_epi32(_mm_srli_si128(x, 8))), 4);
+
+    for (c = 0; c < 4; c++) {
+        __m256i col = _mm256_set1_epi32((c & 1) * 4);
+        __m256i a   = _mm256_permutevar8x32_epi32(w[c >> 1], col);
+        __m256i b   = _mm256_permutevar8x32_epi32(w[c >> 1], _mm256_add_epi32(col, _mm256_set1_epi32(1)));
+        __m256i cc  = _mm256_permutevar8x32_epi32(w[c >> 1], _mm256_add_epi32(col, _mm256_set1_epi32(2)));
+        __m256i d   = _mm256_permutevar8x32_epi32(w[c >> 1], _mm256_add_epi32(col, _mm256_set1_epi32(3)));
+        __m256i ab, cd, n;
+
+        ab = kernel::gather_u8(flat, _mm256_add_epi32(_mm256_add_epi32(k256, _mm256_set1_epi32((c*16    )*256)), column_nibbles(a, b)));
+        cd = kernel::gather_u8(flat, _mm256_add_epi32(_mm256_add_epi32(k256, _mm256_set1_epi32((c*16 + 8)*256)), column_nibbles(cc, d)));
+        n  = kernel::gather_u8(flat, _mm256_add_epi32(_mm256_add_epi32(k256, _mm256_set1_epi32((64 + c*8)*256)), _mm256_or_si256(_mm256_slli_epi32(ab, 4), cd)));
+
+        n = _mm256_add_epi64(_mm256_slli_epi64(n, 4), _mm256_srli_epi64(n, 32));
+        u = _mm256_or_si256(u, _mm256_slli_epi64(n, 8*c));
+    }
+
+    /* byte c of dword m is output byte c*4 + m */
+    x = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(u, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+}
+
+void wbaes_encrypt_block_avx2(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
+    const __m128i sm = _mm_loadu_si128((const __m128i *)shift_map);
+    const __m128i id = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i s = _mm_loadu_si128((const __m128i *)pt);
+    uint8_t t[16];
+    int r, i;
+
+    for (r = 0; r < 9; r++) {
+        s = block_stage(et.ty_boxes[r]  , et.r1_xor_tables[r], s, sm);
+        s = block_stage(et.mbl_tables[r], et.r2_xor_tables[r], s, id);
+    }
+
+    _mm_storeu_si128((__m128i *)t, s);
+    for (i = 0; i < 16; i++) {
+        pt[i] = et.last_box[i][t[shift_map[i]]];
+    }
+}
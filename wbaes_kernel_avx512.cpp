@@ -0,0 +1,113 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - AVX-512 kernel (built with -mavx512f -mavx512bw)
+*/
+#include <immintrin.h>
+
+#include "wbaes_cpu.h"
+#include "wbaes_kernel_gather.h"
+
+/*
+    GCC 12 builds the unmasked gathers and shifts on _mm512_undefined_epi32(), a self-initialized
+    vector -Wuninitialized reports once they are inlined: the warning is off around the code
+    calling them (the ISA wrappers and the single-block stage)
+*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+namespace {
+
+struct avx512 {
+    typedef __m512i vec;
+    static const int LANES = 16;
+
+    template <int scale>
+    static vec gather(const void *base, vec idx)    { return _mm512_i32gather_epi32(idx, base, scale); }
+    static vec load(const uint32_t *p)              { return _mm512_loadu_si512(p); }
+    static void store(uint32_t *p, vec x)           { _mm512_storeu_si512(p, x); }
+    static vec set1(int x)                          { return _mm512_set1_epi32(x); }
+    static vec add(vec a, vec b)                    { return _mm512_add_epi32(a, b); }
+    static vec and_(vec a, vec b)                   { return _mm512_and_si512(a, b); }
+    static vec or_(vec a, vec b)                    { return _mm512_or_si512(a, b); }
+    static vec slli4(vec a)                         { return _mm512_slli_epi32(a, 4); }
+    static vec srl(vec a, __m128i n)                { return _mm512_srl_epi32(a, n); }
+};
+
+}
+
+#pragma GCC diagnostic pop
+
+typedef WBAES_GATHER_KERNEL<avx512> kernel;
+
+void wbaes_encrypt_blocks_avx512(const WBAES_ENCRYPTION_TABLE &et, uint8_t *blocks, size_t n) {
+    kernel::encrypt_blocks(et, blocks, n);
+}
+
+/*
+    Single block
+     - lane (c, k) of a vector holds nibble k (k = 0: bits 31-28) of column c, two columns
+       per vector: the 64 first-level XOR lookups are 4 gathers, the 32 second-level ones 2,
+       the 16 T-boxes 1
+     - lane k of the second level is nibble k of the column output, byte k/2 of it
+       is the high nibble for k even; pairs are merged in the 64-bit lanes
+*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+static inline __m512i column_nibbles(__m512i w, __m512i col, int x, int y) {
+    const __m512i sh = _mm512_setr_epi32(28, 24, 20, 16, 12, 8, 4, 0, 28, 24, 20, 16, 12, 8, 4, 0);
+    const __m512i f  = _mm512_set1_epi32(0xf);
+    __m512i a = _mm512_permutexvar_epi32(_mm512_add_epi32(col, _mm512_set1_epi32(x)), w);
+    __m512i b = _mm512_permutexvar_epi32(_mm512_add_epi32(col, _mm512_set1_epi32(y)), w);
+
+    return _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(_mm512_srlv_epi32(a, sh), f), 4), _mm512_and_si512(_mm512_srlv_epi32(b, sh), f));
+}
+
+static __m128i block_stage(const uint32_t (*tables)[256], const uint8_t (*xor_tables)[16][16], __m128i in, __m128i map) {
+    const uint8_t *flat = &xor_tables[0][0][0];
+    const __m512i  k256 = _mm512_setr_epi32(0, 256, 2*256, 3*256, 4*256, 5*256, 6*256, 7*256,
+                                            8*256, 9*256, 10*256, 11*256, 12*256, 13*256, 14*256, 15*256);
+    const __m512i  col  = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4, 4);
+    const __m512i  xor1 = _mm512_setr_epi32(0, 256, 2*256, 3*256, 4*256, 5*256, 6*256, 7*256,
+                                            16*256, 17*256, 18*256, 19*256, 20*256, 21*256, 22*256, 23*256);
+    __m512i w, ab[2], cd[2], n[2];
+    int h;
+
+    w = _mm512_i32gather_epi32(_mm512_add_epi32(k256, _mm512_cvtepu8_epi32(_mm_shuffle_epi8(in, map))), (const int *)tables[0], 4);
+
+    /* columns 2h, 2h + 1 */
+    for (h = 0; h < 2; h++) {
+        __m512i c = _mm512_add_epi32(col, _mm512_set1_epi32(8*h));
+
+        ab[h] = kernel::gather_u8(flat, _mm512_add_epi32(_mm512_add_epi32(xor1, _mm512_set1_epi32((32*h    )*256)), column_nibbles(w, c, 0, 1)));
+        cd[h] = kernel::gather_u8(flat, _mm512_add_epi32(_mm512_add_epi32(xor1, _mm512_set1_epi32((32*h + 8)*256)), column_nibbles(w, c, 2, 3)));
+    }
+    for (h = 0; h < 2; h++) {
+        n[h] = kernel::gather_u8(flat, _mm512_add_epi32(_mm512_add_epi32(k256, _mm512_set1_epi32((64 + 16*h)*256)), _mm512_or_si512(_mm512_slli_epi32(ab[h], 4), cd[h])));
+        n[h] = _mm512_add_epi64(_mm512_slli_epi64(n[h], 4), _mm512_srli_epi64(n[h], 32));
+    }
+
+    return _mm_unpacklo_epi64(_mm512_cvtepi64_epi8(n[0]), _mm512_cvtepi64_epi8(n[1]));
+}
+
+#pragma GCC diagnostic pop
+
+void wbaes_encrypt_block_avx512(const WBAES_ENCRYPTION_TABLE &et, uint8_t *pt) {
+    const __m128i sm = _mm_loadu_si128((const __m128i *)shift_map);
+    const __m128i id = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i s = _mm_loadu_si128((const __m128i *)pt);
+    uint8_t t[16];
+    int r, i;
+
+    for (r = 0; r < 9; r++) {
+        s = block_stage(et.ty_boxes[r]  , et.r1_xor_tables[r], s, sm);
+        s = block_stage(et.mbl_tables[r], et.r2_xor_tables[r], s, id);
+    }
+
+    _mm_storeu_si128((__m128i *)t, s);
+    for (i = 0; i < 16; i++) {
+        pt[i] = et.last_box[i][t[shift_map[i]]];
+    }
+}
@@ -0,0 +1,44 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - GFNI kernels for table generation (built with -mgfni)
+*/
+#include <immintrin.h>
+
+#include "wbaes_cpu.h"
+
+/* AES affine map in the gf2p8affine layout, sbox(x) = A * x^-1 ^ 0x63 */
+#define GFNI_AES_AFFINE     0xf1e3c78f1f3e7cf8ULL
+
+/*
+    8x8 bit matrix on n bytes, 16 per gf2p8affineqb
+*/
+void gf2_linear_bytes_gfni(uint64_t a, const uint8_t *x, uint8_t *y, size_t n) {
+    const __m128i m = _mm_set1_epi64x((long long)a);
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        _mm_storeu_si128((__m128i *)(y + i), _mm_gf2p8affine_epi64_epi8(v, m, 0));
+    }
+    if (i < n) {
+        gf2_linear_bytes_scalar(a, x + i, y + i, n - i);
+    }
+}
+
+/*
+    sbox(x ^ k) on n bytes: gf2p8affineinvqb is the field inversion followed by the
+    AES affine step
+*/
+void gf2_sbox_bytes_gfni(uint8_t k, const uint8_t *x, uint8_t *y, size_t n) {
+    const __m128i m  = _mm_set1_epi64x((long long)GFNI_AES_AFFINE);
+    const __m128i kv = _mm_set1_epi8((char)k);
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(x + i)), kv);
+        _mm_storeu_si128((__m128i *)(y + i), _mm_gf2p8affineinv_epi64_epi8(v, m, 0x63));
+    }
+    if (i < n) {
+        gf2_sbox_bytes_scalar(k, x + i, y + i, n - i);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - SSSE3 kernels (built with -mssse3)
+*/
+#include <tmmintrin.h>
+
+#include "wbaes_cpu.h"
+
+/*
+    16x16 byte transpose: four rounds of the perfect shuffle
+    (row i and i+8 interleaved into rows 2i and 2i+1)
+*/
+static inline void transpose16(__m128i *r) {
+    __m128i t[16];
+    int i, s;
+
+    for (s = 0; s < 4; s++) {
+        for (i = 0; i < 8; i++) {
+            t[2*i  ] = _mm_unpacklo_epi8(r[i], r[i+8]);
+            t[2*i+1] = _mm_unpackhi_epi8(r[i], r[i+8]);
+        }
+        for (i = 0; i < 16; i++) {
+            r[i] = t[i];
+        }
+    }
+}
+
+/*
+    External encoding, 16 blocks at a time
+     - every byte position has its own pair of nibble tables, so blocks are transposed
+       to put one byte position in a register and both nibbles go through pshufb
+*/
+void encode_ext_blocks_ssse3(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n) {
+    const __m128i lo = _mm_set1_epi8(0x0f);
+    __m128i r[16], x;
+    int i;
+
+    for (; n >= 16; n -= 16, blocks += 256) {
+        for (i = 0; i < 16; i++) {
+            r[i] = _mm_loadu_si128((const __m128i *)(blocks + 16*i));
+        }
+        transpose16(r);
+
+        for (i = 0; i < 16; i++) {
+            x    = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)f[i][0]), _mm_and_si128(r[i], lo));
+            r[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)f[i][1]), _mm_and_si128(_mm_srli_epi16(r[i], 4), lo));
+            r[i] = _mm_or_si128(_mm_slli_epi16(r[i], 4), x);        // nibble entries, no carry across bytes
+        }
+
+        transpose16(r);
+        for (i = 0; i < 16; i++) {
+            _mm_storeu_si128((__m128i *)(blocks + 16*i), r[i]);
+        }
+    }
+
+    encode_ext_blocks_scalar(f, blocks, n);
+}
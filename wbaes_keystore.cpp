@@ -0,0 +1,230 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Keystore of table sets
+*/
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wbaes_archive.h"
+
+typedef std::chrono::steady_clock::time_point miss_time;
+
+struct WBAES_KEYSTORE {
+    std::string                                  dir;
+    WBAES_ARCHIVE                               *ar;           // NULL for a directory
+    int                                          flags;
+
+    std::mutex                                   lock;
+    std::unordered_map<std::string, WBAES_KEY *> keys;
+    std::unordered_map<std::string, miss_time>   misses;       // ids that failed to load, and when
+};
+
+bool wbaes_key_id_valid(const char *id) {
+    size_t i;
+
+    for (i = 0; id[i]; i++) {
+        if (i >= WBAES_KEY_ID_MAX - 1 ||
+            !((id[i] >= 'a' && id[i] <= 'z') || (id[i] >= 'A' && id[i] <= 'Z') ||
+              (id[i] >= '0' && id[i] <= '9') || id[i] == '_' || id[i] == '-')) {
+            return false;
+        }
+    }
+
+    return i > 0;
+}
+
+static std::string set_path(const std::string &dir, const char *id, const char *ext) {
+    return dir + "/" + id + ext;
+}
+
+WBAES_KEYSTORE *wbaes_keystore_open(const char *dir, int flags) {
+    WBAES_KEYSTORE *ks;
+    struct stat st;
+
+    if (stat(dir, &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+        return NULL;
+    }
+
+    ks = new WBAES_KEYSTORE();
+    ks->dir   = dir;
+    ks->ar    = NULL;
+    ks->flags = flags;
+
+    if (S_ISREG(st.st_mode) && !(ks->ar = wbaes_archive_open(dir))) {
+        delete ks;
+        return NULL;
+    }
+
+    return ks;
+}
+
+static void free_key(WBAES_KEY *k) {
+    wbaes_table_free(k->et);
+    memset((void *)k->ee, 0, sizeof(WBAES_EXT_ENCODING));
+    delete k->ee;
+    delete k;
+}
+
+void wbaes_keystore_close(WBAES_KEYSTORE *ks) {
+    if (!ks) {
+        return;
+    }
+
+    for (auto &k : ks->keys) {
+        free_key(k.second);
+    }
+    wbaes_archive_close(ks->ar);
+    delete ks;
+}
+
+/* copies an archive entry into table memory of the keystore, once its checksum is verified */
+static WBAES_ENCRYPTION_TABLE *load_archived(WBAES_KEYSTORE *ks, const char *id, WBAES_EXT_ENCODING *ee) {
+    WBAES_ARCHIVE_ENTRY e;
+    WBAES_ENCRYPTION_TABLE *et;
+    long i = wbaes_archive_find(ks->ar, id);
+
+    if (i < 0 || wbaes_archive_map(ks->ar, i, &e, true) < 0) {
+        return NULL;
+    }
+
+    if ((et = wbaes_table_alloc(-1, ks->flags))) {
+        memcpy((void *)et, e.et, sizeof(WBAES_ENCRYPTION_TABLE));
+        memcpy((void *)ee, e.ee, sizeof(WBAES_EXT_ENCODING));
+    }
+    wbaes_archive_unmap(&e);
+
+    return et;
+}
+
+static WBAES_KEY *load_key(WBAES_KEYSTORE *ks, const char *id) {
+    WBAES_KEY *k = new WBAES_KEY();
+
+    strcpy(k->id, id);
+    k->ee = new WBAES_EXT_ENCODING();
+    k->et = ks->ar ? load_archived(ks, id, k->ee)
+                   : wbaes_table_load(set_path(ks->dir, id, ".tbl").c_str(), -1, ks->flags);
+
+    if (!k->et || (!ks->ar && !k->ee->read(set_path(ks->dir, id, ".ext").c_str()))) {
+        free_key(k);
+        return NULL;
+    }
+
+    return k;
+}
+
+/*
+    Lookup
+     - a set is read without the lock held, lookups of loaded keys go on meanwhile;
+       two threads loading the same id keep the first set inserted
+     - an id that failed to load is not retried for WBAES_KEYSTORE_MISS_MS, at most
+       WBAES_KEYSTORE_MISSES of them are remembered
+*/
+const WBAES_KEY *wbaes_keystore_get(WBAES_KEYSTORE *ks, const char *id) {
+    miss_time  now = std::chrono::steady_clock::now();
+    WBAES_KEY *k;
+
+    if (!wbaes_key_id_valid(id)) {
+        return NULL;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(ks->lock);
+        auto it = ks->keys.find(id);
+        auto m  = ks->misses.find(id);
+
+        if (it != ks->keys.end()) {
+            return it->second;
+        }
+        if (m != ks->misses.end() && now - m->second < std::chrono::milliseconds(WBAES_KEYSTORE_MISS_MS)) {
+            return NULL;
+        }
+    }
+
+    k = load_key(ks, id);
+
+    std::lock_guard<std::mutex> guard(ks->lock);
+
+    if (!k) {
+        if (ks->misses.size() >= WBAES_KEYSTORE_MISSES) {
+            ks->misses.clear();
+        }
+        ks->misses[id] = now;
+        return NULL;
+    }
+
+    auto ins = ks->keys.emplace(id, k);
+    if (!ins.second) {
+        free_key(k);
+    }
+    ks->misses.erase(id);
+
+    return ins.first->second;
+}
+
+/* the external encoding is secret: written 0600, synced, and removed if anything fails */
+static int write_private(const std::string &file, const void *p, size_t len) {
+    const uint8_t *x = (const uint8_t *)p;
+    ssize_t w;
+    int fd, err = 0;
+
+    if ((fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        return -1;
+    }
+
+    for (; len && !err; len -= w, x += w) {
+        w = write(fd, x, len);
+        if (w < 0 && errno == EINTR) {
+            w = 0;
+            continue;
+        }
+        if (w <= 0) {
+            err = w < 0 ? errno : EIO;
+            w = 0;
+        }
+    }
+    if (!err && fsync(fd) < 0) {
+        err = errno;
+    }
+    if (close(fd) < 0 && !err) {
+        err = errno;
+    }
+
+    if (err) {
+        unlink(file.c_str());
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int wbaes_keystore_put(const char *dir, const char *id, const uint8_t *key) {
+    WBAES_EXT_ENCODING *ee;
+    uint32_t rk[11][4];
+    int ret;
+
+    if (!wbaes_key_id_valid(id)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ee = new WBAES_EXT_ENCODING();
+    aes32_enc_keyschedule((byte *)key, rk);
+
+    ret = wbaes_gen_table_file(set_path(dir, id, ".tbl").c_str(), *ee, (uint32_t *)rk);
+    if (ret == 0) {
+        ret = write_private(set_path(dir, id, ".ext"), ee, sizeof(*ee));
+    }
+
+    memset(rk, 0, sizeof(rk));
+    memset((void *)ee, 0, sizeof(*ee));
+    delete ee;
+
+    return ret;
+}
@@ -0,0 +1,252 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - CMAC and PMAC on the batched path
+*/
+#include <vector>
+
+#include "wbaes_mac.h"
+
+#define MAC_CHUNK_BLOCKS    (8 * WBAES_BATCH_LANES)
+#define MAC_JOB_BLOCKS      4096
+#define MAC_WINDOW_JOBS     16
+
+
+static inline void xor_block(uint8_t *x, const uint8_t *y) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        x[i] ^= y[i];
+    }
+}
+
+/* x * 2 */
+static void gf_double(uint8_t *x) {
+    uint8_t carry = x[0] >> 7;
+    int i;
+
+    for (i = 0; i < 15; i++) {
+        x[i] = (x[i] << 1) | (x[i+1] >> 7);
+    }
+    x[15] = (x[15] << 1) ^ (carry ? 0x87 : 0);
+}
+
+/* x * 2^-1 */
+static void gf_half(uint8_t *x) {
+    uint8_t lsb = x[15] & 1;
+    int i;
+
+    for (i = 15; i > 0; i--) {
+        x[i] = (x[i] >> 1) | (x[i-1] << 7);
+    }
+    x[0] >>= 1;
+
+    if (lsb) {
+        x[0]  ^= 0x80;
+        x[15] ^= 0x43;
+    }
+}
+
+/* last block of a message, padded with 10* when short */
+static void last_block(const uint8_t *msg, size_t len, size_t m, uint8_t *x, bool *full) {
+    size_t r = len - 16 * (m - 1);
+
+    memset(x, 0, 16);
+    memcpy(x, msg + 16 * (m - 1), r);
+    *full = r == 16;
+    if (!*full) {
+        x[r] = 0x80;
+    }
+}
+
+static inline size_t mac_blocks(size_t len) {
+    return len ? (len + 15) / 16 : 1;
+}
+
+void wbaes_mac_init(WBAES_MAC_KEY *k, const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee) {
+    uint8_t l[16] = {0, };
+    int i;
+
+    k->et = &et;
+    k->ee = ee;
+
+    wbaes_encrypt_blocks_ext(et, ee, l, 1);
+
+    memcpy(k->k1, l, 16);
+    gf_double(k->k1);
+    memcpy(k->k2, k->k1, 16);
+    gf_double(k->k2);
+
+    memcpy(k->l[0], l, 16);
+    for (i = 1; i < WBAES_PMAC_LEVELS; i++) {
+        memcpy(k->l[i], k->l[i-1], 16);
+        gf_double(k->l[i]);
+    }
+    memcpy(k->l_inv, l, 16);
+    gf_half(k->l_inv);
+
+    memset(l, 0, 16);
+}
+
+/*
+    CMAC
+     - each step takes one block of every message that still has blocks left,
+       so messages of different lengths drop out of the batch as they finish
+*/
+static void cmac_group(const WBAES_MAC_KEY *k, const uint8_t *const *msgs, const size_t *lens, size_t n, uint8_t (*tags)[16]) {
+    uint8_t x[16 * MAC_CHUNK_BLOCKS];
+    size_t  idx[MAC_CHUNK_BLOCKS], step, steps = 0, i, a;
+    bool    full;
+
+    for (i = 0; i < n; i++) {
+        memset(tags[i], 0, 16);
+        steps = mac_blocks(lens[i]) > steps ? mac_blocks(lens[i]) : steps;
+    }
+
+    for (step = 0; step < steps; step++) {
+        for (i = 0, a = 0; i < n; i++) {
+            size_t m = mac_blocks(lens[i]);
+
+            if (step >= m) {
+                continue;
+            }
+            memcpy(x + 16*a, tags[i], 16);
+
+            if (step < m - 1) {
+                xor_block(x + 16*a, msgs[i] + 16*step);
+            }
+            else {
+                uint8_t last[16];
+
+                last_block(msgs[i], lens[i], m, last, &full);
+                xor_block(last, full ? k->k1 : k->k2);
+                xor_block(x + 16*a, last);
+            }
+            idx[a++] = i;
+        }
+
+        wbaes_encrypt_blocks_ext(*k->et, k->ee, x, a);
+
+        for (i = 0; i < a; i++) {
+            memcpy(tags[idx[i]], x + 16*i, 16);
+        }
+    }
+}
+
+void wbaes_cmac_multi(const WBAES_MAC_KEY *k, const uint8_t *const *msgs, const size_t *lens, size_t n, uint8_t (*tags)[16]) {
+    size_t i, g;
+
+    for (i = 0; i < n; i += g) {
+        g = n - i < MAC_CHUNK_BLOCKS ? n - i : MAC_CHUNK_BLOCKS;
+        cmac_group(k, msgs + i, lens + i, g, tags + i);
+    }
+}
+
+void wbaes_cmac(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t len, uint8_t *tag) {
+    wbaes_cmac_multi(k, &msg, &len, 1, (uint8_t (*)[16])tag);
+}
+
+/*
+    PMAC
+     - Z[i] = Z[i-1] ^ L * x^ntz(i), X[i] = M[i] ^ Z[i] for the m-1 leading blocks,
+       Sigma is the XOR of their E(X[i])
+     - the last block is folded in padded (short) or with L * x^-1 (full), tag = E(Sigma)
+*/
+static void pmac_prepare(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t first, size_t n, uint8_t *z, uint8_t *x) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        xor_block(z, k->l[__builtin_ctzll(first + i)]);
+        memcpy(x + 16*i, msg + 16*i, 16);
+        xor_block(x + 16*i, z);
+    }
+}
+
+static void pmac_fold(uint8_t *sigma, const uint8_t *y, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        xor_block(sigma, y + 16*i);
+    }
+}
+
+static void pmac_final(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t len, uint8_t *sigma, uint8_t *tag) {
+    uint8_t last[16];
+    bool    full;
+
+    last_block(msg, len, mac_blocks(len), last, &full);
+    xor_block(sigma, last);
+    if (full) {
+        xor_block(sigma, k->l_inv);
+    }
+
+    memcpy(tag, sigma, 16);
+    wbaes_encrypt_blocks_ext(*k->et, k->ee, tag, 1);
+}
+
+void wbaes_pmac(const WBAES_MAC_KEY *k, const uint8_t *msg, size_t len, uint8_t *tag) {
+    uint8_t x[16 * MAC_CHUNK_BLOCKS], z[16] = {0, }, sigma[16] = {0, };
+    size_t  lead = mac_blocks(len) - 1, i, n;
+
+    for (i = 0; i < lead; i += n) {
+        n = lead - i < MAC_CHUNK_BLOCKS ? lead - i : MAC_CHUNK_BLOCKS;
+
+        pmac_prepare(k, msg + 16*i, i + 1, n, z, x);
+        wbaes_encrypt_blocks_ext(*k->et, k->ee, x, n);
+        pmac_fold(sigma, x, n);
+    }
+
+    pmac_final(k, msg, len, sigma, tag);
+}
+
+/*
+    PMAC on the engine
+     - a window of X blocks is prepared and handed out as ECB jobs, the engine must not
+       be used by other submitters meanwhile (its completions are consumed here)
+*/
+int wbaes_pmac_engine(const WBAES_MAC_KEY *k, WBAES_ENGINE *eng, const uint8_t *msg, size_t len, uint8_t *tag) {
+    std::vector<uint8_t> x(16 * MAC_JOB_BLOCKS * MAC_WINDOW_JOBS);
+    WBAES_JOB jobs[MAC_WINDOW_JOBS], *done[MAC_WINDOW_JOBS];
+    uint8_t   z[16] = {0, }, sigma[16] = {0, };
+    size_t    lead = mac_blocks(len) - 1, i, n, j, off, pending, got;
+    int       status = 0, rc = 0;
+
+    for (i = 0; i < lead && !rc; i += n) {
+        n = lead - i < MAC_JOB_BLOCKS * MAC_WINDOW_JOBS ? lead - i : MAC_JOB_BLOCKS * MAC_WINDOW_JOBS;
+        pmac_prepare(k, msg + 16*i, i + 1, n, z, x.data());
+
+        for (off = 0, j = 0, pending = 0; off < n && !rc; off += MAC_JOB_BLOCKS, j++) {
+            memset(&jobs[j], 0, sizeof(WBAES_JOB));
+            jobs[j].et   = k->et;
+            jobs[j].ee   = k->ee;
+            jobs[j].mode = WBAES_JOB_ECB;
+            jobs[j].in   = x.data() + 16*off;
+            jobs[j].out  = x.data() + 16*off;
+            jobs[j].len  = 16 * (n - off < MAC_JOB_BLOCKS ? n - off : MAC_JOB_BLOCKS);
+
+            while ((rc = wbaes_engine_submit(eng, &jobs[j])) == -EAGAIN) {
+                for (got = wbaes_engine_wait(eng, done, MAC_WINDOW_JOBS, 10); got; got--) {
+                    status |= done[got-1]->status;
+                    pending--;
+                }
+            }
+            pending += rc == 0;
+        }
+
+        /* the jobs in flight are drained even after a refused submit, they use x */
+        while (pending) {
+            for (got = wbaes_engine_wait(eng, done, MAC_WINDOW_JOBS, 100); got; got--) {
+                status |= done[got-1]->status;
+                pending--;
+            }
+        }
+
+        pmac_fold(sigma, x.data(), n);
+    }
+
+    if (rc) {
+        return rc;
+    }
+    pmac_final(k, msg, len, sigma, tag);
+
+    return status ? -EIO : 0;
+}
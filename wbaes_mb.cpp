@@ -0,0 +1,165 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Multi-buffer job manager
+*/
+#include "wbaes_mb.h"
+#include "wbaes_cpu.h"
+
+
+static inline size_t job_blocks(const WBAES_MB_JOB *job, size_t done) {
+    return (job->len - done + 15) / 16;
+}
+
+static bool job_valid(const WBAES_MB_JOB *job) {
+    switch (job->mode) {
+    case WBAES_MB_ECB:
+    case WBAES_MB_CBC_ENC:
+        return job->len % 16 == 0;
+    case WBAES_MB_CTR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void complete(WBAES_MB_MGR *mgr, WBAES_MB_JOB *job, int status) {
+    job->status = status;
+    mgr->completed[mgr->n_completed++] = job;
+}
+
+/*
+    Runs steps until at least one lane drains
+     - the step count is the shortest remaining job, every step gathers one block
+       per busy lane into a contiguous batch and scatters the result back
+*/
+static void run(WBAES_MB_MGR *mgr) {
+    uint8_t buf[16 * WBAES_MB_MAX_LANES];
+    int     lane[WBAES_MB_MAX_LANES];
+    size_t  steps = (size_t)-1, s, n, k, bytes;
+    int     l, i;
+
+    for (l = 0, n = 0; l < mgr->lanes; l++) {
+        if (mgr->busy & (1U << l)) {
+            k = job_blocks(mgr->job[l], mgr->done[l]);
+            steps = k < steps ? k : steps;
+            lane[n++] = l;
+        }
+    }
+    if (!n) {
+        return;
+    }
+
+    for (s = 0; s < steps; s++) {
+        for (k = 0; k < n; k++) {
+            const WBAES_MB_JOB *job = mgr->job[lane[k]];
+            const uint8_t *in = job->in + mgr->done[lane[k]];
+
+            switch (job->mode) {
+            case WBAES_MB_ECB:
+                memcpy(buf + 16*k, in, 16);
+                break;
+            case WBAES_MB_CBC_ENC:
+                for (i = 0; i < 16; i++) {
+                    buf[16*k+i] = in[i] ^ mgr->chain[lane[k]][i];
+                }
+                break;
+            case WBAES_MB_CTR:
+                memcpy(buf + 16*k, mgr->chain[lane[k]], 16);
+                wbaes_ctr_add(mgr->chain[lane[k]], 1);
+                break;
+            }
+        }
+
+        wbaes_encrypt_blocks_ext(*mgr->et, mgr->ee, buf, n);
+
+        for (k = 0; k < n; k++) {
+            WBAES_MB_JOB *job = mgr->job[lane[k]];
+            size_t        off = mgr->done[lane[k]];
+
+            bytes = job->len - off < 16 ? job->len - off : 16;
+
+            switch (job->mode) {
+            case WBAES_MB_ECB:
+                memcpy(job->out + off, buf + 16*k, 16);
+                break;
+            case WBAES_MB_CBC_ENC:
+                memcpy(job->out + off, buf + 16*k, 16);
+                memcpy(mgr->chain[lane[k]], buf + 16*k, 16);
+                break;
+            case WBAES_MB_CTR:
+                for (i = 0; i < (int)bytes; i++) {
+                    job->out[off+i] = job->in[off+i] ^ buf[16*k+i];
+                }
+                break;
+            }
+            mgr->done[lane[k]] += bytes;
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        l = lane[k];
+        if (mgr->done[l] == mgr->job[l]->len) {
+            complete(mgr, mgr->job[l], WBAES_MB_COMPLETED);
+            mgr->busy &= ~(1U << l);
+            mgr->job[l] = NULL;
+        }
+    }
+}
+
+static WBAES_MB_JOB *pop_completed(WBAES_MB_MGR *mgr) {
+    return mgr->n_completed ? mgr->completed[--mgr->n_completed] : NULL;
+}
+
+void wbaes_mb_mgr_init(WBAES_MB_MGR *mgr, const WBAES_ENCRYPTION_TABLE *et, const WBAES_EXT_ENCODING *ee) {
+    int lanes = wbaes_kernels().lanes;
+
+    memset(mgr, 0, sizeof(*mgr));
+    mgr->et    = et;
+    mgr->ee    = ee;
+    mgr->lanes = lanes < WBAES_MB_MAX_LANES ? lanes : WBAES_MB_MAX_LANES;
+}
+
+WBAES_MB_JOB *wbaes_mb_submit(WBAES_MB_MGR *mgr, WBAES_MB_JOB *job) {
+    int l;
+
+    if (!job_valid(job)) {
+        job->status = WBAES_MB_INVALID;
+        return job;
+    }
+
+    job->status = WBAES_MB_BEING_PROCESSED;
+
+    if (job->len == 0) {
+        complete(mgr, job, WBAES_MB_COMPLETED);
+    }
+    else {
+        /* lanes can be full if the last step left completions to hand out */
+        if (mgr->busy == (1U << mgr->lanes) - 1) {
+            run(mgr);
+        }
+        for (l = 0; mgr->busy & (1U << l); l++);
+
+        mgr->job[l]  = job;
+        mgr->done[l] = 0;
+        mgr->busy   |= 1U << l;
+        memcpy(mgr->chain[l], job->iv, 16);
+
+        if (mgr->busy == (1U << mgr->lanes) - 1 && !mgr->n_completed) {
+            run(mgr);
+        }
+    }
+
+    return pop_completed(mgr);
+}
+
+WBAES_MB_JOB *wbaes_mb_flush(WBAES_MB_MGR *mgr) {
+    if (!mgr->n_completed) {
+        run(mgr);
+    }
+
+    return pop_completed(mgr);
+}
+
+int wbaes_mb_jobs(const WBAES_MB_MGR *mgr) {
+    return __builtin_popcount(mgr->busy) + mgr->n_completed;
+}
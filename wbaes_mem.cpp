@@ -0,0 +1,459 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Memory for whitebox tables
+*/
+#include <new>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "wbaes_mem.h"
+#include "wbaes_metrics.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define HUGE_PAGE       (2UL << 20)
+#define HUGE_REGION     (8 * HUGE_PAGE)
+
+
+/*
+    Huge-page regions, split in table slots
+*/
+struct huge_region {
+    uint8_t          *base;
+    size_t            len;
+    int               node;
+    WBAES_MEM_BACKING backing;
+    uint32_t          used;     // slot bitmap
+};
+
+static std::vector<huge_region> regions;
+static std::mutex               regions_lock;
+
+static inline size_t page_round(size_t len, size_t page) {
+    return (len + page - 1) & ~(page - 1);
+}
+
+static size_t table_map_size() {
+    return page_round(sizeof(WBAES_ENCRYPTION_TABLE), sysconf(_SC_PAGESIZE));
+}
+
+static inline int region_slots() {
+    int n = HUGE_REGION / table_map_size();
+
+    return n < 32 ? n : 32;
+}
+
+static int bind_node(void *addr, size_t len, int node) {
+    unsigned long mask[16] = {0, };
+
+    if (node < 0 || node >= (int)(8 * sizeof(mask))) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    return (int)syscall(SYS_mbind, addr, len, MPOL_BIND, mask, 8 * sizeof(mask), MPOL_MF_MOVE);
+}
+
+/*
+    Maps a huge-page region
+     - MAP_HUGETLB needs pages reserved in /proc/sys/vm/nr_hugepages,
+       otherwise a 2MB aligned mapping is advised for THP
+     - a region is shared by tables allocated with different flags, so it is not
+       prefaulted here: WBAES_MEM_POPULATE applies to each slot as it is handed out
+*/
+static bool map_region(huge_region &rg, int node) {
+    uint8_t *p;
+    size_t   head;
+
+    rg.len  = HUGE_REGION;
+    rg.node = node;
+    rg.used = 0;
+
+    p = (uint8_t *)mmap(NULL, rg.len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    if (p != MAP_FAILED) {
+        rg.base    = p;
+        rg.backing = WBAES_MEM_HUGETLB;
+    }
+    else {
+        p = (uint8_t *)mmap(NULL, rg.len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+
+        /* trims the mapping to a 2MB boundary */
+        head = (HUGE_PAGE - ((uintptr_t)p & (HUGE_PAGE - 1))) & (HUGE_PAGE - 1);
+        if (head) {
+            munmap(p, head);
+        }
+        munmap(p + head + rg.len, HUGE_PAGE - head);
+
+        rg.base    = p + head;
+        rg.backing = (madvise(rg.base, rg.len, MADV_HUGEPAGE) == 0) ? WBAES_MEM_THP : WBAES_MEM_SMALL;
+    }
+
+    if (node >= 0 && bind_node(rg.base, rg.len, node) < 0) {
+        int err = errno;
+
+        munmap(rg.base, rg.len);
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Prefaults a slot (after the region is advised and bound),
+    touching its pages on kernels without MADV_POPULATE_WRITE (before 5.14)
+*/
+static void populate_slot(uint8_t *p) {
+    size_t page = sysconf(_SC_PAGESIZE), off;
+
+    if (madvise(p, table_map_size(), MADV_POPULATE_WRITE) != 0) {
+        for (off = 0; off < table_map_size(); off += page) {
+            ((volatile uint8_t *)p)[off] = 0;
+        }
+    }
+}
+
+static WBAES_ENCRYPTION_TABLE *alloc_huge(int node, int flags) {
+    std::lock_guard<std::mutex> guard(regions_lock);
+    size_t i;
+    int    s, slots = region_slots();
+    huge_region rg;
+
+    for (i = 0; i < regions.size(); i++) {
+        if (regions[i].node != node) {
+            continue;
+        }
+        for (s = 0; s < slots; s++) {
+            if (!(regions[i].used & (1U << s))) {
+                uint8_t *p = regions[i].base + s * table_map_size();
+
+                regions[i].used |= 1U << s;
+                if (flags & WBAES_MEM_POPULATE) {
+                    populate_slot(p);
+                }
+                memset(p, 0, sizeof(WBAES_ENCRYPTION_TABLE));       // slot may be reused
+                return new (p) WBAES_ENCRYPTION_TABLE();
+            }
+        }
+    }
+
+    if (!map_region(rg, node)) {
+        return NULL;
+    }
+    rg.used = 1;
+    regions.push_back(rg);
+
+    if (flags & WBAES_MEM_POPULATE) {
+        populate_slot(rg.base);
+    }
+    return new (rg.base) WBAES_ENCRYPTION_TABLE();
+}
+
+static bool free_huge(WBAES_ENCRYPTION_TABLE *et) {
+    std::lock_guard<std::mutex> guard(regions_lock);
+    uint8_t *p = (uint8_t *)et;
+    size_t i;
+
+    for (i = 0; i < regions.size(); i++) {
+        if (p >= regions[i].base && p < regions[i].base + regions[i].len) {
+            regions[i].used &= ~(1U << ((p - regions[i].base) / table_map_size()));
+            if (!regions[i].used) {
+                munmap(regions[i].base, regions[i].len);
+                regions.erase(regions.begin() + i);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static WBAES_ENCRYPTION_TABLE *alloc_small(int node, int flags) {
+    size_t len = table_map_size();
+    void *p;
+
+    /*
+        MAP_POPULATE would fault the pages in before mbind, so with
+        a node the mapping is populated after the policy is set
+    */
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | ((flags & WBAES_MEM_POPULATE) && node < 0 ? MAP_POPULATE : 0), -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    /*
+        Without a policy (no NUMA, or mbind refused) the pages land
+        on the node of the thread that touches them first
+    */
+    if (node >= 0) {
+        if (bind_node(p, len, node) < 0) {
+            int err = errno;
+
+            munmap(p, len);
+            errno = err;
+            return NULL;
+        }
+        if (flags & WBAES_MEM_POPULATE) {
+            madvise(p, len, MADV_POPULATE_WRITE);
+        }
+    }
+
+    return new (p) WBAES_ENCRYPTION_TABLE();
+}
+
+WBAES_ENCRYPTION_TABLE *wbaes_table_alloc(int node, int flags) {
+    WBAES_ENCRYPTION_TABLE *et;
+
+    et = (flags & WBAES_MEM_HUGE) ? alloc_huge(node, flags) : alloc_small(node, flags);
+
+    if (et && (flags & WBAES_MEM_LOCK)) {
+        wbaes_table_set_hot(et, true);
+    }
+
+    return et;
+}
+
+void wbaes_table_free(WBAES_ENCRYPTION_TABLE *et) {
+    if (et) {
+        munlock(et, sizeof(WBAES_ENCRYPTION_TABLE));
+    }
+    if (et && !free_huge(et)) {
+        munmap(et, table_map_size());
+    }
+}
+
+WBAES_ENCRYPTION_TABLE *wbaes_table_load(const char *file, int node, int flags) {
+    WBAES_METRIC_START(start);
+    std::ifstream in(file, std::ios::in | std::ios::binary);
+    WBAES_ENCRYPTION_TABLE *et;
+
+    if (!in.is_open() || !(et = wbaes_table_alloc(node, flags))) {
+        return NULL;
+    }
+
+    if (!in.read((char *)et, sizeof(WBAES_ENCRYPTION_TABLE))) {
+        wbaes_table_free(et);
+        return NULL;
+    }
+
+    WBAES_METRIC_DONE(WBAES_API_TABLE_LOAD, 0, sizeof(WBAES_ENCRYPTION_TABLE), start);   // loaded tables only
+    return et;
+}
+
+/*
+    Streaming generation into a file
+     - every finished round is written back (msync) and dropped from the mapping
+       (MADV_DONTNEED), so resident memory stays at about one round of tables
+     - the first writeback error is kept and returned once the table is done
+*/
+static int flush_range(const void *p, size_t len) {
+    uintptr_t page  = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(page - 1);
+    size_t    n     = page_round((uintptr_t)p + len - start, page);
+
+    if (msync((void *)start, n, MS_SYNC) < 0) {
+        return errno;
+    }
+    madvise((void *)start, n, MADV_DONTNEED);
+    return 0;
+}
+
+static void flush_round(WBAES_ENCRYPTION_TABLE &et, int r, void *arg) {
+    int *err = (int *)arg, rc;
+
+    if (r == 9) {
+        rc = flush_range(et.last_box, sizeof(et.last_box));
+    }
+    else {
+        rc = flush_range(et.r1_xor_tables[r], sizeof(et.r1_xor_tables[r]));
+        rc = rc ? rc : flush_range(et.r2_xor_tables[r], sizeof(et.r2_xor_tables[r]));
+        rc = rc ? rc : flush_range(et.mbl_tables[r], sizeof(et.mbl_tables[r]));
+        rc = rc ? rc : flush_range(et.ty_boxes[r], sizeof(et.ty_boxes[r]));
+    }
+
+    if (rc && !*err) {
+        *err = rc;
+    }
+}
+
+int wbaes_gen_table_fd(int fd, off_t offset, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys) {
+    WBAES_ENCRYPTION_TABLE *et;
+    int err = 0;
+
+    if (offset % sysconf(_SC_PAGESIZE)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    et = (WBAES_ENCRYPTION_TABLE *)mmap(NULL, sizeof(WBAES_ENCRYPTION_TABLE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (et == MAP_FAILED) {
+        return -1;
+    }
+
+    wbaes_gen_encryption_table_rounds(*et, ee, roundkeys, flush_round, &err);
+
+    if (munmap(et, sizeof(WBAES_ENCRYPTION_TABLE)) < 0 && !err) {
+        err = errno;
+    }
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int wbaes_gen_table_file(const char *file, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys) {
+    int fd, err;
+
+    if ((fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+        return -1;
+    }
+
+    /* blocks are reserved up front: a full disk is ENOSPC here, not SIGBUS in the mapped stores */
+    if ((err = posix_fallocate(fd, 0, sizeof(WBAES_ENCRYPTION_TABLE))) == 0 &&
+        wbaes_gen_table_fd(fd, 0, ee, roundkeys) < 0) {
+        err = errno;
+    }
+    if (err) {
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if (close(fd) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+WBAES_MEM_BACKING wbaes_table_backing(const WBAES_ENCRYPTION_TABLE *et) {
+    std::lock_guard<std::mutex> guard(regions_lock);
+    const uint8_t *p = (const uint8_t *)et;
+    size_t i;
+
+    for (i = 0; i < regions.size(); i++) {
+        if (p >= regions[i].base && p < regions[i].base + regions[i].len) {
+            return regions[i].backing;
+        }
+    }
+
+    return WBAES_MEM_SMALL;
+}
+
+/*
+    Warm-up
+*/
+static double now_ms() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec * 1e3 + t_val.tv_nsec / 1e6;
+}
+
+static uint8_t touch(const void *p, size_t len, size_t stride) {
+    const volatile uint8_t *x = (const volatile uint8_t *)p;
+    uint8_t acc = 0;
+    size_t i;
+
+    for (i = 0; i < len; i += stride) {
+        acc ^= x[i];
+    }
+
+    return acc;
+}
+
+static void prefault(const WBAES_ENCRYPTION_TABLE *et) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t base = (uintptr_t)et & ~(page - 1);
+    size_t    len  = page_round((uintptr_t)et + sizeof(WBAES_ENCRYPTION_TABLE) - base, page);
+
+    /* swapped pages are read back in a batch, the touch covers kernels without MADV_POPULATE_READ */
+    madvise((void *)base, len, MADV_WILLNEED);
+    if (madvise((void *)base, len, MADV_POPULATE_READ) != 0) {
+        touch(et, sizeof(WBAES_ENCRYPTION_TABLE), page);
+    }
+}
+
+static void warm_cache(const WBAES_ENCRYPTION_TABLE *et) {
+    int r;
+
+    /*
+        Encryption order is ty_boxes, r1_xor_tables, mbl_tables, r2_xor_tables per round,
+        lines are read in the reverse order so the first round ends up most recently used
+    */
+    touch(et->last_box, sizeof(et->last_box), 64);
+    for (r = 8; r >= 0; r--) {
+        touch(et->r2_xor_tables[r], sizeof(et->r2_xor_tables[r]), 64);
+        touch(et->mbl_tables[r]   , sizeof(et->mbl_tables[r])   , 64);
+        touch(et->r1_xor_tables[r], sizeof(et->r1_xor_tables[r]), 64);
+        touch(et->ty_boxes[r]     , sizeof(et->ty_boxes[r])     , 64);
+    }
+}
+
+int wbaes_table_warm(const WBAES_ENCRYPTION_TABLE *et, int flags, WBAES_WARM_STATS *st) {
+    WBAES_WARM_STATS tmp;
+    double begin = now_ms(), t;
+    int ret = 0;
+
+    st = st ? st : &tmp;
+    memset(st, 0, sizeof(*st));
+
+    if (flags & WBAES_WARM_PREFAULT) {
+        t = now_ms();
+        prefault(et);
+        st->prefault_ms = now_ms() - t;
+    }
+
+    if (flags & WBAES_WARM_LOCK) {
+        t = now_ms();
+        if (wbaes_table_set_hot(et, true) != 0) {
+            st->lock_errno = errno;
+            ret = -1;
+        }
+        st->lock_ms = now_ms() - t;
+    }
+
+    if (flags & WBAES_WARM_CACHE) {
+        t = now_ms();
+        warm_cache(et);
+        st->cache_ms = now_ms() - t;
+    }
+
+    st->total_ms = now_ms() - begin;
+    return ret;
+}
+
+std::future<WBAES_WARM_STATS> wbaes_table_warm_async(const WBAES_ENCRYPTION_TABLE *et, int flags) {
+    return std::async(std::launch::async, [et, flags]() {
+        WBAES_WARM_STATS st;
+        wbaes_table_warm(et, flags, &st);
+        return st;
+    });
+}
+
+int wbaes_table_set_hot(const WBAES_ENCRYPTION_TABLE *et, bool hot) {
+    return hot ? mlock(et, sizeof(WBAES_ENCRYPTION_TABLE)) : munlock(et, sizeof(WBAES_ENCRYPTION_TABLE));
+}
@@ -0,0 +1,281 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Metrics: per-thread counters, latency histograms, Prometheus export
+*/
+#include <cerrno>
+#include <string>
+
+#include <unistd.h>
+
+#include "wbaes_metrics.h"
+
+static const char *api_names[WBAES_METRIC_APIS] = {
+    "encrypt", "encrypt_lowlat", "encrypt_blocks", "encrypt_blocks_ext", "encrypt_ctr_blocks", "table_load", "archive_map"
+};
+
+
+/*
+    Slots
+     - attached on a thread's first counted call, pushed onto a list that is never shrunk;
+       a thread that exits hands its slot, counts included, to the next thread attaching
+*/
+#if WBAES_METRICS
+
+thread_local WBAES_METRICS_SLOT *wbaes_metrics_tls = NULL;
+
+static std::atomic<WBAES_METRICS_SLOT *> slots(NULL);
+static std::atomic<unsigned>             slot_count(0);
+
+struct slot_release {
+    ~slot_release() {
+        if (wbaes_metrics_tls) {
+            wbaes_metrics_tls->in_use.store(false, std::memory_order_release);
+            wbaes_metrics_tls = NULL;
+        }
+    }
+};
+
+static thread_local slot_release release;
+
+WBAES_METRICS_SLOT *wbaes_metrics_attach() {
+    WBAES_METRICS_SLOT *s;
+    bool free_slot;
+
+    for (s = slots.load(std::memory_order_acquire); s; s = s->next) {
+        free_slot = false;
+        if (s->in_use.compare_exchange_strong(free_slot, true, std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    if (!s) {
+        s = new WBAES_METRICS_SLOT();           // value-initialized: counters at zero
+        s->in_use.store(true, std::memory_order_relaxed);
+        s->next = slots.load(std::memory_order_relaxed);
+        while (!slots.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        slot_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    (void)&release;                             // registers the destructor of this thread
+    wbaes_metrics_tls = s;
+    return s;
+}
+
+void wbaes_metrics_snapshot(WBAES_METRICS_SNAPSHOT *out) {
+    const WBAES_METRICS_SLOT *s;
+    int a, b;
+
+    memset(out, 0, sizeof(*out));
+
+    for (s = slots.load(std::memory_order_acquire); s; s = s->next) {
+        for (a = 0; a < WBAES_METRIC_APIS; a++) {
+            out->calls[a]  += s->calls[a].load(std::memory_order_relaxed);
+            out->blocks[a] += s->blocks[a].load(std::memory_order_relaxed);
+            out->bytes[a]  += s->bytes[a].load(std::memory_order_relaxed);
+            out->latency[a].sum_ns += s->hist_sum[a].load(std::memory_order_relaxed);
+            for (b = 0; b < WBAES_HIST_BUCKETS; b++) {
+                out->latency[a].count[b] += s->hist[a][b].load(std::memory_order_relaxed);
+            }
+        }
+        for (a = 0; a < WBAES_KERNEL_LEVELS; a++) {
+            out->kernel_calls[a]  += s->kernel_calls[a].load(std::memory_order_relaxed);
+            out->kernel_blocks[a] += s->kernel_blocks[a].load(std::memory_order_relaxed);
+        }
+    }
+
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        for (b = 0; b < WBAES_HIST_BUCKETS; b++) {
+            out->latency[a].samples += out->latency[a].count[b];
+        }
+    }
+    out->threads = slot_count.load(std::memory_order_relaxed);
+}
+
+#else
+
+void wbaes_metrics_snapshot(WBAES_METRICS_SNAPSHOT *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+#endif /* WBAES_METRICS */
+
+/*
+    Histograms
+     - buckets below 2^SUB_BITS ns are 1 ns wide, then every power of two is split
+       into 2^SUB_BITS equal buckets
+*/
+uint64_t wbaes_hist_bucket_ns(int bucket) {
+    int e, sub;
+
+    if (bucket < (1 << WBAES_HIST_SUB_BITS)) {
+        return bucket + 1;
+    }
+    e   = (bucket >> WBAES_HIST_SUB_BITS) + WBAES_HIST_SUB_BITS - 1;
+    sub = bucket & ((1 << WBAES_HIST_SUB_BITS) - 1);
+    return (uint64_t)((1 << WBAES_HIST_SUB_BITS) + sub + 1) << (e - WBAES_HIST_SUB_BITS);
+}
+
+uint64_t wbaes_hist_quantile(const WBAES_HISTOGRAM &h, double q) {
+    uint64_t rank, seen = 0;
+    int b;
+
+    if (!h.samples) {
+        return 0;
+    }
+    rank = (uint64_t)(q * h.samples);
+    rank = rank < 1 ? 1 : rank > h.samples ? h.samples : rank;
+
+    for (b = 0; b < WBAES_HIST_BUCKETS; b++) {
+        if ((seen += h.count[b]) >= rank) {
+            break;
+        }
+    }
+    return wbaes_hist_bucket_ns(b < WBAES_HIST_BUCKETS ? b : WBAES_HIST_BUCKETS - 1);
+}
+
+const char *wbaes_metric_api_name(WBAES_METRIC_API api) {
+    return api >= 0 && api < WBAES_METRIC_APIS ? api_names[api] : "unknown";
+}
+
+/*
+    Prometheus text format
+     - counters per entry point and per kernel level
+     - latency as a histogram in seconds, exported at power-of-two bounds only (the fine
+       buckets stay in the snapshot), from the first to the last populated one, plus
+       p50 / p99 / p99.9 from the fine buckets as gauges
+*/
+static void prom_head(std::string &o, const char *name, const char *type, const char *help) {
+    o += "# HELP "; o += name; o += " "; o += help; o += "\n";
+    o += "# TYPE "; o += name; o += " "; o += type; o += "\n";
+}
+
+static void prom_line(std::string &o, const char *name, const char *labels, double v) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, labels, v);
+    o += line;
+}
+
+static void prom_hist(std::string &o, const char *api, const WBAES_HISTOGRAM &h) {
+    char     labels[128];
+    uint64_t cum = 0;
+    int      first = -1, last = -1, e, b = 0, i;
+
+    for (i = 0; i < WBAES_HIST_BUCKETS; i++) {
+        if (h.count[i]) {
+            first = first < 0 ? i : first;
+            last  = i;
+        }
+    }
+
+    if (first >= 0) {
+        /* bucket index (e - SUB_BITS + 1) << SUB_BITS starts at 2^e ns */
+        for (e = WBAES_HIST_SUB_BITS; e <= WBAES_HIST_MAX_EXP + 1; e++) {
+            int end = (e - WBAES_HIST_SUB_BITS + 1) << WBAES_HIST_SUB_BITS;
+
+            for (; b < end && b < WBAES_HIST_BUCKETS; b++) {
+                cum += h.count[b];
+            }
+            if (end > first && end - (1 << WBAES_HIST_SUB_BITS) <= last) {
+                snprintf(labels, sizeof(labels), "api=\"%s\",le=\"%.9g\"", api, (double)(1ULL << e) * 1e-9);
+                prom_line(o, "wbaes_latency_seconds_bucket", labels, (double)cum);
+            }
+        }
+    }
+    snprintf(labels, sizeof(labels), "api=\"%s\",le=\"+Inf\"", api);
+    prom_line(o, "wbaes_latency_seconds_bucket", labels, (double)h.samples);
+
+    snprintf(labels, sizeof(labels), "api=\"%s\"", api);
+    prom_line(o, "wbaes_latency_seconds_sum", labels, h.sum_ns * 1e-9);
+    prom_line(o, "wbaes_latency_seconds_count", labels, (double)h.samples);
+}
+
+static void prom_quantiles(std::string &o, const char *api, const WBAES_HISTOGRAM &h) {
+    static const char  *names[3]     = { "0.5", "0.99", "0.999" };
+    static const double quantiles[3] = { 0.5, 0.99, 0.999 };
+    char labels[128];
+    int  i;
+
+    if (!h.samples) {
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        snprintf(labels, sizeof(labels), "api=\"%s\",quantile=\"%s\"", api, names[i]);
+        prom_line(o, "wbaes_latency_quantile_seconds", labels, wbaes_hist_quantile(h, quantiles[i]) * 1e-9);
+    }
+}
+
+int wbaes_metrics_write(FILE *f) {
+    WBAES_METRICS_SNAPSHOT *s = new WBAES_METRICS_SNAPSHOT();
+    std::string o;
+    char labels[64];
+    int  a;
+
+    wbaes_metrics_snapshot(s);
+
+    prom_head(o, "wbaes_calls_total", "counter", "Calls per entry point.");
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        snprintf(labels, sizeof(labels), "api=\"%s\"", api_names[a]);
+        prom_line(o, "wbaes_calls_total", labels, (double)s->calls[a]);
+    }
+    prom_head(o, "wbaes_blocks_total", "counter", "16-byte blocks per entry point.");
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        snprintf(labels, sizeof(labels), "api=\"%s\"", api_names[a]);
+        prom_line(o, "wbaes_blocks_total", labels, (double)s->blocks[a]);
+    }
+    prom_head(o, "wbaes_bytes_total", "counter", "Bytes per entry point, table bytes for loads.");
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        snprintf(labels, sizeof(labels), "api=\"%s\"", api_names[a]);
+        prom_line(o, "wbaes_bytes_total", labels, (double)s->bytes[a]);
+    }
+    prom_head(o, "wbaes_kernel_calls_total", "counter", "Batched kernel calls per dispatch level.");
+    for (a = 0; a < WBAES_KERNEL_LEVELS; a++) {
+        snprintf(labels, sizeof(labels), "kernel=\"%s\"", wbaes_kernel_name((WBAES_KERNEL)a));
+        prom_line(o, "wbaes_kernel_calls_total", labels, (double)s->kernel_calls[a]);
+    }
+    prom_head(o, "wbaes_kernel_blocks_total", "counter", "Blocks through the batched kernel per dispatch level.");
+    for (a = 0; a < WBAES_KERNEL_LEVELS; a++) {
+        snprintf(labels, sizeof(labels), "kernel=\"%s\"", wbaes_kernel_name((WBAES_KERNEL)a));
+        prom_line(o, "wbaes_kernel_blocks_total", labels, (double)s->kernel_blocks[a]);
+    }
+    prom_head(o, "wbaes_latency_seconds", "histogram", "Sampled call latency per entry point.");
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        prom_hist(o, api_names[a], s->latency[a]);
+    }
+    prom_head(o, "wbaes_latency_quantile_seconds", "gauge", "Latency quantiles from the fine histogram buckets.");
+    for (a = 0; a < WBAES_METRIC_APIS; a++) {
+        prom_quantiles(o, api_names[a], s->latency[a]);
+    }
+    prom_head(o, "wbaes_metrics_threads", "gauge", "Per-thread counter slots.");
+    o += "wbaes_metrics_threads "; o += std::to_string(s->threads); o += "\n";
+
+    delete s;
+    return fwrite(o.data(), 1, o.size(), f) == o.size() ? 0 : -1;
+}
+
+int wbaes_metrics_dump(const char *file) {
+    std::string tmp = std::string(file) + ".tmp." + std::to_string(getpid());
+    FILE *f = fopen(tmp.c_str(), "w");
+    bool  ok;
+    int   err;
+
+    if (!f) {
+        return -1;
+    }
+    ok  = wbaes_metrics_write(f) == 0;
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        err = errno;
+        unlink(tmp.c_str());
+        errno = err ? err : EIO;
+        return -1;
+    }
+    if (rename(tmp.c_str(), file) < 0) {
+        err = errno;
+        unlink(tmp.c_str());
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
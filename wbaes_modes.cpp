@@ -0,0 +1,309 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Modes of operation (ECB, CTR, GCM) on the batched path, ECB decryption on decryption tables
+*/
+#include "wbaes_modes.h"
+#include "wbaes_cpu.h"
+#include "wbaes_metrics.h"
+
+#define MODE_CHUNK_BLOCKS   (4 * WBAES_BATCH_LANES)
+
+
+void wbaes_encrypt_blocks_ext(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *blocks, size_t n) {
+    WBAES_METRIC(WBAES_API_BLOCKS_EXT, n, 16 * n);
+
+    if (ee) {
+        encode_ext_blocks(ee->ext_f, blocks, n);
+    }
+
+    wbaes_encrypt_blocks(et, blocks, n);
+
+    if (ee) {
+        encode_ext_blocks(ee->ext_g, blocks, n);
+    }
+}
+
+void wbaes_ecb_encrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, const uint8_t *in, uint8_t *out, size_t n) {
+    if (in != out) {
+        memmove(out, in, 16 * n);
+    }
+
+    wbaes_encrypt_blocks_ext(et, ee, out, n);
+}
+
+void wbaes_decrypt_blocks_ext(const WBAES_ENCRYPTION_TABLE &dt, const WBAES_EXT_ENCODING *ee, uint8_t *blocks, size_t n) {
+    if (ee) {
+        wbaes_dec_order(blocks, n);
+    }
+
+    wbaes_encrypt_blocks_ext(dt, ee, blocks, n);
+
+    if (ee) {
+        wbaes_dec_order(blocks, n);
+    }
+}
+
+void wbaes_ecb_decrypt(const WBAES_ENCRYPTION_TABLE &dt, const WBAES_EXT_ENCODING *ee, const uint8_t *in, uint8_t *out, size_t n) {
+    if (in != out) {
+        memmove(out, in, 16 * n);
+    }
+
+    wbaes_decrypt_blocks_ext(dt, ee, out, n);
+}
+
+void wbaes_ctr_add(uint8_t *ctr, uint64_t n) {
+    int i;
+
+    for (i = 15; i >= 0 && n; i--) {
+        n += ctr[i];
+        ctr[i] = (uint8_t)n;
+        n >>= 8;
+    }
+}
+
+void wbaes_ctr_add32(uint8_t *ctr, uint64_t n) {
+    PUTU32(ctr + 12, GETU32(ctr + 12) + (uint32_t)n);
+}
+
+/*
+    CTR
+     - on the scalar kernel, the counter blocks go through wbaes_encrypt_ctr_blocks(),
+       the gather kernels are faster than the cached scalar path and take the blocks as they are
+     - inc32 (GCM) wraps the low 32 bits of the counter block and leaves the first 12 bytes alone
+*/
+static void ctr_xcrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len, bool inc32) {
+    uint8_t ks[16 * MODE_CHUNK_BLOCKS];
+    size_t i, n, bytes;
+    WBAES_CTR_CACHE cache;
+    bool cached = wbaes_kernels().encrypt_blocks == wbaes_encrypt_blocks_scalar;
+
+    cache.valid = false;
+
+    while (len) {
+        n = (len + 15) / 16;
+        if (n > MODE_CHUNK_BLOCKS) {
+            n = MODE_CHUNK_BLOCKS;
+        }
+
+        for (i = 0; i < n; i++) {
+            memcpy(ks + 16*i, ctr, 16);
+            if (inc32) {
+                wbaes_ctr_add32(ctr, 1);
+            }
+            else {
+                wbaes_ctr_add(ctr, 1);
+            }
+        }
+
+        if (cached) {
+            if (ee) {
+                encode_ext_blocks(ee->ext_f, ks, n);
+            }
+            wbaes_encrypt_ctr_blocks(et, cache, ks, n);
+            if (ee) {
+                encode_ext_blocks(ee->ext_g, ks, n);
+            }
+        }
+        else {
+            wbaes_encrypt_blocks_ext(et, ee, ks, n);
+        }
+
+        bytes = (16 * n < len) ? 16 * n : len;
+        for (i = 0; i < bytes; i++) {
+            out[i] = in[i] ^ ks[i];
+        }
+
+        in  += bytes;
+        out += bytes;
+        len -= bytes;
+    }
+}
+
+void wbaes_ctr_xcrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len) {
+    ctr_xcrypt(et, ee, ctr, in, out, len, false);
+}
+
+void wbaes_ctr32_xcrypt(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len) {
+    ctr_xcrypt(et, ee, ctr, in, out, len, true);
+}
+
+/*
+    GCM
+*/
+static const uint64_t gcm_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)GETU32(p) << 32 | GETU32(p + 4);
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+    PUTU32(p, (uint32_t)(v >> 32));
+    PUTU32(p + 4, (uint32_t)v);
+}
+
+static void gcm_table(WBAES_GCM *g, const uint8_t *h) {
+    uint64_t vh = get_u64(h), vl = get_u64(h + 8), t;
+    int i, j;
+
+    g->hh[8] = vh;
+    g->hl[8] = vl;
+    for (i = 4; i > 0; i >>= 1) {
+        t  = (vl & 1) * 0xe1000000U;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ (t << 32);
+        g->hh[i] = vh;
+        g->hl[i] = vl;
+    }
+    g->hh[0] = g->hl[0] = 0;
+
+    for (i = 2; i <= 8; i *= 2) {
+        for (j = 1; j < i; j++) {
+            g->hh[i+j] = g->hh[i] ^ g->hh[j];
+            g->hl[i+j] = g->hl[i] ^ g->hl[j];
+        }
+    }
+}
+
+/* x = x * H */
+static void gcm_mult(const WBAES_GCM *g, uint8_t *x) {
+    uint64_t zh, zl;
+    uint8_t  lo, hi, rem;
+    int i;
+
+    lo = x[15] & 0xf;
+    zh = g->hh[lo];
+    zl = g->hl[lo];
+
+    for (i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        hi = x[i] >> 4;
+
+        if (i != 15) {
+            rem = zl & 0xf;
+            zl  = (zh << 60) | (zl >> 4);
+            zh  = (zh >> 4) ^ (gcm_last4[rem] << 48);
+            zh ^= g->hh[lo];
+            zl ^= g->hl[lo];
+        }
+        rem = zl & 0xf;
+        zl  = (zh << 60) | (zl >> 4);
+        zh  = (zh >> 4) ^ (gcm_last4[rem] << 48);
+        zh ^= g->hh[hi];
+        zl ^= g->hl[hi];
+    }
+
+    put_u64(x, zh);
+    put_u64(x + 8, zl);
+}
+
+static void gcm_hash(WBAES_GCM *g, const uint8_t *p, size_t len) {
+    size_t i;
+
+    if (g->n_part) {
+        for (; len && g->n_part < 16; len--) {
+            g->part[g->n_part++] = *p++;
+        }
+        if (g->n_part < 16) {
+            return;
+        }
+        for (i = 0; i < 16; i++) {
+            g->x[i] ^= g->part[i];
+        }
+        gcm_mult(g, g->x);
+        g->n_part = 0;
+    }
+
+    for (; len >= 16; len -= 16, p += 16) {
+        for (i = 0; i < 16; i++) {
+            g->x[i] ^= p[i];
+        }
+        gcm_mult(g, g->x);
+    }
+
+    memcpy(g->part, p, len);
+    g->n_part = len;
+}
+
+/* pads the pending partial block with zeros */
+static void gcm_hash_pad(WBAES_GCM *g) {
+    size_t i;
+
+    if (g->n_part) {
+        for (i = 0; i < g->n_part; i++) {
+            g->x[i] ^= g->part[i];
+        }
+        gcm_mult(g, g->x);
+        g->n_part = 0;
+    }
+}
+
+void wbaes_gcm_init(WBAES_GCM *g, const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING *ee, const uint8_t *iv, size_t iv_len) {
+    uint8_t h[16] = {0, }, len_block[16] = {0, };
+
+    memset(g, 0, sizeof(*g));
+    g->et = &et;
+    g->ee = ee;
+
+    wbaes_encrypt_blocks_ext(et, ee, h, 1);
+    gcm_table(g, h);
+
+    if (iv_len == 12) {
+        memcpy(g->j0, iv, 12);
+        g->j0[15] = 1;
+    }
+    else {
+        gcm_hash(g, iv, iv_len);
+        gcm_hash_pad(g);
+        put_u64(len_block + 8, (uint64_t)iv_len * 8);
+        gcm_hash(g, len_block, 16);
+        memcpy(g->j0, g->x, 16);
+        memset(g->x, 0, 16);
+    }
+
+    /* with an IV other than 96 bits, J0 is a hash and its low word may wrap early */
+    memcpy(g->ctr, g->j0, 16);
+    wbaes_ctr_add32(g->ctr, 1);
+}
+
+void wbaes_gcm_aad(WBAES_GCM *g, const uint8_t *aad, size_t len) {
+    gcm_hash(g, aad, len);
+    g->aad_len += len;
+}
+
+void wbaes_gcm_ghash(WBAES_GCM *g, const uint8_t *ct, size_t len) {
+    if (!g->ct_len) {
+        gcm_hash_pad(g);
+    }
+
+    gcm_hash(g, ct, len);
+    g->ct_len += len;
+}
+
+void wbaes_gcm_encrypt(WBAES_GCM *g, const uint8_t *in, uint8_t *out, size_t len) {
+    wbaes_ctr32_xcrypt(*g->et, g->ee, g->ctr, in, out, len);
+    wbaes_gcm_ghash(g, out, len);
+}
+
+void wbaes_gcm_decrypt(WBAES_GCM *g, const uint8_t *in, uint8_t *out, size_t len) {
+    wbaes_gcm_ghash(g, in, len);
+    wbaes_ctr32_xcrypt(*g->et, g->ee, g->ctr, in, out, len);
+}
+
+void wbaes_gcm_tag(WBAES_GCM *g, uint8_t *tag) {
+    uint8_t len_block[16], ek[16];
+    int i;
+
+    gcm_hash_pad(g);
+    put_u64(len_block, g->aad_len * 8);
+    put_u64(len_block + 8, g->ct_len * 8);
+    gcm_hash(g, len_block, 16);
+
+    memcpy(ek, g->j0, 16);
+    wbaes_encrypt_blocks_ext(*g->et, g->ee, ek, 1);
+    for (i = 0; i < 16; i++) {
+        tag[i] = g->x[i] ^ ek[i];
+    }
+}
@@ -0,0 +1,306 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - NUMA topology, thread placement and table replication
+*/
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+#include "wbaes_numa.h"
+
+
+struct numa_topology {
+    int                           nodes;
+    bool                          emulated;
+    std::vector<std::vector<int>> cpus;         // per node
+    std::vector<int>              os_node;      // per node, kernel id (-1 on emulated nodes)
+    std::vector<int>              cpu_node;     // per cpu
+};
+
+static numa_topology topo;
+static std::once_flag topo_once;
+
+/*
+    Parses a sysfs list ("0-3,8,10-11")
+*/
+static std::vector<int> parse_list(const char *path) {
+    std::vector<int> ret;
+    FILE *fp = fopen(path, "r");
+    int a, b;
+    char sep;
+
+    if (!fp) {
+        return ret;
+    }
+
+    while (fscanf(fp, "%d", &a) == 1) {
+        b = a;
+        sep = fgetc(fp);
+        if (sep == '-') {
+            if (fscanf(fp, "%d", &b) != 1) {
+                break;
+            }
+            sep = fgetc(fp);
+        }
+        for (; a <= b; a++) {
+            ret.push_back(a);
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+static bool has(const std::vector<int> &list, int x) {
+    return std::find(list.begin(), list.end(), x) != list.end();
+}
+
+/*
+    Parses a node distance row ("10 21")
+*/
+static std::vector<int> parse_distances(const char *path) {
+    std::vector<int> ret;
+    FILE *fp = fopen(path, "r");
+    int d;
+
+    if (!fp) {
+        return ret;
+    }
+    while (fscanf(fp, "%d", &d) == 1) {
+        ret.push_back(d);
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+/* distance to kernel node id, from a node<n>/distance row */
+static int distance(const std::vector<int> &dist, const std::vector<int> &online_nodes, int id) {
+    size_t j = std::find(online_nodes.begin(), online_nodes.end(), id) - online_nodes.begin();
+
+    return j < dist.size() ? dist[j] : INT_MAX;
+}
+
+/*
+    Kernel nodes, compacted
+     - only nodes with both CPUs and memory become nodes, numbered from 0 whatever their
+       kernel ids (offline and sparse ids leave no empty node behind)
+     - the CPUs of a node without memory join the nearest node that has some
+       (node<n>/distance lists the distances to the online nodes, in order)
+*/
+static void load_nodes(const std::vector<int> &online_nodes) {
+    std::vector<int> memory = parse_list("/sys/devices/system/node/has_memory");
+    std::vector<std::vector<int>> memless;          // CPUs of nodes without memory, then the node id
+    std::vector<int> cpus, dist;
+    char   path[128];
+    size_t i;
+    int    n, best;
+
+    for (i = 0; i < online_nodes.size(); i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", online_nodes[i]);
+        cpus = parse_list(path);
+
+        if (cpus.empty()) {
+            continue;
+        }
+        if (!memory.empty() && !has(memory, online_nodes[i])) {
+            memless.push_back(cpus);
+            memless.back().push_back(online_nodes[i]);
+            continue;
+        }
+        if (topo.nodes == WBAES_MAX_NODES) {
+            break;
+        }
+        topo.cpus.push_back(cpus);
+        topo.os_node.push_back(online_nodes[i]);
+        topo.nodes++;
+    }
+
+    for (auto &c : memless) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance", c.back());
+        dist = parse_distances(path);
+        c.pop_back();
+
+        for (n = 1, best = 0; n < topo.nodes; n++) {
+            if (distance(dist, online_nodes, topo.os_node[n]) < distance(dist, online_nodes, topo.os_node[best])) {
+                best = n;
+            }
+        }
+        if (topo.nodes) {
+            topo.cpus[best].insert(topo.cpus[best].end(), c.begin(), c.end());
+        }
+    }
+}
+
+static void load_topology() {
+    int  n, cpu, fake;
+    size_t i;
+    std::vector<int> online = parse_list("/sys/devices/system/cpu/online");
+    std::vector<int> nodes  = parse_list("/sys/devices/system/node/online");
+
+    if (online.empty()) {
+        n = std::thread::hardware_concurrency();
+        for (cpu = 0; cpu < (n ? n : 1); cpu++) {
+            online.push_back(cpu);
+        }
+    }
+
+    const char *env = getenv("WBAES_NUMA_NODES");
+    fake = env ? atoi(env) : 0;
+
+    if (fake > 0) {
+        /*
+            Emulated nodes: contiguous slices of the online CPUs,
+            every node gets at least one CPU even if they have to be shared
+        */
+        topo.nodes    = fake < WBAES_MAX_NODES ? fake : WBAES_MAX_NODES;
+        topo.emulated = true;
+        topo.cpus.assign(topo.nodes, std::vector<int>());
+        topo.os_node.assign(topo.nodes, -1);
+
+        for (i = 0; i < online.size(); i++) {
+            topo.cpus[i * topo.nodes / online.size()].push_back(online[i]);
+        }
+        for (n = 0; n < topo.nodes; n++) {
+            if (topo.cpus[n].empty()) {
+                topo.cpus[n].push_back(online[n % online.size()]);
+            }
+        }
+    }
+    else {
+        topo.emulated = false;
+        topo.nodes    = 0;
+
+        load_nodes(nodes);
+
+        if (topo.nodes == 0) {
+            topo.nodes = 1;
+            topo.cpus.assign(1, online);
+            topo.os_node.assign(1, -1);
+        }
+    }
+
+    for (n = 0; n < topo.nodes; n++) {
+        for (i = 0; i < topo.cpus[n].size(); i++) {
+            cpu = topo.cpus[n][i];
+            if (cpu >= (int)topo.cpu_node.size()) {
+                topo.cpu_node.resize(cpu + 1, 0);
+            }
+            topo.cpu_node[cpu] = n;
+        }
+    }
+}
+
+static inline const numa_topology &topology() {
+    std::call_once(topo_once, load_topology);
+    return topo;
+}
+
+int wbaes_numa_nodes() {
+    return topology().nodes;
+}
+
+int wbaes_numa_node_of_cpu(int cpu) {
+    const numa_topology &t = topology();
+
+    return (cpu >= 0 && cpu < (int)t.cpu_node.size()) ? t.cpu_node[cpu] : 0;
+}
+
+int wbaes_numa_current_node() {
+    return wbaes_numa_node_of_cpu(sched_getcpu());
+}
+
+size_t wbaes_numa_cpus(int node, int *cpus, size_t max) {
+    const numa_topology &t = topology();
+    size_t i;
+
+    if (node < 0 || node >= t.nodes) {
+        return 0;
+    }
+
+    for (i = 0; i < t.cpus[node].size() && i < max; i++) {
+        cpus[i] = t.cpus[node][i];
+    }
+
+    return i;
+}
+
+int wbaes_numa_os_node(int node) {
+    const numa_topology &t = topology();
+
+    return (node >= 0 && node < t.nodes) ? t.os_node[node] : -1;
+}
+
+int wbaes_numa_bind_thread(int node) {
+    const numa_topology &t = topology();
+    cpu_set_t set;
+    size_t i;
+
+    if (node < 0 || node >= t.nodes || t.cpus[node].empty()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    for (i = 0; i < t.cpus[node].size(); i++) {
+        if (t.cpus[node][i] < CPU_SETSIZE) {
+            CPU_SET(t.cpus[node][i], &set);
+        }
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void replicate_on(const WBAES_ENCRYPTION_TABLE *src, WBAES_ENCRYPTION_TABLE **dst, int *err, int node, int flags) {
+    if (wbaes_numa_bind_thread(node) < 0 || !(*dst = wbaes_table_alloc(wbaes_numa_os_node(node), flags))) {
+        *err = errno ? errno : ENOMEM;
+        return;
+    }
+    memcpy((void *)*dst, src, sizeof(WBAES_ENCRYPTION_TABLE));      // first touch
+}
+
+int wbaes_table_replicate(const WBAES_ENCRYPTION_TABLE &src, WBAES_TABLE_REPLICAS &rep, int flags) {
+    const numa_topology &t = topology();
+    std::vector<std::thread> th;
+    std::vector<int> err(t.nodes, 0);
+    int n;
+
+    rep.nodes = t.nodes;
+    for (n = 0; n < t.nodes; n++) {
+        rep.node[n] = NULL;
+        th.emplace_back(replicate_on, &src, &rep.node[n], &err[n], n, flags);
+    }
+    for (auto &x : th) {
+        x.join();
+    }
+
+    for (n = 0; n < t.nodes; n++) {
+        if (err[n]) {
+            wbaes_table_replicas_free(rep);
+            errno = err[n];
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void wbaes_table_replicas_free(WBAES_TABLE_REPLICAS &rep) {
+    int n;
+
+    for (n = 0; n < rep.nodes; n++) {
+        wbaes_table_free(rep.node[n]);
+        rep.node[n] = NULL;
+    }
+    rep.nodes = 0;
+}
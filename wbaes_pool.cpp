@@ -0,0 +1,119 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Pool of key-independent generation material
+*/
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "wbaes_pool.h"
+
+struct WBAES_GEN_POOL {
+    std::mutex                        lock;
+    std::condition_variable           ready_cv;     // an entry became ready
+    std::condition_variable           stale_cv;     // an entry needs generating, or stop
+
+    std::vector<WBAES_GEN_MATERIAL *> ready;
+    std::vector<WBAES_GEN_MATERIAL *> stale;        // allocated, to be (re)generated
+    std::vector<std::thread>          threads;
+    bool                              stop;
+};
+
+static void generator_main(WBAES_GEN_POOL *pool) {
+    std::unique_lock<std::mutex> guard(pool->lock);
+    WBAES_GEN_MATERIAL *m;
+
+    for (;;) {
+        pool->stale_cv.wait(guard, [pool] { return pool->stop || !pool->stale.empty(); });
+        if (pool->stop) {
+            return;
+        }
+
+        m = pool->stale.back();
+        pool->stale.pop_back();
+
+        guard.unlock();
+        wbaes_gen_material(*m);
+        guard.lock();
+
+        pool->ready.push_back(m);
+        pool->ready_cv.notify_one();
+    }
+}
+
+WBAES_GEN_POOL *wbaes_gen_pool_create(size_t size, unsigned threads) {
+    WBAES_GEN_POOL *pool = new WBAES_GEN_POOL();
+    size_t i;
+
+    pool->stop = false;
+    for (i = 0; i < (size ? size : 1); i++) {
+        pool->stale.push_back(new WBAES_GEN_MATERIAL());
+    }
+    for (i = 0; i < (threads ? threads : 1); i++) {
+        pool->threads.emplace_back(generator_main, pool);
+    }
+
+    return pool;
+}
+
+void wbaes_gen_pool_destroy(WBAES_GEN_POOL *pool) {
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stop = true;
+    }
+    pool->stale_cv.notify_all();
+    for (auto &t : pool->threads) {
+        t.join();
+    }
+
+    for (i = 0; i < pool->ready.size(); i++) {
+        memset((void *)pool->ready[i], 0, sizeof(WBAES_GEN_MATERIAL));
+        delete pool->ready[i];
+    }
+    for (i = 0; i < pool->stale.size(); i++) {
+        delete pool->stale[i];
+    }
+    delete pool;
+}
+
+WBAES_GEN_MATERIAL *wbaes_gen_pool_take(WBAES_GEN_POOL *pool) {
+    std::unique_lock<std::mutex> guard(pool->lock);
+    WBAES_GEN_MATERIAL *m;
+
+    pool->ready_cv.wait(guard, [pool] { return !pool->ready.empty(); });
+    m = pool->ready.back();
+    pool->ready.pop_back();
+
+    return m;
+}
+
+void wbaes_gen_pool_give_back(WBAES_GEN_POOL *pool, WBAES_GEN_MATERIAL *m) {
+    memset((void *)m, 0, sizeof(WBAES_GEN_MATERIAL));
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stale.push_back(m);
+    }
+    pool->stale_cv.notify_one();
+}
+
+size_t wbaes_gen_pool_ready(WBAES_GEN_POOL *pool) {
+    std::lock_guard<std::mutex> guard(pool->lock);
+    return pool->ready.size();
+}
+
+void wbaes_gen_encryption_table_pooled(WBAES_GEN_POOL *pool, WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING *ie, uint32_t *roundkeys) {
+    WBAES_GEN_MATERIAL *m = wbaes_gen_pool_take(pool);
+
+    wbaes_gen_keyed_table(et, *m, roundkeys);
+
+    memcpy(&ee, &m->ee, sizeof(ee));
+    if (ie) {
+        memcpy(ie, &m->ie, sizeof(*ie));
+    }
+
+    wbaes_gen_pool_give_back(pool, m);
+}
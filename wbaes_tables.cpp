@@ -4,23 +4,63 @@
 */
 
 #include <iostream>
+#include <chrono>
 #include <cstdlib>
 #include <NTL/mat_GF2.h>
 
 #include "gf.h"
 #include "wbaes_tables.h"
+#include "wbaes_cpu.h"
 
-extern uint8_t         Sbox[256];
 extern uint8_t     shift_map[16];
 extern uint8_t inv_shift_map[16];
 
+/*
+    Generation statistics
+     - gen_lap() closes a phase: the time since t goes to the phase and t restarts
+*/
+static const char *gen_phase_names[WBAES_GEN_PHASES] = {
+    "encoding", "mb", "l", "xor", "t_boxes", "tyi", "apply_mb", "reencode", "copy"
+};
+
+static thread_local WBAES_GEN_STATS gen_stats;
+
+static inline uint64_t gen_clock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void gen_lap(WBAES_GEN_PHASE phase, uint64_t &t) {
+    uint64_t now = gen_clock();
+
+    gen_stats.ns[phase] += now - t;
+    gen_stats.calls[phase]++;
+    t = now;
+}
+
+static inline void gen_alloc(size_t bytes) {
+    gen_stats.allocs++;
+    gen_stats.alloc_bytes += bytes;
+}
+
+void wbaes_gen_stats(WBAES_GEN_STATS *st, bool reset) {
+    *st = gen_stats;
+    if (reset) {
+        memset(&gen_stats, 0, sizeof(gen_stats));
+    }
+}
+
+const char *wbaes_gen_phase_name(int phase) {
+    return (phase >= 0 && phase < WBAES_GEN_PHASES) ? gen_phase_names[phase] : "unknown";
+}
+
 /*
     Operations on GF(2) using NTL
 */
 static NTL::mat_GF2 gen_gf2_rand_matrix(const int dim) {
     int i, j;
     NTL::mat_GF2 ret(NTL::INIT_SIZE, dim, dim);
-    
+
+    gen_alloc(dim * ((dim + 7) / 8));
     for (i = 0; i < dim; i++) {
         for (j = 0; j < dim; j++) {
             ret[i][j] = NTL::random_GF2();
@@ -39,35 +79,96 @@ static NTL::mat_GF2 gen_gf2_rand_invertible_matrix(const int dim) {
     }
 }
 
-template <typename T>
-static inline NTL::vec_GF2 scalar2vec(const T in) {
-    int i, bit_len = sizeof(T) * 8;
-    NTL::vec_GF2 ret;
+static NTL::mat_GF2 gf2_inv(const NTL::mat_GF2& mat) {
+    gen_alloc(mat.NumRows() * ((mat.NumCols() + 7) / 8));
+    return NTL::inv(mat);
+}
 
-    ret.SetLength(bit_len);
-    
-    for (i = 0; i < bit_len; i++) {
-        ret[bit_len - 1 - i] = ((in >> i) & 0x1);
+/*
+    8x8 block (i, j) of a matrix in the gf2p8affineqb layout
+     - block (i, j) maps byte j of the input to byte i of the output, bytes and bits
+       counted from the most significant one (row r, column c of the matrix is the
+       coefficient of input bit n-1-c in output bit n-1-r), row k of the block lands in byte k
+*/
+static uint64_t gf2_block(const NTL::mat_GF2& mat, const int i, const int j) {
+    uint64_t a = 0;
+    int r, c;
+
+    for (r = 0; r < 8; r++) {
+        uint64_t row = 0;
+
+        for (c = 0; c < 8; c++) {
+            row |= (uint64_t)NTL::rep(mat[8*i + r][8*j + c]) << (7 - c);
+        }
+        a |= row << (8*r);
+    }
+
+    return a;
+}
+
+struct byte_range {
+    uint8_t x[256];
+};
+
+static constexpr byte_range gen_byte_range() {
+    byte_range ret = {};
+
+    for (int x = 0; x < 256; x++) {
+        ret.x[x] = (uint8_t)x;
     }
-    
     return ret;
 }
 
-template <typename T>
-static inline T vec2scalar(const NTL::vec_GF2& in) {
-  int i, bit_len = sizeof(T) * 8;
-  T ret = 0;
-  
-  for (i = 0; i < bit_len; i++) {
-    ret = (ret << 1) | NTL::rep(in[i]);
-  }
+static constexpr byte_range all_bytes = gen_byte_range();
 
-  return ret;
+/* table[x] = mat * x, for an 8x8 matrix */
+static void gen_l_table(const NTL::mat_GF2& mat, uint8_t *table) {
+    wbaes_kernels().gf2_linear_bytes(gf2_block(mat, 0, 0), all_bytes.x, table, 256);
 }
 
-template <typename T>
-static inline T mul(const NTL::mat_GF2& mat, const T x) {
-  return vec2scalar<T>(mat * scalar2vec<T>(x));
+/* table[b][x] = mat * (x << (24 - 8*b)), for a 32x32 matrix, one 8x8 block at a time */
+static void gen_mb_table(const NTL::mat_GF2& mat, uint32_t (*table)[256]) {
+    const WBAES_KERNELS &k = wbaes_kernels();
+    uint8_t out[256];
+    int b, i, x;
+
+    for (b = 0; b < 4; b++) {
+        memset(table[b], 0, sizeof(table[b]));
+
+        for (i = 0; i < 4; i++) {
+            k.gf2_linear_bytes(gf2_block(mat, i, b), all_bytes.x, out, 256);
+            for (x = 0; x < 256; x++) {
+                table[b][x] |= (uint32_t)out[x] << (24 - 8*i);
+            }
+        }
+    }
+}
+
+/*
+    L on the output of the MBL-tables, then the output encoding int_m
+     - byte j of every entry goes through L of the column entry shift_map^-1[4*(n/4) + j],
+       a whole byte plane of the row per gf2_linear_bytes() call
+*/
+static void apply_l_row(uint32_t *row, const uint64_t *l, const uint8_t (*int_m)[16], const int n) {
+    const WBAES_KERNELS &k = wbaes_kernels();
+    uint8_t plane[4][256];
+    int j, x;
+
+    for (j = 0; j < 4; j++) {
+        for (x = 0; x < 256; x++) {
+            plane[j][x] = (uint8_t)(row[x] >> (24 - 8*j));
+        }
+        k.gf2_linear_bytes(l[inv_shift_map[4*(n/4) + j]], plane[j], plane[j], 256);
+    }
+
+    for (x = 0; x < 256; x++) {
+        row[x] = (
+            (uint32_t)int_m[0][plane[0][x] >> 4] << 28 | int_m[1][plane[0][x] & 0xf] << 24 |
+            int_m[2][plane[1][x] >> 4] << 20 | int_m[3][plane[1][x] & 0xf] << 16 |
+            int_m[4][plane[2][x] >> 4] << 12 | int_m[5][plane[2][x] & 0xf] <<  8 |
+            int_m[6][plane[3][x] >> 4] <<  4 | int_m[7][plane[3][x] & 0xf]
+        );
+    }
 }
 
 /*
@@ -108,7 +209,7 @@ static void gen_rand(uint8_t *x, uint8_t *inv_x) {
     }
 }
 
-void encode_ext_x(uint8_t (*f)[2][16], uint8_t *x) {
+void encode_ext_x(const uint8_t (*f)[2][16], uint8_t *x) {
     int i;
 
     for (i = 0; i < 16; i++) {
@@ -116,7 +217,57 @@ void encode_ext_x(uint8_t (*f)[2][16], uint8_t *x) {
     }
 }
 
-void decode_ext_x(uint8_t (*inv_f)[2][16], uint8_t *x) {
+void encode_ext_blocks_scalar(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        encode_ext_x(f, blocks + 16*i);
+    }
+}
+
+void encode_ext_blocks(const uint8_t (*f)[2][16], uint8_t *blocks, size_t n) {
+    wbaes_kernels().encode_ext_blocks(f, blocks, n);
+}
+
+/*
+    Generation kernels, scalar
+     - the matrix is split into the images of the low and the high nibble of the input
+*/
+void gf2_linear_bytes_scalar(uint64_t a, const uint8_t *x, uint8_t *y, size_t n) {
+    uint8_t col[8], lo[16], hi[16];
+    size_t  i;
+    int     c, b;
+
+    for (c = 0; c < 8; c++) {
+        col[c] = 0;
+        for (b = 0; b < 8; b++) {
+            col[c] |= ((a >> (8*(7 - b) + c)) & 1) << b;
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        lo[i] = hi[i] = 0;
+        for (c = 0; c < 4; c++) {
+            if ((i >> c) & 1) {
+                lo[i] ^= col[c];
+                hi[i] ^= col[c + 4];
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        y[i] = lo[x[i] & 0xf] ^ hi[x[i] >> 4];
+    }
+}
+
+void gf2_sbox_bytes_scalar(uint8_t k, const uint8_t *x, uint8_t *y, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        y[i] = gf_tables.sbox[x[i] ^ k];
+    }
+}
+
+void decode_ext_x(const uint8_t (*inv_f)[2][16], uint8_t *x) {
     int i;
 
     for (i = 0; i < 16; i++) {
@@ -296,6 +447,13 @@ static void gen_nonlinear_encoding(WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &i
     // }
 }
 
+/*
+    Decodes byte k (nibbles 2k, 2k+1) of the output of a XOR-32 level
+*/
+static inline uint8_t ie_out_byte(const uint8_t (*inv_out)[16], int k, int x) {
+    return inv_out[2*k][(x >> 4) & 0xf] << 4 | inv_out[2*k+1][x & 0xf];
+}
+
 static void gen_xor_tables(uint8_t (*r1_xor_tables)[96][16][16], uint8_t (*r2_xor_tables)[96][16][16], const WBAES_EXT_ENCODING &ee, const WBAES_INT_ENCODING &ie) {
     /*
         xor_tables
@@ -369,17 +527,16 @@ static void gen_xor_tables(uint8_t (*r1_xor_tables)[96][16][16], uint8_t (*r2_xo
 }
 
 static void gen_t_boxes(uint8_t (*t_boxes)[16][256], uint32_t *roundkeys) {
+    const WBAES_KERNELS &k = wbaes_kernels();
     int r, x, n;
     uint8_t temp[16];
 
     for (r = 0; r < 10; r++) {
-        for (x = 0; x < 256; x++) {
-            memset(temp, x, 16);
-            add_rk(temp, &roundkeys[4*r]);          // temp ^ shift_rows(RK)
+        memset(temp, 0, 16);
+        add_rk(temp, &roundkeys[4*r]);              // shift_rows(RK)
 
-            for (n = 0; n < 16; n++) {
-                t_boxes[r][n][x] = Sbox[temp[n]];   // sbox(temp ^ shift_rows(RK))
-            }
+        for (n = 0; n < 16; n++) {
+            k.gf2_sbox_bytes(temp[n], all_bytes.x, t_boxes[r][n], 256);     // sbox(x ^ shift_rows(RK))
         }
     }
 
@@ -397,18 +554,58 @@ static void gen_t_boxes(uint8_t (*t_boxes)[16][256], uint32_t *roundkeys) {
     }
 }
 
-static void gen_tyi_tables(uint32_t (*tyi_tables)[256]) {
-    int x;
+/*
+    Inverse T-boxes
+     - equivalent inverse cipher (FIPS-197 5.3.5): InvSubBytes, InvShiftRows, InvMixColumns
+       and round keys InvMixColumns(RK_10-r), run on the encryption datapath
+     - the state is kept with rows 1 and 3 swapped: in that order InvShiftRows becomes
+       ShiftRows, so the evaluator and the encodings stay as they are; the round keys are
+       swapped the same way, InvMixColumns is inv_tyi
+*/
+static inline int dec_row_swap(int i) {
+    return (i & ~3) | ((4 - (i & 3)) & 3);
+}
 
-    for (x = 0; x < 256; x++) {
-        tyi_tables[0][x] = (gf_mul(2, x) << 24) |           (x  << 16) |           (x  << 8) | gf_mul(3, x);
-        tyi_tables[1][x] = (gf_mul(3, x) << 24) | (gf_mul(2, x) << 16) |           (x  << 8) |          (x);
-        tyi_tables[2][x] =           (x  << 24) | (gf_mul(3, x) << 16) | (gf_mul(2, x) << 8) |          (x);
-        tyi_tables[3][x] =           (x  << 24) |           (x  << 16) | (gf_mul(3, x) << 8) | gf_mul(2, x);
+static void gen_inv_t_boxes(uint8_t (*t_boxes)[16][256], const uint32_t *roundkeys) {
+    static const uint8_t inv_mc[4] = { 0x0e, 0x0b, 0x0d, 0x09 };
+    uint8_t u8_rk[16], dk[11][16], y;
+    int r, n, c, x;
+
+    for (r = 0; r < 11; r++) {
+        for (c = 0; c < 4; c++) {
+            PUTU32(u8_rk + 4*c, roundkeys[4*(10-r) + c]);
+        }
+        for (n = 0; n < 16; n++) {
+            y = u8_rk[n];
+            if (r > 0 && r < 10) {
+                for (c = 0, y = 0; c < 4; c++) {
+                    y ^= gf_tables.mul[inv_mc[c]][u8_rk[(n & ~3) | ((n + c) & 3)]];     // InvMixColumns(RK)
+                }
+            }
+            dk[r][dec_row_swap(n)] = y;
+        }
+    }
+
+    for (r = 0; r < 10; r++) {
+        for (n = 0; n < 16; n++) {
+            for (x = 0; x < 256; x++) {
+                t_boxes[r][n][x] = gf_tables.inv_sbox[x ^ dk[r][shift_map[n]]];      // InvSbox(x ^ shift_rows(DK))
+            }
+        }
+    }
+
+    /* InvSbox(temp ^ shift_rows(DK_9)) ^ DK_10 */
+    for (n = 0; n < 16; n++) {
+        for (x = 0; x < 256; x++) {
+            t_boxes[9][n][x] ^= dk[10][n];
+        }
     }
+
+    memset(u8_rk, 0, sizeof(u8_rk));
+    memset(dk, 0, sizeof(dk));
 }
 
-static void composite_t_tyi(uint8_t (*t_boxes)[16][256], uint32_t (*tyi_tables)[256], uint32_t (*ty_boxes)[16][256], uint8_t (*last_box)[256]) {
+static void composite_t_tyi(uint8_t (*t_boxes)[16][256], const uint32_t (*tyi_tables)[256], uint32_t (*ty_boxes)[16][256], uint8_t (*last_box)[256]) {
     int r, n, x;
 
     /* Round 1-9 */
@@ -424,20 +621,18 @@ static void composite_t_tyi(uint8_t (*t_boxes)[16][256], uint32_t (*tyi_tables)[
     memcpy(last_box, t_boxes[9], 16 * 256);
 }
 
-static void apply_encoding(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie) {
-    uint8_t   u8_temp[256];
-    uint32_t u32_temp[256];
-    NTL::mat_GF2 mb[9][4], l[10][16], l0[16], cl0;
-
-    int r, n, x;
-
-    /*
-        Linear Encoding
-         - (MB) Inverible 32x32 matrix
-         - (L)  Inverible 8x8 matrix
-    */
-    uint8_t  y, t1, t2, t3, t4;
-    uint32_t t;
+/*
+    Mixing bijections and MBL-tables (key-independent)
+     - MB and L are kept as lookups: 32x32 MB as four byte slices, MB * x = XOR of slice[b][byte b of x],
+       L^-1 as a 256 entry table, the key stage then needs no matrix arithmetic
+*/
+static void gen_mixing(WBAES_GEN_MATERIAL &m) {
+    NTL::mat_GF2 mb, l;
+    uint64_t l_blocks[16];
+    uint32_t inv_mb_table[4][256];
+    uint8_t  y;
+    uint64_t t = gen_clock();
+    int r, n, c, x;
 
     for (r = 0; r < 9; r++) {
         /*
@@ -446,94 +641,88 @@ static void apply_encoding(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, W
              - components : GF2
              - determinant: !0
         */
-        mb[r][0] = gen_gf2_rand_invertible_matrix(32);
-        mb[r][1] = gen_gf2_rand_invertible_matrix(32);
-        mb[r][2] = gen_gf2_rand_invertible_matrix(32);
-        mb[r][3] = gen_gf2_rand_invertible_matrix(32);
-
-        /*
-            Applies Mixing Bijection
-        */
-        for (x = 0; x < 256; x++) {
-            for (n = 0; n < 16; n++) {
-                et.ty_boxes[r][n][x] = mul<uint32_t>(mb[r][n/4], et.ty_boxes[r][n][x]);
-                
-                uint8_t y = ie.inv_int_outs[r][8+(n/4)][(n%4)*2][(x >> 4) & 0xf] << 4 | ie.inv_int_outs[r][8+(n/4)][(n%4)*2+1][x & 0xf];
-                et.mbl_tables[r][n][x] = mul<uint32_t>(NTL::inv(mb[r][n/4]), (uint32_t)(y << (24 - (8 * (n % 4)))));
+        for (c = 0; c < 4; c++) {
+            mb = gen_gf2_rand_invertible_matrix(32);
+            gen_mb_table(mb, m.mb[r][c]);
+            gen_mb_table(gf2_inv(mb), inv_mb_table);
+
+            /*
+                Applies Mixing Bijection (MB^-1 on the input of the MBL-tables)
+            */
+            for (n = c*4; n < c*4 + 4; n++) {
+                for (x = 0; x < 256; x++) {
+                    y = ie_out_byte(m.ie.inv_int_outs[r][8+(n/4)], n%4, x);
+                    m.mbl_tables[r][n][x] = inv_mb_table[n%4][y];
+                }
             }
         }
-    }
+        gen_lap(WBAES_GEN_MB, t);
 
-    /*
-        Applies L at each round
-    */
-
-    for (r = 0; r < 9; r++) {
         /*
             Initializes Invertible Matrix (L)
                 - size       : 8 x 8
                 - components : GF2
                 - determinant: !0
         */
-        l[r][0 ] = gen_gf2_rand_invertible_matrix(8); l[r][1 ] = gen_gf2_rand_invertible_matrix(8);
-        l[r][2 ] = gen_gf2_rand_invertible_matrix(8); l[r][3 ] = gen_gf2_rand_invertible_matrix(8);
-        l[r][4 ] = gen_gf2_rand_invertible_matrix(8); l[r][5 ] = gen_gf2_rand_invertible_matrix(8);
-        l[r][6 ] = gen_gf2_rand_invertible_matrix(8); l[r][7 ] = gen_gf2_rand_invertible_matrix(8);
-        l[r][8 ] = gen_gf2_rand_invertible_matrix(8); l[r][9 ] = gen_gf2_rand_invertible_matrix(8);
-        l[r][10] = gen_gf2_rand_invertible_matrix(8); l[r][11] = gen_gf2_rand_invertible_matrix(8);
-        l[r][12] = gen_gf2_rand_invertible_matrix(8); l[r][13] = gen_gf2_rand_invertible_matrix(8);
-        l[r][14] = gen_gf2_rand_invertible_matrix(8); l[r][15] = gen_gf2_rand_invertible_matrix(8);
-        
         for (n = 0; n < 16; n++) {
-            for (x = 0; x < 256; x++) {
-                t1 = mul<uint8_t>(l[r][inv_shift_map[(4*(n/4))  ]], (uint8_t)(et.mbl_tables[r][n][x] >> 24));
-                t2 = mul<uint8_t>(l[r][inv_shift_map[(4*(n/4))+1]], (uint8_t)(et.mbl_tables[r][n][x] >> 16));
-                t3 = mul<uint8_t>(l[r][inv_shift_map[(4*(n/4))+2]], (uint8_t)(et.mbl_tables[r][n][x] >>  8));
-                t4 = mul<uint8_t>(l[r][inv_shift_map[(4*(n/4))+3]], (uint8_t)(et.mbl_tables[r][n][x]      ));
-
-                et.mbl_tables[r][n][x] = (
-                    ie.int_m[r][n][0][(t1 >> 4) & 0xf] << 28 | ie.int_m[r][n][1][t1 & 0xf] << 24 |
-                    ie.int_m[r][n][2][(t2 >> 4) & 0xf] << 20 | ie.int_m[r][n][3][t2 & 0xf] << 16 |
-                    ie.int_m[r][n][4][(t3 >> 4) & 0xf] << 12 | ie.int_m[r][n][5][t3 & 0xf] <<  8 |
-                    ie.int_m[r][n][6][(t4 >> 4) & 0xf] <<  4 | ie.int_m[r][n][7][t4 & 0xf]
-                );
-            }
+            l = gen_gf2_rand_invertible_matrix(8);
+            l_blocks[n] = gf2_block(l, 0, 0);
+            gen_l_table(gf2_inv(l), m.inv_l[r][n]);
+        }
+
+        /*
+            Applies L at each round
+        */
+        for (n = 0; n < 16; n++) {
+            apply_l_row(m.mbl_tables[r][n], l_blocks, m.ie.int_m[r][n], n);
         }
+        gen_lap(WBAES_GEN_L, t);
     }
+}
+
+static inline uint32_t encode_int_s(const uint8_t (*int_s)[16], uint32_t t) {
+    return (
+        int_s[0][(t >> 28) & 0xf] << 28 | int_s[1][(t >> 24) & 0xf] << 24 |
+        int_s[2][(t >> 20) & 0xf] << 20 | int_s[3][(t >> 16) & 0xf] << 16 |
+        int_s[4][(t >> 12) & 0xf] << 12 | int_s[5][(t >>  8) & 0xf] <<  8 |
+        int_s[6][(t >>  4) & 0xf] <<  4 | int_s[7][(t      ) & 0xf]
+    );
+}
+
+/*
+    Applies encodings to the key-dependent tables
+     - MB on the output of the ty-boxes
+     - input decoding: external encoding at round 1, L^-1 and XOR output encoding after
+     - output encoding: int_s on the ty-boxes, external encoding on the last box
+*/
+static void apply_encoding(WBAES_ENCRYPTION_TABLE &et, const WBAES_GEN_MATERIAL &m) {
+    const WBAES_EXT_ENCODING &ee = m.ee;
+    const WBAES_INT_ENCODING &ie = m.ie;
+    uint8_t   u8_temp[256], y, t8;
+    uint32_t u32_temp[256], t;
+    uint64_t clock = gen_clock();
+    int r, n, x;
 
     /*
-        Applies L to inverse of L at previous round
+        Applies Mixing Bijection
     */
-    l0[0 ] = gen_gf2_rand_invertible_matrix(8); l0[1 ] = gen_gf2_rand_invertible_matrix(8);
-    l0[2 ] = gen_gf2_rand_invertible_matrix(8); l0[3 ] = gen_gf2_rand_invertible_matrix(8);
-    l0[4 ] = gen_gf2_rand_invertible_matrix(8); l0[5 ] = gen_gf2_rand_invertible_matrix(8);
-    l0[6 ] = gen_gf2_rand_invertible_matrix(8); l0[7 ] = gen_gf2_rand_invertible_matrix(8);
-    l0[8 ] = gen_gf2_rand_invertible_matrix(8); l0[9 ] = gen_gf2_rand_invertible_matrix(8);
-    l0[10] = gen_gf2_rand_invertible_matrix(8); l0[11] = gen_gf2_rand_invertible_matrix(8);
-    l0[12] = gen_gf2_rand_invertible_matrix(8); l0[13] = gen_gf2_rand_invertible_matrix(8);
-    l0[14] = gen_gf2_rand_invertible_matrix(8); l0[15] = gen_gf2_rand_invertible_matrix(8);
-
-    // for (r = 0; r < 16; r++) {
-    //     for (x = 0; x < 256; x++) {
-    //         y = ee.inv_ext_f[r][1][(x >> 4) & 0xf] << 4 | ee.inv_ext_f[r][0][(x & 0xf)];
-    //         t = mul<uint8_t>(l0[inv_shift_map[r]], y);
-    //         et.i_tables[r][r][x] = ie.int_f[r][1][(t >> 4) & 0xf] << 4 | ie.int_f[r][0][(t & 0xf)];
-    //     }
-    // }
+    for (r = 0; r < 9; r++) {
+        for (n = 0; n < 16; n++) {
+            const uint32_t (*mb)[256] = m.mb[r][n/4];
+
+            for (x = 0; x < 256; x++) {
+                t = et.ty_boxes[r][n][x];
+                et.ty_boxes[r][n][x] = mb[0][t >> 24] ^ mb[1][(t >> 16) & 0xff] ^ mb[2][(t >> 8) & 0xff] ^ mb[3][t & 0xff];
+            }
+        }
+    }
+    gen_lap(WBAES_GEN_APPLY_MB, clock);
 
     for (n = 0; n < 16; n++) {
         memcpy(u32_temp, et.ty_boxes[0][n], 1024);
         for (x = 0; x < 256; x++) {
             y = ee.inv_ext_f[shift_map[n]][1][(x >> 4) & 0xf] << 4 | ee.inv_ext_f[shift_map[n]][0][x & 0xf];
-            // y = ie.inv_int_outf[14][shift_map[n]*2][(x >> 4) & 0xf] << 4 | ie.inv_int_outf[14][shift_map[n]*2+1][x & 0xf];
-            t = u32_temp[(uint8_t)y];
-            // t = u32_temp[mul<uint8_t>(NTL::inv(l0[n]), (uint8_t)y)];
-            et.ty_boxes[0][n][x] = (
-                ie.int_s[0][n][0][(t >> 28) & 0xf] << 28 | ie.int_s[0][n][1][(t >> 24) & 0xf] << 24 |
-                ie.int_s[0][n][2][(t >> 20) & 0xf] << 20 | ie.int_s[0][n][3][(t >> 16) & 0xf] << 16 |
-                ie.int_s[0][n][4][(t >> 12) & 0xf] << 12 | ie.int_s[0][n][5][(t >>  8) & 0xf] <<  8 |
-                ie.int_s[0][n][6][(t >>  4) & 0xf] <<  4 | ie.int_s[0][n][7][(t      ) & 0xf]   
-            );
+            et.ty_boxes[0][n][x] = encode_int_s(ie.int_s[0][n], u32_temp[y]);
         }
     }
 
@@ -542,14 +731,8 @@ static void apply_encoding(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, W
             uint8_t entry = shift_map[n];
             memcpy(u32_temp, et.ty_boxes[r][n], 1024);
             for (x = 0; x < 256; x++) {
-                y = ie.inv_int_outm[r-1][8+(entry/4)][2*(entry%4)][(x >> 4) & 0xf] << 4 | ie.inv_int_outm[r-1][8+(entry/4)][2*(entry%4)+1][x & 0xf];
-                t = u32_temp[mul<uint8_t>(NTL::inv(l[r-1][n]), (uint8_t)y)];
-                et.ty_boxes[r][n][x] = (
-                    ie.int_s[r][n][0][(t >> 28) & 0xf] << 28 | ie.int_s[r][n][1][(t >> 24) & 0xf] << 24 |
-                    ie.int_s[r][n][2][(t >> 20) & 0xf] << 20 | ie.int_s[r][n][3][(t >> 16) & 0xf] << 16 |
-                    ie.int_s[r][n][4][(t >> 12) & 0xf] << 12 | ie.int_s[r][n][5][(t >>  8) & 0xf] <<  8 |
-                    ie.int_s[r][n][6][(t >>  4) & 0xf] <<  4 | ie.int_s[r][n][7][(t      ) & 0xf]       
-                );
+                y = ie_out_byte(ie.inv_int_outm[r-1][8+(entry/4)], entry%4, x);
+                et.ty_boxes[r][n][x] = encode_int_s(ie.int_s[r][n], u32_temp[m.inv_l[r-1][n][y]]);
             }
         }
     }
@@ -561,35 +744,301 @@ static void apply_encoding(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, W
         uint8_t entry = shift_map[n];
         memcpy(u8_temp, et.last_box[n], 256);
         for (x = 0; x < 256; x++) {
-            y = ie.inv_int_outm[8][8+(entry/4)][2*(entry%4)][(x >> 4) & 0xf] << 4 | ie.inv_int_outm[8][8+(entry/4)][2*(entry%4)+1][x & 0xf];
-            t = u8_temp[mul<uint8_t>(NTL::inv(l[8][n]), (uint8_t)y)];
-            et.last_box[n][x] = ee.inv_ext_g[n][1][(t >> 4) & 0xf] << 4 | ee.inv_ext_g[n][0][t & 0xf];
+            y  = ie_out_byte(ie.inv_int_outm[8][8+(entry/4)], entry%4, x);
+            t8 = u8_temp[m.inv_l[8][n][y]];
+            et.last_box[n][x] = ee.inv_ext_g[n][1][(t8 >> 4) & 0xf] << 4 | ee.inv_ext_g[n][0][t8 & 0xf];
         }
     }
+    gen_lap(WBAES_GEN_REENCODE, clock);
 }
 
-void wbaes_gen_encryption_table(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys) {
-    uint8_t    t_boxes[10][16][256];
-    uint32_t tyi_table[4][256]     ;
+void wbaes_gen_material(WBAES_GEN_MATERIAL &m) {
+    uint64_t t = gen_clock();
 
     /*
         Generates Non-linear random encoding table
             External Encoding - ee
             Internal Encoding - ie
     */
-    gen_nonlinear_encoding(ee, ie);
+    gen_nonlinear_encoding(m.ee, m.ie);
+    gen_lap(WBAES_GEN_ENCODING, t);
+
+    /*
+        Mixing bijections, MBL-tables and XOR-tables
+    */
+    gen_mixing(m);
+    t = gen_clock();
+    gen_xor_tables(m.r1_xor_tables, m.r2_xor_tables, m.ee, m.ie);
+    gen_lap(WBAES_GEN_XOR, t);
+}
+
+static void gen_keyed(WBAES_ENCRYPTION_TABLE &et, const WBAES_GEN_MATERIAL &m, uint32_t *roundkeys, bool inverse) {
+    uint8_t    t_boxes[10][16][256];
+    uint64_t   t = gen_clock();
 
     /*
         Generates T-boxes depend on round keys, 
             Tyi-table and complex them. 
     */
-    gen_t_boxes(t_boxes, roundkeys);
-    gen_tyi_tables(tyi_table);
-    composite_t_tyi(t_boxes, tyi_table, et.ty_boxes, et.last_box);
+    if (inverse) {
+        gen_inv_t_boxes(t_boxes, roundkeys);
+    }
+    else {
+        gen_t_boxes(t_boxes, roundkeys);
+    }
+    gen_lap(WBAES_GEN_T_BOXES, t);
+    composite_t_tyi(t_boxes, inverse ? gf_tables.inv_tyi : gf_tables.tyi, et.ty_boxes, et.last_box);
+    gen_lap(WBAES_GEN_TYI, t);
 
     /*
         Applies encoding to tables
     */
-    apply_encoding(et, ee, ie);
-    gen_xor_tables(et.r1_xor_tables, et.r2_xor_tables, ee, ie);
+    apply_encoding(et, m);
+    t = gen_clock();
+    memcpy(et.mbl_tables   , m.mbl_tables   , sizeof(et.mbl_tables));
+    memcpy(et.r1_xor_tables, m.r1_xor_tables, sizeof(et.r1_xor_tables));
+    memcpy(et.r2_xor_tables, m.r2_xor_tables, sizeof(et.r2_xor_tables));
+    gen_lap(WBAES_GEN_COPY, t);
+    gen_stats.tables++;
+
+    memset(t_boxes, 0, sizeof(t_boxes));
+}
+
+static void gen_table(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys, bool inverse) {
+    WBAES_GEN_MATERIAL *m = new WBAES_GEN_MATERIAL();
+
+    gen_alloc(sizeof(*m));
+    wbaes_gen_material(*m);
+    gen_keyed(et, *m, roundkeys, inverse);
+
+    memcpy(&ee, &m->ee, sizeof(ee));
+    memcpy(&ie, &m->ie, sizeof(ie));
+
+    memset((void *)m, 0, sizeof(*m));
+    delete m;
+}
+
+void wbaes_gen_keyed_table(WBAES_ENCRYPTION_TABLE &et, const WBAES_GEN_MATERIAL &m, uint32_t *roundkeys) {
+    gen_keyed(et, m, roundkeys, false);
+}
+
+void wbaes_gen_encryption_table(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys) {
+    gen_table(et, ee, ie, roundkeys, false);
+}
+
+void wbaes_gen_decryption_table(WBAES_ENCRYPTION_TABLE &dt, WBAES_EXT_ENCODING &ee, WBAES_INT_ENCODING &ie, uint32_t *roundkeys) {
+    gen_table(dt, ee, ie, roundkeys, true);
+}
+
+void wbaes_dec_order(uint8_t *blocks, size_t n) {
+    uint8_t t;
+    size_t  i;
+    int     c;
+
+    for (i = 0; i < n; i++, blocks += 16) {
+        for (c = 0; c < 16; c += 4) {
+            t = blocks[c+1];
+            blocks[c+1] = blocks[c+3];
+            blocks[c+3] = t;
+        }
+    }
+}
+
+/*
+    Round-at-a-time generation
+     - only the encodings of the current and the previous round are kept (gen_round),
+       XOR-tables read their input decodings straight from inv_int_s / inv_int_outs
+       instead of the int_xs / int_ys copies
+     - every round is written into et as soon as it is done, no WBAES_INT_ENCODING,
+       T-box set or NTL matrix outlives its round
+*/
+struct gen_round {
+    uint8_t        int_s[16][8][16];
+    uint8_t    inv_int_s[16][8][16];
+    uint8_t     int_outs[12][8][16];
+    uint8_t inv_int_outs[12][8][16];
+    uint8_t        int_m[16][8][16];
+    uint8_t    inv_int_m[16][8][16];
+    uint8_t     int_outm[12][8][16];
+    uint8_t inv_int_outm[12][8][16];
+    uint8_t        inv_l[16][256];
+};
+
+static void gen_round_encoding(gen_round &g) {
+    int j, k;
+
+    for (j = 0; j < 16; j++) {
+        for (k = 0; k < 8; k++) {
+            gen_rand(g.int_s[j][k], g.inv_int_s[j][k]);
+            gen_rand(g.int_m[j][k], g.inv_int_m[j][k]);
+        }
+    }
+    for (j = 0; j < 12; j++) {
+        for (k = 0; k < 8; k++) {
+            gen_rand(g.int_outs[j][k], g.inv_int_outs[j][k]);
+            gen_rand(g.int_outm[j][k], g.inv_int_outm[j][k]);
+        }
+    }
+}
+
+/*
+    XOR-32 tables of one round: trees 0-7 decode the encoded nibbles of the inputs,
+    trees 8-11 the outputs of trees 0-7
+*/
+static void gen_xor_round(uint8_t (*xor_tables)[16][16], const uint8_t (*inv_in)[8][16], const uint8_t (*inv_out)[8][16], const uint8_t (*out)[8][16]) {
+    int n, x, y;
+
+    for (n = 0; n < 96; n++) {
+        int i = n >> 3;
+        int j = n % 8;
+        const uint8_t *dx = (i < 8) ? inv_in[i*2][j]   : inv_out[(i-8)*2][j];
+        const uint8_t *dy = (i < 8) ? inv_in[i*2+1][j] : inv_out[(i-8)*2+1][j];
+
+        for (x = 0; x < 16; x++) {
+            for (y = 0; y < 16; y++) {
+                xor_tables[n][x][y] = out[i][j][dx[x] ^ dy[y]];
+            }
+        }
+    }
+}
+
+static void gen_t_box_round(uint8_t (*t_box)[256], uint32_t *roundkeys, int r) {
+    uint8_t u8_rk[16];
+    int n;
+
+    PUTU32(u8_rk     , roundkeys[4*r  ]);
+    PUTU32(u8_rk +  4, roundkeys[4*r+1]);
+    PUTU32(u8_rk +  8, roundkeys[4*r+2]);
+    PUTU32(u8_rk + 12, roundkeys[4*r+3]);
+
+    for (n = 0; n < 16; n++) {
+        wbaes_kernels().gf2_sbox_bytes(u8_rk[shift_map[n]], all_bytes.x, t_box[n], 256);
+    }
+}
+
+static void gen_round_tables(WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING &ee, gen_round &g, const gen_round *prev, uint32_t *roundkeys, int r) {
+    NTL::mat_GF2 mb, l;
+    uint64_t l_blocks[16];
+    uint8_t  t_box[16][256], y;
+    uint32_t mb_table[4][4][256], inv_mb_table[4][256], raw[256], t;
+    uint64_t clock = gen_clock();
+    int c, n, x;
+
+    /* MB, and MB^-1 on the input of the MBL-tables */
+    for (c = 0; c < 4; c++) {
+        mb = gen_gf2_rand_invertible_matrix(32);
+        gen_mb_table(mb, mb_table[c]);
+        gen_mb_table(gf2_inv(mb), inv_mb_table);
+        for (n = c*4; n < c*4 + 4; n++) {
+            for (x = 0; x < 256; x++) {
+                et.mbl_tables[r][n][x] = inv_mb_table[n%4][ie_out_byte(g.inv_int_outs[8+c], n%4, x)];
+            }
+        }
+    }
+    gen_lap(WBAES_GEN_MB, clock);
+
+    /* L, and L on the output of the MBL-tables */
+    for (n = 0; n < 16; n++) {
+        l = gen_gf2_rand_invertible_matrix(8);
+        l_blocks[n] = gf2_block(l, 0, 0);
+        gen_l_table(gf2_inv(l), g.inv_l[n]);
+    }
+
+    for (n = 0; n < 16; n++) {
+        apply_l_row(et.mbl_tables[r][n], l_blocks, g.int_m[n], n);
+    }
+    gen_lap(WBAES_GEN_L, clock);
+
+    /* Ty-boxes: T-box, Tyi, MB, then the input decoding of the round */
+    gen_t_box_round(t_box, roundkeys, r);
+    gen_lap(WBAES_GEN_T_BOXES, clock);
+
+    for (n = 0; n < 16; n++) {
+        uint8_t entry = shift_map[n];
+        const uint32_t (*m)[256] = mb_table[n/4];
+
+        for (x = 0; x < 256; x++) {
+            t = gf_tables.tyi[n%4][t_box[n][x]];
+            raw[x] = m[0][t >> 24] ^ m[1][(t >> 16) & 0xff] ^ m[2][(t >> 8) & 0xff] ^ m[3][t & 0xff];
+        }
+        gen_lap(WBAES_GEN_APPLY_MB, clock);
+
+        for (x = 0; x < 256; x++) {
+            if (!prev) {
+                y = ee.inv_ext_f[entry][1][(x >> 4) & 0xf] << 4 | ee.inv_ext_f[entry][0][x & 0xf];
+            }
+            else {
+                y = prev->inv_l[n][ie_out_byte(prev->inv_int_outm[8+(entry/4)], entry%4, x)];
+            }
+            et.ty_boxes[r][n][x] = encode_int_s(g.int_s[n], raw[y]);
+        }
+        gen_lap(WBAES_GEN_REENCODE, clock);
+    }
+
+    gen_xor_round(et.r1_xor_tables[r], g.inv_int_s, g.inv_int_outs, g.int_outs);
+    gen_xor_round(et.r2_xor_tables[r], g.inv_int_m, g.inv_int_outm, g.int_outm);
+    gen_lap(WBAES_GEN_XOR, clock);
+}
+
+static void gen_last_box(WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING &ee, const gen_round &prev, uint32_t *roundkeys) {
+    uint8_t t_box[16][256], u8_rk[16], y, t;
+    uint64_t clock = gen_clock();
+    int n, x;
+
+    /* sbox(temp ^ shift_rows(RK_10)) ^ RK_11 */
+    gen_t_box_round(t_box, roundkeys, 9);
+    gen_lap(WBAES_GEN_T_BOXES, clock);
+    PUTU32(u8_rk     , roundkeys[40]);
+    PUTU32(u8_rk +  4, roundkeys[41]);
+    PUTU32(u8_rk +  8, roundkeys[42]);
+    PUTU32(u8_rk + 12, roundkeys[43]);
+
+    for (n = 0; n < 16; n++) {
+        uint8_t entry = shift_map[n];
+
+        for (x = 0; x < 256; x++) {
+            y = prev.inv_l[n][ie_out_byte(prev.inv_int_outm[8+(entry/4)], entry%4, x)];
+            t = t_box[n][y] ^ u8_rk[n];
+            et.last_box[n][x] = ee.inv_ext_g[n][1][(t >> 4) & 0xf] << 4 | ee.inv_ext_g[n][0][t & 0xf];
+        }
+    }
+    gen_lap(WBAES_GEN_REENCODE, clock);
+}
+
+void wbaes_gen_encryption_table_rounds(WBAES_ENCRYPTION_TABLE &et, WBAES_EXT_ENCODING &ee, uint32_t *roundkeys,
+                                       void (*round_done)(WBAES_ENCRYPTION_TABLE &et, int r, void *arg), void *arg) {
+    gen_round *g = new gen_round[2];
+    uint64_t t;
+    int r, i, j;
+
+    gen_alloc(2 * sizeof(gen_round));
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < 2; j++) {
+            gen_rand(ee.ext_f[i][j], ee.inv_ext_f[i][j]);
+            gen_rand(ee.ext_g[i][j], ee.inv_ext_g[i][j]);
+        }
+    }
+
+    for (r = 0; r < 9; r++) {
+        gen_round &cur = g[r & 1];
+
+        t = gen_clock();
+        gen_round_encoding(cur);
+        gen_lap(WBAES_GEN_ENCODING, t);
+        gen_round_tables(et, ee, cur, r ? &g[(r-1) & 1] : NULL, roundkeys, r);
+
+        if (round_done) {
+            round_done(et, r, arg);
+        }
+    }
+
+    gen_last_box(et, ee, g[8 & 1], roundkeys);
+    if (round_done) {
+        round_done(et, 9, arg);
+    }
+    gen_stats.tables++;
+
+    memset((void *)g, 0, 2 * sizeof(gen_round));
+    delete[] g;
 }
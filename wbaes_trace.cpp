@@ -0,0 +1,312 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Table access traces and cache model
+*/
+#include <cstddef>
+
+#include "wbaes_trace.h"
+
+extern uint8_t shift_map[16];
+
+#define TRACE_OFFSET_BITS   20
+#define TRACE_BASE          (1ULL << 32)    // where the first table is placed, huge-page aligned
+
+static_assert(sizeof(WBAES_ENCRYPTION_TABLE) <= (1U << TRACE_OFFSET_BITS), "table offsets fit a trace reference");
+static_assert(WBAES_TRACE_MAX_TABLES <= (1U << (32 - TRACE_OFFSET_BITS)), "table numbers fit a trace reference");
+
+static const char *family_names[WBAES_TRACE_FAMILIES] = {
+    "ty_boxes", "r1_xor", "mbl", "r2_xor", "last_box"
+};
+
+static const char *layout_names[WBAES_TRACE_LAYOUTS] = {
+    "struct", "round"
+};
+
+/*
+    Families, in the order a round reads them
+*/
+struct family_span {
+    size_t off;
+    size_t round_size;
+    int    rounds;
+};
+
+static const family_span families[WBAES_TRACE_FAMILIES] = {
+    { offsetof(WBAES_ENCRYPTION_TABLE, ty_boxes)     , sizeof(WBAES_ENCRYPTION_TABLE::ty_boxes[0])     , 9 },
+    { offsetof(WBAES_ENCRYPTION_TABLE, r1_xor_tables), sizeof(WBAES_ENCRYPTION_TABLE::r1_xor_tables[0]), 9 },
+    { offsetof(WBAES_ENCRYPTION_TABLE, mbl_tables)   , sizeof(WBAES_ENCRYPTION_TABLE::mbl_tables[0])   , 9 },
+    { offsetof(WBAES_ENCRYPTION_TABLE, r2_xor_tables), sizeof(WBAES_ENCRYPTION_TABLE::r2_xor_tables[0]), 9 },
+    { offsetof(WBAES_ENCRYPTION_TABLE, last_box)     , sizeof(WBAES_ENCRYPTION_TABLE::last_box)        , 1 },
+};
+
+const char *wbaes_trace_family_name(int family) {
+    return (family >= 0 && family < WBAES_TRACE_FAMILIES) ? family_names[family] : "unknown";
+}
+
+const char *wbaes_trace_layout_name(int layout) {
+    return (layout >= 0 && layout < WBAES_TRACE_LAYOUTS) ? layout_names[layout] : "unknown";
+}
+
+WBAES_TRACE_FAMILY wbaes_trace_family(uint32_t offset, int *round) {
+    int f;
+
+    for (f = 0; f < WBAES_TRACE_FAMILIES - 1; f++) {
+        const family_span &s = families[f];
+
+        if (offset >= s.off && offset < s.off + s.rounds * s.round_size) {
+            *round = (offset - s.off) / s.round_size;
+            return (WBAES_TRACE_FAMILY)f;
+        }
+    }
+
+    *round = 9;
+    return WBAES_TRACE_LAST_BOX;
+}
+
+/*
+    Traced reference path
+     - same lookups as ref_table() / encrypt_lanes() in wbaes.cpp, every one of them recorded
+*/
+struct tracer {
+    const uint8_t         *base;
+    uint32_t               tag;
+    std::vector<uint32_t> *out;
+
+    template <typename T>
+    inline T ref(const T &entry) {
+        out->push_back(tag | (uint32_t)((const uint8_t *)&entry - base));
+        return entry;
+    }
+};
+
+static void trace_shift_rows(uint8_t *x) {
+    uint8_t temp[16];
+    int i;
+
+    memcpy(temp, x, 16);
+    for (i = 0; i < 16; i++) {
+        x[i] = temp[shift_map[i]];
+    }
+}
+
+static uint8_t trace_xor(tracer &t, const uint8_t (*xor_tables)[16][16], int i, int k, uint32_t a, uint32_t b, uint32_t c, uint32_t d, int s) {
+    uint8_t x = t.ref(xor_tables[i*16 + k    ][(a >> s) & 0xf][(b >> s) & 0xf]);
+    uint8_t y = t.ref(xor_tables[i*16 + k + 8][(c >> s) & 0xf][(d >> s) & 0xf]);
+
+    return t.ref(xor_tables[64 + i*8 + k][x][y]);
+}
+
+static void trace_stage(tracer &t, const uint32_t (*tables)[256], const uint8_t (*xor_tables)[16][16], uint8_t *in) {
+    uint32_t a, b, c, d;
+    int i, k;
+
+    for (i = 0; i < 4; i++) {
+        a = t.ref(tables[i*4  ][in[i*4  ]]);
+        b = t.ref(tables[i*4+1][in[i*4+1]]);
+        c = t.ref(tables[i*4+2][in[i*4+2]]);
+        d = t.ref(tables[i*4+3][in[i*4+3]]);
+
+        for (k = 0; k < 4; k++) {
+            in[i*4 + k] = trace_xor(t, xor_tables, i, 2*k, a, b, c, d, 28 - 8*k) << 4 |
+                          trace_xor(t, xor_tables, i, 2*k + 1, a, b, c, d, 24 - 8*k);
+        }
+    }
+}
+
+static void trace_lanes(tracer &t, const WBAES_ENCRYPTION_TABLE &et, uint8_t *x, size_t lanes) {
+    size_t l;
+    int r, i;
+
+    for (r = 0; r < 9; r++) {
+        for (l = 0; l < lanes; l++) {
+            trace_shift_rows(x + 16*l);
+            trace_stage(t, et.ty_boxes[r], et.r1_xor_tables[r], x + 16*l);
+        }
+        for (l = 0; l < lanes; l++) {
+            trace_stage(t, et.mbl_tables[r], et.r2_xor_tables[r], x + 16*l);
+        }
+    }
+
+    for (l = 0; l < lanes; l++) {
+        trace_shift_rows(x + 16*l);
+        for (i = 0; i < 16; i++) {
+            x[16*l + i] = t.ref(et.last_box[i][x[16*l + i]]);
+        }
+    }
+}
+
+void wbaes_trace_blocks(const WBAES_ENCRYPTION_TABLE *const *et, size_t tables, uint8_t *blocks, size_t n, size_t lanes, std::vector<uint32_t> &trace) {
+    tracer t;
+    size_t i, g, k = 0;
+
+    lanes = lanes ? lanes : 1;
+    tables = tables < WBAES_TRACE_MAX_TABLES ? tables : WBAES_TRACE_MAX_TABLES;
+    t.out = &trace;
+
+    for (i = 0; i < n; i += g, k = (k + 1) % tables) {
+        g = n - i < lanes ? n - i : lanes;
+
+        t.base = (const uint8_t *)et[k];
+        t.tag  = (uint32_t)k << TRACE_OFFSET_BITS;
+        trace_lanes(t, *et[k], blocks + 16*i, g);
+    }
+}
+
+/*
+    Cache model
+*/
+struct lru_level {
+    size_t                sets;
+    int                   ways;
+    std::vector<uint64_t> tag;          // key + 1, 0 = invalid
+    std::vector<uint64_t> stamp;
+
+    void init(size_t entries, int w) {
+        ways  = w;
+        sets  = entries / w;
+        tag.assign(sets * ways, 0);
+        stamp.assign(sets * ways, 0);
+    }
+
+    /* true on a hit, the line is filled on a miss */
+    bool access(uint64_t key, uint64_t now) {
+        size_t base = (key % sets) * ways;
+        int w, victim = 0;
+
+        for (w = 0; w < ways; w++) {
+            if (tag[base + w] == key + 1) {
+                stamp[base + w] = now;
+                return true;
+            }
+            if (stamp[base + w] < stamp[base + victim]) {
+                victim = w;
+            }
+        }
+
+        tag[base + victim]   = key + 1;
+        stamp[base + victim] = now;
+        return false;
+    }
+};
+
+static uint32_t layout_offset(uint32_t off, WBAES_TRACE_LAYOUT layout) {
+    size_t round_size = 0, pos = 0;
+    int f, r;
+
+    if (layout == WBAES_LAYOUT_STRUCT) {
+        return off;
+    }
+
+    for (f = 0; f < WBAES_TRACE_FAMILIES - 1; f++) {
+        round_size += families[f].round_size;
+    }
+
+    f = wbaes_trace_family(off, &r);
+    if (f == WBAES_TRACE_LAST_BOX) {
+        return 9 * round_size + (off - families[f].off);
+    }
+
+    for (int p = 0; p < f; p++) {
+        pos += families[p].round_size;
+    }
+    return r * round_size + pos + (off - families[f].off - r * families[f].round_size);
+}
+
+/* physical frame of a small page: scattered, as handed out by the kernel */
+static inline uint64_t scatter_frame(uint64_t vpn) {
+    uint64_t z = vpn + 0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31)) & ((1ULL << 28) - 1);
+}
+
+static void count(WBAES_CACHE_COUNTS &c, const bool *miss, int levels, bool tlb_miss) {
+    int l;
+
+    c.refs++;
+    for (l = 0; l < levels; l++) {
+        c.miss[l] += miss[l];
+    }
+    c.tlb_miss += tlb_miss;
+}
+
+int wbaes_cache_replay(const std::vector<uint32_t> &trace, const WBAES_CACHE_MODEL &m, WBAES_CACHE_REPORT *rep) {
+    lru_level level[3], tlb;
+    uint64_t  stride = (sizeof(WBAES_ENCRYPTION_TABLE) + 4095) & ~4095ULL, now = 0;
+    bool      miss[3] = { false, false, false }, tlb_miss;
+    int       levels, l, f, r;
+
+    if (m.line <= 0 || (m.line & (m.line - 1)) || m.page < 4096 || (m.page & (m.page - 1)) ||
+        (m.tlb_entries && (m.tlb_ways <= 0 || m.tlb_entries % m.tlb_ways))) {
+        return -1;
+    }
+    for (levels = 0; levels < 3 && m.level[levels].size; levels++) {
+        if (m.level[levels].ways <= 0 || m.level[levels].size % ((size_t)m.level[levels].ways * m.line)) {
+            return -1;
+        }
+        level[levels].init(m.level[levels].size / m.line, m.level[levels].ways);
+    }
+    if (m.tlb_entries) {
+        tlb.init(m.tlb_entries, m.tlb_ways);
+    }
+
+    memset(rep, 0, sizeof(*rep));
+
+    for (uint32_t ref : trace) {
+        uint32_t off  = ref & ((1U << TRACE_OFFSET_BITS) - 1);
+        uint64_t virt = TRACE_BASE + (ref >> TRACE_OFFSET_BITS) * stride + layout_offset(off, m.layout);
+        uint64_t vpn  = virt / m.page;
+        uint64_t phys = (m.page > 4096 ? vpn : scatter_frame(vpn)) * m.page + virt % m.page;
+        bool     hit  = false;
+
+        now++;
+        tlb_miss = m.tlb_entries && !tlb.access(vpn, now);
+
+        for (l = 0; l < levels; l++) {
+            miss[l] = !hit && !level[l].access(phys / m.line, now);
+            hit     = hit || !miss[l];
+        }
+
+        f = wbaes_trace_family(off, &r);
+        count(rep->by[f][r], miss, levels, tlb_miss);
+        count(rep->total, miss, levels, tlb_miss);
+    }
+
+    return 0;
+}
+
+static void dump_counts(const char *name, const WBAES_CACHE_COUNTS &c, FILE *out) {
+    double refs = c.refs ? (double)c.refs : 1.0;
+
+    fprintf(out, "%-14s %12llu %8.3f %8.3f %8.3f %8.3f\n", name, (unsigned long long)c.refs,
+        100.0 * c.miss[0] / refs, 100.0 * c.miss[1] / refs, 100.0 * c.miss[2] / refs, 100.0 * c.tlb_miss / refs);
+}
+
+void wbaes_cache_dump(const WBAES_CACHE_REPORT &rep, bool per_round, FILE *out) {
+    WBAES_CACHE_COUNTS sum;
+    char name[32];
+    int  f, r, l;
+
+    fprintf(out, "%-14s %12s %8s %8s %8s %8s\n", "family", "refs", "L1 %", "L2 %", "L3 %", "TLB %");
+
+    for (f = 0; f < WBAES_TRACE_FAMILIES; f++) {
+        memset(&sum, 0, sizeof(sum));
+        for (r = 0; r < WBAES_TRACE_ROUNDS; r++) {
+            sum.refs     += rep.by[f][r].refs;
+            sum.tlb_miss += rep.by[f][r].tlb_miss;
+            for (l = 0; l < 3; l++) {
+                sum.miss[l] += rep.by[f][r].miss[l];
+            }
+        }
+        dump_counts(family_names[f], sum, out);
+
+        for (r = 0; per_round && r < WBAES_TRACE_ROUNDS; r++) {
+            if (rep.by[f][r].refs) {
+                snprintf(name, sizeof(name), "  round %d", r + 1);
+                dump_counts(name, rep.by[f][r], out);
+            }
+        }
+    }
+    dump_counts("total", rep.total, out);
+}
@@ -0,0 +1,193 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - Differential verification against the oracle AES
+*/
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "wbaes.h"
+#include "wbaes_verify.h"
+
+#define VERIFY_BATCH    512     // blocks per claim, a multiple of every kernel's lanes
+
+
+struct verify_ctx {
+    const WBAES_ENCRYPTION_TABLE *et;
+    const WBAES_EXT_ENCODING     *ee;
+    u32                         (*rk)[4];
+    uint64_t                      budget;
+
+    std::atomic<uint64_t>         next;         // first block of the next claim
+    std::atomic<uint64_t>         checked;
+    std::atomic<bool>             stop;
+
+    std::mutex                    lock;
+    WBAES_VERIFY_REPORT          *rep;          // first mismatch, under lock
+    bool                          mismatch;
+};
+
+static double now_s() {
+    struct timespec t_val;
+    clock_gettime(CLOCK_MONOTONIC, &t_val);
+    return t_val.tv_sec + t_val.tv_nsec / 1e9;
+}
+
+uint64_t wbaes_verify_budget(double confidence, double fault_rate) {
+    if (!(confidence > 0 && confidence < 1 && fault_rate > 0 && fault_rate < 1)) {
+        return 0;
+    }
+
+    return (uint64_t)std::ceil(std::log1p(-confidence) / std::log1p(-fault_rate));
+}
+
+static void trace(verify_ctx &c, const uint8_t *pt, const uint8_t *got, const uint8_t *expected) {
+    WBAES_VERIFY_REPORT *rep = c.rep;
+    uint8_t x[16];
+    u32     s[4];
+    int     r, k;
+
+    memcpy(rep->pt, pt, 16);
+    memcpy(rep->got, got, 16);
+    memcpy(rep->expected, expected, 16);
+
+    memcpy(x, pt, 16);
+    encode_ext_x(c.ee->ext_f, x);
+    wbaes_encrypt_trace(*c.et, x, rep->wb_states);
+
+    for (k = 0; k < 4; k++) {
+        s[k] = GETU32(pt + 4*k) ^ c.rk[0][k];
+        PUTU32(rep->aes_states[0] + 4*k, s[k]);
+    }
+    for (r = 1; r < 10; r++) {
+        aes32_round(s, c.rk[r]);
+        for (k = 0; k < 4; k++) {
+            PUTU32(rep->aes_states[r] + 4*k, s[k]);
+        }
+    }
+    memcpy(rep->aes_states[10], expected, 16);
+}
+
+static void verify_main(verify_ctx *c, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    uint8_t  pt[16 * VERIFY_BATCH], x[16 * VERIFY_BATCH], ct[16];
+    uint64_t first, n, i, w;
+
+    while (!c->stop.load(std::memory_order_relaxed)) {
+        first = c->next.fetch_add(VERIFY_BATCH);
+        if (first >= c->budget) {
+            return;
+        }
+        n = c->budget - first < VERIFY_BATCH ? c->budget - first : VERIFY_BATCH;
+
+        for (i = 0; i < 2*n; i++) {
+            w = rng();
+            memcpy(pt + 8*i, &w, 8);
+        }
+        memcpy(x, pt, 16*n);
+
+        encode_ext_blocks(c->ee->ext_f, x, n);
+        wbaes_encrypt_blocks(*c->et, x, n);
+        encode_ext_blocks(c->ee->ext_g, x, n);
+
+        for (i = 0; i < n; i++) {
+            aes_encrypt(pt + 16*i, c->rk, ct);
+
+            if (memcmp(ct, x + 16*i, 16) != 0) {
+                std::lock_guard<std::mutex> guard(c->lock);
+
+                if (!c->mismatch) {
+                    c->mismatch = true;
+                    c->stop.store(true);
+                    if (c->rep) {
+                        trace(*c, pt + 16*i, x + 16*i, ct);
+                    }
+                }
+                c->checked += i + 1;
+                return;
+            }
+        }
+        c->checked += n;
+    }
+}
+
+int wbaes_verify(const WBAES_ENCRYPTION_TABLE &et, const WBAES_EXT_ENCODING &ee, u32 rk[11][4], const WBAES_VERIFY_OPTS &opts, WBAES_VERIFY_REPORT *rep) {
+    verify_ctx c;
+    std::vector<std::thread> threads;
+    unsigned n = opts.threads ? opts.threads : std::thread::hardware_concurrency(), i;
+    double   begin;
+
+    c.et       = &et;
+    c.ee       = &ee;
+    c.rk       = rk;
+    c.budget   = opts.blocks ? opts.blocks : wbaes_verify_budget(opts.confidence, opts.fault_rate);
+    c.next     = 0;
+    c.checked  = 0;
+    c.stop     = false;
+    c.rep      = rep;
+    c.mismatch = false;
+
+    if (rep) {
+        memset(rep, 0, sizeof(*rep));
+    }
+    if (!c.budget) {
+        return -1;
+    }
+
+    begin = now_s();
+    for (i = 0; i < (n ? n : 1); i++) {
+        threads.emplace_back(verify_main, &c, opts.seed + i * 0x9e3779b97f4a7c15ULL);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    if (rep) {
+        rep->blocks       = c.checked;
+        rep->seconds      = now_s() - begin;
+        rep->blocks_per_s = rep->seconds > 0 ? rep->blocks / rep->seconds : 0;
+        rep->mismatch     = c.mismatch;
+    }
+
+    return c.mismatch ? 1 : 0;
+}
+
+static void dump_line(FILE *out, const char *label, const uint8_t *x) {
+    int i;
+
+    fprintf(out, "%-10s", label);
+    for (i = 0; i < 16; i++) {
+        fprintf(out, " %02x", x[i]);
+    }
+    fputc('\n', out);
+}
+
+void wbaes_verify_dump(const WBAES_VERIFY_REPORT &rep, FILE *out) {
+    char label[16];
+    int  r;
+
+    fprintf(out, "blocks %llu, %.3f s, %.0f blocks/s\n", (unsigned long long)rep.blocks, rep.seconds, rep.blocks_per_s);
+    if (!rep.mismatch) {
+        fputs("no mismatch\n", out);
+        return;
+    }
+
+    fputs("MISMATCH\n", out);
+    dump_line(out, "pt", rep.pt);
+    dump_line(out, "expected", rep.expected);
+    dump_line(out, "got", rep.got);
+
+    fputs("table rounds (encoded)\n", out);
+    for (r = 0; r < 10; r++) {
+        snprintf(label, sizeof(label), "[%02d]", r + 1);
+        dump_line(out, label, rep.wb_states[r]);
+    }
+    fputs("aes rounds\n", out);
+    for (r = 0; r < 11; r++) {
+        snprintf(label, sizeof(label), "[%02d]", r);
+        dump_line(out, label, rep.aes_states[r]);
+    }
+}
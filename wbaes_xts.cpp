@@ -0,0 +1,279 @@
+/*
+    Implementation of Chow's Whitebox AES
+        - XTS on the batched path
+*/
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "wbaes_xts.h"
+
+#define XTS_LOCAL_BLOCKS    (64 * WBAES_BATCH_LANES)
+#define XTS_JOB_BLOCKS      4096
+#define XTS_WINDOW_JOBS     16
+
+
+/*
+    Tweaks
+     - T * alpha is a 1-bit left shift of the little-endian 128-bit value, the carry out of
+       bit 127 folds back as 0x87; on SSE2 both 64-bit halves shift at once and the two
+       carries are broadcast from the sign bits of dwords 1 and 3
+*/
+#if defined(__SSE2__)
+static inline __m128i xts_double(__m128i t) {
+    const __m128i poly  = _mm_set_epi32(0, 1, 0, 0x87);
+    __m128i       carry = _mm_srai_epi32(_mm_shuffle_epi32(t, 0x13), 31);
+
+    return _mm_xor_si128(_mm_slli_epi64(t, 1), _mm_and_si128(carry, poly));
+}
+#else
+static inline void xts_double(uint8_t *t) {
+    uint8_t carry = t[15] >> 7;
+    int i;
+
+    for (i = 15; i > 0; i--) {
+        t[i] = (t[i] << 1) | (t[i-1] >> 7);
+    }
+    t[0] = (t[0] << 1) ^ (carry ? 0x87 : 0);
+}
+#endif
+
+/* tw = T_0 .. T_bulk-1 of each of the g sectors in turn, t[i] is left at T_bulk */
+static void xts_fill(uint8_t (*t)[16], size_t g, size_t bulk, uint8_t *tw) {
+    size_t i, j;
+
+    for (i = 0; i < g; i++) {
+#if defined(__SSE2__)
+        __m128i v = _mm_loadu_si128((const __m128i *)t[i]);
+
+        for (j = 0; j < bulk; j++, tw += 16) {
+            _mm_storeu_si128((__m128i *)tw, v);
+            v = xts_double(v);
+        }
+        _mm_storeu_si128((__m128i *)t[i], v);
+#else
+        for (j = 0; j < bulk; j++, tw += 16) {
+            memcpy(tw, t[i], 16);
+            xts_double(t[i]);
+        }
+#endif
+    }
+}
+
+static void xts_xor(uint8_t *x, const uint8_t *t, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++, x += 16, t += 16) {
+#if defined(__SSE2__)
+        _mm_storeu_si128((__m128i *)x, _mm_xor_si128(_mm_loadu_si128((const __m128i *)x), _mm_loadu_si128((const __m128i *)t)));
+#else
+        for (int b = 0; b < 16; b++) {
+            x[b] ^= t[b];
+        }
+#endif
+    }
+}
+
+static void xts_next(uint8_t *t) {
+#if defined(__SSE2__)
+    _mm_storeu_si128((__m128i *)t, xts_double(_mm_loadu_si128((const __m128i *)t)));
+#else
+    xts_double(t);
+#endif
+}
+
+static void xts_cipher(const WBAES_XTS *x, bool decrypt, uint8_t *blocks, size_t n) {
+    if (decrypt) {
+        wbaes_decrypt_blocks_ext(*x->dt, x->de, blocks, n);
+    }
+    else {
+        wbaes_encrypt_blocks_ext(*x->et, x->ee, blocks, n);
+    }
+}
+
+/* T_0 = E_k2(sector), for g consecutive sectors in one batch */
+static void xts_tweaks(const WBAES_XTS *x, uint64_t sector, uint8_t (*t)[16], size_t g) {
+    size_t i;
+    int    b;
+
+    for (i = 0; i < g; i++) {
+        memset(t[i], 0, 16);
+        for (b = 0; b < 8; b++) {
+            t[i][b] = (uint8_t)((sector + i) >> (8*b));
+        }
+    }
+
+    wbaes_encrypt_blocks_ext(*x->tt, x->te, t[0], g);
+}
+
+/*
+    Ciphertext stealing, the last full block m-1 and the r-byte block m of every sector
+     - encryption: CC = E(P[m-1], T[m-1]), C[m] = CC[:r], C[m-1] = E(P[m] | CC[r:], T[m])
+     - decryption: PP = D(C[m-1], T[m]),   P[m] = PP[:r], P[m-1] = D(C[m] | PP[r:], T[m-1])
+     - both steps run over the g sectors of the group in one batch; t[i] holds T[m-1]
+*/
+static void xts_steal(const WBAES_XTS *x, bool decrypt, uint8_t *data, size_t size, uint8_t (*t)[16], size_t g) {
+    std::vector<uint8_t> a(16 * g), b(16 * g), last(16 * g);
+    size_t r = size % 16, m = size / 16, i;
+
+    for (i = 0; i < g; i++) {
+        memcpy(b.data() + 16*i, t[i], 16);
+        xts_next(b.data() + 16*i);          // T[m]
+        memcpy(last.data() + 16*i, data + i*size + 16*m, r);
+    }
+
+    /* first step, under T[m-1] encrypting, T[m] decrypting */
+    for (i = 0; i < g; i++) {
+        memcpy(a.data() + 16*i, data + i*size + 16*(m-1), 16);
+    }
+    for (i = 0; i < g; i++) {
+        xts_xor(a.data() + 16*i, decrypt ? b.data() + 16*i : t[i], 1);
+    }
+    xts_cipher(x, decrypt, a.data(), g);
+    for (i = 0; i < g; i++) {
+        xts_xor(a.data() + 16*i, decrypt ? b.data() + 16*i : t[i], 1);
+        memcpy(last.data() + 16*i + r, a.data() + 16*i + r, 16 - r);
+    }
+
+    /* second step, under the other tweak */
+    for (i = 0; i < g; i++) {
+        xts_xor(last.data() + 16*i, decrypt ? t[i] : b.data() + 16*i, 1);
+    }
+    xts_cipher(x, decrypt, last.data(), g);
+    for (i = 0; i < g; i++) {
+        xts_xor(last.data() + 16*i, decrypt ? t[i] : b.data() + 16*i, 1);
+
+        memcpy(data + i*size + 16*(m-1), last.data() + 16*i, 16);
+        memcpy(data + i*size + 16*m, a.data() + 16*i, r);
+    }
+}
+
+/*
+    Sector groups
+     - whole sectors are contiguous, the bulk blocks of a group form one run; with
+       stealing every sector contributes its own run of m-1 blocks
+     - on the engine, runs are cut into ECB jobs of XTS_JOB_BLOCKS; decryption tables need
+       wbaes_dec_order() around the job, wbaes_decrypt_blocks_ext() does not run there
+*/
+static int xts_group(const WBAES_XTS *x, WBAES_ENGINE *eng, bool decrypt, uint64_t sector, uint8_t *data, size_t size, size_t g,
+                     std::vector<uint8_t> &tw, std::vector<uint8_t> &t) {
+    size_t bulk = size / 16 - (size % 16 != 0), runs = size % 16 ? g : 1, run = size % 16 ? bulk : g * bulk;
+    size_t stride = size % 16 ? size : 0, i;
+    uint8_t (*tweak)[16] = (uint8_t (*)[16])t.data();
+    int     status = 0;
+
+    xts_tweaks(x, sector, tweak, g);
+    xts_fill(tweak, g, bulk, tw.data());
+
+    for (i = 0; i < runs; i++) {
+        xts_xor(data + i*stride, tw.data() + 16*i*run, run);
+    }
+
+    if (!eng) {
+        for (i = 0; i < runs; i++) {
+            xts_cipher(x, decrypt, data + i*stride, run);
+        }
+    }
+    else {
+        std::vector<WBAES_JOB> jobs;
+        WBAES_JOB *done[XTS_WINDOW_JOBS];
+        size_t     off, k, pending = 0, got;
+        int        rc = 0;
+
+        for (i = 0; i < runs; i++) {
+            for (off = 0; off < run; off += XTS_JOB_BLOCKS) {
+                WBAES_JOB job;
+
+                memset(&job, 0, sizeof(job));
+                job.et   = decrypt ? x->dt : x->et;
+                job.ee   = decrypt ? x->de : x->ee;
+                job.mode = WBAES_JOB_ECB;
+                job.in   = job.out = data + i*stride + 16*off;
+                job.len  = 16 * (run - off < XTS_JOB_BLOCKS ? run - off : XTS_JOB_BLOCKS);
+                jobs.push_back(job);
+            }
+        }
+
+        for (k = 0; k < jobs.size() && !rc; k++) {
+            if (decrypt) {
+                wbaes_dec_order(jobs[k].out, jobs[k].len / 16);
+            }
+            while ((rc = wbaes_engine_submit(eng, &jobs[k])) == -EAGAIN) {
+                for (got = wbaes_engine_wait(eng, done, XTS_WINDOW_JOBS, 10); got; got--) {
+                    status |= done[got-1]->status;
+                    pending--;
+                }
+            }
+            pending += rc == 0;
+        }
+        /* the jobs in flight are drained even after a refused submit, they point into data */
+        while (pending) {
+            for (got = wbaes_engine_wait(eng, done, XTS_WINDOW_JOBS, 100); got; got--) {
+                status |= done[got-1]->status;
+                pending--;
+            }
+        }
+        if (rc) {
+            return rc;
+        }
+
+        if (decrypt) {
+            for (k = 0; k < jobs.size(); k++) {
+                wbaes_dec_order(jobs[k].out, jobs[k].len / 16);
+            }
+        }
+    }
+
+    for (i = 0; i < runs; i++) {
+        xts_xor(data + i*stride, tw.data() + 16*i*run, run);
+    }
+
+    if (size % 16) {
+        xts_steal(x, decrypt, data, size, tweak, g);
+    }
+
+    return status ? -EIO : 0;
+}
+
+static int xts_sectors(const WBAES_XTS *x, WBAES_ENGINE *eng, bool decrypt, uint64_t sector, const uint8_t *in, uint8_t *out, size_t size, size_t n) {
+    size_t bulk = size / 16 - (size % 16 != 0), window = eng ? XTS_JOB_BLOCKS * XTS_WINDOW_JOBS : XTS_LOCAL_BLOCKS, group, i, g;
+    std::vector<uint8_t> tw, t;
+    int status = 0;
+
+    if (size < 16 || !x->tt || !x->te || (decrypt ? (!x->dt || !x->de) : (!x->et || !x->ee))) {
+        return -EINVAL;
+    }
+    if (!n) {
+        return 0;
+    }
+
+    group = bulk < window ? window / (bulk ? bulk : 1) : 1;
+    tw.resize(16 * group * bulk);
+    t.resize(16 * group);
+
+    if (in != out) {
+        memmove(out, in, size * n);
+    }
+
+    for (i = 0; i < n && !status; i += g) {
+        g = n - i < group ? n - i : group;
+        status = xts_group(x, eng, decrypt, sector + i, out + i*size, size, g, tw, t);
+    }
+
+    memset(tw.data(), 0, tw.size());
+    return status;
+}
+
+int wbaes_xts_encrypt(const WBAES_XTS *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n) {
+    return xts_sectors(x, NULL, false, sector, in, out, sector_size, n);
+}
+
+int wbaes_xts_decrypt(const WBAES_XTS *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n) {
+    return xts_sectors(x, NULL, true, sector, in, out, sector_size, n);
+}
+
+int wbaes_xts_engine(const WBAES_XTS *x, WBAES_ENGINE *eng, bool decrypt, uint64_t sector, const uint8_t *in, uint8_t *out, size_t sector_size, size_t n) {
+    return xts_sectors(x, eng, decrypt, sector, in, out, sector_size, n);
+}